@@ -0,0 +1,203 @@
+#ifndef ALLOCATION_GUARD_H
+#define ALLOCATION_GUARD_H
+
+#include "MotionPhase.h"
+#include <iostream>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+// Heap allocations made inside an AllocationScope, which PositionManager opens around every
+// control cycle. Only checked in a build with DOOMBLADE_CHECK_ALLOC defined:
+//   -DDOOMBLADE_CHECK_ALLOC=1   count them, per motion phase, see printReport()
+//   -DDOOMBLADE_CHECK_ALLOC=2   abort on the first one
+// The checked build replaces malloc, calloc, realloc, free and the global operator new and
+// delete. Every program here is one translation unit, which is what that needs. Without
+// the define the scope compiles to nothing.
+enum class AllocationPolicy {
+    Count,
+    Abort
+};
+
+struct AllocationCounts {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+class AllocationGuard {
+public:
+    static constexpr bool enabled() {
+#ifdef DOOMBLADE_CHECK_ALLOC
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static void setPolicy(AllocationPolicy newPolicy) { policy = newPolicy; }
+    static AllocationCounts counts(MotionPhase phase) {
+        size_t index = static_cast<size_t>(phase);
+        return {allocations[index].load(std::memory_order_relaxed), bytes[index].load(std::memory_order_relaxed)};
+    }
+    static inline void reset();
+    static inline void printReport(std::ostream& out);
+
+    // Called by the replaced allocators, counts only on a thread inside a scope
+    static inline void note(size_t size);
+
+private:
+    friend class AllocationScope;
+
+#if DOOMBLADE_CHECK_ALLOC == 2
+    static inline AllocationPolicy policy = AllocationPolicy::Abort;
+#else
+    static inline AllocationPolicy policy = AllocationPolicy::Count;
+#endif
+    static inline thread_local int depth = 0;
+    static inline thread_local MotionPhase phase = MotionPhase::Idle;
+    static inline std::atomic<uint64_t> allocations[kMotionPhaseCount] = {};
+    static inline std::atomic<uint64_t> bytes[kMotionPhaseCount] = {};
+};
+
+// Allocations on this thread count against the phase until the scope closes
+class AllocationScope {
+public:
+#ifdef DOOMBLADE_CHECK_ALLOC
+    explicit AllocationScope(MotionPhase phase) : previous(AllocationGuard::phase) {
+        AllocationGuard::phase = phase;
+        AllocationGuard::depth++;
+    }
+    ~AllocationScope() {
+        AllocationGuard::depth--;
+        AllocationGuard::phase = previous;
+    }
+#else
+    explicit AllocationScope(MotionPhase) {}
+#endif
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+private:
+#ifdef DOOMBLADE_CHECK_ALLOC
+    MotionPhase previous;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// NOTE - runs inside malloc, so nothing here may allocate. The abort message is a plain write().
+void AllocationGuard::note(size_t size) {
+    if (depth == 0) {
+        return;
+    }
+    size_t index = static_cast<size_t>(phase);
+    allocations[index].fetch_add(1, std::memory_order_relaxed);
+    bytes[index].fetch_add(size, std::memory_order_relaxed);
+    if (policy == AllocationPolicy::Abort) {
+        static const char message[] = "Heap allocation inside a control cycle\n";
+        ssize_t ignored = write(STDERR_FILENO, message, sizeof message - 1);
+        (void)ignored;
+        std::abort();
+    }
+}
+
+void AllocationGuard::reset() {
+    for (size_t i = 0; i < kMotionPhaseCount; i++) {
+        allocations[i].store(0, std::memory_order_relaxed);
+        bytes[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void AllocationGuard::printReport(std::ostream& out) {
+    if (!enabled()) {
+        return;
+    }
+    uint64_t total = 0;
+    for (size_t i = 0; i < kMotionPhaseCount; i++) {
+        AllocationCounts phaseCounts = counts(static_cast<MotionPhase>(i));
+        if (phaseCounts.allocations > 0) {
+            out << "Allocations in " << motionPhaseName(static_cast<MotionPhase>(i)) << ": " << phaseCounts.allocations
+                << " (" << phaseCounts.bytes << " bytes)" << std::endl;
+        }
+        total += phaseCounts.allocations;
+    }
+    if (total == 0) {
+        out << "Allocations in control cycles: none" << std::endl;
+    }
+}
+
+// CHECKED BUILD - glibc's own entry points do the work, the replacements only count
+#ifdef DOOMBLADE_CHECK_ALLOC
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* pointer);
+
+void* malloc(size_t size) {
+    AllocationGuard::note(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    AllocationGuard::note(count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    AllocationGuard::note(size);
+    return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer) {
+    __libc_free(pointer);
+}
+}
+
+void* operator new(size_t size) {
+    void* pointer = malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return malloc(size == 0 ? 1 : size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    AllocationGuard::note(size);
+    void* pointer = __libc_memalign(static_cast<size_t>(alignment), size == 0 ? 1 : size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept { free(pointer); }
+void operator delete[](void* pointer) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { free(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { free(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { free(pointer); }
+#endif // DOOMBLADE_CHECK_ALLOC
+
+#endif // ALLOCATION_GUARD_H
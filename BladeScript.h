@@ -0,0 +1,74 @@
+#ifndef BLADE_SCRIPT_H
+#define BLADE_SCRIPT_H
+
+#include "PositionManager.h"
+#include "SafetySupervisor.h"
+#include "MotionScript.h"
+#include <iostream>
+
+// The blade as two coroutine scripts: the blade script reads top to bottom like the
+// motion it describes, the monitor script watches the safety supervisor and stops
+// everything on a trip. motion_script_test runs them on the blade, script_scheduler_test
+// against SimulatedController.
+
+static const MotionPhase kExtendPhases[] = {MotionPhase::Acceleration, MotionPhase::Cruising, MotionPhase::Deceleration};
+static const MotionPhase kSheathPhases[] = {MotionPhase::AccelerationReverse, MotionPhase::CruisingReverse, MotionPhase::DecelerationReverse};
+
+inline bool completed(TickResult result) {
+    return result == TickResult::Done;
+}
+
+// Keep each co_await in its own statement: GCC 12 drops coroutine bodies that
+// co_await inside a short-circuit condition.
+
+// BLADE SCRIPT - home, then extend and sheath on each press of the activate switch
+inline MotionScript bladeScript(PositionManager& positionManager, MyGpio& activateSwitch, float& commandedPosition, float& currentPosition) {
+    std::cout << "Press activate to home" << std::endl;
+    co_await switchLevel(activateSwitch, 0);
+    TickResult result = co_await runPhase(positionManager, MotionPhase::Homing, commandedPosition, currentPosition);
+    if (!completed(result)) {
+        co_return;
+    }
+
+    while (true) {
+        co_await switchLevel(activateSwitch, 1);
+        co_await switchLevel(activateSwitch, 0);
+
+        // EXTEND
+        positionManager.rezero(500.0f);
+        commandedPosition = currentPosition = 500.0f;
+        for (MotionPhase phase : kExtendPhases) {
+            result = co_await runPhase(positionManager, phase, commandedPosition, currentPosition);
+            if (!completed(result)) {
+                co_return;
+            }
+        }
+        co_await hold(positionManager, (commandedPosition + currentPosition) / 2.0f, 1.0f, commandedPosition, currentPosition);
+        std::cout << commandedPosition << "\t" << currentPosition << std::endl;
+
+        // Stay extended until released and pressed again
+        co_await switchLevel(activateSwitch, 1);
+        co_await switchLevel(activateSwitch, 0);
+
+        // SHEATH
+        positionManager.rezero(500.0f);
+        commandedPosition = currentPosition = 500.0f;
+        for (MotionPhase phase : kSheathPhases) {
+            result = co_await runPhase(positionManager, phase, commandedPosition, currentPosition);
+            if (!completed(result)) {
+                co_return;
+            }
+        }
+        co_await hold(positionManager, (commandedPosition + currentPosition) / 2.0f, 0.5f, commandedPosition, currentPosition);
+        std::cout << commandedPosition << "\t" << currentPosition << std::endl;
+    }
+}
+
+// MONITOR SCRIPT - ends the run when the safety supervisor trips
+inline MotionScript monitorScript(ScriptScheduler& scheduler, SafetySupervisor& supervisor) {
+    co_await until([&supervisor] { return supervisor.tripped(); });
+    supervisor.printLatencyReport();
+    scheduler.requestStop();
+}
+
+#endif // BLADE_SCRIPT_H
@@ -0,0 +1,517 @@
+#ifndef BLADE_STATE_MACHINE_H
+#define BLADE_STATE_MACHINE_H
+
+#include "MyController.h"
+#include "MyGpio.h"
+#include "PositionManager.h"
+#include "SafetySupervisor.h"
+#include "RuntimeConfig.h"
+#include "MotorState.h"
+#include "TelemetryPublisher.h"
+#include <iostream>
+#include <ctime>
+
+// Commands accepted from outside the machine, serviced on the next cycle
+enum class BladeCommand {
+    None,
+    Home,
+    Extend,
+    Sheath,
+    MoveTo,     // value is the logical target position
+    Stop        // abandon any motion and hold where the blade is
+};
+
+// Motion sequences run by the Extending and Sheathing states
+static const MotionStep kExtendSteps[] = {
+    {MotionStepKind::Rezero,      MotionPhase::Idle,                500.0f},
+    {MotionStepKind::Phase,       MotionPhase::Acceleration,        0.0f},
+    {MotionStepKind::Phase,       MotionPhase::Cruising,            0.0f},
+    {MotionStepKind::Phase,       MotionPhase::Deceleration,        0.0f},
+    {MotionStepKind::HoldAverage, MotionPhase::Hold,                1.0f},
+    {MotionStepKind::Report,      MotionPhase::Idle,                0.0f},
+    {MotionStepKind::Rezero,      MotionPhase::Idle,                500.0f},
+    {MotionStepKind::Hold,        MotionPhase::Hold,                0.5f},
+};
+
+static const MotionStep kSheathSteps[] = {
+    {MotionStepKind::Rezero,      MotionPhase::Idle,                500.0f},
+    {MotionStepKind::Phase,       MotionPhase::AccelerationReverse, 0.0f},
+    {MotionStepKind::Phase,       MotionPhase::CruisingReverse,     0.0f},
+    {MotionStepKind::Phase,       MotionPhase::DecelerationReverse, 0.0f},
+    {MotionStepKind::HoldAverage, MotionPhase::Hold,                0.5f},
+    {MotionStepKind::Report,      MotionPhase::Idle,                0.0f},
+};
+
+// Extend cancelled while moving: come to a stop from the current velocity, then sheath
+static const MotionStep kCancelExtendSteps[] = {
+    {MotionStepKind::Phase,       MotionPhase::Deceleration,        0.0f},
+    {MotionStepKind::Rezero,      MotionPhase::Idle,                500.0f},
+    {MotionStepKind::Phase,       MotionPhase::AccelerationReverse, 0.0f},
+    {MotionStepKind::Phase,       MotionPhase::CruisingReverse,     0.0f},
+    {MotionStepKind::Phase,       MotionPhase::DecelerationReverse, 0.0f},
+    {MotionStepKind::HoldAverage, MotionPhase::Hold,                0.5f},
+    {MotionStepKind::Report,      MotionPhase::Idle,                0.0f},
+};
+
+// Table driven system state machine. tick() runs exactly one scheduler cycle: inputs
+// and commands are serviced, then the current state advances by at most one control
+// cycle, so no motion ever holds the loop for more than one period.
+class BladeStateMachine {
+public:
+    // Constructor
+    BladeStateMachine(PositionManager& positionManager, MyController& controller, MyGpio& homeLimitSwitch, MyGpio& extendLimitSwitch,
+                      MyGpio& activateSwitch, MyGpio& safetySwitch, SafetySupervisor* supervisor, struct timespec req)
+    : positionManager(positionManager), controller(controller), homeLimitSwitch(homeLimitSwitch), extendLimitSwitch(extendLimitSwitch),
+      activateSwitch(activateSwitch), safetySwitch(safetySwitch), supervisor(supervisor), req(req) {}
+
+    inline bool tick();
+    inline void command(BladeCommand newCommand, float value = 0.0f);
+    inline bool accepts(BladeCommand newCommand) const;
+    inline bool hasPendingCommand() const { return pendingCommand != BladeCommand::None; }
+    inline void resume(float position, bool atHome);    // warm start, skips Initial and homing
+    inline void setRuntimeConfig(RuntimeConfig* config) { runtimeConfig = config; }
+    inline void setTelemetry(TelemetryPublisher* publisher) { telemetry = publisher; }
+    inline void setLockoutOnTrip(bool lockout) { lockoutOnTrip = lockout; }  // keep ticking in SafetyLockout instead of shutting down
+    inline const char* getLastTrip() const { return lastTrip; }
+    inline MotorState getState() const { return state; }
+    inline float getCommandedPosition() const { return commandedPosition; }
+    inline float getCurrentPosition() const { return currentPosition; }
+
+private:
+    struct StateEntry {
+        void (BladeStateMachine::*enter)();
+        MotorState (BladeStateMachine::*update)();
+    };
+    static inline const StateEntry& entry(MotorState state);
+
+    inline bool take(BladeCommand expected);
+    inline void refreshConfig();
+    inline void publishTelemetry(int64_t tickStartNs);
+    inline void stopMotion();
+    inline void lockOut(bool safetyReleased);
+
+    // State handlers
+    inline void enterNothing() {}
+    inline void enterHoming();
+    inline void enterExtending();
+    inline void enterSheathing();
+    inline void enterMoving();
+    inline void enterSafetyLockout();
+    inline MotorState updateInitial();
+    inline MotorState updateWaitingToHome();
+    inline MotorState updateHoming();
+    inline MotorState updateHomed();
+    inline MotorState updateWaitingToExtend();
+    inline MotorState updateExtending();
+    inline MotorState updateExtended();
+    inline MotorState updateSheathing();
+    inline MotorState updateExtendError();
+    inline MotorState updateSafetyLockout();
+    inline MotorState updateMoving();
+    inline MotorState updatePositioned();
+
+    PositionManager& positionManager;
+    MyController& controller;
+    MyGpio& homeLimitSwitch;
+    MyGpio& extendLimitSwitch;
+    MyGpio& activateSwitch;
+    MyGpio& safetySwitch;
+    SafetySupervisor* supervisor;
+    struct timespec req;
+    RuntimeConfig* runtimeConfig = nullptr;
+    uint64_t appliedGeneration = 0;
+    TelemetryPublisher* telemetry = nullptr;
+    bool lockoutOnTrip = false;
+    const char* lastTrip = "none";
+
+    MotorState state = MotorState::Initial;
+    BladeCommand pendingCommand = BladeCommand::None;
+    float moveTarget = 500.0f;
+    TickResult motionResult = TickResult::Done;
+    bool obstruction_encountered = false;
+    bool cancelExtend = false;
+    int activate = 1;
+    bool activatePressed = false;
+    float commandedPosition = 500.0f;
+    float currentPosition = 500.0f;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+const BladeStateMachine::StateEntry& BladeStateMachine::entry(MotorState state) {
+    static const StateEntry table[static_cast<size_t>(MotorState::Count)] = {
+        {&BladeStateMachine::enterNothing,   &BladeStateMachine::updateInitial},
+        {&BladeStateMachine::enterNothing,   &BladeStateMachine::updateWaitingToHome},
+        {&BladeStateMachine::enterHoming,    &BladeStateMachine::updateHoming},
+        {&BladeStateMachine::enterNothing,   &BladeStateMachine::updateHomed},
+        {&BladeStateMachine::enterNothing,   &BladeStateMachine::updateWaitingToExtend},
+        {&BladeStateMachine::enterExtending, &BladeStateMachine::updateExtending},
+        {&BladeStateMachine::enterNothing,   &BladeStateMachine::updateExtended},
+        {&BladeStateMachine::enterSheathing, &BladeStateMachine::updateSheathing},
+        {&BladeStateMachine::enterNothing,   &BladeStateMachine::updateExtendError},
+        {&BladeStateMachine::enterSafetyLockout, &BladeStateMachine::updateSafetyLockout},
+        {&BladeStateMachine::enterMoving,    &BladeStateMachine::updateMoving},
+        {&BladeStateMachine::enterNothing,   &BladeStateMachine::updatePositioned},
+    };
+    return table[static_cast<size_t>(state)];
+}
+
+// TICK - one scheduler cycle, returns false once the safety switch has shut the system down.
+// With lockout on trip it never does: a trip locks the blade out and the ticks go on.
+bool BladeStateMachine::tick() {
+    int64_t tickStartNs = controller.nowNs();
+
+    //SAFETY CHECK
+    if (supervisor != nullptr && supervisor->onControlThread()) {
+        supervisor->poll();     // no supervisor thread, see SafetySupervisor
+    }
+    bool safety_ok = safetySwitch.readValue() == 1; // Synchronously check the safety button, unreadable counts as released
+    if (!safety_ok || (supervisor != nullptr && supervisor->tripped())) {
+        if (!lockoutOnTrip) {
+            positionManager.cancelSequence();
+            lastTrip = safety_ok ? SafetySupervisor::tripName(supervisor->reason()) : "safety switch released";
+            if (supervisor != nullptr) {
+                supervisor->printLatencyReport();
+            }
+            return false;
+        }
+        if (state != MotorState::SafetyLockout) {
+            lockOut(!safety_ok);
+            publishTelemetry(tickStartNs);
+            return true;
+        }
+    }
+
+    // DEVICE RECOVERY - a motion recovers from its own cycle, the states between motions from here
+    if (positionManager.getPhase() == MotionPhase::Idle && controller.recoveryDue()) {
+        positionManager.recoverLink();
+    }
+
+    // INPUTS
+    int previous = activate;
+    activate = activateSwitch.readValue();
+    activatePressed = (activate == 0 && previous != 0);
+    if (take(BladeCommand::Stop)) {
+        stopMotion();
+    }
+
+    const StateEntry& current = entry(state);
+    MotorState next = (this->*current.update)();
+    if (next != state) {
+        state = next;
+        (this->*entry(state).enter)();
+        if (!accepts(pendingCommand)) {
+            pendingCommand = BladeCommand::None;    // meant for the state just left
+        }
+    }
+    publishTelemetry(tickStartNs);
+    return true;
+}
+
+// PUBLISH TELEMETRY - latest state and loop timing for readers in other processes
+void BladeStateMachine::publishTelemetry(int64_t tickStartNs) {
+    if (telemetry == nullptr) {
+        return;
+    }
+    const StateEstimator& estimator = positionManager.getEstimator();
+    int64_t now = controller.nowNs();
+    TelemetrySample sample;
+    sample.timeNs = now;
+    sample.reply = positionManager.getLastReply();
+    sample.commandedPosition = commandedPosition;
+    sample.currentPosition = currentPosition;
+    sample.estimatedVelocity = estimator.getVelocity();
+    sample.uncertainty = estimator.getUncertainty(now);
+    sample.replyValid = positionManager.isLastReplyValid() ? 1 : 0;
+    sample.phase = static_cast<uint8_t>(positionManager.getPhase());
+    sample.motorState = static_cast<uint8_t>(state);
+    telemetry->publish(sample, tickStartNs);
+}
+
+// COMMAND - replaces any command not yet taken
+void BladeStateMachine::command(BladeCommand newCommand, float value) {
+    pendingCommand = newCommand;
+    if (newCommand == BladeCommand::MoveTo) {
+        moveTarget = value;
+    }
+}
+
+// ACCEPTS - whether the current state acts on the command, so callers can refuse it up front
+bool BladeStateMachine::accepts(BladeCommand newCommand) const {
+    switch (newCommand) {
+        case BladeCommand::Home:
+            return state == MotorState::WaitingToHome || state == MotorState::WaitingToExtend || state == MotorState::Positioned;
+        case BladeCommand::Extend:
+            return state == MotorState::WaitingToExtend;
+        case BladeCommand::Sheath:
+            return state == MotorState::Extending || state == MotorState::Extended;
+        case BladeCommand::MoveTo:
+            return state == MotorState::WaitingToExtend || state == MotorState::Extended || state == MotorState::Positioned;
+        case BladeCommand::Stop:
+            return state != MotorState::Initial && state != MotorState::SafetyLockout;
+        default:
+            return false;
+    }
+}
+
+// STOP MOTION - only moving states are affected, the blade then holds where it stopped
+void BladeStateMachine::stopMotion() {
+    if (state != MotorState::Homing && state != MotorState::Extending && state != MotorState::Sheathing && state != MotorState::Moving) {
+        return;
+    }
+    std::cout << "Stop requested in " << motorStateName(state) << std::endl;
+    positionManager.cancelSequence();
+    controller.sendStopCommand();  //gets controller to a known state
+    commandedPosition = currentPosition;
+    cancelExtend = false;
+    state = MotorState::Positioned;
+}
+
+// LOCK OUT - a supervisor trip has braked already, a released switch seen first brakes here
+void BladeStateMachine::lockOut(bool safetyReleased) {
+    bool braked = supervisor != nullptr && supervisor->tripped();
+    std::cout << "Safety trip in " << motorStateName(state) << std::endl;
+    positionManager.cancelSequence();
+    positionManager.cancelPhase();
+    if (!braked && safetyReleased) {
+        controller.sendBrakeCommand();
+    }
+    if (supervisor != nullptr) {
+        supervisor->printLatencyReport();
+    }
+    commandedPosition = currentPosition;
+    cancelExtend = false;
+    state = MotorState::SafetyLockout;
+    enterSafetyLockout();
+    pendingCommand = BladeCommand::None;
+}
+
+// RESUME - before the first tick, once the position manager holds the restored position.
+// Sheathed at home the blade is ready to extend, anywhere else it holds where it is.
+void BladeStateMachine::resume(float position, bool atHome) {
+    commandedPosition = position;
+    currentPosition = position;
+    obstruction_encountered = false;
+    state = atHome ? MotorState::WaitingToExtend : MotorState::Positioned;
+    std::cout << "Warm start at " << position << ", " << motorStateName(state) << std::endl;
+}
+
+// TAKE - consume a pending command
+bool BladeStateMachine::take(BladeCommand expected) {
+    if (pendingCommand != expected) {
+        return false;
+    }
+    pendingCommand = BladeCommand::None;
+    return true;
+}
+
+// REFRESH CONFIG - picks up a reloaded config before each move
+void BladeStateMachine::refreshConfig() {
+    if (runtimeConfig == nullptr) {
+        return;
+    }
+    const MotionConfig& config = runtimeConfig->acquire();
+    if (config.generation != appliedGeneration && positionManager.applyConfig(config)) {
+        appliedGeneration = config.generation;
+        std::cout << "Applied config generation " << appliedGeneration << std::endl;
+    }
+}
+
+//INITIAL
+MotorState BladeStateMachine::updateInitial() {
+    std::cout << "Initial state. Checking system status..." << std::endl;
+    controller.waitCycle(req);
+    if (homeLimitSwitch.readValue() == 0) {
+        return MotorState::Homing;
+    }
+    return MotorState::WaitingToHome;
+}
+
+//WAITING TO HOME
+MotorState BladeStateMachine::updateWaitingToHome() {
+    positionManager.holdPosition(commandedPosition);
+    if (activate == 0 || take(BladeCommand::Home)) {
+        return MotorState::Homing;
+    }
+    if (homeLimitSwitch.readValue() == 0) {
+        return MotorState::Homing;
+    }
+    return MotorState::WaitingToHome;
+}
+
+//HOMING
+void BladeStateMachine::enterHoming() {
+    std::cout << "Homing..." << std::endl;
+    refreshConfig();
+    controller.sendStopCommand();  //gets controller to a known state
+    positionManager.rezero(500.0f); // sets the current position to 500.0
+    commandedPosition = 500.0f;
+    motionResult = positionManager.beginPhase(MotionPhase::Homing, commandedPosition, currentPosition);
+}
+
+MotorState BladeStateMachine::updateHoming() {
+    if (motionResult == TickResult::Running) {
+        motionResult = positionManager.tick(commandedPosition, currentPosition);
+    }
+    switch (motionResult) {
+        case TickResult::Running:   return MotorState::Homing;
+        case TickResult::Done:      return MotorState::Homed;
+        case TickResult::Preempted: return MotorState::SafetyLockout;
+        default:                    return MotorState::WaitingToHome;
+    }
+}
+
+//HOMED
+MotorState BladeStateMachine::updateHomed() {
+    std::cout << "System is homed, ready for next command." << std::endl;
+    obstruction_encountered = false;
+    return MotorState::WaitingToExtend;
+}
+
+//WAITING TO EXTEND
+MotorState BladeStateMachine::updateWaitingToExtend() {
+    positionManager.holdPosition(currentPosition);
+    if (activate == 0 || take(BladeCommand::Extend)) {
+        return MotorState::Extending;
+    }
+    if (take(BladeCommand::Home)) {
+        return MotorState::Homing;
+    }
+    if (take(BladeCommand::MoveTo)) {
+        return MotorState::Moving;
+    }
+    return MotorState::WaitingToExtend;
+}
+
+//EXTENDING
+void BladeStateMachine::enterExtending() {
+    std::cout << "Extending..." << std::endl;
+    refreshConfig();
+    positionManager.startSequence(kExtendSteps, sizeof(kExtendSteps) / sizeof(kExtendSteps[0]));
+}
+
+MotorState BladeStateMachine::updateExtending() {
+    // A fresh press or a sheath command cancels the extend straight away
+    if (activatePressed || take(BladeCommand::Sheath)) {
+        std::cout << "Extend cancelled, sheathing..." << std::endl;
+        cancelExtend = positionManager.isMoving();
+        positionManager.cancelSequence();
+        return MotorState::Sheathing;
+    }
+    TickResult result = positionManager.tickSequence(commandedPosition, currentPosition);
+    switch (result) {
+        case TickResult::Running:   return MotorState::Extending;
+        case TickResult::Done:      return MotorState::Extended;
+        case TickResult::Preempted: return MotorState::SafetyLockout;
+        default:
+            obstruction_encountered = true;
+            return MotorState::Sheathing;
+    }
+}
+
+//EXTENDED
+MotorState BladeStateMachine::updateExtended() {
+    positionManager.holdPosition(commandedPosition);
+    if (activate == 0 || take(BladeCommand::Sheath)) {
+        return MotorState::Sheathing;
+    }
+    if (take(BladeCommand::MoveTo)) {
+        return MotorState::Moving;
+    }
+    return MotorState::Extended;
+}
+
+//SHEATHING
+void BladeStateMachine::enterSheathing() {
+    std::cout << "Sheathing..." << std::endl;
+    if (cancelExtend) {
+        // Still moving, keep the parameters the extend started with
+        positionManager.startSequence(kCancelExtendSteps, sizeof(kCancelExtendSteps) / sizeof(kCancelExtendSteps[0]));
+    } else {
+        refreshConfig();
+        positionManager.startSequence(kSheathSteps, sizeof(kSheathSteps) / sizeof(kSheathSteps[0]));
+    }
+    cancelExtend = false;
+}
+
+MotorState BladeStateMachine::updateSheathing() {
+    TickResult result = positionManager.tickSequence(commandedPosition, currentPosition);
+    switch (result) {
+        case TickResult::Running:   return MotorState::Sheathing;
+        case TickResult::Preempted: return MotorState::SafetyLockout;
+        case TickResult::Stalled:   obstruction_encountered = true; break;
+        default: break;
+    }
+    if (obstruction_encountered) {
+        return MotorState::WaitingToHome;
+    }
+    return MotorState::Homing;
+}
+
+//MOVING
+void BladeStateMachine::enterMoving() {
+    std::cout << "Moving to " << moveTarget << "..." << std::endl;
+    refreshConfig();
+    motionResult = positionManager.beginMoveTo(moveTarget, commandedPosition, currentPosition);
+}
+
+MotorState BladeStateMachine::updateMoving() {
+    if (motionResult == TickResult::Running) {
+        motionResult = positionManager.tick(commandedPosition, currentPosition);
+    }
+    switch (motionResult) {
+        case TickResult::Running:   return MotorState::Moving;
+        case TickResult::Done:      return MotorState::Positioned;
+        case TickResult::Preempted: return MotorState::SafetyLockout;
+        default:
+            commandedPosition = currentPosition;    // stopped short, hold where the blade is
+            return MotorState::Positioned;
+    }
+}
+
+//POSITIONED
+MotorState BladeStateMachine::updatePositioned() {
+    positionManager.holdPosition(commandedPosition);
+    if (activate == 0 || take(BladeCommand::Home)) {
+        return MotorState::Homing;
+    }
+    if (take(BladeCommand::MoveTo)) {
+        return MotorState::Moving;
+    }
+    return MotorState::Positioned;
+}
+
+//EXTEND ERROR
+MotorState BladeStateMachine::updateExtendError() {
+    struct timespec req2 = {0, 5 * 1000};
+    std::cout << "Extension error: extend limit switch was not activated." << std::endl;
+    nanosleep(&req2, NULL);
+    return MotorState::Initial;
+}
+
+//SAFETY LOCKOUT
+void BladeStateMachine::enterSafetyLockout() {
+    if (supervisor != nullptr && supervisor->tripped()) {
+        lastTrip = SafetySupervisor::tripName(supervisor->reason());
+    } else if (controller.linkFaulted()) {
+        lastTrip = "controller link fault";
+    } else {
+        lastTrip = "safety switch released";
+    }
+    std::cout << "SAFETY LOCKOUT (" << lastTrip << ") - The system is in a locked state until the safety button is engaged." << std::endl;
+}
+
+MotorState BladeStateMachine::updateSafetyLockout() {
+    // Wait in safety lockout state until the safety button is pressed and the controller answers
+    bool engaged = safetySwitch.readValue() == 1;
+    if (engaged && !controller.linkFaulted() && (supervisor == nullptr || supervisor->rearm())) {
+        return MotorState::Initial;  // Reset to initial state
+    }
+    // Held through a link fault, left braked while the switch is released or a trip stands
+    if (engaged && (supervisor == nullptr || !supervisor->tripped())) {
+        positionManager.holdPosition(commandedPosition);
+    }
+    return MotorState::SafetyLockout;
+}
+
+#endif // BLADE_STATE_MACHINE_H
@@ -0,0 +1,382 @@
+#ifndef CAN_FRAME_DECODER_H
+#define CAN_FRAME_DECODER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <charconv>
+#include <system_error>
+
+// Decoder for the moteus multiplex register protocol, the same grammar as
+// decode_can_frame.py. Decoding runs a cursor over the frame where it lies, hex text of
+// an fdcanusb line or raw bytes, and reports each element to a visitor. Nothing is
+// copied or allocated.
+
+enum class MultiplexCommand : uint8_t {
+    WriteRegisters = 0x00,
+    ReadRegisters = 0x10,
+    Reply = 0x20,
+    WriteError = 0x30,
+    ReadError = 0x31,
+    StreamClientToServer = 0x40,
+    StreamServerToClient = 0x41,
+    StreamClientPollServer = 0x42,
+    Nop = 0x50
+};
+
+enum class RegisterType : uint8_t {
+    Int8 = 0,
+    Int16 = 1,
+    Int32 = 2,
+    F32 = 3
+};
+
+// One register value as it was on the wire
+struct RegisterValue {
+    RegisterType type = RegisterType::F32;
+    int32_t integer = 0;
+    float real = 0.0f;
+
+    // Integer encodings reserve their most negative value for NaN
+    inline bool isNan() const {
+        switch (type) {
+            case RegisterType::Int8:  return integer == -128;
+            case RegisterType::Int16: return integer == -32768;
+            case RegisterType::Int32: return integer == std::numeric_limits<int32_t>::min();
+            default:                  return std::isnan(real);
+        }
+    }
+};
+
+// CURSORS - both read one byte at a time and never look past end
+class ByteCursor {
+public:
+    ByteCursor(const uint8_t* begin, const uint8_t* end) : position(begin), end(end) {}
+
+    inline bool empty() const { return position >= end; }
+    inline bool readByte(uint8_t& value) {
+        if (position >= end) return false;
+        value = *position++;
+        return true;
+    }
+    inline bool skip(size_t count) {
+        if (static_cast<size_t>(end - position) < count) return false;
+        position += count;
+        return true;
+    }
+
+private:
+    const uint8_t* position;
+    const uint8_t* end;
+};
+
+// Over hex text, two characters per byte
+class HexCursor {
+public:
+    HexCursor(const char* begin, const char* end) : position(begin), end(end) {}
+
+    inline bool empty() const { return end - position < 2; }
+    inline bool readByte(uint8_t& value) {
+        if (end - position < 2) return false;
+        int high = nibble(position[0]);
+        int low = nibble(position[1]);
+        if ((high | low) < 0) return false;
+        value = static_cast<uint8_t>((high << 4) | low);
+        position += 2;
+        return true;
+    }
+    inline bool skip(size_t count) {
+        if (static_cast<size_t>(end - position) < 2 * count) return false;
+        position += 2 * count;
+        return true;
+    }
+
+    static inline int nibble(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+private:
+    const char* position;
+    const char* end;
+};
+
+// PRIMITIVES
+template <typename Cursor>
+inline bool readVaruint(Cursor& cursor, uint32_t& value) {
+    value = 0;
+    for (int i = 0; i < 5; i++) {
+        uint8_t byte;
+        if (!cursor.readByte(byte)) return false;
+        value |= static_cast<uint32_t>(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;   // more than 5 bytes
+}
+
+template <typename Cursor>
+inline bool readValue(Cursor& cursor, RegisterType type, RegisterValue& value) {
+    static const size_t sizes[] = {1, 2, 4, 4};
+    uint8_t bytes[4] = {};
+    size_t size = sizes[static_cast<size_t>(type)];
+    for (size_t i = 0; i < size; i++) {
+        if (!cursor.readByte(bytes[i])) return false;
+    }
+    value.type = type;
+    switch (type) {
+        case RegisterType::Int8:
+            value.integer = static_cast<int8_t>(bytes[0]);
+            value.real = static_cast<float>(value.integer);
+            break;
+        case RegisterType::Int16:
+            value.integer = static_cast<int16_t>(bytes[0] | (bytes[1] << 8));
+            value.real = static_cast<float>(value.integer);
+            break;
+        case RegisterType::Int32:
+            value.integer = static_cast<int32_t>(bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24));
+            value.real = static_cast<float>(value.integer);
+            break;
+        case RegisterType::F32: {
+            uint32_t bits = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+            std::memcpy(&value.real, &bits, sizeof bits);
+            value.integer = 0;
+            break;
+        }
+    }
+    return true;
+}
+
+// DECODE - walks one frame. The visitor provides
+//   onWrite(reg, value) onReply(reg, value) onRead(startReg, count, type)
+//   onError(command, reg, code) onStream(command, channel, bytes) onPoll(channel, maxBytes)
+//   onNop() onUnknown(byte)
+// Returns false when the frame ends in the middle of an element.
+template <typename Cursor, typename Visitor>
+inline bool decodeMultiplex(Cursor cursor, Visitor& visitor) {
+    while (!cursor.empty()) {
+        uint8_t command;
+        if (!cursor.readByte(command)) {
+            return false;   // not hex
+        }
+        uint8_t upper = command & 0xf0;
+        RegisterType type = static_cast<RegisterType>((command >> 2) & 0x03);
+        uint32_t count = command & 0x03;
+
+        if (upper == static_cast<uint8_t>(MultiplexCommand::ReadRegisters)
+            || upper == static_cast<uint8_t>(MultiplexCommand::WriteRegisters)
+            || upper == static_cast<uint8_t>(MultiplexCommand::Reply)) {
+            uint32_t reg;
+            if ((count == 0 && !readVaruint(cursor, count)) || !readVaruint(cursor, reg)) {
+                return false;
+            }
+            if (upper == static_cast<uint8_t>(MultiplexCommand::ReadRegisters)) {
+                visitor.onRead(reg, count, type);
+                continue;
+            }
+            for (uint32_t i = 0; i < count; i++, reg++) {
+                RegisterValue value;
+                if (!readValue(cursor, type, value)) {
+                    return false;
+                }
+                if (upper == static_cast<uint8_t>(MultiplexCommand::Reply)) {
+                    visitor.onReply(reg, value);
+                } else {
+                    visitor.onWrite(reg, value);
+                }
+            }
+        } else if (command == static_cast<uint8_t>(MultiplexCommand::WriteError)
+                   || command == static_cast<uint8_t>(MultiplexCommand::ReadError)) {
+            uint32_t reg, code;
+            if (!readVaruint(cursor, reg) || !readVaruint(cursor, code)) {
+                return false;
+            }
+            visitor.onError(static_cast<MultiplexCommand>(command), reg, code);
+        } else if (command == static_cast<uint8_t>(MultiplexCommand::StreamClientToServer)
+                   || command == static_cast<uint8_t>(MultiplexCommand::StreamServerToClient)) {
+            uint32_t channel, bytes;
+            if (!readVaruint(cursor, channel) || !readVaruint(cursor, bytes) || !cursor.skip(bytes)) {
+                return false;
+            }
+            visitor.onStream(static_cast<MultiplexCommand>(command), channel, bytes);
+        } else if (command == static_cast<uint8_t>(MultiplexCommand::StreamClientPollServer)) {
+            uint32_t channel, bytes;
+            if (!readVaruint(cursor, channel) || !readVaruint(cursor, bytes)) {
+                return false;
+            }
+            visitor.onPoll(channel, bytes);
+        } else if (command == static_cast<uint8_t>(MultiplexCommand::Nop)) {
+            visitor.onNop();
+        } else {
+            visitor.onUnknown(command);
+        }
+    }
+    return true;
+}
+
+// REGISTERS - names and integer scales of the registers decode_can_frame.py knows
+struct RegisterScale {
+    double int8Scale;
+    double int16Scale;
+    double int32Scale;
+};
+
+struct RegisterInfo {
+    uint16_t reg;
+    const char* name;
+    const RegisterScale* scale;     // nullptr for unscaled registers
+};
+
+static const RegisterScale kPositionScale = {0.01, 0.0001, 0.00001};
+static const RegisterScale kVelocityScale = {0.1, 0.00025, 0.00001};
+static const RegisterScale kTorqueScale = {0.5, 0.01, 0.001};
+static const RegisterScale kCurrentScale = {1.0, 0.1, 0.001};
+static const RegisterScale kVoltageScale = {0.5, 0.1, 0.001};
+static const RegisterScale kTemperatureScale = {1.0, 0.1, 0.001};
+static const RegisterScale kPwmScale = {1.0 / 127.0, 1.0 / 32767.0, 1.0 / 2147483647.0};
+static const RegisterScale kAccelerationScale = {0.05, 0.001, 0.00001};
+static const RegisterScale kTimeScale = {0.01, 0.001, 0.000001};
+
+static const RegisterInfo kRegisters[] = {
+    {0x000, "MODE", nullptr},
+    {0x001, "POSITION", &kPositionScale},
+    {0x002, "VELOCITY", &kVelocityScale},
+    {0x003, "TORQUE", &kTorqueScale},
+    {0x004, "Q_CURRENT", &kCurrentScale},
+    {0x005, "D_CURRENT", &kCurrentScale},
+    {0x006, "ABS_POSITION", &kPositionScale},
+    {0x00d, "VOLTAGE", &kVoltageScale},
+    {0x00e, "TEMPERATURE", &kTemperatureScale},
+    {0x00f, "FAULT", nullptr},
+    {0x010, "PWM_PHASE_A", &kPwmScale},
+    {0x011, "PWM_PHASE_B", &kPwmScale},
+    {0x012, "PWM_PHASE_C", &kPwmScale},
+    {0x014, "VOLTAGE_PHASE_A", &kVoltageScale},
+    {0x015, "VOLTAGE_PHASE_B", &kVoltageScale},
+    {0x016, "VOLTAGE_PHASE_C", &kVoltageScale},
+    {0x019, "VFOC_VOLTAGE", &kVoltageScale},
+    {0x01a, "VOLTAGEDQ_D", &kVoltageScale},
+    {0x01b, "VOLTAGEDQ_Q", &kVoltageScale},
+    {0x01c, "COMMAND_Q_CURRENT", &kCurrentScale},
+    {0x01d, "COMMAND_D_CURRENT", &kCurrentScale},
+    {0x020, "COMMAND_POSITION", &kPositionScale},
+    {0x021, "COMMAND_VELOCITY", &kVelocityScale},
+    {0x022, "COMMAND_FEEDFORWARD_TORQUE", &kTorqueScale},
+    {0x023, "COMMAND_KP_SCALE", &kPwmScale},
+    {0x024, "COMMAND_KD_SCALE", &kPwmScale},
+    {0x025, "COMMAND_POSITION_MAX_TORQUE", &kTorqueScale},
+    {0x026, "COMMAND_STOP_POSITION", &kPositionScale},
+    {0x027, "COMMAND_TIMEOUT", &kTimeScale},
+    {0x028, "COMMAND_VELOCITY_LIMIT", &kVelocityScale},
+    {0x029, "COMMAND_ACCEL_LIMIT", &kAccelerationScale},
+    {0x02a, "COMMAND_FIXED_VOLTAGE_OVERRIDE", &kVoltageScale},
+    {0x033, "POSITION_FEEDFORWARD", &kTorqueScale},
+    {0x034, "POSITION_COMMAND", &kTorqueScale},
+    {0x040, "COMMAND_WITHIN_LOWER_BOUND", &kPositionScale},
+    {0x041, "COMMAND_WITHIN_UPPER_BOUND", &kPositionScale},
+    {0x042, "COMMAND_WITHIN_FEEDFORWARD_TORQUE", &kTorqueScale},
+    {0x043, "COMMAND_WITHIN_KP_SCALE", &kPwmScale},
+    {0x044, "COMMAND_WITHIN_KD_SCALE", &kPwmScale},
+    {0x045, "COMMAND_WITHIN_MAX_TORQUE", &kTorqueScale},
+    {0x046, "COMMAND_WITHIN_TIMEOUT", &kTimeScale},
+    {0x050, "ENCODER_0_POSITION", &kPositionScale},
+    {0x051, "ENCODER_0_VELOCITY", &kVelocityScale},
+    {0x052, "ENCODER_1_POSITION", &kPositionScale},
+    {0x053, "ENCODER_1_VELOCITY", &kVelocityScale},
+    {0x054, "ENCODER_2_POSITION", &kPositionScale},
+    {0x055, "ENCODER_2_VELOCITY", &kVelocityScale},
+    {0x130, "SET_OUTPUT_NEAREST", nullptr},
+    {0x131, "SET_OUTPUT_EXACT", nullptr},
+};
+
+static const uint32_t kRegisterTableSize = 0x140;
+
+// Table lookup, built once, this runs for every decoded value
+inline const RegisterInfo* findRegister(uint32_t reg) {
+    struct Table {
+        const RegisterInfo* entries[kRegisterTableSize] = {};
+        Table() {
+            for (const RegisterInfo& info : kRegisters) entries[info.reg] = &info;
+        }
+    };
+    static const Table table;
+    return reg < kRegisterTableSize ? table.entries[reg] : nullptr;
+}
+
+// SCALED VALUE - physical units, NaN for the integer NaN encodings
+inline double scaledValue(uint32_t reg, const RegisterValue& value) {
+    if (value.isNan()) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    if (value.type == RegisterType::F32) {
+        return value.real;
+    }
+    const RegisterInfo* info = findRegister(reg);
+    if (info == nullptr || info->scale == nullptr) {
+        return value.integer;
+    }
+    switch (value.type) {
+        case RegisterType::Int8:  return value.integer * info->scale->int8Scale;
+        case RegisterType::Int16: return value.integer * info->scale->int16Scale;
+        default:                  return value.integer * info->scale->int32Scale;
+    }
+}
+
+// FDCANUSB LINES - "can send <id> <hex>" or "rcv <id> <hex>", optionally after a timestamp
+// in seconds. Fields point into the line.
+struct CanLine {
+    double time = std::numeric_limits<double>::quiet_NaN();
+    uint16_t id = 0;                // arbitration id, replies carry the source in the high byte
+    bool reply = false;
+    const char* hexBegin = nullptr;
+    const char* hexEnd = nullptr;
+
+    inline uint8_t sourceId() const { return static_cast<uint8_t>((id >> 8) & 0x7f); }
+};
+
+inline bool nextCanToken(const char*& position, const char* end, const char*& tokenBegin, const char*& tokenEnd) {
+    while (position < end && (*position == ' ' || *position == '\t' || *position == '\r')) position++;
+    if (position >= end) return false;
+    tokenBegin = position;
+    while (position < end && *position != ' ' && *position != '\t' && *position != '\r') position++;
+    tokenEnd = position;
+    return true;
+}
+
+inline bool canTokenIs(const char* begin, const char* end, const char* word) {
+    size_t length = std::strlen(word);
+    return static_cast<size_t>(end - begin) == length && std::memcmp(begin, word, length) == 0;
+}
+
+// False for anything that is not a frame, "OK" acknowledgements included
+inline bool parseCanLine(const char* begin, const char* end, CanLine& line) {
+    const char* position = begin;
+    const char* tokenBegin;
+    const char* tokenEnd;
+    if (!nextCanToken(position, end, tokenBegin, tokenEnd)) return false;
+    if ((*tokenBegin >= '0' && *tokenBegin <= '9') || *tokenBegin == '-') {
+        double time;
+        if (std::from_chars(tokenBegin, tokenEnd, time).ec == std::errc()) {
+            line.time = time;
+        }
+        if (!nextCanToken(position, end, tokenBegin, tokenEnd)) return false;
+    }
+    if (canTokenIs(tokenBegin, tokenEnd, "can")) {
+        if (!nextCanToken(position, end, tokenBegin, tokenEnd) || !canTokenIs(tokenBegin, tokenEnd, "send")) return false;
+        line.reply = false;
+    } else if (canTokenIs(tokenBegin, tokenEnd, "rcv")) {
+        line.reply = true;
+    } else {
+        return false;
+    }
+    if (!nextCanToken(position, end, tokenBegin, tokenEnd)) return false;
+    uint32_t id = 0;
+    if (std::from_chars(tokenBegin, tokenEnd, id, 16).ec != std::errc()) return false;
+    line.id = static_cast<uint16_t>(id);
+    return nextCanToken(position, end, line.hexBegin, line.hexEnd);
+}
+
+#endif // CAN_FRAME_DECODER_H
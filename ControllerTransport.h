@@ -0,0 +1,196 @@
+#ifndef CONTROLLER_TRANSPORT_H
+#define CONTROLLER_TRANSPORT_H
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <poll.h>
+#include <errno.h>
+
+// Outcome of one device operation
+enum class IoStatus {
+    Ok,
+    Timeout,            // deadline passed, the device may still be there
+    Disconnected        // device gone or the stream out of step, it has to be reopened
+};
+
+inline const char* ioStatusName(IoStatus status) {
+    switch (status) {
+        case IoStatus::Ok:           return "ok";
+        case IoStatus::Timeout:      return "timeout";
+        case IoStatus::Disconnected: return "disconnected";
+        default:                     return "unknown";
+    }
+}
+
+// errno of a failed read or write
+inline IoStatus ioStatusFromErrno(int error) {
+    return (error == EAGAIN || error == EWOULDBLOCK || error == EINTR || error == ETIMEDOUT) ? IoStatus::Timeout : IoStatus::Disconnected;
+}
+
+// Byte stream between MyController and the fdcanusb. The serial port is the normal
+// transport, capture and replay transports wrap or stand in for it. No call blocks past
+// its deadline: writes give up after the transport's write timeout with ETIMEDOUT,
+// reads return what has arrived and fail with EAGAIN when nothing has.
+class ControllerTransport {
+public:
+    virtual ~ControllerTransport() = default;
+
+    virtual bool open() = 0;
+    virtual void close() = 0;
+    virtual ssize_t writeBytes(const char* data, size_t length) = 0;
+    virtual ssize_t readBytes(char* buffer, size_t length) = 0;
+    virtual bool waitReadable(int timeoutMs) = 0;
+
+    // Device recovery, a wrapper passes it on and keeps its own state
+    virtual bool reopen() {
+        close();
+        return open();
+    }
+
+    // Wait between the write and the read of a control cycle, replay paces itself instead
+    virtual void sleep(const struct timespec& duration) { nanosleep(&duration, nullptr); }
+
+    // Time base for anything derived from the stream, replay substitutes recorded time
+    virtual int64_t nowNs() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// SERIAL TRANSPORT - the fdcanusb character device, non-blocking and in raw mode
+class SerialTransport : public ControllerTransport {
+public:
+    explicit SerialTransport(const std::string& portName, int writeTimeoutMs = 20) : portName(portName), writeTimeoutMs(writeTimeoutMs) {}
+    ~SerialTransport() override { close(); }
+
+    inline bool open() override;
+    inline void close() override;
+    inline ssize_t writeBytes(const char* data, size_t length) override;
+    inline ssize_t readBytes(char* buffer, size_t length) override;
+    inline bool waitReadable(int timeoutMs) override;
+
+private:
+    std::string portName;
+    int writeTimeoutMs;
+    int fd = -1;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// SERIAL PORT SETUP - also the reopen after a device fault, so termios is applied in full
+// every time rather than patched onto whatever the port was left with
+bool SerialTransport::open() {
+    close();
+    fd = ::open(portName.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        std::cerr << "Error opening " << portName << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct termios tty;
+    memset(&tty, 0, sizeof tty);
+    if (tcgetattr(fd, &tty) != 0) {
+        std::cerr << "Error from tcgetattr: " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    cfmakeraw(&tty);
+    cfsetospeed(&tty, B115200);
+    cfsetispeed(&tty, B115200);
+
+    tty.c_cflag |= (CLOCAL | CREAD);
+    tty.c_cflag &= ~CSIZE;
+    tty.c_cflag |= CS8;
+    tty.c_cflag &= ~PARENB;
+    tty.c_cflag &= ~CSTOPB;
+    tty.c_cflag &= ~CRTSCTS;
+    tty.c_cc[VMIN] = 0;         // reads never wait, poll() does
+    tty.c_cc[VTIME] = 0;
+
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        std::cerr << "Error from tcsetattr: " << strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    return true;
+}
+
+void SerialTransport::close() {
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+// WRITE - the whole line or nothing useful: a line cut short by the deadline leaves the
+// fdcanusb out of step, which the caller sees as ETIMEDOUT and recovers from
+ssize_t SerialTransport::writeBytes(const char* data, size_t length) {
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(writeTimeoutMs);
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(fd, data + written, length - written);
+        if (n > 0) {
+            written += n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            return -1;
+        }
+        int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if (remaining <= 0 || poll(&pfd, 1, remaining) <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    return static_cast<ssize_t>(written);
+}
+
+// READ - end of file on a tty means the device went away
+ssize_t SerialTransport::readBytes(char* buffer, size_t length) {
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    ssize_t n = read(fd, buffer, length);
+    if (n == 0) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))) {
+            errno = EIO;
+            return -1;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    return n;
+}
+
+// WAIT READABLE - true on a hangup too, so the read that follows reports it
+bool SerialTransport::waitReadable(int timeoutMs) {
+    if (fd < 0) {
+        return false;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, timeoutMs) > 0;
+}
+
+#endif // CONTROLLER_TRANSPORT_H
@@ -0,0 +1,39 @@
+#ifndef COORDINATE_FRAME_H
+#define COORDINATE_FRAME_H
+
+#include <cmath>
+#include <cstddef>
+
+// Host side coordinate frame. The controller keeps counting absolute position and the
+// motion code works in a logical frame that is moved by a host side offset, so a
+// rezero costs no bus transaction and position history stays continuous. A physical
+// rezero is only needed when the absolute position drifts far enough from the center
+// that the firmware range or float resolution would suffer.
+class CoordinateFrame {
+public:
+    // Constructor
+    explicit CoordinateFrame(float center = 500.0f, float halfRange = 100.0f)
+    : center(center), halfRange(halfRange) {}
+
+    inline float toLogical(float absolute) const { return absolute + offset; }
+    inline float toAbsolute(float logical) const { return logical - offset; }  // NaN stays NaN
+
+    // Logical position becomes value at the given absolute position
+    inline void setOrigin(float value, float absolute) { offset = value - absolute; hostRezeros++; }
+    inline void physicalRezero() { offset = 0.0f; physicalRezeros++; }
+    inline bool needsPhysicalRezero(float absolute) const { return !std::isfinite(absolute) || std::fabs(absolute - center) > halfRange; }
+
+    inline float getCenter() const { return center; }
+    inline float getOffset() const { return offset; }
+    inline size_t getHostRezeros() const { return hostRezeros; }
+    inline size_t getPhysicalRezeros() const { return physicalRezeros; }
+
+private:
+    float center;
+    float halfRange;
+    float offset = 0.0f;
+    size_t hostRezeros = 0;
+    size_t physicalRezeros = 0;
+};
+
+#endif // COORDINATE_FRAME_H
@@ -0,0 +1,279 @@
+#ifndef DAEMON_PROTOCOL_H
+#define DAEMON_PROTOCOL_H
+
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Binary protocol spoken over the daemon's Unix socket. Every message is an 8 byte
+// header followed by length bytes of payload, all fields little endian:
+//   type (1) | status (1) | length (2) | sequence (4)
+// Clients may send any number of requests without waiting. Each request is answered by
+// one response carrying the same sequence and type | kResponseFlag. Notifications are
+// pushed to every client unasked, with their own sequence counter.
+enum class DaemonMessage : uint8_t {
+    Home = 0x01,
+    Extend = 0x02,
+    Sheath = 0x03,
+    MoveTo = 0x04,          // payload: target position (f32)
+    Stop = 0x05,
+    Query = 0x06,           // response payload: status
+    SetParameter = 0x07,    // payload: "key value" as in doomblade.cfg
+    StateChanged = 0x40     // notification, payload: status
+};
+
+static const uint8_t kResponseFlag = 0x80;
+static const size_t kDaemonHeaderSize = 8;
+static const size_t kDaemonMaxPayload = 1024;
+
+enum class DaemonStatus : uint8_t {
+    Ok = 0,
+    Refused = 1,            // the current state does not take the command
+    BadRequest = 2,         // malformed payload or unknown key
+    Unknown = 3             // unknown message type
+};
+
+// Status payload of Query responses and StateChanged notifications, 24 bytes
+struct DaemonStatusPayload {
+    uint8_t motorState = 0;
+    uint8_t phase = 0;
+    uint8_t replyValid = 0;
+    uint8_t pendingCommand = 0;
+    float commandedPosition = 0.0f;
+    float currentPosition = 0.0f;
+    float velocity = 0.0f;          // estimator, per second
+    float torque = 0.0f;
+    uint32_t configGeneration = 0;
+};
+
+static const size_t kDaemonStatusSize = 24;
+
+struct DaemonFrame {
+    uint8_t type = 0;
+    uint8_t status = 0;
+    uint32_t sequence = 0;
+    std::string payload;
+
+    inline bool isResponse() const { return (type & kResponseFlag) != 0; }
+    inline DaemonMessage message() const { return static_cast<DaemonMessage>(type & ~kResponseFlag); }
+};
+
+// ENCODING
+inline void putU16(std::string& out, uint16_t value) {
+    out.push_back(static_cast<char>(value & 0xff));
+    out.push_back(static_cast<char>(value >> 8));
+}
+
+inline void putU32(std::string& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+}
+
+inline void putF32(std::string& out, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    putU32(out, bits);
+}
+
+inline uint32_t getU32(const char* data) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+inline float getF32(const char* data) {
+    uint32_t bits = getU32(data);
+    float value;
+    std::memcpy(&value, &bits, sizeof value);
+    return value;
+}
+
+// Appends one framed message to out
+inline void encodeFrame(std::string& out, uint8_t type, uint8_t status, uint32_t sequence, const std::string& payload) {
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(status));
+    putU16(out, static_cast<uint16_t>(payload.size()));
+    putU32(out, sequence);
+    out.append(payload);
+}
+
+// Takes one complete message off the front of buffer. False when more bytes are needed,
+// malformed is set when the stream cannot be framed any more.
+inline bool decodeFrame(std::string& buffer, DaemonFrame& frame, bool& malformed) {
+    malformed = false;
+    if (buffer.size() < kDaemonHeaderSize) {
+        return false;
+    }
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(buffer.data());
+    size_t length = bytes[2] | (bytes[3] << 8);
+    if (length > kDaemonMaxPayload) {
+        malformed = true;
+        return false;
+    }
+    if (buffer.size() < kDaemonHeaderSize + length) {
+        return false;
+    }
+    frame.type = bytes[0];
+    frame.status = bytes[1];
+    frame.sequence = getU32(buffer.data() + 4);
+    frame.payload.assign(buffer, kDaemonHeaderSize, length);
+    buffer.erase(0, kDaemonHeaderSize + length);
+    return true;
+}
+
+inline std::string encodeStatus(const DaemonStatusPayload& status) {
+    std::string out;
+    out.push_back(static_cast<char>(status.motorState));
+    out.push_back(static_cast<char>(status.phase));
+    out.push_back(static_cast<char>(status.replyValid));
+    out.push_back(static_cast<char>(status.pendingCommand));
+    putF32(out, status.commandedPosition);
+    putF32(out, status.currentPosition);
+    putF32(out, status.velocity);
+    putF32(out, status.torque);
+    putU32(out, status.configGeneration);
+    return out;
+}
+
+inline bool decodeStatus(const std::string& payload, DaemonStatusPayload& status) {
+    if (payload.size() < kDaemonStatusSize) {
+        return false;
+    }
+    const char* data = payload.data();
+    status.motorState = static_cast<uint8_t>(data[0]);
+    status.phase = static_cast<uint8_t>(data[1]);
+    status.replyValid = static_cast<uint8_t>(data[2]);
+    status.pendingCommand = static_cast<uint8_t>(data[3]);
+    status.commandedPosition = getF32(data + 4);
+    status.currentPosition = getF32(data + 8);
+    status.velocity = getF32(data + 12);
+    status.torque = getF32(data + 16);
+    status.configGeneration = getU32(data + 20);
+    return true;
+}
+
+inline const char* daemonStatusName(uint8_t status) {
+    switch (static_cast<DaemonStatus>(status)) {
+        case DaemonStatus::Ok:         return "ok";
+        case DaemonStatus::Refused:    return "refused";
+        case DaemonStatus::BadRequest: return "bad request";
+        case DaemonStatus::Unknown:    return "unknown request";
+        default:                       return "?";
+    }
+}
+
+// Client side connection, used by doomblade_ctl and test programs
+class DaemonClient {
+public:
+    DaemonClient() = default;
+    ~DaemonClient() { close(); }
+
+    inline bool connect(const std::string& path);
+    inline void close();
+
+    // Sends one request, returns its sequence number (0 on failure)
+    inline uint32_t send(DaemonMessage type, const std::string& payload = std::string());
+
+    // Next response or notification, false on timeout or a closed connection
+    inline bool receive(DaemonFrame& frame, int timeoutMs);
+    inline bool isOpen() const { return fd >= 0; }
+
+private:
+    int fd = -1;
+    uint32_t nextSequence = 1;
+    std::string input;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool DaemonClient::connect(const std::string& path) {
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << "Failed to create socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof address) != 0) {
+        std::cerr << "Failed to connect to " << path << ": " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void DaemonClient::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+uint32_t DaemonClient::send(DaemonMessage type, const std::string& payload) {
+    if (fd < 0 || payload.size() > kDaemonMaxPayload) {
+        return 0;
+    }
+    uint32_t sequence = nextSequence++;
+    std::string out;
+    encodeFrame(out, static_cast<uint8_t>(type), 0, sequence, payload);
+    size_t sent = 0;
+    while (sent < out.size()) {
+        ssize_t n = ::send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::cerr << "Daemon connection lost: " << strerror(errno) << std::endl;
+            close();
+            return 0;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return sequence;
+}
+
+bool DaemonClient::receive(DaemonFrame& frame, int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (fd >= 0) {
+        bool malformed;
+        if (decodeFrame(input, frame, malformed)) {
+            return true;
+        }
+        if (malformed) {
+            std::cerr << "Malformed message from the daemon" << std::endl;
+            close();
+            return false;
+        }
+        int remaining = timeoutMs < 0 ? -1 : static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count());
+        if (timeoutMs >= 0 && remaining <= 0) {
+            return false;
+        }
+        pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, remaining);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return false;
+        }
+        char buf[4096];
+        ssize_t n = ::recv(fd, buf, sizeof buf, 0);
+        if (n <= 0) {
+            close();
+            return false;
+        }
+        input.append(buf, static_cast<size_t>(n));
+    }
+    return false;
+}
+
+#endif // DAEMON_PROTOCOL_H
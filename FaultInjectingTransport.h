@@ -0,0 +1,158 @@
+#ifndef FAULT_INJECTING_TRANSPORT_H
+#define FAULT_INJECTING_TRANSPORT_H
+
+#include "ControllerTransport.h"
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <random>
+
+// Faults of the fdcanusb link, as a host sees them
+enum class InjectedFault {
+    None,
+    Stall,          // nothing moves: writes time out, reads find nothing
+    DropReplies,    // commands get through, nothing comes back
+    Garbage,        // replies arrive as noise
+    Disconnect      // the device is gone, every operation fails until it is reopened
+};
+
+inline const char* injectedFaultName(InjectedFault fault) {
+    switch (fault) {
+        case InjectedFault::None:        return "none";
+        case InjectedFault::Stall:       return "stall";
+        case InjectedFault::DropReplies: return "drop replies";
+        case InjectedFault::Garbage:     return "garbage";
+        case InjectedFault::Disconnect:  return "disconnect";
+        default:                         return "unknown";
+    }
+}
+
+// FAULT INJECTING TRANSPORT - wraps another transport, usually SimulatedController, and
+// fails it the way a USB serial device fails, with the errno values SerialTransport gives.
+// A fault lasts for its duration or until a reopen clears it, and the reopen itself can be
+// made to fail. Time is the inner transport's, so a stall costs simulated time only.
+class FaultInjectingTransport : public ControllerTransport {
+public:
+    explicit FaultInjectingTransport(ControllerTransport& inner, int writeTimeoutMs = 20) : inner(inner), writeTimeoutMs(writeTimeoutMs) {}
+
+    // INJECT - durationNs < 0 lasts until a reopen. failedReopens reopens fail first, < 0 all of them.
+    inline void inject(InjectedFault fault, int64_t durationNs = -1, int failedReopens = 0);
+    inline InjectedFault getFault() const { return fault; }
+    inline int getReopens() const { return reopens; }
+
+    inline bool open() override { return inner.open(); }
+    inline void close() override { inner.close(); }
+    inline ssize_t writeBytes(const char* data, size_t length) override;
+    inline ssize_t readBytes(char* buffer, size_t length) override;
+    inline bool waitReadable(int timeoutMs) override;
+    inline bool reopen() override;
+    inline void sleep(const struct timespec& duration) override { inner.sleep(duration); }
+    inline int64_t nowNs() const override { return inner.nowNs(); }
+
+private:
+    ControllerTransport& inner;
+    int writeTimeoutMs;
+    InjectedFault fault = InjectedFault::None;
+    int64_t faultEndNs = -1;
+    int failedReopens = 0;
+    int reopens = 0;
+    std::mt19937 random{7};
+
+    inline InjectedFault active();
+    inline void discardInner();
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void FaultInjectingTransport::inject(InjectedFault newFault, int64_t durationNs, int newFailedReopens) {
+    fault = newFault;
+    faultEndNs = durationNs < 0 ? -1 : inner.nowNs() + durationNs;
+    failedReopens = newFailedReopens;
+}
+
+// ACTIVE - the fault in force now, one that ran its time is cleared
+InjectedFault FaultInjectingTransport::active() {
+    if (fault != InjectedFault::None && faultEndNs >= 0 && inner.nowNs() >= faultEndNs) {
+        fault = InjectedFault::None;
+    }
+    return fault;
+}
+
+// DISCARD INNER - what the device sent while the host could not see it
+void FaultInjectingTransport::discardInner() {
+    char buf[256];
+    while (inner.readBytes(buf, sizeof buf) > 0) {
+    }
+}
+
+// WRITE - a stalled device takes the whole write timeout to fail
+ssize_t FaultInjectingTransport::writeBytes(const char* data, size_t length) {
+    switch (active()) {
+        case InjectedFault::Stall:
+            inner.sleep({writeTimeoutMs / 1000, (writeTimeoutMs % 1000) * 1000000L});
+            errno = ETIMEDOUT;
+            return -1;
+        case InjectedFault::Disconnect:
+            errno = EIO;
+            return -1;
+        default:
+            return inner.writeBytes(data, length);
+    }
+}
+
+// READ - replies the device sent meanwhile are lost, not delivered late
+ssize_t FaultInjectingTransport::readBytes(char* buffer, size_t length) {
+    switch (active()) {
+        case InjectedFault::Stall:
+        case InjectedFault::DropReplies:
+            discardInner();
+            errno = EAGAIN;
+            return -1;
+        case InjectedFault::Disconnect:
+            errno = EIO;
+            return -1;
+        case InjectedFault::Garbage: {
+            ssize_t n = inner.readBytes(buffer, length);
+            for (ssize_t i = 0; i < n; i++) {
+                buffer[i] = static_cast<char>(std::uniform_int_distribution<int>(0, 255)(random));
+            }
+            return n;
+        }
+        default:
+            return inner.readBytes(buffer, length);
+    }
+}
+
+// WAIT READABLE - a gone device is readable at once, as a hangup is, so the read reports it
+bool FaultInjectingTransport::waitReadable(int timeoutMs) {
+    switch (active()) {
+        case InjectedFault::Stall:
+        case InjectedFault::DropReplies:
+            inner.sleep({timeoutMs / 1000, (timeoutMs % 1000) * 1000000L});
+            return false;
+        case InjectedFault::Disconnect:
+            return true;
+        default:
+            return inner.waitReadable(timeoutMs);
+    }
+}
+
+// REOPEN - clears any fault once the failures asked for are used up
+bool FaultInjectingTransport::reopen() {
+    reopens++;
+    if (fault != InjectedFault::None && failedReopens != 0) {
+        if (failedReopens > 0) {
+            failedReopens--;
+        }
+        errno = ENOENT;
+        return false;
+    }
+    fault = InjectedFault::None;
+    if (!inner.reopen()) {
+        return false;
+    }
+    discardInner();
+    return true;
+}
+
+#endif // FAULT_INJECTING_TRANSPORT_H
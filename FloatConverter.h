@@ -6,23 +6,45 @@
 #include <cstring> // For memcpy
 #include <iomanip>
 #include <sstream>
+#include <limits>
 
 class FloatConverter {
 public:
     // Convert a single float to its full hexadecimal ASCII representation
     static std::vector<unsigned char> convertFloat(float value) {
-        std::vector<unsigned char> convertedData;
+        std::vector<unsigned char> convertedData(2 * sizeof(float));
+        writeHex(value, reinterpret_cast<char*>(convertedData.data()));
+        return convertedData;
+    }
 
+    // Same digits written in place, 8 chars and no terminator. Does not allocate.
+    static void writeHex(float value, char* out) {
         // Convert float to bytes
         unsigned char bytes[sizeof(float)];
         std::memcpy(bytes, &value, sizeof(float));
 
         // Convert each byte to two hex digits in ASCII
-        for (int i = 0; i < sizeof(float); i++) {
-            convertedData.push_back(toHexDigit((bytes[i] >> 4) & 0x0F));  // High nibble
-            convertedData.push_back(toHexDigit(bytes[i] & 0x0F));         // Low nibble
+        for (size_t i = 0; i < sizeof(float); i++) {
+            out[2 * i] = toHexDigit((bytes[i] >> 4) & 0x0F);     // High nibble
+            out[2 * i + 1] = toHexDigit(bytes[i] & 0x0F);        // Low nibble
         }
-        return convertedData;
+    }
+
+    // Inverse of writeHex, reads 8 hex digits in byte order. NaN when any is not a hex
+    // digit. Does not allocate.
+    static float readHex(const char* in) {
+        unsigned char bytes[sizeof(float)];
+        for (size_t i = 0; i < sizeof(float); i++) {
+            int high = fromHexDigit(in[2 * i]);
+            int low = fromHexDigit(in[2 * i + 1]);
+            if (high < 0 || low < 0) {
+                return std::numeric_limits<float>::quiet_NaN();
+            }
+            bytes[i] = static_cast<unsigned char>((high << 4) | low);
+        }
+        float value;
+        std::memcpy(&value, bytes, sizeof(float));
+        return value;
     }
 
 private:
@@ -30,6 +52,13 @@ private:
     static unsigned char toHexDigit(unsigned int nibble) {
         return nibble < 10 ? '0' + nibble : 'a' + (nibble - 10);
     }
+
+    static int fromHexDigit(char digit) {
+        if (digit >= '0' && digit <= '9') return digit - '0';
+        if (digit >= 'a' && digit <= 'f') return digit - 'a' + 10;
+        if (digit >= 'A' && digit <= 'F') return digit - 'A' + 10;
+        return -1;
+    }
 };
 
 #endif // FLOATCONVERTER_H
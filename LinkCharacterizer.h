@@ -0,0 +1,155 @@
+#ifndef LINK_CHARACTERIZER_H
+#define LINK_CHARACTERIZER_H
+
+#include "MyController.h"
+#include "RuntimeConfig.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <limits>
+
+// Round trip distribution of the fdcanusb link, microseconds
+struct LinkProfile {
+    size_t queries = 0;
+    size_t lost = 0;                    // no reply within the timeout
+    double p50Us = 0.0;
+    double p90Us = 0.0;
+    double p99Us = 0.0;
+    double p999Us = 0.0;
+    double maxUs = 0.0;
+    long periodUs = 0;                  // chosen control period, 0 when none meets the miss rate
+    double expectedMissRate = 0.0;      // share of the burst slower than the chosen period
+};
+
+// Measures the query round trip with a burst of back to back queries and picks the
+// shortest control period that meets a miss rate. A control cycle writes, waits one
+// period and reads, so a reply slower than the period is a missed cycle. Times come from
+// the controller transport, so a replayed session chooses the period it recorded.
+class LinkCharacterizer {
+public:
+    // Constructor
+    explicit LinkCharacterizer(MyController& controller) : controller(controller) {}
+
+    inline bool measure(size_t queries, int timeoutMs);
+    inline long choosePeriod(double missRate, long marginUs, long stepUs, long minPeriodUs, long maxPeriodUs);
+    inline const LinkProfile& getProfile() const { return profile; }
+    inline const std::vector<double>& getRoundTrips() const { return roundTripsUs; }
+    inline void printReport() const;
+
+private:
+    inline double quantile(double fraction) const;
+
+    MyController& controller;
+    LinkProfile profile;
+    std::vector<double> roundTripsUs;   // sorted, replies only
+    std::string line;
+};
+
+// Control period for the session, measured when link.characterize is set. Falls back to
+// control.period_us when the link cannot be measured or nothing meets the miss rate.
+inline struct timespec selectControlPeriod(MyController& controller, const MotionConfig& config);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// MEASURE - one query in flight at a time, the next goes out once the reply is in
+bool LinkCharacterizer::measure(size_t queries, int timeoutMs) {
+    profile = LinkProfile();
+    roundTripsUs.clear();
+    roundTripsUs.reserve(queries);
+    for (size_t i = 0; i < queries; i++) {
+        controller.sendQueryCommand();
+        int64_t sentNs = controller.nowNs();
+        bool replied = false;
+        while (controller.readLine(line, timeoutMs)) {
+            uint8_t source;
+            ControllerState state;
+            if (MyController::parseReply(line, source, state) && source == controller.getCanId()) {
+                replied = true;
+                break;
+            }
+        }
+        profile.queries++;
+        if (replied) {
+            roundTripsUs.push_back((controller.nowNs() - sentNs) / 1000.0);
+        } else {
+            profile.lost++;
+        }
+    }
+    if (roundTripsUs.empty()) {
+        return false;
+    }
+    std::sort(roundTripsUs.begin(), roundTripsUs.end());
+    profile.p50Us = quantile(0.5);
+    profile.p90Us = quantile(0.9);
+    profile.p99Us = quantile(0.99);
+    profile.p999Us = quantile(0.999);
+    profile.maxUs = roundTripsUs.back();
+    return true;
+}
+
+// QUANTILE - of every query sent, a lost reply counts as slower than any received one
+double LinkCharacterizer::quantile(double fraction) const {
+    size_t rank = static_cast<size_t>(std::ceil(fraction * profile.queries));
+    if (rank == 0) {
+        rank = 1;
+    }
+    if (rank > roundTripsUs.size()) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return roundTripsUs[rank - 1];
+}
+
+// CHOOSE PERIOD - the (1 - missRate) round trip plus margin for the host side of the
+// cycle, rounded up to stepUs and clamped
+long LinkCharacterizer::choosePeriod(double missRate, long marginUs, long stepUs, long minPeriodUs, long maxPeriodUs) {
+    double needed = quantile(1.0 - missRate);
+    if (!std::isfinite(needed)) {
+        profile.periodUs = 0;
+        return 0;
+    }
+    stepUs = std::max(1L, stepUs);
+    long period = static_cast<long>(std::ceil((needed + marginUs) / stepUs)) * stepUs;
+    period = std::max(period, minPeriodUs);
+    if (period > maxPeriodUs) {
+        profile.periodUs = 0;
+        return 0;
+    }
+    size_t slower = roundTripsUs.end() - std::upper_bound(roundTripsUs.begin(), roundTripsUs.end(), static_cast<double>(period - marginUs));
+    profile.periodUs = period;
+    profile.expectedMissRate = static_cast<double>(slower + profile.lost) / profile.queries;
+    return period;
+}
+
+void LinkCharacterizer::printReport() const {
+    std::cout << "Link: " << profile.queries << " queries, " << profile.lost << " lost, round trip p50 " << profile.p50Us
+              << " us, p90 " << profile.p90Us << " us, p99 " << profile.p99Us << " us, p99.9 " << profile.p999Us
+              << " us, max " << profile.maxUs << " us" << std::endl;
+    if (profile.periodUs > 0) {
+        std::cout << "Link: control period " << profile.periodUs << " us, expected miss rate " << profile.expectedMissRate << std::endl;
+    } else {
+        std::cout << "Link: no control period within range meets the miss rate" << std::endl;
+    }
+}
+
+struct timespec selectControlPeriod(MyController& controller, const MotionConfig& config) {
+    if (!config.linkCharacterize) {
+        return config.controlPeriod();
+    }
+    LinkCharacterizer link(controller);
+    if (!link.measure(config.linkQueries, 10)) {
+        std::cout << "Link: no replies, keeping control period " << config.controlPeriodUs << " us" << std::endl;
+        return config.controlPeriod();
+    }
+    long periodUs = link.choosePeriod(config.linkMissRate, config.linkMarginUs, 50, config.linkMinPeriodUs, config.linkMaxPeriodUs);
+    link.printReport();
+    if (periodUs == 0) {
+        std::cout << "Link: keeping control period " << config.controlPeriodUs << " us" << std::endl;
+        return config.controlPeriod();
+    }
+    return {periodUs / 1000000, (periodUs % 1000000) * 1000};
+}
+
+#endif // LINK_CHARACTERIZER_H
@@ -0,0 +1,94 @@
+#ifndef LOAD_TRACKER_H
+#define LOAD_TRACKER_H
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+// Load side position from the output encoder, read in the same reply as the motor position.
+// The encoder is referenced to the motor once, at home, and from then on the gap between
+// motor and load is the wind-up and backlash of the drive. The gap is averaged separately
+// while the motor drives each way; backlash is the difference of the two averages. Once
+// both are known the load position is centred between them, which takes out the half
+// backlash the reference was off by. Positions are in the controller's absolute frame,
+// the encoder in its own units.
+class LoadTracker {
+public:
+    inline void setScale(float newScale) { scale = newScale; }             // encoder units per controller unit
+    inline void setVelocityThreshold(float threshold) { velocityThreshold = threshold; }
+    inline void setSmoothing(float newSmoothing) { smoothing = newSmoothing; }
+
+    // REFERENCE - load and motor at the same position, at home
+    inline bool reference(float motorPosition, float encoder);
+    // SHIFT - the controller was rezeroed, motor positions moved by delta
+    inline void shift(float delta);
+    // UPDATE - false without an encoder reading or before the reference
+    inline bool update(float motorPosition, float motorVelocity, float encoder);
+    inline void clear();
+
+    inline bool isReferenced() const { return referenced; }
+    inline float getLoadPosition() const { return load; }
+    inline float getGap() const { return gap; }                         // motor minus load, last reading, centred
+    inline float getBacklash() const { return forwardGap - reverseGap; }  // NaN until both ways were driven
+    inline size_t getSamples() const { return samples; }
+
+private:
+    float scale = 1.0f;
+    float velocityThreshold = 0.5f;     // controller units per second, slower counts as standing
+    float smoothing = 0.05f;            // weight of each new gap in its direction's average
+
+    bool referenced = false;
+    float offset = 0.0f;                // motor position of encoder zero
+    float load = std::numeric_limits<float>::quiet_NaN();
+    float gap = std::numeric_limits<float>::quiet_NaN();
+    float forwardGap = std::numeric_limits<float>::quiet_NaN();
+    float reverseGap = std::numeric_limits<float>::quiet_NaN();
+    size_t samples = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool LoadTracker::reference(float motorPosition, float encoder) {
+    if (!std::isfinite(motorPosition) || !std::isfinite(encoder) || scale == 0.0f) {
+        return false;
+    }
+    offset = motorPosition - encoder / scale;
+    load = motorPosition;
+    gap = 0.0f;
+    referenced = true;
+    return true;
+}
+
+void LoadTracker::shift(float delta) {
+    offset += delta;
+    load += delta;
+}
+
+bool LoadTracker::update(float motorPosition, float motorVelocity, float encoder) {
+    if (!referenced || !std::isfinite(motorPosition) || !std::isfinite(encoder)) {
+        return false;
+    }
+    float referencedLoad = offset + encoder / scale;
+    float referencedGap = motorPosition - referencedLoad;
+    samples++;
+
+    // Only a gap taken while driving sits against one side of the backlash
+    if (motorVelocity > velocityThreshold) {
+        forwardGap = std::isnan(forwardGap) ? referencedGap : forwardGap + smoothing * (referencedGap - forwardGap);
+    } else if (motorVelocity < -velocityThreshold) {
+        reverseGap = std::isnan(reverseGap) ? referencedGap : reverseGap + smoothing * (referencedGap - reverseGap);
+    }
+    float centre = std::isnan(getBacklash()) ? 0.0f : (forwardGap + reverseGap) / 2.0f;
+    load = referencedLoad + centre;
+    gap = referencedGap - centre;
+    return true;
+}
+
+// CLEAR - reference and averages dropped, e.g. when the output encoder is switched off
+void LoadTracker::clear() {
+    referenced = false;
+    load = gap = forwardGap = reverseGap = std::numeric_limits<float>::quiet_NaN();
+    samples = 0;
+}
+
+#endif // LOAD_TRACKER_H
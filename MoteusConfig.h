@@ -0,0 +1,403 @@
+#ifndef MOTEUS_CONFIG_H
+#define MOTEUS_CONFIG_H
+
+#include "MyController.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+// Typed value of one moteus config key
+struct ConfigValue {
+    enum class Type { Integer, Float };
+    Type type = Type::Integer;
+    long long integer = 0;
+    double number = 0.0;
+    std::string text;       // as written, pushed back unchanged
+
+    static inline ConfigValue parse(const std::string& text);
+    inline bool operator==(const ConfigValue& other) const;
+    inline bool operator!=(const ConfigValue& other) const { return !(*this == other); }
+};
+
+// Config tree, "servo.pid_position.kp" is servo -> pid_position -> kp
+struct ConfigNode {
+    std::map<std::string, ConfigNode> children;
+    bool leaf = false;
+    ConfigValue value;
+};
+
+struct ConfigChange {
+    std::string key;
+    std::string from;       // empty when the key is missing on the controller
+    std::string to;
+};
+
+// Parsed moteus configuration in the drpi1.cfg / "conf enumerate" format
+class MoteusConfig {
+public:
+    inline bool load(const std::string& path);
+    inline bool parse(std::istream& input);
+    inline void set(const std::string& key, const ConfigValue& value);
+    inline const ConfigValue* find(const std::string& key) const;
+    inline const ConfigNode& root() const { return tree; }
+    inline const std::vector<std::string>& keys() const { return order; }
+    inline size_t size() const { return order.size(); }
+
+    // Keys in desired that differ from this (live) config
+    inline std::vector<ConfigChange> diff(const MoteusConfig& desired, const std::vector<std::string>& skipPrefixes) const;
+
+private:
+    ConfigNode tree;
+    std::vector<std::string> order;     // keys in file order
+};
+
+// Reads and writes the live config over the diagnostic stream. Writes go out as
+// 0x40 subframes, replies are polled with 0x42 and come back as 0x41 subframes.
+class MoteusConfigClient {
+public:
+    static constexpr size_t kFrameData = 61;    // 64 byte CAN-FD frame less the subframe header
+    static constexpr size_t kWindowFrames = 4;  // frames in flight before replies are drained
+
+    explicit MoteusConfigClient(MyController& controller, int timeoutMs = 500)
+    : controller(controller), timeoutMs(timeoutMs) {}
+
+    inline bool enumerate(MoteusConfig& live);
+    inline bool get(const std::vector<std::string>& keys, std::vector<std::string>& values);
+    inline bool push(const std::vector<ConfigChange>& changes);
+    inline bool persist();
+    inline size_t getFramesSent() const { return framesSent; }
+
+private:
+    inline void writeStream(const std::string& text);
+    inline bool readStream(std::string& text);
+    inline bool nextLine(std::string& line);
+    inline bool collectReplies(size_t expected, std::vector<std::string>& replies, std::string* body);
+    static inline std::string toHex(const std::string& bytes);
+    static inline bool fromHex(const std::string& hex, std::string& bytes);
+
+    MyController& controller;
+    int timeoutMs;
+    std::string pending;    // received text not yet split into lines
+    size_t framesSent = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// CONFIG VALUE
+
+ConfigValue ConfigValue::parse(const std::string& text) {
+    ConfigValue value;
+    value.text = text;
+    char* end = nullptr;
+    long long integer = std::strtoll(text.c_str(), &end, 10);
+    if (!text.empty() && *end == '\0') {
+        value.type = Type::Integer;
+        value.integer = integer;
+        value.number = static_cast<double>(integer);
+    } else {
+        value.type = Type::Float;
+        value.number = std::strtod(text.c_str(), nullptr);
+    }
+    return value;
+}
+
+// Floats compare at the six decimals the controller prints, NaN equals NaN
+bool ConfigValue::operator==(const ConfigValue& other) const {
+    if (type == Type::Integer && other.type == Type::Integer) {
+        return integer == other.integer;
+    }
+    if (std::isnan(number) || std::isnan(other.number)) {
+        return std::isnan(number) && std::isnan(other.number);
+    }
+    return std::fabs(number - other.number) <= 1e-6 * std::max(1.0, std::fabs(number));
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// MOTEUS CONFIG
+
+bool MoteusConfig::load(const std::string& path) {
+    std::ifstream input(path);
+    if (!input.is_open()) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    return parse(input);
+}
+
+// PARSE - "key value" per line
+bool MoteusConfig::parse(std::istream& input) {
+    std::string line;
+    while (std::getline(input, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        std::istringstream fields(line);
+        std::string key, text;
+        if (!(fields >> key)) {
+            continue;
+        }
+        if (!(fields >> text)) {
+            std::cerr << "Config key without value: " << key << std::endl;
+            return false;
+        }
+        set(key, ConfigValue::parse(text));
+    }
+    return true;
+}
+
+void MoteusConfig::set(const std::string& key, const ConfigValue& value) {
+    ConfigNode* node = &tree;
+    size_t start = 0;
+    while (true) {
+        size_t dot = key.find('.', start);
+        node = &node->children[key.substr(start, dot == std::string::npos ? std::string::npos : dot - start)];
+        if (dot == std::string::npos) {
+            break;
+        }
+        start = dot + 1;
+    }
+    if (!node->leaf) {
+        order.push_back(key);
+    }
+    node->leaf = true;
+    node->value = value;
+}
+
+const ConfigValue* MoteusConfig::find(const std::string& key) const {
+    const ConfigNode* node = &tree;
+    size_t start = 0;
+    while (true) {
+        size_t dot = key.find('.', start);
+        auto child = node->children.find(key.substr(start, dot == std::string::npos ? std::string::npos : dot - start));
+        if (child == node->children.end()) {
+            return nullptr;
+        }
+        node = &child->second;
+        if (dot == std::string::npos) {
+            break;
+        }
+        start = dot + 1;
+    }
+    return node->leaf ? &node->value : nullptr;
+}
+
+// DIFF
+std::vector<ConfigChange> MoteusConfig::diff(const MoteusConfig& desired, const std::vector<std::string>& skipPrefixes) const {
+    std::vector<ConfigChange> changes;
+    for (const std::string& key : desired.keys()) {
+        bool skip = false;
+        for (const std::string& prefix : skipPrefixes) {
+            if (key.rfind(prefix, 0) == 0) {
+                skip = true;
+                break;
+            }
+        }
+        if (skip) {
+            continue;
+        }
+        const ConfigValue& want = *desired.find(key);
+        const ConfigValue* have = find(key);
+        if (have == nullptr || *have != want) {
+            changes.push_back({key, have == nullptr ? std::string() : have->text, want.text});
+        }
+    }
+    return changes;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// MOTEUS CONFIG CLIENT
+
+std::string MoteusConfigClient::toHex(const std::string& bytes) {
+    std::string hex;
+    char digits[3];
+    for (unsigned char c : bytes) {
+        std::snprintf(digits, sizeof digits, "%02x", c);
+        hex += digits;
+    }
+    return hex;
+}
+
+bool MoteusConfigClient::fromHex(const std::string& hex, std::string& bytes) {
+    if (hex.size() % 2 != 0) {
+        return false;
+    }
+    bytes.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        bytes.push_back(static_cast<char>(std::strtol(hex.substr(i, 2).c_str(), nullptr, 16)));
+    }
+    return true;
+}
+
+// WRITE STREAM - packs text into as few diagnostic write frames as possible
+void MoteusConfigClient::writeStream(const std::string& text) {
+    for (size_t offset = 0; offset < text.size(); offset += kFrameData) {
+        std::string chunk = text.substr(offset, kFrameData);
+        char header[7];
+        std::snprintf(header, sizeof header, "4001%02x", static_cast<unsigned>(chunk.size()));
+        controller.sendFrame(header + toHex(chunk), false);
+        framesSent++;
+    }
+}
+
+// READ STREAM - one 0x42 poll, appends whatever the controller had buffered
+bool MoteusConfigClient::readStream(std::string& text) {
+    char request[7];
+    std::snprintf(request, sizeof request, "4201%02x", static_cast<unsigned>(kFrameData));
+    controller.sendFrame(request, true);
+    framesSent++;
+
+    std::string line;
+    while (controller.readLine(line, timeoutMs)) {
+        if (line.rfind("rcv ", 0) != 0) {
+            continue;   // "OK" acknowledgements from the fdcanusb
+        }
+        std::istringstream fields(line);
+        std::string tag, id, hex;
+        fields >> tag >> id >> hex;
+        std::string bytes;
+        if (!fromHex(hex, bytes) || bytes.size() < 3 || static_cast<unsigned char>(bytes[0]) != 0x41) {
+            return false;
+        }
+        size_t size = static_cast<unsigned char>(bytes[2]);
+        text.append(bytes, 3, std::min(size, bytes.size() - 3));
+        return true;
+    }
+    return false;
+}
+
+// NEXT LINE - polls until a whole line of the stream has arrived
+bool MoteusConfigClient::nextLine(std::string& line) {
+    int idlePolls = 0;
+    size_t end;
+    while ((end = pending.find('\n')) == std::string::npos) {
+        size_t before = pending.size();
+        if (!readStream(pending)) {
+            return false;
+        }
+        idlePolls = (pending.size() == before) ? idlePolls + 1 : 0;
+        if (idlePolls > 50) {
+            return false;
+        }
+    }
+    line = pending.substr(0, end);
+    pending.erase(0, end + 1);
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    return true;
+}
+
+// COLLECT REPLIES - polls until expected "OK"/"ERR" lines arrived, other lines go to body
+bool MoteusConfigClient::collectReplies(size_t expected, std::vector<std::string>& replies, std::string* body) {
+    std::string line;
+    while (replies.size() < expected) {
+        if (!nextLine(line)) {
+            std::cerr << "Controller stopped answering after " << replies.size() << " of " << expected << " replies" << std::endl;
+            return false;
+        }
+        if (line == "OK" || line.rfind("ERR", 0) == 0) {
+            replies.push_back(line);
+        } else if (body != nullptr) {
+            *body += line + "\n";
+        }
+    }
+    return true;
+}
+
+// ENUMERATE - reads back every key of the live config
+bool MoteusConfigClient::enumerate(MoteusConfig& live) {
+    pending.clear();
+    writeStream("conf enumerate\n");
+    std::vector<std::string> replies;
+    std::string body;
+    if (!collectReplies(1, replies, &body) || replies[0] != "OK") {
+        return false;
+    }
+    std::istringstream input(body);
+    return live.parse(input);
+}
+
+// GET - conf get for each key. A value comes back as its own line, without an "OK"; a key
+// the controller does not know comes back as its "ERR" line.
+bool MoteusConfigClient::get(const std::vector<std::string>& keys, std::vector<std::string>& values) {
+    pending.clear();
+    values.clear();
+    size_t first = 0;
+    while (first < keys.size()) {
+        std::string text;
+        size_t last = first;
+        while (last < keys.size()) {
+            std::string line = "conf get " + keys[last] + "\n";
+            if (!text.empty() && text.size() + line.size() > kWindowFrames * kFrameData) {
+                break;
+            }
+            text += line;
+            last++;
+        }
+        writeStream(text);
+
+        std::string line;
+        while (values.size() < last) {
+            if (!nextLine(line)) {
+                return false;
+            }
+            if (!line.empty()) {
+                values.push_back(line);
+            }
+        }
+        first = last;
+    }
+    return true;
+}
+
+// PUSH - conf set for each change, packed back to back into frames. Replies are drained
+// every few frames so the controller's line buffer never overflows.
+bool MoteusConfigClient::push(const std::vector<ConfigChange>& changes) {
+    pending.clear();
+    bool ok = true;
+    size_t first = 0;
+    while (first < changes.size()) {
+        std::string text;
+        size_t last = first;
+        while (last < changes.size()) {
+            std::string line = "conf set " + changes[last].key + " " + changes[last].to + "\n";
+            if (!text.empty() && text.size() + line.size() > kWindowFrames * kFrameData) {
+                break;
+            }
+            text += line;
+            last++;
+        }
+        writeStream(text);
+
+        std::vector<std::string> replies;
+        if (!collectReplies(last - first, replies, nullptr)) {
+            return false;
+        }
+        for (size_t i = 0; i < replies.size(); i++) {
+            if (replies[i] != "OK") {
+                std::cerr << "conf set " << changes[first + i].key << ": " << replies[i] << std::endl;
+                ok = false;
+            }
+        }
+        first = last;
+    }
+    return ok;
+}
+
+// PERSIST - conf write, survives a power cycle
+bool MoteusConfigClient::persist() {
+    pending.clear();
+    writeStream("conf write\n");
+    std::vector<std::string> replies;
+    return collectReplies(1, replies, nullptr) && replies[0] == "OK";
+}
+
+#endif // MOTEUS_CONFIG_H
@@ -0,0 +1,39 @@
+#ifndef MOTION_PHASE_H
+#define MOTION_PHASE_H
+
+#include <cstddef>
+
+// Phases a PositionManager motion passes through
+enum class MotionPhase {
+    Idle,
+    Acceleration,
+    Cruising,
+    Deceleration,
+    AccelerationReverse,
+    CruisingReverse,
+    DecelerationReverse,
+    Hold,
+    Homing,
+    MoveTo,
+    Count
+};
+
+constexpr size_t kMotionPhaseCount = static_cast<size_t>(MotionPhase::Count);
+
+inline const char* motionPhaseName(MotionPhase phase) {
+    switch (phase) {
+        case MotionPhase::Idle:                return "IDLE";
+        case MotionPhase::Acceleration:        return "ACCELERATION";
+        case MotionPhase::Cruising:            return "CRUISING";
+        case MotionPhase::Deceleration:        return "DECELERATION";
+        case MotionPhase::AccelerationReverse: return "ACCELERATION REVERSE";
+        case MotionPhase::CruisingReverse:     return "CRUISING REVERSE";
+        case MotionPhase::DecelerationReverse: return "DECELERATION REVERSE";
+        case MotionPhase::Hold:                return "HOLD";
+        case MotionPhase::Homing:              return "HOMING";
+        case MotionPhase::MoveTo:              return "MOVE TO";
+        default:                               return "UNKNOWN";
+    }
+}
+
+#endif // MOTION_PHASE_H
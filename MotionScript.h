@@ -0,0 +1,354 @@
+#ifndef MOTION_SCRIPT_H
+#define MOTION_SCRIPT_H
+
+#include "PositionManager.h"
+#include "MotionPhase.h"
+#include <coroutine>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <exception>
+#include <cmath>
+
+// Coroutine motion scripting. A MotionScript is a sequence of steps that co_await the
+// next control tick, a condition, or a PositionManager phase. A single threaded
+// ScriptScheduler advances every script once per fixed period, the control period: the
+// phases write their command before the period wait and read the reply after it, so the
+// scheduler's wait is the only one. The wait and the clock are the controller's, so
+// scripts run against SimulatedController or a replay as they do on the bus. Coroutine
+// frames come from a fixed pool and awaiters live inside the frames, so nothing is heap
+// allocated, neither per tick nor when a script is spawned.
+
+class ScriptScheduler;
+
+// FRAME POOL - fixed storage for coroutine frames
+class ScriptFramePool {
+public:
+    static constexpr size_t kSlots = 8;
+    static constexpr size_t kSlotSize = 4096;
+
+    static void* allocate(size_t size) noexcept {
+        if (size > kSlotSize) {
+            return nullptr;
+        }
+        for (size_t i = 0; i < kSlots; i++) {
+            if (!used[i]) {
+                used[i] = true;
+                return storage[i];
+            }
+        }
+        return nullptr;
+    }
+
+    static void release(void* frame) noexcept {
+        for (size_t i = 0; i < kSlots; i++) {
+            if (frame == storage[i]) {
+                used[i] = false;
+                return;
+            }
+        }
+    }
+
+private:
+    alignas(std::max_align_t) static inline unsigned char storage[kSlots][kSlotSize];
+    static inline bool used[kSlots] = {};
+};
+
+class MotionScript {
+public:
+    struct promise_type {
+        ScriptScheduler* scheduler = nullptr;
+        size_t slot = 0;
+
+        MotionScript get_return_object() { return MotionScript(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        static MotionScript get_return_object_on_allocation_failure() { return MotionScript(); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(size_t size) noexcept { return ScriptFramePool::allocate(size); }
+        static void operator delete(void* frame, size_t) noexcept { ScriptFramePool::release(frame); }
+    };
+    using Handle = std::coroutine_handle<promise_type>;
+
+    MotionScript() = default;
+    explicit MotionScript(Handle handle) : handle(handle) {}
+    MotionScript(MotionScript&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    MotionScript& operator=(MotionScript&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+    MotionScript(const MotionScript&) = delete;
+    MotionScript& operator=(const MotionScript&) = delete;
+    ~MotionScript() { if (handle) handle.destroy(); }
+
+    explicit operator bool() const { return static_cast<bool>(handle); }
+    Handle release() { Handle released = handle; handle = nullptr; return released; }
+
+private:
+    Handle handle;
+};
+
+// Called once per scheduler tick for a suspended script, returns true to resume it. An
+// awaiter with a bus exchange also gets a completion call after the period wait, in
+// the ticks its poll returned false; true from it resumes the script there.
+using ScriptPoll = bool (*)(void* awaiter, ScriptScheduler& scheduler);
+
+class ScriptScheduler {
+public:
+    static constexpr size_t kMaxScripts = ScriptFramePool::kSlots;
+
+    ScriptScheduler(MyController& controller, struct timespec period) : controller(controller), period(period) {}
+    ~ScriptScheduler() { destroyAll(); }
+
+    inline bool spawn(MotionScript script);
+    inline bool tick();
+    inline void run();
+    inline void requestStop() { stopRequested = true; }
+
+    inline uint64_t now() const { return tickCount; }
+    inline uint64_t ticksFor(float seconds) const;
+    inline size_t getOverruns() const { return overruns; }  // ticks whose work ran past the period
+
+    // Used by awaiters
+    inline void wait(size_t slot, void* awaiter, ScriptPoll poll, ScriptPoll complete = nullptr);
+
+private:
+    struct Slot {
+        MotionScript::Handle handle;
+        void* awaiter = nullptr;
+        ScriptPoll poll = nullptr;
+        ScriptPoll complete = nullptr;
+        bool exchanging = false;        // poll wrote a command, complete reads its reply
+        bool started = false;
+    };
+
+    inline void resume(Slot& slot);
+    inline void destroyAll();
+    inline void waitForDeadline();
+
+    std::array<Slot, kMaxScripts> slots{};
+    MyController& controller;
+    struct timespec period;
+    int64_t deadlineNs = 0;
+    uint64_t tickCount = 0;
+    size_t overruns = 0;
+    bool stopRequested = false;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// SPAWN - script starts running on the next tick
+bool ScriptScheduler::spawn(MotionScript script) {
+    if (!script) {
+        return false;  // frame pool exhausted
+    }
+    for (size_t i = 0; i < slots.size(); i++) {
+        if (!slots[i].handle) {
+            slots[i] = Slot();
+            slots[i].handle = script.release();
+            slots[i].handle.promise().scheduler = this;
+            slots[i].handle.promise().slot = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ScriptScheduler::wait(size_t slot, void* awaiter, ScriptPoll poll, ScriptPoll complete) {
+    slots[slot].awaiter = awaiter;
+    slots[slot].poll = poll;
+    slots[slot].complete = complete;
+}
+
+uint64_t ScriptScheduler::ticksFor(float seconds) const {
+    double periodSeconds = period.tv_sec + period.tv_nsec / 1e9;
+    return static_cast<uint64_t>(seconds / periodSeconds + 0.5);
+}
+
+// TICK - resume every script whose wait is satisfied and write the phases' commands, sleep
+// to the end of the period, then read the replies and resume the scripts whose phase ended
+bool ScriptScheduler::tick() {
+    if (tickCount == 0) {
+        deadlineNs = controller.nowNs();
+    }
+
+    for (Slot& slot : slots) {
+        if (!slot.handle) {
+            continue;
+        }
+        if (!slot.started || (slot.poll != nullptr && slot.poll(slot.awaiter, *this))) {
+            resume(slot);
+        } else if (slot.complete != nullptr) {
+            slot.exchanging = true;
+        }
+    }
+
+    waitForDeadline();
+
+    for (Slot& slot : slots) {
+        if (slot.handle && slot.exchanging) {
+            slot.exchanging = false;
+            if (slot.complete(slot.awaiter, *this)) {
+                resume(slot);
+            }
+        }
+    }
+
+    bool active = false;
+    for (const Slot& slot : slots) {
+        active = active || static_cast<bool>(slot.handle);
+    }
+    if (stopRequested) {
+        destroyAll();
+        stopRequested = false;
+        active = false;
+    }
+    tickCount++;
+    return active;
+}
+
+// RESUME - runs the script to its next wait, a finished one frees its slot
+void ScriptScheduler::resume(Slot& slot) {
+    slot.started = true;
+    slot.poll = nullptr;
+    slot.complete = nullptr;
+    slot.awaiter = nullptr;
+    slot.handle.resume();
+    if (slot.handle.done()) {
+        slot.handle.destroy();
+        slot = Slot();
+    }
+}
+
+// RUN - tick until every script has finished
+void ScriptScheduler::run() {
+    while (tick()) {
+    }
+}
+
+// WAIT - the rest of the period through the controller's transport, which advances
+// simulated time, lets a replay pace itself and counts as the cycle's Wait stage
+void ScriptScheduler::waitForDeadline() {
+    deadlineNs += period.tv_sec * 1000000000LL + period.tv_nsec;
+    int64_t remainingNs = deadlineNs - controller.nowNs();
+    if (remainingNs < 0) {
+        overruns++;
+        deadlineNs -= remainingNs;  // do not try to catch up
+        remainingNs = 0;
+    }
+    controller.waitCycle({static_cast<time_t>(remainingNs / 1000000000LL), static_cast<long>(remainingNs % 1000000000LL)});
+}
+
+void ScriptScheduler::destroyAll() {
+    for (Slot& slot : slots) {
+        if (slot.handle) {
+            slot.handle.destroy();
+            slot = Slot();
+        }
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// AWAITABLES
+
+// NEXT TICK
+struct NextTick {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(MotionScript::Handle handle) {
+        handle.promise().scheduler->wait(handle.promise().slot, this, &NextTick::poll);
+    }
+    void await_resume() const noexcept {}
+    static bool poll(void*, ScriptScheduler&) { return true; }
+};
+
+inline NextTick nextTick() { return {}; }
+
+// UNTIL - resumes with true when the condition holds, false on timeout (0 waits forever)
+template <typename Condition>
+struct Until {
+    Condition condition;
+    uint64_t timeoutTicks;
+    uint64_t deadline = 0;
+    bool met = false;
+
+    bool await_ready() { met = condition(); return met; }
+    void await_suspend(MotionScript::Handle handle) {
+        ScriptScheduler& scheduler = *handle.promise().scheduler;
+        deadline = scheduler.now() + timeoutTicks;
+        scheduler.wait(handle.promise().slot, this, &Until::poll);
+    }
+    bool await_resume() const noexcept { return met; }
+    static bool poll(void* awaiter, ScriptScheduler& scheduler) {
+        Until& self = *static_cast<Until*>(awaiter);
+        self.met = self.condition();
+        return self.met || (self.timeoutTicks != 0 && scheduler.now() >= self.deadline);
+    }
+};
+
+template <typename Condition>
+inline Until<Condition> until(Condition condition, uint64_t timeoutTicks = 0) {
+    return Until<Condition>{condition, timeoutTicks};
+}
+
+// Switch edge: waits for the input to read level
+inline auto switchLevel(MyGpio& input, int level, uint64_t timeoutTicks = 0) {
+    return until([&input, level] { return input.readValue() == level; }, timeoutTicks);
+}
+
+// Position reached: waits for the position to come within tolerance of target
+inline auto positionReached(const float& position, float target, float tolerance, uint64_t timeoutTicks = 0) {
+    return until([&position, target, tolerance] { return std::fabs(position - target) <= tolerance; }, timeoutTicks);
+}
+
+// PHASE - runs a PositionManager phase, one control cycle per tick, resumes with its result.
+// The poll writes the cycle's command, the completion reads its reply after the wait.
+struct RunPhase {
+    PositionManager& positionManager;
+    MotionPhase phase;
+    float& commandedPosition;
+    float& currentPosition;
+    float holdPosition = 0.0f;
+    float holdSeconds = -1.0f;  // >= 0 holds instead of running phase
+    TickResult result = TickResult::Done;
+
+    bool await_ready() {
+        if (holdSeconds >= 0.0f) {
+            result = positionManager.beginHold(holdPosition, holdSeconds);
+        } else {
+            result = positionManager.beginPhase(phase, commandedPosition, currentPosition);
+        }
+        return result != TickResult::Running;
+    }
+    void await_suspend(MotionScript::Handle handle) {
+        handle.promise().scheduler->wait(handle.promise().slot, this, &RunPhase::poll, &RunPhase::complete);
+    }
+    TickResult await_resume() const noexcept { return result; }
+    static bool poll(void* awaiter, ScriptScheduler&) {
+        RunPhase& self = *static_cast<RunPhase*>(awaiter);
+        self.result = self.positionManager.tickWrite(self.commandedPosition, self.currentPosition);
+        return self.result != TickResult::Running;
+    }
+    static bool complete(void* awaiter, ScriptScheduler&) {
+        RunPhase& self = *static_cast<RunPhase*>(awaiter);
+        self.result = self.positionManager.tickRead(self.commandedPosition, self.currentPosition);
+        return self.result != TickResult::Running;
+    }
+};
+
+inline RunPhase runPhase(PositionManager& positionManager, MotionPhase phase, float& commandedPosition, float& currentPosition) {
+    return RunPhase{positionManager, phase, commandedPosition, currentPosition};
+}
+
+inline RunPhase hold(PositionManager& positionManager, float position, float seconds, float& commandedPosition, float& currentPosition) {
+    return RunPhase{positionManager, MotionPhase::Hold, commandedPosition, currentPosition, position, seconds};
+}
+
+#endif // MOTION_SCRIPT_H
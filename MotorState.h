@@ -0,0 +1,39 @@
+#ifndef MOTOR_STATE_H
+#define MOTOR_STATE_H
+
+// States of the blade system state machine
+enum class MotorState {
+    Initial,
+    WaitingToHome,
+    Homing,
+    Homed,
+    WaitingToExtend,
+    Extending,
+    Extended,
+    Sheathing,
+    ExtendError,
+    SafetyLockout,
+    Moving,             // MoveTo in progress
+    Positioned,         // stopped away from home or extend, Home or MoveTo to continue
+    Count
+};
+
+inline const char* motorStateName(MotorState state) {
+    switch (state) {
+        case MotorState::Initial:         return "Initial";
+        case MotorState::WaitingToHome:   return "WaitingToHome";
+        case MotorState::Homing:          return "Homing";
+        case MotorState::Homed:           return "Homed";
+        case MotorState::WaitingToExtend: return "WaitingToExtend";
+        case MotorState::Extending:       return "Extending";
+        case MotorState::Extended:        return "Extended";
+        case MotorState::Sheathing:       return "Sheathing";
+        case MotorState::ExtendError:     return "ExtendError";
+        case MotorState::SafetyLockout:   return "SafetyLockout";
+        case MotorState::Moving:          return "Moving";
+        case MotorState::Positioned:      return "Positioned";
+        default:                          return "Unknown";
+    }
+}
+
+#endif // MOTOR_STATE_H
@@ -0,0 +1,387 @@
+#ifndef MULTI_AXIS_COORDINATOR_H
+#define MULTI_AXIS_COORDINATOR_H
+
+#include "MyController.h"
+#include "SafetySupervisor.h"
+#include "CoordinateFrame.h"
+#include "RuntimeConfig.h"
+#include "PositionManager.h"
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+
+// Why a coordinated move stopped early
+enum class AxisFault {
+    None,
+    BadTarget,          // target outside the position range, or not one per axis
+    NoReply,            // an axis missed too many replies in a row
+    FollowingError,     // an axis stayed too far from its setpoint
+    Torque,             // an axis went over the torque limit
+    Preempted           // safety supervisor tripped
+};
+
+// One controller on the shared bus, positions in its own logical frame
+struct Axis {
+    uint8_t canId = 1;
+    long offsetCycles = 0;              // cycles this axis runs behind the shared profile
+    CoordinateFrame frame;
+    ControllerState reply;              // last reply, absolute frame
+    bool replied = false;               // replied in the last control cycle
+    bool replyValid = false;
+    float startPosition = 0.0f;
+    float targetPosition = 0.0f;
+    float commandedPosition = 0.0f;
+    float currentPosition = 0.0f;
+    int missedReplies = 0;
+    int followingErrorCycles = 0;
+    size_t replies = 0;
+    size_t lostReplies = 0;
+};
+
+// Time synchronized moves of several axes on one fdcanusb. Every axis follows the same
+// normalized trapezoid, planned for the axis with the longest travel and scaled to each
+// axis's distance, so all of them arrive together, or keep their phase offset. Each tick
+// writes every axis's setpoint in one batch, waits one period and collects the replies by
+// source id. A trip, missing replies, a torque spike or a following error on any axis
+// brakes all of them.
+class MultiAxisCoordinator {
+public:
+    // Constructor
+    MultiAxisCoordinator(MyController& bus, float maxSpeed, size_t stepsToAccelerate, struct timespec req)
+    : bus(bus), maxSpeed(maxSpeed), stepsToAccelerate(stepsToAccelerate), req(req) {}
+
+    inline size_t addAxis(uint8_t canId, float phaseOffset = 0.0f);
+    inline Axis& axis(size_t index) { return axes[index]; }
+    inline size_t axisCount() const { return axes.size(); }
+    inline void attachSupervisor(SafetySupervisor* newSupervisor) { supervisor = newSupervisor; }
+    inline bool applyConfig(const MotionConfig& config);
+
+    // Moves, each tick() is exactly one control cycle for every axis
+    inline void rezeroAll(float position);
+    inline TickResult beginMove(const std::vector<float>& targets);
+    inline TickResult tick();
+    inline void stopAll();
+    inline bool isMoving() const { return moving; }
+    inline long getPlannedCycles() const { return plannedCycles; }
+
+    inline AxisFault getFault() const { return fault; }
+    inline int getFaultAxis() const { return faultAxis; }
+    static inline const char* faultName(AxisFault fault);
+
+private:
+    inline long offsetCycles(float seconds) const;
+    inline void exchange(const std::string& batch);
+    inline void planProfile();
+    inline double profileFraction(long index) const;
+    inline TickResult abort(AxisFault why, int axisIndex);
+
+    MyController& bus;
+    float maxSpeed;                     // per cycle, as PositionManager
+    size_t stepsToAccelerate;
+    struct timespec req;
+    float followingErrorLimit = 0.5f;
+    int followingErrorCycles = 20;
+    float torqueLimit = 0.5f;
+    int maxMissedReplies = 10;
+    SafetySupervisor* supervisor = nullptr;
+    std::vector<Axis> axes;
+
+    bool moving = false;
+    bool planned = false;               // start positions read and profile planned
+    long cycle = 0;
+    long plannedCycles = 0;             // length of the shared profile
+    long maxOffsetCycles = 0;
+    double leadDistance = 0.0;
+    double rate = 0.0;                  // per cycle change in velocity
+    double peakVelocity = 0.0;
+    double accelerationCycles = 0.0;
+    double cruiseCycles = 0.0;
+    AxisFault fault = AxisFault::None;
+    int faultAxis = -1;
+    std::string line;                   // reused for every reply
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+long MultiAxisCoordinator::offsetCycles(float seconds) const {
+    double periodSeconds = req.tv_sec + req.tv_nsec / 1e9;
+    return std::max(0L, std::lround(seconds / periodSeconds));
+}
+
+size_t MultiAxisCoordinator::addAxis(uint8_t canId, float phaseOffset) {
+    Axis axis;
+    axis.canId = canId;
+    axis.offsetCycles = offsetCycles(phaseOffset);
+    axes.push_back(axis);
+    return axes.size() - 1;
+}
+
+// APPLY CONFIG - limits and phase offsets from a config snapshot, refused while moving.
+// Speed and ramp are rescaled from the configured period to the one in use.
+bool MultiAxisCoordinator::applyConfig(const MotionConfig& config) {
+    if (moving) {
+        return false;
+    }
+    double scale = (req.tv_sec * 1e6 + req.tv_nsec / 1e3) / config.controlPeriodUs;
+    maxSpeed = static_cast<float>(config.maxSpeed * scale);
+    stepsToAccelerate = std::max<size_t>(1, std::lround(config.stepsToAccelerate / scale));
+    followingErrorLimit = config.axisFollowingError;
+    followingErrorCycles = config.axisFollowingErrorCycles;
+    torqueLimit = config.axisTorqueLimit;
+    maxMissedReplies = config.axisMissedReplies;
+    for (size_t i = 0; i < axes.size(); i++) {
+        axes[i].offsetCycles = i < config.axisPhaseOffsets.size() ? offsetCycles(config.axisPhaseOffsets[i]) : 0;
+    }
+    return true;
+}
+
+// REZERO ALL - every controller to the frame center in one batch, logical position becomes position
+void MultiAxisCoordinator::rezeroAll(float position) {
+    std::string batch;
+    for (Axis& axis : axes) {
+        std::vector<unsigned char> centerBytes = FloatConverter::convertFloat(axis.frame.getCenter());
+        batch += MyController::frameLine(axis.canId, "0db102" + std::string(centerBytes.begin(), centerBytes.end()), false);
+        axis.frame.physicalRezero();
+        axis.frame.setOrigin(position, axis.frame.getCenter());
+        axis.commandedPosition = position;
+        axis.currentPosition = position;
+    }
+    bus.sendLines(batch);
+}
+
+// BEGIN MOVE - one logical target per axis, the first tick reads where the axes are
+TickResult MultiAxisCoordinator::beginMove(const std::vector<float>& targets) {
+    fault = AxisFault::None;
+    faultAxis = -1;
+    if (targets.size() != axes.size()) {
+        return abort(AxisFault::BadTarget, -1);
+    }
+    for (size_t i = 0; i < axes.size(); i++) {
+        if (!std::isfinite(targets[i]) || targets[i] < 450.0f || targets[i] > 550.0f) {
+            return abort(AxisFault::BadTarget, static_cast<int>(i));
+        }
+        axes[i].targetPosition = targets[i];
+        axes[i].missedReplies = 0;
+        axes[i].followingErrorCycles = 0;
+    }
+    moving = true;
+    planned = false;
+    cycle = 0;
+    return TickResult::Running;
+}
+
+// STOP ALL - brake every axis in one batch
+void MultiAxisCoordinator::stopAll() {
+    std::string batch;
+    for (const Axis& axis : axes) {
+        batch += MyController::frameLine(axis.canId, "01000f", false);
+    }
+    bus.sendLines(batch);
+    moving = false;
+}
+
+TickResult MultiAxisCoordinator::abort(AxisFault why, int axisIndex) {
+    fault = why;
+    faultAxis = axisIndex;
+    std::cout << "Coordinated move stopped: " << faultName(why);
+    if (axisIndex >= 0) {
+        std::cout << " on axis " << static_cast<int>(axes[axisIndex].canId) << " at " << axes[axisIndex].currentPosition;
+    }
+    std::cout << std::endl;
+    if (why == AxisFault::BadTarget) {
+        moving = false;
+        return TickResult::Stalled;
+    }
+    stopAll();
+    if (why == AxisFault::Preempted) {
+        if (!supervisor->acknowledged()) {
+            supervisor->acknowledge();
+        }
+        return TickResult::Preempted;
+    }
+    return TickResult::Stalled;
+}
+
+const char* MultiAxisCoordinator::faultName(AxisFault fault) {
+    switch (fault) {
+        case AxisFault::None:           return "none";
+        case AxisFault::BadTarget:      return "target outside the position range";
+        case AxisFault::NoReply:        return "no reply";
+        case AxisFault::FollowingError: return "following error";
+        case AxisFault::Torque:         return "torque limit";
+        case AxisFault::Preempted:      return "safety trip";
+        default:                        return "?";
+    }
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// PLAN PROFILE - trapezoid for the longest travel, rate and speed as in PositionManager::beginMoveTo
+void MultiAxisCoordinator::planProfile() {
+    leadDistance = 0.0;
+    for (const Axis& axis : axes) {
+        leadDistance = std::max(leadDistance, static_cast<double>(std::fabs(axis.targetPosition - axis.startPosition)));
+    }
+    rate = maxSpeed / static_cast<double>(std::max<size_t>(stepsToAccelerate, 1));
+    if (leadDistance >= static_cast<double>(maxSpeed) * maxSpeed / rate) {
+        peakVelocity = maxSpeed;
+        accelerationCycles = peakVelocity / rate;
+        cruiseCycles = leadDistance / peakVelocity - accelerationCycles;
+    } else {
+        accelerationCycles = std::sqrt(leadDistance / rate);    // triangle, never reaches maxSpeed
+        peakVelocity = rate * accelerationCycles;
+        cruiseCycles = 0.0;
+    }
+    plannedCycles = static_cast<long>(std::ceil(2.0 * accelerationCycles + cruiseCycles));
+    maxOffsetCycles = 0;
+    for (const Axis& axis : axes) {
+        maxOffsetCycles = std::max(maxOffsetCycles, axis.offsetCycles);
+    }
+    std::cout << "Coordinated move of " << axes.size() << " axes over " << plannedCycles << " cycles, lead travel " << leadDistance
+              << ", peak velocity " << peakVelocity << " per cycle" << std::endl;
+}
+
+// PROFILE FRACTION - share of the travel completed after index cycles
+double MultiAxisCoordinator::profileFraction(long index) const {
+    if (leadDistance <= 0.0) {
+        return 1.0;
+    }
+    if (index <= 0) {
+        return 0.0;
+    }
+    double total = 2.0 * accelerationCycles + cruiseCycles;
+    double t = static_cast<double>(index);
+    if (t >= total) {
+        return 1.0;
+    }
+    double travelled;
+    if (t < accelerationCycles) {
+        travelled = 0.5 * rate * t * t;
+    } else if (t < accelerationCycles + cruiseCycles) {
+        travelled = 0.5 * rate * accelerationCycles * accelerationCycles + peakVelocity * (t - accelerationCycles);
+    } else {
+        double left = total - t;
+        travelled = leadDistance - 0.5 * rate * left * left;
+    }
+    return travelled / leadDistance;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// EXCHANGE - one batch out, one reply per axis back. Lines that are not replies of an axis
+// ("OK", other traffic) are skipped, a reply later than two periods is taken by the next cycle.
+void MultiAxisCoordinator::exchange(const std::string& batch) {
+    for (Axis& axis : axes) {
+        axis.replied = false;
+    }
+    bus.sendLines(batch);
+    bus.waitCycle(req);
+
+    int64_t periodNs = req.tv_sec * 1000000000LL + req.tv_nsec;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(2 * periodNs);
+    size_t pending = axes.size();
+    while (pending > 0) {
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0 || !bus.readLine(line, static_cast<int>((remaining + 999) / 1000))) {
+            break;
+        }
+        uint8_t source;
+        ControllerState state;
+        if (!MyController::parseReply(line, source, state)) {
+            continue;
+        }
+        for (Axis& axis : axes) {
+            if (axis.canId == source && !axis.replied) {
+                axis.reply = state;
+                axis.replied = true;
+                axis.replies++;
+                axis.currentPosition = axis.frame.toLogical(state.position);
+                axis.replyValid = axis.currentPosition >= 450 && axis.currentPosition <= 550;
+                pending--;
+                break;
+            }
+        }
+    }
+    for (Axis& axis : axes) {
+        if (!axis.replied) {
+            axis.lostReplies++;
+        }
+    }
+}
+
+// TICK - one control cycle of every axis
+TickResult MultiAxisCoordinator::tick() {
+    if (!moving) {
+        return TickResult::Done;
+    }
+    if (supervisor != nullptr && supervisor->tripped()) {
+        return abort(AxisFault::Preempted, -1);
+    }
+
+    // Setpoints for every axis, a query only until the start positions are known
+    std::string batch;
+    if (planned) {
+        cycle++;
+    }
+    for (Axis& axis : axes) {
+        if (planned) {
+            double fraction = profileFraction(cycle - axis.offsetCycles);
+            axis.commandedPosition = static_cast<float>(axis.startPosition + (axis.targetPosition - axis.startPosition) * fraction);
+            batch += MyController::frameLine(axis.canId, MyController::positionCommandHex(
+                axis.frame.toAbsolute(axis.commandedPosition), std::numeric_limits<float>::quiet_NaN(), true), true);
+        } else {
+            batch += MyController::frameLine(axis.canId, "1c0301", true);
+        }
+    }
+    exchange(batch);
+
+    bool allValid = true;
+    for (size_t i = 0; i < axes.size(); i++) {
+        Axis& axis = axes[i];
+        if (!axis.replied || !axis.replyValid) {
+            allValid = false;
+            if (++axis.missedReplies > maxMissedReplies) {
+                return abort(AxisFault::NoReply, static_cast<int>(i));
+            }
+            continue;
+        }
+        axis.missedReplies = 0;
+        if (std::fabs(axis.reply.torque) > torqueLimit) {
+            return abort(AxisFault::Torque, static_cast<int>(i));
+        }
+        if (planned && std::fabs(axis.commandedPosition - axis.currentPosition) > followingErrorLimit) {
+            if (++axis.followingErrorCycles > followingErrorCycles) {
+                return abort(AxisFault::FollowingError, static_cast<int>(i));
+            }
+        } else {
+            axis.followingErrorCycles = 0;
+        }
+    }
+    if (supervisor != nullptr) {
+        supervisor->noteReply(allValid);
+    }
+
+    if (!planned) {
+        if (!allValid) {
+            return TickResult::Running;     // ask again, NoReply ends it if an axis never answers
+        }
+        for (Axis& axis : axes) {
+            axis.startPosition = axis.currentPosition;
+            axis.commandedPosition = axis.currentPosition;
+        }
+        planProfile();
+        planned = true;
+        return TickResult::Running;
+    }
+    if (cycle >= plannedCycles + maxOffsetCycles) {
+        moving = false;
+        return TickResult::Done;
+    }
+    return TickResult::Running;
+}
+
+#endif // MULTI_AXIS_COORDINATOR_H
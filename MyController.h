@@ -6,17 +6,73 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <poll.h>
 #include <errno.h>
 #include <chrono>
 #include <vector>
 #include <sstream>
 #include <algorithm>
 #include "FloatConverter.h"
+#include "ControllerTransport.h"
+#include "CanFrameDecoder.h"
+#include "PerfCounters.h"
 #include <limits>
+#include <atomic>
+#include <mutex>
+
+// Decoded query reply (registers 0x001-0x003), in the controller's absolute frame, and the
+// output encoder when it was read too
+struct ControllerState {
+    float position = 0.0f;
+    float velocity = 0.0f;
+    float torque = 0.0f;
+    float output = std::numeric_limits<float>::quiet_NaN();    // encoder units
+
+    static ControllerState fromReply(const std::vector<float>& reply) {
+        return {reply[0], reply[1], reply[2]};
+    }
+};
+
+// Collects registers 0x001-0x003 of a reply frame
+struct ControllerStateVisitor {
+    ControllerState state;
+    int found = 0;
+
+    inline void onReply(uint32_t reg, const RegisterValue& value) {
+        float physical = static_cast<float>(scaledValue(reg, value));
+        switch (reg) {
+            case 0x001: state.position = physical; found |= 1; break;
+            case 0x002: state.velocity = physical; found |= 2; break;
+            case 0x003: state.torque = physical; found |= 4; break;
+            case 0x050:
+            case 0x052:
+            case 0x054: state.output = physical; found |= 8; break;
+            default: break;
+        }
+    }
+    inline void onWrite(uint32_t, const RegisterValue&) {}
+    inline void onRead(uint32_t, uint32_t, RegisterType) {}
+    inline void onError(MultiplexCommand, uint32_t, uint32_t) {}
+    inline void onStream(MultiplexCommand, uint32_t, uint32_t) {}
+    inline void onPoll(uint32_t, uint32_t) {}
+    inline void onNop() {}
+    inline void onUnknown(uint8_t) {}
+};
+
+// Device operations since the controller was set up, by outcome
+struct IoCounters {
+    uint64_t writeTimeouts = 0;
+    uint64_t writeErrors = 0;
+    uint64_t readTimeouts = 0;          // cycle replies that did not arrive in time
+    uint64_t readErrors = 0;
+    uint64_t recoveries = 0;
+    uint64_t failedRecoveries = 0;
+};
 
 class MyController {
 public:
-    MyController(const char* portName);
+    MyController(const char* portName, int writeTimeoutMs = 20);
+    MyController(ControllerTransport& transport);
     ~MyController();
     bool setupSerialPort();
     void clearBuffer();
@@ -28,122 +84,188 @@ public:
     void sendWriteOnlyCommand(float float1, float float2);
     void sendCustomCommand();
     std::vector<float> sendReadCommand();
+    void sendReadCommand(std::vector<float>& reply);   // fills reply in place, no allocation once it holds 3
     void closeSerialPort();
 
+    // CAN id of the controller every command is addressed to, 1 unless configured
+    void setCanId(uint8_t id) { canId = id; }
+    uint8_t getCanId() const { return canId; }
+
+    // OUTPUT ENCODER - encoder source 0-2 whose position every state query reads along with
+    // position, velocity and torque, -1 for none. getOutputPosition() is the last reply's,
+    // NaN when it was missing or none is read.
+    void setOutputEncoder(int source);
+    int getOutputEncoder() const { return outputRegister == 0 ? -1 : static_cast<int>(outputRegister - 0x050) / 2; }
+    float getOutputPosition() const { return outputPosition; }
+
+    // Raw frames, used by the config tool
+    void sendFrame(const std::string& hexData, bool expectReply);
+    bool readLine(std::string& line, int timeoutMs);
+
+    // Next reply from this controller, skipping acknowledgements and other traffic. A
+    // timeout of 0 only looks at what has already arrived.
+    bool readState(ControllerState& state, int timeoutMs);
+
+    // Shared bus - frames for several controllers written in one batch, replies told
+    // apart by their source id
+    static std::string frameLine(uint8_t id, const std::string& hexData, bool expectReply);
+    static std::string positionCommandHex(float position, float velocity, bool query);
+
+    // Whole position command line written into out, returns its length. Does not allocate.
+    // A query with outputRegister set reads that encoder position as well.
+    static const size_t kCommandLineSize = 64;
+    static size_t positionCommandLine(char* out, uint8_t id, float position, float velocity, bool query, bool expectReply, uint32_t outputRegister = 0);
+    static bool parseReply(const std::string& line, uint8_t& sourceId, ControllerState& state);
+    void sendLines(const std::string& lines) { writeAll(lines.c_str(), lines.length(), false); }
+
+    // DEVICE RECOVERY - the link counts as faulted once the device is gone or enough replies
+    // in a row timed out. recover() reopens and resynchronizes it within the budget, after a
+    // failed recovery the next one is due retryMs later.
+    void setRecoveryPolicy(int timeoutsBeforeRecovery, long budgetMs, long retryMs);
+    bool linkFaulted() const { return linkDown.load(std::memory_order_relaxed) || consecutiveTimeouts >= timeoutsBeforeRecovery; }
+    bool recoveryDue() const { return linkFaulted() && nowNs() >= nextRecoveryNs; }
+    bool recover(ControllerState* state = nullptr);
+
+    // Outcome of the last write and of the last read, and the counts of every outcome
+    IoStatus getLastWriteStatus() const { return lastWriteStatus.load(std::memory_order_relaxed); }
+    IoStatus getLastReadStatus() const { return lastReadStatus; }
+    IoCounters getIoCounters() const;
+    void printIoReport(std::ostream& out) const;
+
+    // Control cycle wait and time base, both come from the transport so a replay can
+    // run faster than real time
+    void waitCycle(const struct timespec& period) { transport->sleep(period); markStage(CycleStage::Wait); }
+    int64_t nowNs() const { return transport->nowNs(); }
+
+    // Per stage counters of the control cycle, nothing is counted when null
+    void attachPerfCounters(PerfCounters* counters) { perf = counters; }
+
 private:
-    int fd;
-    std::string portName;
+    SerialTransport serial;
+    ControllerTransport* transport;
+    std::string lineBuffer;
+    std::string stateLine;              // reused by readState, reserved up front
+    uint8_t canId = 1;
+    int replyTimeoutMs = 10;
+    uint32_t outputRegister = 0;        // 0x050, 0x052 or 0x054, 0 when none is read
+    float outputPosition = std::numeric_limits<float>::quiet_NaN();
+
+    // Device recovery. Writes come from the supervisor thread too, so their outcome is
+    // atomic and the lock keeps them off a transport being reopened and in the order the
+    // acknowledgements below are counted.
+    std::mutex deviceMutex;
+    std::atomic<bool> linkDown{false};
+    std::atomic<IoStatus> lastWriteStatus{IoStatus::Ok};
+    std::atomic<uint64_t> writeTimeouts{0};
+    std::atomic<uint64_t> writeErrors{0};
+    IoStatus lastReadStatus = IoStatus::Ok;
+    uint64_t readTimeouts = 0;
+    uint64_t readErrors = 0;
+    uint64_t recoveries = 0;
+    uint64_t failedRecoveries = 0;
+    int consecutiveTimeouts = 0;
+    int timeoutsBeforeRecovery = 5;
+    long recoveryBudgetMs = 250;
+    long recoveryRetryMs = 1000;
+    int64_t nextRecoveryNs = 0;
 
+    // Frames sent without a reply still get an "OK" from the fdcanusb. Once one is sent
+    // the next reply is no longer at a fixed offset, so it is read line by line. The
+    // supervisor thread brakes at any point of a cycle, so acknowledgements are counted as
+    // they are written and a reply skips only those written before its request: a brake
+    // that goes out between a request and its reply is still skipped after it.
+    std::atomic<uint64_t> acksWritten{0};
+    uint64_t acksBeforeRequest = 0;     // control thread only, from here down
+    uint64_t acksSkipped = 0;
+    bool readByLine = false;            // a late or cut reply left the stream out of step
+    PerfCounters* perf = nullptr;
+
+    void markStage(CycleStage stage) {
+        if (perf != nullptr) {
+            perf->mark(stage);
+        }
+    }
+
+    bool acksPending() const { return readByLine || acksWritten.load(std::memory_order_acquire) != acksSkipped; }
+    IoStatus writeAll(const char* data, size_t length, bool acknowledged);
+    void noteReadFailure(IoStatus status);
+    void drainInput();
 };
 
 // Constructor
-MyController::MyController(const char* portName) : portName(portName), fd(-1) {}
+MyController::MyController(const char* portName, int writeTimeoutMs) : serial(portName, writeTimeoutMs), transport(&serial) {
+    lineBuffer.reserve(1024);
+    stateLine.reserve(256);
+}
+
+MyController::MyController(ControllerTransport& transport) : serial(""), transport(&transport) {
+    lineBuffer.reserve(1024);
+    stateLine.reserve(256);
+}
 
 // Destructor
 MyController::~MyController() {
-    if (fd != -1) {
-        closeSerialPort();
-    }
+    closeSerialPort();
 }
 
 // SERIAL PORT SETUP
 bool MyController::setupSerialPort() {
-    fd = open(portName.c_str(), O_RDWR | O_NOCTTY | O_SYNC);
-    if (fd < 0) {
-        std::cerr << "Error opening " << portName << ": " << strerror(errno) << std::endl;
-        return false;
-    }
-
-    struct termios tty;
-    memset(&tty, 0, sizeof tty);
-    if (tcgetattr(fd, &tty) != 0) {
-        std::cerr << "Error from tcgetattr: " << strerror(errno) << std::endl;
-        close(fd);
-        return false;
-    }
-
-    cfsetospeed(&tty, B115200);
-    cfsetispeed(&tty, B115200);
-
-    tty.c_cflag |= (CLOCAL | CREAD);
-    tty.c_cflag &= ~CSIZE;
-    tty.c_cflag |= CS8;
-    tty.c_cflag &= ~PARENB;
-    tty.c_cflag &= ~CSTOPB;
-    tty.c_cflag &= ~CRTSCTS;
-
-    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
-        std::cerr << "Error from tcsetattr: " << strerror(errno) << std::endl;
-        close(fd);
-        return false;
-    }
-
-    return true;
+    return transport->open();
 }
 
 // CLEAR BUFFER
 void MyController::clearBuffer() {    
     char buf[256];
-    read(fd, buf, sizeof buf);
+    transport->readBytes(buf, sizeof buf);
 }
 
 // STOP COMMAND
 void MyController::sendStopCommand() {
-    std::string message = "can send 0001 010000\n";
-    write(fd, message.c_str(), message.length());
+    std::string message = frameLine(canId, "010000", false);
+    writeAll(message.c_str(), message.length(), true);
 }
 
 // BRAKE COMMAND
 void MyController::sendBrakeCommand() {
-    std::string message = "can send 0001 01000f\n";
-    write(fd, message.c_str(), message.length());
+    std::string message = frameLine(canId, "01000f", false);
+    writeAll(message.c_str(), message.length(), true);
 }
 
 // WRITE COMMAND
 void MyController::sendWriteCommand(float float1, float float2) {
-    std::string commandPrefix = "can send 8001 01000a0c0220";
-    std::string commandSuffix = "1c0301\n";   //Read 3 registers starting at 0x01
-    std::vector<unsigned char> float1Bytes = FloatConverter::convertFloat(float1);
-    std::vector<unsigned char> float2Bytes = FloatConverter::convertFloat(float2);
-    std::string float1Hex(float1Bytes.begin(), float1Bytes.end());
-    std::string float2Hex(float2Bytes.begin(), float2Bytes.end());
-    std::string commandData = float1Hex + float2Hex;
-    std::string command = commandPrefix + commandData + commandSuffix;
-    write(fd, command.c_str(), command.length());
+    char command[kCommandLineSize];
+    size_t length = positionCommandLine(command, canId, float1, float2, true, true, outputRegister);
+    markStage(CycleStage::Encode);
+    writeAll(command, length, false);
+    markStage(CycleStage::Write);
 }
 
 
-// WRITE ONLY COMMAND
+// WRITE ONLY COMMAND - same setpoint as sendWriteCommand, no reply requested or read.
+// Its acknowledgement is skipped by the next read.
 void MyController::sendWriteOnlyCommand(float float1, float float2) {
-    std::string commandPrefix = "can send 01 01000a0c0220";
-    std::string commandSuffix = "\n";   
-    std::vector<unsigned char> float1Bytes = FloatConverter::convertFloat(float1);
-    std::vector<unsigned char> float2Bytes = FloatConverter::convertFloat(float2);
-    std::string float1Hex(float1Bytes.begin(), float1Bytes.end());
-    std::string float2Hex(float2Bytes.begin(), float2Bytes.end());
-    std::string commandData = float1Hex + float2Hex;
-    std::string command = commandPrefix + commandData + commandSuffix;
-    //std::cout << "Command: " << command << std::endl;
-    write(fd, command.c_str(), command.length());
-    usleep(5);
-    //clear buffer
-    char buf[256];
-    read(fd, buf, sizeof buf);
+    char command[kCommandLineSize];
+    size_t length = positionCommandLine(command, canId, float1, float2, false, false);
+    markStage(CycleStage::Encode);
+    writeAll(command, length, true);
+    markStage(CycleStage::Write);
 }
 
 // CUSTOM COMMAND
 void MyController::sendCustomCommand() {
-    std::string commandPrefix = "can send 0001 ";
+    std::string commandPrefix = frameLine(canId, "", false);
+    commandPrefix.pop_back();
     std::string commandSuffix = "\n";
     std::string commandData = "0db10200004040";
     std::string command = commandPrefix + commandData + commandSuffix;
     std::cout << "Command: " << command << std::endl;
-    write(fd, command.c_str(), command.length());
+    writeAll(command.c_str(), command.length(), true);
 }
 
 // REZERO 
 void MyController::sendRezeroCommand(float float1) {
-    std::string commandPrefix = "can send 0001 0db102";
+    std::string commandPrefix = frameLine(canId, "0db102", false);
+    commandPrefix.pop_back();
     std::string commandSuffix = "\n";
 
     std::vector<unsigned char> float1Bytes = FloatConverter::convertFloat(float1);
@@ -152,59 +274,338 @@ void MyController::sendRezeroCommand(float float1) {
     //std::string commandData = "0db102 00 00 40 40";
     std::string command = commandPrefix + commandData + commandSuffix;
     //std::cout << "Command: " << command << std::endl;
-    write(fd, command.c_str(), command.length());
+    writeAll(command.c_str(), command.length(), true);
 }
 
 // SEND QUERY COMMAND
 void MyController::sendQueryCommand() {
-    std::string commandPrefix = "can send 8001 ";
-    std::string commandSuffix = "1c0301\n";   //Read 3 register starting at 0x01
-    std::string command = commandPrefix  + commandSuffix;
-    write(fd, command.c_str(), command.length());
-}
-
-// HEX STRING TO FLOAT
-float hexStringToFloat(const std::vector<std::string>& hexParts) {
-    unsigned int x = 0;
-    std::stringstream ss;
-    for (const auto& part : hexParts) { ss << part; }
-    ss >> std::hex >> x; 
-    float f;
-    std::memcpy(&f, &x, sizeof(x)); // Reinterpret the bits of x as a float
-    return f;
+    char command[kCommandLineSize];
+    int length = std::snprintf(command, sizeof command, "can send %02x%02x 1c0301", 0x80, canId);   //Read 3 register starting at 0x01
+    if (outputRegister != 0) {
+        length += std::snprintf(command + length, sizeof command - length, "1d%02x", static_cast<uint8_t>(outputRegister));    //Read 1 register, the output encoder
+    }
+    command[length++] = '\n';
+    writeAll(command, length, false);
 }
 
 // Send read command and return vector of floats
 std::vector<float> MyController::sendReadCommand() {
+    std::vector<float> floats(3);
+    sendReadCommand(floats);
+    return floats;
+}
+
+// READ COMMAND - position, velocity, torque into reply. NaN when the reply is missing or
+// garbled, which fails the range check.
+void MyController::sendReadCommand(std::vector<float>& reply) {
+    float nan = std::numeric_limits<float>::quiet_NaN();
+    reply.resize(3);
+    if (acksPending()) {
+        ControllerState state;
+        bool replied = readState(state, replyTimeoutMs);   // parses as it reads, counted as read
+        markStage(CycleStage::Read);
+        reply[0] = replied ? state.position : nan;
+        reply[1] = replied ? state.velocity : nan;
+        reply[2] = replied ? state.torque : nan;
+        outputPosition = replied ? state.output : nan;
+        return;
+    }
+
+    // Reads never block, so the reply is gathered up to the end of its line or the deadline.
+    // It is usually in by now and the first read takes all of it.
+    char buf[256];
+    size_t received = 0;
+    size_t replyLength = outputRegister != 0 ? 54 : 42;
+    IoStatus status = IoStatus::Timeout;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(replyTimeoutMs);
+    while (received < sizeof buf) {
+        ssize_t n = transport->readBytes(buf + received, sizeof buf - received);
+        if (n > 0) {
+            received += n;
+            if (received >= replyLength && buf[received - 1] == '\n') {
+                status = IoStatus::Ok;
+                break;
+            }
+            continue;
+        }
+        if (n < 0 && ioStatusFromErrno(errno) == IoStatus::Disconnected) {
+            status = IoStatus::Disconnected;
+            break;
+        }
+        int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+        if (remaining <= 0 || !transport->waitReadable(remaining)) {
+            break;
+        }
+    }
+    markStage(CycleStage::Read);
+
+    // Three floats at fixed offsets of "OK\r\nrcv 100 2c0301...", bytes in wire order, then the
+    // output encoder's "2d<register>..." when it is read. Whatever part of a late reply
+    // arrives next is no longer at those offsets, so it is read by line.
+    bool complete = status == IoStatus::Ok;
+    if (complete) {
+        lastReadStatus = IoStatus::Ok;
+        consecutiveTimeouts = 0;
+    } else {
+        noteReadFailure(status);
+        readByLine = true;
+    }
+    reply[0] = complete ? FloatConverter::readHex(buf + 18) : nan;
+    reply[1] = complete ? FloatConverter::readHex(buf + 26) : nan;
+    reply[2] = complete ? FloatConverter::readHex(buf + 34) : nan;
+    outputPosition = complete && outputRegister != 0 && buf[42] == '2' && buf[43] == 'd' ? FloatConverter::readHex(buf + 46) : nan;
+    markStage(CycleStage::Parse);
+}
+
+// SEND FRAME - hexData is the frame payload, replies are requested with the 0x8000 source bit
+void MyController::sendFrame(const std::string& hexData, bool expectReply) {
+    std::string command = frameLine(canId, hexData, expectReply);
+    writeAll(command.c_str(), command.length(), !expectReply);
+}
+
+// FRAME LINE - "can send 8001 <hex>", the 0x8000 source bit asks for a reply
+std::string MyController::frameLine(uint8_t id, const std::string& hexData, bool expectReply) {
+    char prefix[24];
+    std::snprintf(prefix, sizeof prefix, "can send %02x%02x ", expectReply ? 0x80 : 0x00, id);
+    return prefix + hexData + "\n";
+}
+
+// POSITION COMMAND - mode 10, position and velocity, optionally reading back 0x001-0x003
+std::string MyController::positionCommandHex(float position, float velocity, bool query) {
+    char line[kCommandLineSize];
+    size_t length = positionCommandLine(line, 0, position, velocity, query, false);
+    return std::string(line + 14, length - 15);     // between "can send 0000 " and the newline
+}
+
+// POSITION COMMAND LINE - "can send 8001 01000a0c0220<position><velocity>[1c0301[1d<output>]]\n"
+size_t MyController::positionCommandLine(char* out, uint8_t id, float position, float velocity, bool query, bool expectReply, uint32_t outputRegister) {
+    int length = std::snprintf(out, kCommandLineSize, "can send %02x%02x 01000a0c0220", expectReply ? 0x80 : 0x00, id);
+    FloatConverter::writeHex(position, out + length);
+    FloatConverter::writeHex(velocity, out + length + 8);
+    length += 16;
+    if (query) {
+        std::memcpy(out + length, "1c0301", 6);    //Read 3 registers starting at 0x01
+        length += 6;
+        if (outputRegister != 0) {
+            length += std::snprintf(out + length, kCommandLineSize - length, "1d%02x", static_cast<uint8_t>(outputRegister));   //Read 1 register, the output encoder
+        }
+    }
+    out[length++] = '\n';
+    return length;
+}
+
+// PARSE REPLY - false unless the line is a reply carrying position, velocity and torque
+bool MyController::parseReply(const std::string& line, uint8_t& sourceId, ControllerState& state) {
+    CanLine fields;
+    if (!parseCanLine(line.data(), line.data() + line.size(), fields) || !fields.reply) {
+        return false;
+    }
+    ControllerStateVisitor visitor;
+    if (!decodeMultiplex(HexCursor(fields.hexBegin, fields.hexEnd), visitor) || (visitor.found & 7) != 7) {
+        return false;
+    }
+    sourceId = fields.sourceId();
+    state = visitor.state;
+    return true;
+}
+
+// READ LINE - one line from the fdcanusb, false on timeout or a device error, told apart by
+// getLastReadStatus()
+bool MyController::readLine(std::string& line, int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+        size_t end = lineBuffer.find('\n');
+        if (end != std::string::npos) {
+            line.assign(lineBuffer, 0, end);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            lineBuffer.erase(0, end + 1);
+            lastReadStatus = IoStatus::Ok;
+            return true;
+        }
+        int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+        if (!transport->waitReadable(std::max(remaining, 0))) {
+            lastReadStatus = IoStatus::Timeout;
+            return false;
+        }
+        char buf[256];
+        ssize_t n = transport->readBytes(buf, sizeof buf);
+        if (n < 0 && ioStatusFromErrno(errno) == IoStatus::Disconnected) {
+            lastReadStatus = IoStatus::Disconnected;
+            return false;
+        }
+        if (n > 0) {
+            lineBuffer.append(buf, n);
+        } else if (remaining <= 0) {
+            lastReadStatus = IoStatus::Timeout;
+            return false;
+        }
+    }
+}
+
+// READ STATE - every earlier acknowledgement comes before the reply, so none are left after
+// it. One deadline covers the whole read however many other lines come first.
+bool MyController::readState(ControllerState& state, int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    int remaining = timeoutMs;
+    while (readLine(stateLine, remaining)) {
+        uint8_t source;
+        if (parseReply(stateLine, source, state) && source == canId) {
+            acksSkipped = acksBeforeRequest;
+            readByLine = false;
+            consecutiveTimeouts = 0;
+            return true;
+        }
+        remaining = std::max(0, static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count()));
+    }
+    noteReadFailure(lastReadStatus);
+    return false;
+}
+
+// WRITE ALL - one whole line or a failed write. A line cut short leaves the fdcanusb out of
+// step with the host, so any failure takes the link down until it is recovered. An
+// acknowledged frame is counted, anything else is taken for a request and notes how many
+// acknowledgements come before its reply.
+IoStatus MyController::writeAll(const char* data, size_t length, bool acknowledged) {
+    ssize_t written;
+    int error;
+    {
+        std::lock_guard<std::mutex> lock(deviceMutex);
+        if (acknowledged) {
+            acksWritten.fetch_add(1, std::memory_order_release);
+        } else {
+            acksBeforeRequest = acksWritten.load(std::memory_order_relaxed);
+        }
+        written = transport->writeBytes(data, length);
+        error = errno;
+    }
+    IoStatus status = IoStatus::Ok;
+    if (written < 0) {
+        status = ioStatusFromErrno(error);
+    } else if (static_cast<size_t>(written) != length) {
+        status = IoStatus::Timeout;
+    }
+    if (status == IoStatus::Timeout) {
+        writeTimeouts.fetch_add(1, std::memory_order_relaxed);
+    } else if (status == IoStatus::Disconnected) {
+        writeErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (status != IoStatus::Ok) {
+        linkDown.store(true, std::memory_order_relaxed);
+    }
+    lastWriteStatus.store(status, std::memory_order_relaxed);
+    return status;
+}
+
+// NOTE READ FAILURE - a missing reply counts towards recovery, a device error takes the
+// link down at once
+void MyController::noteReadFailure(IoStatus status) {
+    lastReadStatus = status;
+    if (status == IoStatus::Disconnected) {
+        readErrors++;
+        linkDown.store(true, std::memory_order_relaxed);
+    } else if (status == IoStatus::Timeout) {
+        readTimeouts++;
+        consecutiveTimeouts++;
+    }
+}
+
+// DRAIN INPUT - bytes buffered from before a reopen, bounded for a device that keeps sending
+void MyController::drainInput() {
     char buf[256];
-    read(fd, buf, sizeof buf);
+    for (int i = 0; i < 64 && transport->waitReadable(0) && transport->readBytes(buf, sizeof buf) > 0; i++) {
+    }
+}
 
-    std::vector<float> floats;
+// OUTPUT ENCODER - source n reports its position in register 0x050 + 2n
+void MyController::setOutputEncoder(int source) {
+    outputRegister = source >= 0 && source <= 2 ? 0x050 + 2 * source : 0;
+    outputPosition = std::numeric_limits<float>::quiet_NaN();
+}
+
+// RECOVERY POLICY
+void MyController::setRecoveryPolicy(int newTimeoutsBeforeRecovery, long budgetMs, long retryMs) {
+    timeoutsBeforeRecovery = std::max(1, newTimeoutsBeforeRecovery);
+    recoveryBudgetMs = std::max(0L, budgetMs);
+    recoveryRetryMs = std::max(0L, retryMs);
+}
 
-    // Helper lambda to convert hex in buffer to float
-    auto convertToFloat = [&](int start) -> float {
-        std::vector<std::string> parts;
-        for (int j = 0; j < 4; ++j) {
-            parts.emplace_back(buf + start + j * 2, 2);
+// RECOVER - reopens the device, which applies termios afresh and drops what either side
+// buffered, then sends a stop and reads the controller's state back. The stop is what
+// clears a moteus that timed out waiting for commands meanwhile. Attempts back off from
+// 10 ms to 200 ms, and the whole recovery ends within the budget plus the write timeout of
+// its two frames. state gets the reply that resynchronized the link.
+bool MyController::recover(ControllerState* state) {
+    int64_t startNs = nowNs();
+    int64_t deadlineNs = startNs + recoveryBudgetMs * 1000000LL;
+    long backoffMs = 10;
+    int attempts = 0;
+    bool recovered = false;
+    ControllerState resync;
+    while (!recovered && nowNs() < deadlineNs) {
+        if (attempts++ > 0) {
+            long pauseMs = std::min<long>(backoffMs, (deadlineNs - nowNs()) / 1000000);
+            transport->sleep({pauseMs / 1000, (pauseMs % 1000) * 1000000});
+            backoffMs = std::min(backoffMs * 2, 200L);
+        }
+        bool reopened;
+        {
+            std::lock_guard<std::mutex> lock(deviceMutex);
+            reopened = transport->reopen();
         }
-        std::reverse(parts.begin(), parts.end());
-        return hexStringToFloat(parts);
-    };
+        if (!reopened) {
+            continue;
+        }
+        lineBuffer.clear();
+        drainInput();
+        linkDown.store(false, std::memory_order_relaxed);
+        sendStopCommand();
+        sendFrame("1c0301", true);  //Read 3 registers starting at 0x01
+        int remaining = static_cast<int>(std::max<int64_t>(0, (deadlineNs - nowNs()) / 1000000));
+        recovered = !linkDown.load(std::memory_order_relaxed) && readState(resync, remaining);
+    }
 
-    // Read three floats from specified buffer positions
-    floats.push_back(convertToFloat(18)); // First float
-    floats.push_back(convertToFloat(26)); // Second float
-    floats.push_back(convertToFloat(34)); // Third float
+    long elapsedMs = static_cast<long>((nowNs() - startNs) / 1000000);
+    if (!recovered) {
+        linkDown.store(true, std::memory_order_relaxed);
+        failedRecoveries++;
+        nextRecoveryNs = nowNs() + recoveryRetryMs * 1000000LL;
+        std::cerr << "Controller link not recovered, " << attempts << " attempts in " << elapsedMs << " ms" << std::endl;
+        return false;
+    }
+    consecutiveTimeouts = 0;
+    recoveries++;
+    nextRecoveryNs = 0;
+    std::cout << "Controller link recovered, " << attempts << " attempts in " << elapsedMs << " ms" << std::endl;
+    if (state != nullptr) {
+        *state = resync;
+    }
+    return true;
+}
 
-    return floats;
+// IO COUNTERS - a snapshot, the write counts may move while it is taken
+IoCounters MyController::getIoCounters() const {
+    IoCounters counters;
+    counters.writeTimeouts = writeTimeouts.load(std::memory_order_relaxed);
+    counters.writeErrors = writeErrors.load(std::memory_order_relaxed);
+    counters.readTimeouts = readTimeouts;
+    counters.readErrors = readErrors;
+    counters.recoveries = recoveries;
+    counters.failedRecoveries = failedRecoveries;
+    return counters;
+}
+
+void MyController::printIoReport(std::ostream& out) const {
+    IoCounters counters = getIoCounters();
+    out << "Controller I/O: " << counters.writeTimeouts << " write timeouts, " << counters.writeErrors << " write errors, "
+        << counters.readTimeouts << " reply timeouts, " << counters.readErrors << " read errors, " << counters.recoveries
+        << " recoveries, " << counters.failedRecoveries << " failed" << std::endl;
 }
 
 // Close the serial port
 void MyController::closeSerialPort() {
-    if (fd != -1) {
-        close(fd);
-        fd = -1;
-    }
+    transport->close();
 }
 
 #endif // MY_CONTROLLER_H
@@ -5,6 +5,14 @@
 #include <string>
 #include <iostream>
 
+// Optional tap on every read, used to capture inputs and to replay them without hardware
+class GpioTap {
+public:
+    virtual ~GpioTap() = default;
+    virtual bool simulated() const = 0;                     // no hardware behind the line
+    virtual int onRead(unsigned int gpio, int value) = 0;   // returns the value the caller sees
+};
+
 class MyGpio {
 public:
     MyGpio(const std::string& chipname, unsigned int gpio)
@@ -19,7 +27,12 @@ public:
         }
     }
 
+    void setTap(GpioTap* newTap) { tap = newTap; }
+
     bool init() {
+        if (tap != nullptr && tap->simulated()) {
+            return true;
+        }
         chip = gpiod_chip_open_by_name(chipname.c_str());
         if (!chip) {
             std::cerr << "Error opening GPIO chip: " << chipname << std::endl;
@@ -47,8 +60,10 @@ public:
     }
 
     int readValue() {
+        if (tap != nullptr && tap->simulated()) return tap->onRead(gpio, -1);
         if (!line) return -1; // Ensure line is valid
-        return gpiod_line_get_value(line);
+        int value = gpiod_line_get_value(line);
+        return tap != nullptr ? tap->onRead(gpio, value) : value;
     }
 
 private:
@@ -56,6 +71,7 @@ private:
     unsigned int gpio;
     gpiod_line* line;
     gpiod_chip* chip;
+    GpioTap* tap = nullptr;
 };
 
 #endif // MYGPIO_H
@@ -0,0 +1,294 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "MotionPhase.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Counters read around every stage of a control cycle
+enum class PerfCounter {
+    Cycles,
+    Instructions,
+    CacheMisses,
+    ContextSwitches,
+    PageFaults,
+    Count
+};
+
+constexpr size_t kPerfCounterCount = static_cast<size_t>(PerfCounter::Count);
+
+// Stages of one control cycle, in the order they run
+enum class CycleStage {
+    Encode,     // command frame built
+    Write,      // frame handed to the transport
+    Wait,       // control period sleep
+    Read,       // reply read from the transport
+    Parse,      // reply decoded
+    Control,    // range check, estimator, torque capture, stall detection
+    Log,        // cycle log line
+    Other,      // rest of the tick, switches and phase changes
+    Count
+};
+
+constexpr size_t kCycleStageCount = static_cast<size_t>(CycleStage::Count);
+
+inline const char* cycleStageName(CycleStage stage) {
+    switch (stage) {
+        case CycleStage::Encode:  return "encode";
+        case CycleStage::Write:   return "write";
+        case CycleStage::Wait:    return "wait";
+        case CycleStage::Read:    return "read";
+        case CycleStage::Parse:   return "parse";
+        case CycleStage::Control: return "control";
+        case CycleStage::Log:     return "log";
+        case CycleStage::Other:   return "other";
+        default:                  return "unknown";
+    }
+}
+
+// Totals for one stage of one motion phase
+struct StageStats {
+    uint64_t samples = 0;
+    uint64_t wallNs = 0;
+    uint64_t maxWallNs = 0;
+    uint64_t counters[kPerfCounterCount] = {};
+};
+
+// Hardware and software counters of the control thread, read as one perf_event group at
+// every stage boundary and attributed to the stage just finished and the motion phase
+// of the cycle. Counters the kernel refuses (no PMU in a VM, perf_event_paranoid) are
+// left out; with none at all only wall time is kept. Counts the thread that calls open().
+class PerfCounters {
+public:
+    PerfCounters() = default;
+    ~PerfCounters() { close(); }
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    inline bool open();
+    inline void close();
+    inline bool isAvailable(PerfCounter counter) const { return slot[static_cast<size_t>(counter)] >= 0; }
+    inline bool anyAvailable() const { return groupSize > 0; }
+
+    // One control cycle, stages are marked as they finish
+    inline void beginCycle(MotionPhase phase);
+    inline void mark(CycleStage stage);
+    inline void endCycle();
+
+    inline const StageStats& stats(MotionPhase phase, CycleStage stage) const { return table[static_cast<size_t>(phase)][static_cast<size_t>(stage)]; }
+    inline uint64_t cycles(MotionPhase phase) const { return cycleCount[static_cast<size_t>(phase)]; }
+    inline void reset();
+    inline void printReport(std::ostream& out) const;
+
+private:
+    struct Sample {
+        uint64_t wallNs = 0;
+        uint64_t values[kPerfCounterCount] = {};
+    };
+
+    inline bool openCounter(PerfCounter counter, uint32_t type, uint64_t config);
+    inline void read(Sample& sample) const;
+
+    int fds[kPerfCounterCount] = {-1, -1, -1, -1, -1};
+    int slot[kPerfCounterCount] = {-1, -1, -1, -1, -1};   // position in the group read, -1 when unavailable
+    int leader = -1;
+    int groupSize = 0;
+    bool inCycle = false;
+    MotionPhase phase = MotionPhase::Idle;
+    Sample last;
+    StageStats table[kMotionPhaseCount][kCycleStageCount];
+    uint64_t cycleCount[kMotionPhaseCount] = {};
+};
+
+// Brackets one control cycle, a null PerfCounters does nothing
+class PerfCycleScope {
+public:
+    PerfCycleScope(PerfCounters* counters, MotionPhase phase) : counters(counters) {
+        if (counters != nullptr) {
+            counters->beginCycle(phase);
+        }
+    }
+    ~PerfCycleScope() {
+        if (counters != nullptr) {
+            counters->endCycle();
+        }
+    }
+    PerfCycleScope(const PerfCycleScope&) = delete;
+    PerfCycleScope& operator=(const PerfCycleScope&) = delete;
+
+private:
+    PerfCounters* counters;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// OPEN - one group, the first counter that opens leads it. Fails only when none open.
+bool PerfCounters::open() {
+    close();
+    openCounter(PerfCounter::Cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    openCounter(PerfCounter::Instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    openCounter(PerfCounter::CacheMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    openCounter(PerfCounter::ContextSwitches, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+    openCounter(PerfCounter::PageFaults, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+    if (leader < 0) {
+        return false;
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+// OPEN COUNTER - kernel side counted when allowed, user side only otherwise
+bool PerfCounters::openCounter(PerfCounter counter, uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (leader < 0) ? 1 : 0;   // the group starts together once complete
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+    }
+    if (fd < 0) {
+        return false;
+    }
+    size_t index = static_cast<size_t>(counter);
+    fds[index] = fd;
+    slot[index] = groupSize++;
+    if (leader < 0) {
+        leader = fd;
+    }
+    return true;
+}
+
+void PerfCounters::close() {
+    for (size_t i = 0; i < kPerfCounterCount; i++) {
+        if (fds[i] >= 0) {
+            ::close(fds[i]);
+        }
+        fds[i] = -1;
+        slot[i] = -1;
+    }
+    leader = -1;
+    groupSize = 0;
+    inCycle = false;
+}
+
+// READ - wall clock and the whole group in one read()
+void PerfCounters::read(Sample& sample) const {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample.wallNs = static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+    if (leader < 0) {
+        return;
+    }
+    uint64_t buffer[1 + kPerfCounterCount];
+    if (::read(leader, buffer, sizeof buffer) < static_cast<ssize_t>(sizeof(uint64_t) * (1 + groupSize))) {
+        return;     // keeps the previous values, the stage counts as zero
+    }
+    for (size_t i = 0; i < kPerfCounterCount; i++) {
+        if (slot[i] >= 0) {
+            sample.values[i] = buffer[1 + slot[i]];
+        }
+    }
+}
+
+void PerfCounters::beginCycle(MotionPhase newPhase) {
+    phase = newPhase;
+    read(last);
+    inCycle = true;
+    cycleCount[static_cast<size_t>(phase)]++;
+}
+
+// MARK - everything since the previous mark belongs to this stage. Ignored outside a
+// cycle, so controller calls made between cycles are not counted.
+void PerfCounters::mark(CycleStage stage) {
+    if (!inCycle) {
+        return;
+    }
+    Sample now = last;
+    read(now);
+    StageStats& stats = table[static_cast<size_t>(phase)][static_cast<size_t>(stage)];
+    uint64_t wall = now.wallNs - last.wallNs;
+    stats.samples++;
+    stats.wallNs += wall;
+    stats.maxWallNs = std::max(stats.maxWallNs, wall);
+    for (size_t i = 0; i < kPerfCounterCount; i++) {
+        stats.counters[i] += now.values[i] - last.values[i];
+    }
+    last = now;
+}
+
+void PerfCounters::endCycle() {
+    mark(CycleStage::Other);
+    inCycle = false;
+}
+
+void PerfCounters::reset() {
+    for (size_t p = 0; p < kMotionPhaseCount; p++) {
+        cycleCount[p] = 0;
+        for (size_t s = 0; s < kCycleStageCount; s++) {
+            table[p][s] = StageStats();
+        }
+    }
+    if (leader >= 0) {
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    }
+    inCycle = false;
+}
+
+// PRINT REPORT - per phase, per stage means; counters that did not open print as "-"
+void PerfCounters::printReport(std::ostream& out) const {
+    static const char* counterNames[kPerfCounterCount] = {"cycles", "instr", "cache-miss", "ctx-sw", "faults"};
+    out << "Perf counters:";
+    for (size_t i = 0; i < kPerfCounterCount; i++) {
+        out << " " << counterNames[i] << (slot[i] >= 0 ? "" : " (unavailable)");
+    }
+    out << std::endl;
+
+    for (size_t p = 0; p < kMotionPhaseCount; p++) {
+        if (cycleCount[p] == 0) {
+            continue;
+        }
+        out << motionPhaseName(static_cast<MotionPhase>(p)) << ": " << cycleCount[p] << " cycles" << std::endl;
+        out << "  stage      mean us    max us";
+        for (size_t i = 0; i < kPerfCounterCount; i++) {
+            out << std::setw(12) << counterNames[i];
+        }
+        out << std::endl;
+        for (size_t s = 0; s < kCycleStageCount; s++) {
+            const StageStats& stats = table[p][s];
+            if (stats.samples == 0) {
+                continue;
+            }
+            out << "  " << std::left << std::setw(8) << cycleStageName(static_cast<CycleStage>(s)) << std::right << std::fixed << std::setprecision(1)
+                << std::setw(10) << stats.wallNs / 1000.0 / stats.samples << std::setw(10) << stats.maxWallNs / 1000.0;
+            for (size_t i = 0; i < kPerfCounterCount; i++) {
+                if (slot[i] < 0) {
+                    out << std::setw(12) << "-";
+                } else {
+                    out << std::setw(12) << static_cast<double>(stats.counters[i]) / stats.samples;    // mean per cycle
+                }
+            }
+            out << std::endl;
+        }
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6);
+    }
+}
+
+#endif // PERF_COUNTERS_H
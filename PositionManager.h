@@ -2,20 +2,68 @@
 #define POSITION_MANAGER_H
 
 #include "MyController.h"
+#include "SafetySupervisor.h"
+#include "StallDetector.h"
+#include "StateEstimator.h"
+#include "LoadTracker.h"
+#include "SpeedInput.h"
+#include "CoordinateFrame.h"
+#include "RuntimeConfig.h"
+#include "PerfCounters.h"
+#include "AllocationGuard.h"
 #include <iostream>
 #include <vector>
 #include <cmath>
 #include <limits>
+#include <algorithm>
 #include <ctime>
 
 #define DEBUG 0
 
+// Two stage homing: fast approach to latch the switch edge, back off, then a slow
+// re-approach so the final edge is found at a low, repeatable speed
+struct HomingProfile {
+    bool twoStage = false;
+    float fastVelocity = 9.0f;      // stage 1 approach velocity
+    float backOffVelocity = 4.5f;   // stage 2 velocity away from the switch
+    float backOffDistance = 0.2f;   // stage 2 distance cleared past the latched edge
+    float slowVelocity = 1.0f;      // stage 3 re-approach velocity
+    float acceleration = 1500.0f;   // largest change of the velocity command, per second^2
+};
+
+// Outcome of one control cycle of a resumable phase
+enum class TickResult {
+    Running,
+    Done,
+    Stalled,
+    Preempted
+};
+
+// Steps of a motion sequence, run one control cycle at a time by tickSequence()
+enum class MotionStepKind {
+    Rezero,         // rezero the controller at value, no bus cycle of its own
+    Phase,          // run phase to completion
+    Hold,           // hold the commanded position for value seconds
+    HoldAverage,    // hold the average of commanded and actual position for value seconds
+    Report          // print commanded and actual position
+};
+
+struct MotionStep {
+    MotionStepKind kind;
+    MotionPhase phase;
+    float value;
+};
+
 class PositionManager {
 public:
     // Constructor
     explicit PositionManager(MyController& controller, MyGpio& homeLimitSwitch, MyGpio& extendLimitSwitch, float maxSpeed, float cruisingEndPosition, float cruisingReverseEndPosition, size_t stepsToAccelerate, size_t decelerationSteps, struct timespec req)
     : controller(controller), homeLimitSwitch(homeLimitSwitch), extendLimitSwitch(extendLimitSwitch), maxSpeed(maxSpeed), cruisingEndPosition(cruisingEndPosition), cruisingReverseEndPosition(cruisingReverseEndPosition), 
-      stepsToAccelerate(stepsToAccelerate), decelerationSteps(decelerationSteps), req(req) {}
+      stepsToAccelerate(stepsToAccelerate), decelerationSteps(decelerationSteps), req(req), estimator(req.tv_sec + req.tv_nsec / 1e9) {
+        torques.reserve(kDefaultTorqueCapacity);
+    }
+
+    static const size_t kDefaultTorqueCapacity = 1 << 16;     // about 80 s of cycles at 1.2 ms
 
     
     // Motor control functions
@@ -34,16 +82,116 @@ public:
     inline void holdPositionNan();
     inline void holdPositionNanDuration(float duration);
     inline bool homing(float& commandedPosition, float& currentPosition);
+    inline bool homingTwoStage(float& commandedPosition, float& currentPosition);
+    inline void setHomingProfile(const HomingProfile& profile) { homingProfile = profile; }
+    inline float getHomeLatchPosition() const { return homeLatchPosition; }
     inline float tripleQuery();
     inline float validQuery();
+    inline void rezero(float position);
+    inline void restorePosition(float logicalPosition, float absolutePosition);
+    inline bool isReferenced() const { return referenced; }     // homed, or restored by a warm start
     inline void changeMaxSpeed(float newMaxSpeed);
+    inline bool applyConfig(const MotionConfig& config);
+    inline bool setControlPeriod(const struct timespec& period);
+    inline void setQueryInterval(int interval) { queryInterval = std::max(1, interval); }
+    inline int getQueryInterval() const { return queryInterval; }
+    inline const struct timespec& getControlPeriod() const { return req; }
     inline double calculateDecelerationDistance(double initialVelocity, size_t numSteps, double timePerStep);
 
-
-    // Accessor for torque data
+    // Resumable phases, each tick() is exactly one control cycle
+    inline TickResult beginPhase(MotionPhase phase, float& commandedPosition, float& currentPosition);
+    inline TickResult beginHold(float position, float duration);
+    inline TickResult beginMoveTo(float target, float& commandedPosition, float& currentPosition);
+    inline TickResult tick(float& commandedPosition, float& currentPosition);
+    // The same cycle in two halves for a caller that owns the control period wait:
+    // tickWrite(), the wait, then tickRead() once tickWrite() returned Running
+    inline TickResult tickWrite(float& commandedPosition, float& currentPosition);
+    inline TickResult tickRead(float& commandedPosition, float& currentPosition);
+    inline void cancelPhase();
+    inline MotionPhase getPhase() const { return phaseState.phase; }
+    inline bool isMoving() const;
+
+    // Controller link recovery, see MyController::recover(). A phase recovers from its own
+    // cycle and ends where the blade is, between phases the state machine calls this.
+    inline bool recoverLink();
+
+    // Motion sequences, run one control cycle per tickSequence()
+    inline void startSequence(const MotionStep* steps, size_t count);
+    inline TickResult tickSequence(float& commandedPosition, float& currentPosition);
+    inline void cancelSequence();
+    inline bool sequenceActive() const { return sequenceIndex < sequenceCount; }
+
+    // Safety supervision
+    inline void attachSupervisor(SafetySupervisor* newSupervisor) { supervisor = newSupervisor; }
+    inline bool wasPreempted() const { return supervisor != nullptr && supervisor->tripped(); }
+
+    // Speed potentiometer. Acceleration ramps to its setting and cruising eases toward it
+    // every cycle, so the blade changes speed mid-motion. Null detaches, maxSpeed is used
+    // then and while the input has no reading.
+    inline void attachSpeedInput(SpeedInput* input) { speedInput = input; }
+    inline float speedSetting() const;
+
+    // Per cycle performance counters, attributed to the phase of each tick. Also marks the
+    // controller's stages. Null detaches.
+    inline void attachPerfCounters(PerfCounters* counters);
+
+
+    // Stall detection tuning
+    inline StallDetector& getStallDetector() { return stallDetector; }
+
+    // Position and velocity estimate fed by every reply, in the controller's absolute frame,
+    // timed by the controller transport so a replayed session estimates identically
+    inline StateEstimator& getEstimator() { return estimator; }
+    inline const CoordinateFrame& getFrame() const { return frame; }
+
+    // Load side position and backlash from the output encoder, read in every state query
+    // once the controller reads one. Referenced at home, so untracked until the first homing.
+    inline LoadTracker& getLoadTracker() { return loadTracker; }
+    inline bool loadTracked() const { return controller.getOutputEncoder() >= 0 && loadTracker.isReferenced(); }
+    inline float getLoadPosition() const { return frame.toLogical(loadTracker.getLoadPosition()); }
+
+    // Last reply seen by a control cycle and whether it passed the range check
+    inline const ControllerState& getLastReply() const { return lastReply; }
+    inline bool isLastReplyValid() const { return lastReplyValid; }
+
+    // Accessor for torque data. Torques go into a buffer reserved up front and are dropped
+    // once it is full, so a motion never grows it.
     inline const std::vector<float>& getTorques() const { return torques; }
+    inline void reserveTorques(size_t capacity) { torques.reserve(capacity); }
+    inline size_t getDroppedTorques() const { return droppedTorques; }
 
 private:
+    enum class HomingStage {
+        Approach,       // single stage homing
+        FastApproach,
+        BackOff,
+        SlowApproach
+    };
+
+    // Progress of the active phase between ticks
+    struct PhaseState {
+        MotionPhase phase = MotionPhase::Idle;
+        int index = 0;                  // control cycles completed in this phase
+        float direction = 0.0f;         // -1 extending, +1 sheathing
+        float velocity = 0.0f;          // per cycle velocity of position phases, per second velocity while homing
+        float rate = 0.0f;              // per cycle change in velocity
+        float lastVelocityCommand = 0.0f;   // per second, homing sends velocity commands
+        float cycleAcceleration = 0.0f; // commanded this cycle, units/s^2, for the stall detector
+        float cycleDirection = 0.0f;    // MoveTo, direction of this cycle's step
+        bool cycleArrived = false;      // MoveTo, this cycle's setpoint is the target
+        bool cycleQueried = false;      // cruising and holds, this cycle's command asked for a reply
+        float holdPosition = 0.0f;
+        float target = 0.0f;            // logical position a MoveTo ends at
+        long holdCycles = 0;
+        HomingStage homingStage = HomingStage::Approach;
+        long maxBackOffCycles = 0;
+        int recoveryCycles = 0;         // cycles left in a stall recovery
+        float recoveryVelocity = 0.0f;
+        bool recoveryTorques = false;   // record torques during recovery
+        bool rezeroAfterRecovery = false;
+        int64_t startedNs = 0;          // transport time, so a replay reports the recorded duration
+    };
+
     MyController& controller;
     float maxSpeed;
     float cruisingEndPosition;
@@ -52,470 +200,979 @@ private:
     size_t decelerationSteps;
     struct timespec req;
     std::vector<float> torques;
+    size_t droppedTorques = 0;
+    std::vector<float> cycleReply = std::vector<float>(3);    // reply of the current cycle, reused
     MyGpio& homeLimitSwitch;
     MyGpio& extendLimitSwitch;
+    SafetySupervisor* supervisor = nullptr;
+    SpeedInput* speedInput = nullptr;
+    float inputMinSpeed = 0.015f;       // per cycle speed at either end of the speed input
+    float inputMaxSpeed = 0.065f;
+    PerfCounters* perf = nullptr;
+    HomingProfile homingProfile;
+    StallDetector stallDetector;
+    StateEstimator estimator;
+    LoadTracker loadTracker;
+    CoordinateFrame frame;
+    ControllerState lastReply;
+    bool lastReplyValid = false;
+    bool referenced = false;
+    float homeLatchPosition = 500.0f;
+    PhaseState phaseState;
+    float stepVelocity = 0.0f;          // per cycle velocity carried from one phase into the next
+    const MotionStep* sequenceSteps = nullptr;
+    size_t sequenceCount = 0;
+    size_t sequenceIndex = 0;
+    int queryInterval = 1;              // cruising and holds, cycles per state query
+
+    inline bool preempted();
+    inline void streamWrite(float absPosition, float velocity);
+    inline bool streamRead(std::vector<float>& controller_state);
+    inline void writeStep(float& commandedPosition);
+    inline TickResult readStep(float& commandedPosition, float& currentPosition);
+    inline std::vector<float>& readReply();
+    inline void recordTorque(float torque);
+    inline bool acceptReply(const std::vector<float>& controller_state);
+    inline void estimatePosition(float& currentPosition) const;
+    inline float queryEstimate(int rounds, int queriesPerRound);
+    inline TickResult finishPhase(TickResult result);
+    inline void replanCruise();
+    inline TickResult beginHoldCycles(float position, long cycles);
+    inline TickResult beginHoming(float& commandedPosition, float& currentPosition, bool twoStage);
+    inline TickResult homeReached(float& commandedPosition, float& currentPosition);
+    inline void beginRecovery(int cycles, float velocity, bool recordTorques, bool rezeroAfter);
+    inline TickResult stallDetected(float& commandedPosition, float& currentPosition);
+    inline void logCycle(int index, const std::vector<float>& controller_state, float commandedPosition, float currentPosition);
+    inline TickResult runToCompletion(TickResult result, float& commandedPosition, float& currentPosition);
+    inline double periodSeconds() const { return req.tv_sec + req.tv_nsec / 1e9; }
+    // units/s^2 from the change in the per cycle position step, as the stall models take it
+    inline float stepAcceleration(float stepChange) const { return static_cast<float>(stepChange / (periodSeconds() * periodSeconds())); }
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+// PREEMPTED - checked at the top of every control cycle
+bool PositionManager::preempted() {
+    if (supervisor == nullptr || !supervisor->tripped()) {
+        return false;
+    }
+    if (!supervisor->acknowledged()) {
+        controller.sendBrakeCommand();  // make sure brake is the last command the controller sees
+        supervisor->acknowledge();
+    }
+    return true;
+}
+
+// READ REPLY - the cycle's reply, read into the buffer every cycle reuses
+std::vector<float>& PositionManager::readReply() {
+    controller.sendReadCommand(cycleReply);
+    return cycleReply;
+}
+
+// RECORD TORQUE
+void PositionManager::recordTorque(float torque) {
+    if (torques.size() < torques.capacity()) {
+        torques.push_back(torque);
+    } else {
+        droppedTorques++;
+    }
+}
+
+// ACCEPT REPLY - range check shared by every control cycle, feeds the estimator
+bool PositionManager::acceptReply(const std::vector<float>& controller_state) {
+    float position = frame.toLogical(controller_state[0]);
+    bool valid = position >= 450 && position <= 550;
+    if (supervisor != nullptr) {
+        supervisor->noteReply(valid);
+    }
+    lastReply = ControllerState::fromReply(controller_state);
+    lastReply.output = controller.getOutputPosition();
+    lastReplyValid = valid && estimator.update(controller_state[0], controller.nowNs());
+    if (lastReplyValid) {
+        loadTracker.update(controller_state[0], estimator.getVelocity(), lastReply.output);
+    }
+    return lastReplyValid;
+}
+
+// STREAM WRITE / READ - one setpoint, queried only every queryInterval cycles of the phase
+// and write only in between. The read returns whether a reply came back; the estimator
+// carries the position across the cycles without one.
+void PositionManager::streamWrite(float absPosition, float velocity) {
+    phaseState.cycleQueried = phaseState.index % queryInterval == 0;
+    if (phaseState.cycleQueried) {
+        controller.sendWriteCommand(absPosition, velocity);
+    } else {
+        controller.sendWriteOnlyCommand(absPosition, velocity);
+    }
+}
+
+bool PositionManager::streamRead(std::vector<float>& controller_state) {
+    if (phaseState.cycleQueried) {
+        controller.sendReadCommand(controller_state);
+    }
+    return phaseState.cycleQueried;
+}
+
+// ESTIMATE POSITION - filtered position, extrapolated across a rejected or missing reply
+void PositionManager::estimatePosition(float& currentPosition) const {
+    if (estimator.isInitialized()) {
+        currentPosition = frame.toLogical(estimator.getPosition(controller.nowNs()));
+    }
+}
+
+// REZERO - moves the logical frame, only rezeros the controller when the absolute range demands it
+void PositionManager::rezero(float position) {
+    float absolute = estimator.getPosition(controller.nowNs());
+    if (!estimator.isFresh(controller.nowNs()) || frame.needsPhysicalRezero(absolute)) {
+        controller.sendRezeroCommand(frame.getCenter());
+        loadTracker.shift(frame.getCenter() - absolute);   // the encoder does not move with the rezero
+        estimator.reset(frame.getCenter(), controller.nowNs());
+        frame.physicalRezero();
+        absolute = frame.getCenter();
+    }
+    frame.setOrigin(position, absolute);
+}
+
+// RESTORE POSITION - frame and estimator as they were when the position was saved, no bus cycle
+void PositionManager::restorePosition(float logicalPosition, float absolutePosition) {
+    estimator.reset(absolutePosition, controller.nowNs());
+    frame.setOrigin(logicalPosition, absolutePosition);
+    referenced = true;
+}
+
+// LOG CYCLE - ends the control work of the cycle, the line itself is counted as logging
+void PositionManager::logCycle(int index, const std::vector<float>& controller_state, float commandedPosition, float currentPosition) {
+    if (perf != nullptr) {
+        perf->mark(CycleStage::Control);
+    }
+    std::cout << index << "\t" << controller_state[2] << "\tTarget: " << commandedPosition
+              << "\tActual: " << currentPosition << "\t" << std::abs(commandedPosition - currentPosition) <<  "\tVelocity: " << controller_state[1] << std::endl;
+    if (perf != nullptr) {
+        perf->mark(CycleStage::Log);
+    }
+}
+
+void PositionManager::attachPerfCounters(PerfCounters* counters) {
+    perf = counters;
+    controller.attachPerfCounters(counters);
+}
+
 //function to change maxSpeed
 void PositionManager::changeMaxSpeed(float newMaxSpeed) {
     maxSpeed = newMaxSpeed;
 }
 
+// APPLY CONFIG - motion tunables from a config snapshot, refused while a phase is running.
+// Per cycle values are tuned at the configured period and rescaled to the one in use.
+bool PositionManager::applyConfig(const MotionConfig& config) {
+    if (phaseState.phase != MotionPhase::Idle) {
+        return false;
+    }
+    double scale = periodSeconds() * 1e6 / config.controlPeriodUs;
+    maxSpeed = static_cast<float>(config.maxSpeed * scale);
+    inputMinSpeed = static_cast<float>(config.inputMinSpeed * scale);
+    inputMaxSpeed = static_cast<float>(config.inputMaxSpeed * scale);
+    cruisingEndPosition = config.cruisingEndPosition;
+    cruisingReverseEndPosition = config.cruisingReverseEndPosition;
+    stepsToAccelerate = std::max<size_t>(1, std::lround(config.stepsToAccelerate / scale));
+    decelerationSteps = std::lround(config.decelerationSteps / scale);
+    setQueryInterval(config.queryInterval);
+
+    homingProfile.twoStage = config.homingTwoStage;
+    homingProfile.fastVelocity = config.homingFastVelocity;
+    homingProfile.backOffVelocity = config.homingBackOffVelocity;
+    homingProfile.backOffDistance = config.homingBackOffDistance;
+    homingProfile.slowVelocity = config.homingSlowVelocity;
+    homingProfile.acceleration = config.homingAcceleration;
+
+    stallDetector.setModel(MotionPhase::Cruising, config.cruisingStall);
+    stallDetector.setModel(MotionPhase::CruisingReverse, config.cruisingReverseStall);
+    stallDetector.setModel(MotionPhase::Homing, config.homingStall);
+    stallDetector.setModel(MotionPhase::Acceleration, config.accelerationStall);
+    stallDetector.setModel(MotionPhase::AccelerationReverse, config.accelerationReverseStall);
+    loadTracker.setScale(config.outputScale);
+    return true;
+}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////
+// SET CONTROL PERIOD - same speeds and ramp times at a new period, refused while a phase is running
+bool PositionManager::setControlPeriod(const struct timespec& period) {
+    if (phaseState.phase != MotionPhase::Idle) {
+        return false;
+    }
+    double scale = (period.tv_sec + period.tv_nsec / 1e9) / periodSeconds();
+    req = period;
+    estimator.setPeriod(periodSeconds());
+    maxSpeed = static_cast<float>(maxSpeed * scale);
+    inputMinSpeed = static_cast<float>(inputMinSpeed * scale);
+    inputMaxSpeed = static_cast<float>(inputMaxSpeed * scale);
+    stepsToAccelerate = std::max<size_t>(1, std::lround(stepsToAccelerate / scale));
+    decelerationSteps = std::lround(decelerationSteps / scale);
+    return true;
+}
 
+// SPEED SETTING - per cycle cruise speed the speed input asks for, capped at maxSpeed and
+// never below one acceleration step so a cruise always ends. One atomic load.
+float PositionManager::speedSetting() const {
+    float level = (speedInput != nullptr) ? speedInput->getLevel() : std::numeric_limits<float>::quiet_NaN();
+    if (!std::isfinite(level)) {
+        return maxSpeed;
+    }
+    float speed = inputMinSpeed + std::clamp(level, 0.0f, 1.0f) * (inputMaxSpeed - inputMinSpeed);
+    return std::clamp(speed, maxSpeed / std::max<size_t>(stepsToAccelerate, 1), maxSpeed);
+}
 
-// ACCELERATION
-void PositionManager::performAcceleration(float& commandedPosition, float& currentPosition) {
-    std::cout << "ACCELERATION" << std::endl;
-    std::vector<float> accelPositions;
-    accelPositions.push_back(currentPosition); // Assuming currentPosition is rezeroed at 500.0
-
-    float currentVelocity = 0.0f;
-    float accelerationPerStep = -maxSpeed / stepsToAccelerate; 
-    std::cout << "Acceleration Per Step: " << accelerationPerStep << std::endl;
-
-    for (int i = 1; i <= stepsToAccelerate; i++) {
-        currentVelocity += accelerationPerStep;
-        float newPosition = accelPositions.back() + currentVelocity;
-        accelPositions.push_back(newPosition);
-        std::cout << "CurrentVelocity: " << currentVelocity << "\tNewPosition: " << newPosition << std::endl;
-    }
-
-    for (size_t i = 0; i < accelPositions.size(); i++) {
-        commandedPosition = accelPositions[i];
-        controller.sendWriteCommand(commandedPosition, std::numeric_limits<float>::quiet_NaN());
-        nanosleep(&req, nullptr);
-        auto controller_state = controller.sendReadCommand();
-        if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-            currentPosition = controller_state[0];
-            //torques.push_back(controller_state[2]);
+// REPLAN CRUISE - eases the cruise velocity toward the speed setting by at most the
+// acceleration of the extend profile per cycle, so turning the knob never steps the setpoint
+void PositionManager::replanCruise() {
+    if (speedInput == nullptr) {
+        return;
+    }
+    float target = phaseState.direction * speedSetting();
+    float step = maxSpeed / std::max<size_t>(stepsToAccelerate, 1);
+    phaseState.velocity += std::clamp(target - phaseState.velocity, -step, step);
+    stepVelocity = phaseState.velocity;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// BEGIN PHASE - sets up the phase, returns Running when it needs control cycles
+TickResult PositionManager::beginPhase(MotionPhase phase, float& commandedPosition, float& currentPosition) {
+    phaseState = PhaseState();
+    phaseState.phase = phase;
+
+    switch (phase) {
+        case MotionPhase::Acceleration:
+        case MotionPhase::AccelerationReverse: {
+            phaseState.direction = (phase == MotionPhase::Acceleration) ? -1.0f : 1.0f;
+            phaseState.rate = phaseState.direction * speedSetting() / stepsToAccelerate;
+            phaseState.holdPosition = currentPosition;  // first setpoint, assuming currentPosition is rezeroed at 500.0
+            std::cout << motionPhaseName(phase) << std::endl;
+            std::cout << "Acceleration Per Step: " << phaseState.rate << std::endl;
+            stallDetector.begin(phase);
+            float velocity = 0.0f;
+            float position = currentPosition;
+            for (size_t i = 1; i <= stepsToAccelerate; i++) {
+                velocity += phaseState.rate;
+                position += velocity;
+                std::cout << "CurrentVelocity: " << velocity << "\tNewPosition: " << position << std::endl;
+            }
+            return TickResult::Running;
         }
-        std::cout << i << "\t" << controller_state[2] << "\tTarget: " << commandedPosition
-                  << "\tActual: " << currentPosition << "\t" << std::abs(commandedPosition - currentPosition) <<  "\tVelocity: " << controller_state[1] << std::endl;
+        case MotionPhase::Cruising:
+        case MotionPhase::CruisingReverse: {
+            std::cout << motionPhaseName(phase) << std::endl;
+            if (phase == MotionPhase::Cruising) {
+                phaseState.direction = -1.0f;
+                if (!(currentPosition >= cruisingEndPosition)) return finishPhase(TickResult::Done);
+            } else {
+                phaseState.direction = 1.0f;
+                recordTorque(0.0f);
+                if (!(currentPosition <= cruisingReverseEndPosition)) return finishPhase(TickResult::Done);
+            }
+            // With a speed input, carry on at the speed acceleration reached and re-plan from there
+            bool carried = speedInput != nullptr && stepVelocity * phaseState.direction > 0.0f;
+            phaseState.velocity = carried ? stepVelocity : phaseState.direction * speedSetting();
+            stepVelocity = phaseState.velocity;
+            stallDetector.begin(phase);
+            return TickResult::Running;
+        }
+        case MotionPhase::Deceleration:
+        case MotionPhase::DecelerationReverse: {
+            std::cout << motionPhaseName(phase) << std::endl;
+            phaseState.direction = (phase == MotionPhase::Deceleration) ? -1.0f : 1.0f;
+            // Start from the velocity the previous phase left off at, full speed when there was none
+            phaseState.velocity = (stepVelocity * phaseState.direction > 0.0f) ? stepVelocity : phaseState.direction * maxSpeed;
+            phaseState.rate = maxSpeed / decelerationSteps;
+            if (decelerationSteps == 0) return finishPhase(TickResult::Done);
+            return TickResult::Running;
+        }
+        case MotionPhase::Homing:
+            return beginHoming(commandedPosition, currentPosition, homingProfile.twoStage);
+        case MotionPhase::Hold:
+            return beginHoldCycles(commandedPosition, 1);
+        default:
+            return finishPhase(TickResult::Done);
+    }
+}
+
+// BEGIN MOVE TO - trapezoidal move to a logical position, limited by maxSpeed and the
+// acceleration of the extend profile
+TickResult PositionManager::beginMoveTo(float target, float& commandedPosition, float& currentPosition) {
+    phaseState = PhaseState();
+    phaseState.phase = MotionPhase::MoveTo;
+    phaseState.target = target;
+    phaseState.rate = maxSpeed / std::max<size_t>(stepsToAccelerate, 1);
+    commandedPosition = currentPosition;
+    std::cout << motionPhaseName(MotionPhase::MoveTo) << " " << target << " from " << currentPosition << std::endl;
+    if (!std::isfinite(target) || target < 450.0f || target > 550.0f) {
+        std::cout << "Move target outside the position range" << std::endl;
+        return finishPhase(TickResult::Stalled);
+    }
+    return TickResult::Running;
+}
 
+// BEGIN HOLD
+TickResult PositionManager::beginHold(float position, float duration) {
+    return beginHoldCycles(position, std::lround(duration / periodSeconds()));
+}
 
+TickResult PositionManager::beginHoldCycles(float position, long cycles) {
+    phaseState = PhaseState();
+    phaseState.phase = MotionPhase::Hold;
+    phaseState.holdPosition = position;
+    phaseState.holdCycles = cycles;
+    if (cycles <= 0) return finishPhase(TickResult::Done);
+    return TickResult::Running;
+}
 
+// FINISH PHASE
+TickResult PositionManager::finishPhase(TickResult result) {
+    if (phaseState.phase != MotionPhase::Cruising && phaseState.phase != MotionPhase::CruisingReverse
+        && phaseState.phase != MotionPhase::Acceleration && phaseState.phase != MotionPhase::AccelerationReverse) {
+        stepVelocity = 0.0f;
     }
+    if (result != TickResult::Done) {
+        stepVelocity = 0.0f;
+    }
+    phaseState.phase = MotionPhase::Idle;
+    return result;
 }
 
-// CRUISING 
-void PositionManager::performCruising(float& commandedPosition, float& currentPosition) {
-    std::cout << "CRUISING" << std::endl;
-    float stableVelocity = -maxSpeed;
-    int index = 0;
-    while (currentPosition >= cruisingEndPosition) {
-        commandedPosition += stableVelocity;
-        controller.sendWriteCommand(commandedPosition, std::numeric_limits<float>::quiet_NaN());
-        nanosleep(&req, nullptr);
-        auto controller_state = controller.sendReadCommand();
-        index++;
-        if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-            currentPosition = controller_state[0];
-            // torques.push_back(controller_state[2]);
-            // std::cout << "torque: " << controller_state[2] << std::endl;
-
-            if (index > 23) {
-                if (controller_state[2] >= 0.20) {  // Check for torque limit indicating a stall or similar issue
-                    std::cout << "High torque/stall detected, stopping at position: " << currentPosition << "at index" << index << std::endl;
-                    //Move forward a little bit
-                    std::cout << "extendLimitSwitch.readValue() " << extendLimitSwitch.readValue() << std::endl;
-
-                    // long holdTime = static_cast<long>(0.05 * 1000000 / 1025);
-                    // struct timespec req = {0, 1200 * 1000};
-                    // for (long i = 0; i < holdTime; i++) {
-                    // controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), 0.0);
-                    // nanosleep(&req, NULL);
-                    // auto controller_state = controller.sendReadCommand();
-                    // if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-                    //     torques.push_back(controller_state[2]);
-                    // }
-
-                    // for (int i = 0; i < 250; i++) {
-                    //     //ramp up to -2.5
-                    //     nanosleep(&req, NULL);
-                    //     torques.push_back(controller_state[2]);
-                    // }
-                    controller.sendStopCommand();  //gets controller to a known state
-                    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0f
-                    commandedPosition = 500.0f;
-                    currentPosition = 500.0f;
-                    
-
-                    // for (int i = 0; i < 100; i++) {
-                    //     //ramp up to -2.5
-                    //     controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), -2.5 * (i / 100.0));
-                    //     nanosleep(&req, NULL);        
-                    //     auto controller_state = controller.sendReadCommand();
-                    //     torques.push_back(controller_state[2]);
-                    // }
-                    for (int i = 0; i < 250; i++) {
-                        //ramp up to -2.5
-                        controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), -2.5);
-                        nanosleep(&req, NULL);        
-                        auto controller_state = controller.sendReadCommand();
-                        torques.push_back(controller_state[2]);
-                    }
-                    return;                    
-                }
-            }
-        }
-        std::cout << index << "\t" << controller_state[2] << "\tTarget: " << commandedPosition
-                  << "\tActual: " << currentPosition << "\t" << std::abs(commandedPosition - currentPosition) <<  "\tVelocity: " << controller_state[1] << std::endl;
+// RECOVER LINK - the estimator restarts from the reply that resynchronized the link
+bool PositionManager::recoverLink() {
+    ControllerState state;
+    if (!controller.recover(&state)) {
+        return false;
+    }
+    estimator.reset(state.position, controller.nowNs());
+    lastReply = state;
+    lastReplyValid = true;
+    return true;
+}
 
+// CANCEL PHASE - abandon the active phase, the next phase starts from the current velocity
+void PositionManager::cancelPhase() {
+    phaseState.phase = MotionPhase::Idle;
+    phaseState.recoveryCycles = 0;
+}
 
-    }// end while
+bool PositionManager::isMoving() const {
+    switch (phaseState.phase) {
+        case MotionPhase::Acceleration:
+        case MotionPhase::Cruising:
+        case MotionPhase::AccelerationReverse:
+        case MotionPhase::CruisingReverse:
+        case MotionPhase::MoveTo:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// BEGIN RECOVERY - drive away after a stall before reporting it
+void PositionManager::beginRecovery(int cycles, float velocity, bool recordTorques, bool rezeroAfter) {
+    phaseState.recoveryCycles = cycles;
+    phaseState.recoveryVelocity = velocity;
+    phaseState.recoveryTorques = recordTorques;
+    phaseState.rezeroAfterRecovery = rezeroAfter;
+}
+
+// STALL DETECTED - ramp or cruise, the controller is stopped and rezeroed, then the blade
+// drives back before the stall is reported
+TickResult PositionManager::stallDetected(float& commandedPosition, float& currentPosition) {
+    std::cout << "High torque/stall detected, stopping at position: " << currentPosition << "at index" << phaseState.index << std::endl;
+    std::cout << "extendLimitSwitch.readValue() " << extendLimitSwitch.readValue() << std::endl;
+    controller.sendStopCommand();  //gets controller to a known state
+    rezero(500.0f); // sets the current position to 500.0f
+    commandedPosition = 500.0f;
+    currentPosition = 500.0f;
+    beginRecovery(250, -2.5f, true, false);
+    return TickResult::Running;
 }
 
-// DECELERATION
-float PositionManager::performDeceleration(float& commandedPosition, float& currentPosition) {
-    float stableReverseVelocity = -maxSpeed;
-    float currentVelocity = stableReverseVelocity;
-    float decelerationRate = -stableReverseVelocity / decelerationSteps;
-    int index = 0; 
-    std::cout << "DECELERATION" << std::endl;
-
-    for (size_t step = 0; step < decelerationSteps; ++step) {
-        index++;
-        float startPositionThisStep = currentPosition;
-        
-        commandedPosition += currentVelocity;
-        controller.sendWriteCommand(commandedPosition, std::numeric_limits<float>::quiet_NaN());
-        nanosleep(&req, nullptr);
-        
-        auto controller_state = controller.sendReadCommand();
-        if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-            currentPosition = controller_state[0];
-            //torques.push_back(controller_state[0]);
-        }
-        
-        currentVelocity -= decelerationRate;
-        
-        std::cout << index << "\t" << controller_state[2] << "\tTarget: " << commandedPosition
-                  << "\tActual: " << currentPosition << "\t" << std::abs(commandedPosition - currentPosition) <<  "\tVelocity: " << controller_state[1] << std::endl;
 
-        //std::cout << "Commanded Position = " << commandedPosition << ", Actual Position = " << currentPosition << "\tVelocity" << controller_state[1] << "\tTorque" << controller_state[2] << std::endl;
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// TICK - one control cycle of the active phase: its command, the control period, its reply
+TickResult PositionManager::tick(float& commandedPosition, float& currentPosition) {
+    TickResult result = tickWrite(commandedPosition, currentPosition);
+    if (result != TickResult::Running) {
+        return result;
+    }
+    controller.waitCycle(req);
+    return tickRead(commandedPosition, currentPosition);
+}
+
+// TICK WRITE - checks and the command of the cycle. Anything but Running ended the phase
+// and nothing was written.
+TickResult PositionManager::tickWrite(float& commandedPosition, float& currentPosition) {
+    if (phaseState.phase == MotionPhase::Idle) {
+        return TickResult::Done;
+    }
 
-        if (currentVelocity >= 0) { // Check for stopping condition
-            std::cout << "Deceleration complete at step " << step + 1 << std::endl;
-            break;
+    // LINK RECOVERY - not a control cycle, so outside the cycle's counters and allocation
+    // check. The blade may have moved while the link was down, the phase is not resumed.
+    if (controller.linkFaulted()) {
+        if (!controller.recoveryDue() || !recoverLink()) {
+            return finishPhase(TickResult::Preempted);
         }
-        if (extendLimitSwitch.readValue() == 0) {  
-            std::cout << "Button pressed, stopping at position: " << currentPosition << std::endl;
-            break;
+        currentPosition = frame.toLogical(lastReply.position);
+        commandedPosition = currentPosition;
+        return finishPhase(TickResult::Stalled);
+    }
+    if (perf != nullptr) {
+        perf->beginCycle(phaseState.phase);     // ended by tickRead
+    }
+    AllocationScope allocationScope(phaseState.phase);    // counted in a DOOMBLADE_CHECK_ALLOC build
+    if (preempted()) {
+        TickResult result = finishPhase(TickResult::Preempted);
+        if (perf != nullptr) {
+            perf->endCycle();
         }
+        return result;
     }
-    return currentPosition;
+    writeStep(commandedPosition);
+    return TickResult::Running;
 }
 
+// TICK READ - the reply of the cycle tickWrite commanded and what the phase makes of it
+TickResult PositionManager::tickRead(float& commandedPosition, float& currentPosition) {
+    TickResult result;
+    {
+        AllocationScope allocationScope(phaseState.phase);
+        result = readStep(commandedPosition, currentPosition);
+    }
+    if (perf != nullptr) {
+        perf->endCycle();
+    }
+    return result;
+}
 
+// WRITE STEP - the setpoint of this cycle, what the read needs of it is kept in phaseState
+void PositionManager::writeStep(float& commandedPosition) {
+    // STALL RECOVERY
+    if (phaseState.recoveryCycles > 0) {
+        controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), phaseState.recoveryVelocity);
+        return;
+    }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////
-// ACCELERATION REVERSE
-void PositionManager::performAccelerationReverse(float& commandedPosition, float& currentPosition) {
-    std::cout << "ACCELERATION REVERSE" << std::endl;
-    std::vector<float> accelPositions;
-    accelPositions.push_back(currentPosition);
-
-    float currentVelocity = 0.0f;
-    float accelerationPerStep = maxSpeed / stepsToAccelerate;
-    std::cout << "Acceleration Per Step: " << accelerationPerStep << std::endl;
-
-    for (int i = 1; i <= stepsToAccelerate; i++) {
-        currentVelocity += accelerationPerStep;
-        float newPosition = accelPositions.back() + currentVelocity;
-        accelPositions.push_back(newPosition);
-        std::cout << "Current Velocity: " << currentVelocity << "\tNew Position: " << newPosition << std::endl;
-    }
-
-    for (size_t i = 0; i < accelPositions.size(); i++) {
-        commandedPosition = accelPositions[i];
-        controller.sendWriteCommand(commandedPosition, std::numeric_limits<float>::quiet_NaN());
-        nanosleep(&req, nullptr);
-        auto controller_state = controller.sendReadCommand();
-        if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-            currentPosition = controller_state[0];
-            torques.push_back(controller_state[2]);
+    switch (phaseState.phase) {
+
+    // ACCELERATION
+    case MotionPhase::Acceleration:
+    case MotionPhase::AccelerationReverse: {
+        float stepChange = 0.0f;
+        if (phaseState.index == 0) {
+            commandedPosition = phaseState.holdPosition;
+        } else {
+            stepChange = phaseState.rate;
+            phaseState.velocity += phaseState.rate;
+            commandedPosition += phaseState.velocity;
         }
-        std::cout << i << "\t" << controller_state[2] << "\tTarget: " << commandedPosition
-                  << "\tActual: " << currentPosition << "\t" << std::abs(commandedPosition - currentPosition) <<  "\tVelocity: " << controller_state[1] << std::endl;
+        stepVelocity = phaseState.velocity;
+        phaseState.cycleAcceleration = stepAcceleration(stepChange);
+        controller.sendWriteCommand(frame.toAbsolute(commandedPosition), std::numeric_limits<float>::quiet_NaN());
+        return;
+    }
+
+    // CRUISING
+    case MotionPhase::Cruising:
+    case MotionPhase::CruisingReverse: {
+        float previousStep = phaseState.velocity;
+        replanCruise();
+        commandedPosition += phaseState.velocity;
+        phaseState.cycleAcceleration = stepAcceleration(phaseState.velocity - previousStep);   // a knob turn accelerates
+        streamWrite(frame.toAbsolute(commandedPosition), std::numeric_limits<float>::quiet_NaN());
+        return;
+    }
+
+    // DECELERATION
+    case MotionPhase::Deceleration:
+    case MotionPhase::DecelerationReverse: {
+        phaseState.index++;
+        commandedPosition += phaseState.velocity;
+        controller.sendWriteCommand(frame.toAbsolute(commandedPosition), std::numeric_limits<float>::quiet_NaN());
+        return;
+    }
 
+    // MOVE TO
+    case MotionPhase::MoveTo: {
+        float remaining = phaseState.target - commandedPosition;
+        float direction = remaining < 0.0f ? -1.0f : 1.0f;
+        float speed = std::abs(phaseState.velocity);
+        if (speed * speed / (2.0f * phaseState.rate) >= std::abs(remaining)) {
+            speed = std::max(phaseState.rate, speed - phaseState.rate);    // braking, never below one step
+        } else {
+            speed = std::min(maxSpeed, speed + phaseState.rate);
+        }
+        bool arrived = speed >= std::abs(remaining);
+        commandedPosition = arrived ? phaseState.target : commandedPosition + direction * speed;
+        phaseState.velocity = arrived ? 0.0f : direction * speed;
+        phaseState.cycleDirection = direction;
+        phaseState.cycleArrived = arrived;
+        controller.sendWriteCommand(frame.toAbsolute(commandedPosition), std::numeric_limits<float>::quiet_NaN());
+        return;
+    }
+
+    // HOLD
+    case MotionPhase::Hold:
+        streamWrite(frame.toAbsolute(phaseState.holdPosition), 0.0f);
+        return;
+
+    // HOMING
+    case MotionPhase::Homing: {
+        float velocity = phaseState.velocity;
+        if (phaseState.homingStage == HomingStage::BackOff) {
+            velocity = -homingProfile.backOffVelocity;
+        }
+        // Every change of stage ramps at the homing acceleration, the reversal off the switch
+        // included, instead of stepping the velocity in one cycle
+        float maxChange = static_cast<float>(homingProfile.acceleration * periodSeconds());
+        velocity = std::clamp(velocity, phaseState.lastVelocityCommand - maxChange, phaseState.lastVelocityCommand + maxChange);
+        controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), velocity);
+        phaseState.cycleAcceleration = static_cast<float>((velocity - phaseState.lastVelocityCommand) / periodSeconds());
+        phaseState.lastVelocityCommand = velocity;
+        return;
+    }
+
+    default:
+        return;
     }
 }
 
-// CRUISING REVERSE
-void PositionManager::performCruisingReverse(float& commandedPosition, float& currentPosition) {
-    std::cout << "CRUISING REVERSE" << std::endl;
-    torques.push_back(0.0);
-    float stableVelocity = maxSpeed;
-    int index = 0;
-    while (currentPosition <= cruisingReverseEndPosition) {
-        commandedPosition += stableVelocity;
-        controller.sendWriteCommand(commandedPosition, std::numeric_limits<float>::quiet_NaN());
-        nanosleep(&req, nullptr);
-        auto controller_state = controller.sendReadCommand();
-        index++;
-        if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-            currentPosition = controller_state[0];
-            torques.push_back(controller_state[2]);
-            // std::cout << "torque: " << controller_state[2] << std::endl;
-
-            if (index >7) {  //13
-                if (controller_state[2] >= 0.40) {  // Check for torque limit indicating a stall or similar issue
-                    std::cout << "High torque/stall detected, stopping at position: " << currentPosition << "at index" << index << std::endl;
-                    //Move forward a little bit
-                    std::cout << "extendLimitSwitch.readValue() " << extendLimitSwitch.readValue() << std::endl;
-
-                    // long holdTime = static_cast<long>(0.05 * 1000000 / 1025);
-                    // struct timespec req = {0, 1200 * 1000};
-                    // for (long i = 0; i < holdTime; i++) {
-                    // controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), 0.0);
-                    // nanosleep(&req, NULL);
-                    // auto controller_state = controller.sendReadCommand();
-                    // if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-                    //     torques.push_back(controller_state[2]);
-                    // }
-
-                    // for (int i = 0; i < 250; i++) {
-                    //     //ramp up to -2.5
-                    //     nanosleep(&req, NULL);
-                    //     torques.push_back(controller_state[2]);
-                    // }
-                    controller.sendStopCommand();  //gets controller to a known state
-                    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0f
-                    commandedPosition = 500.0f;
-                    currentPosition = 500.0f;
-                    
-
-                    // for (int i = 0; i < 100; i++) {
-                    //     //ramp up to -2.5
-                    //     controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), -2.5 * (i / 100.0));
-                    //     nanosleep(&req, NULL);        
-                    //     auto controller_state = controller.sendReadCommand();
-                    //     torques.push_back(controller_state[2]);
-                    // }
-                    for (int i = 0; i < 250; i++) {
-                        //ramp up to -2.5
-                        controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), -2.5);
-                        nanosleep(&req, NULL);        
-                        auto controller_state = controller.sendReadCommand();
-                        torques.push_back(controller_state[2]);
-                    }
-                    return;                    
+// READ STEP - the reply to the write step's command
+TickResult PositionManager::readStep(float& commandedPosition, float& currentPosition) {
+    // STALL RECOVERY
+    if (phaseState.recoveryCycles > 0) {
+        std::vector<float>& controller_state = readReply();
+        if (phaseState.recoveryTorques) {
+            recordTorque(controller_state[2]);
+        }
+        if (--phaseState.recoveryCycles == 0) {
+            if (phaseState.rezeroAfterRecovery) {
+                rezero(500.0f); // sets the current position to 500.0
+                commandedPosition = 500.0f;
+                currentPosition = 500.0f;
+            }
+            return finishPhase(TickResult::Stalled);  //obstruction encountered
+        }
+        return TickResult::Running;
+    }
+
+    switch (phaseState.phase) {
+
+    // ACCELERATION
+    case MotionPhase::Acceleration:
+    case MotionPhase::AccelerationReverse: {
+        std::vector<float>& controller_state = readReply();
+        bool valid = acceptReply(controller_state);
+        estimatePosition(currentPosition);
+        if (valid) {
+            if (phaseState.phase == MotionPhase::AccelerationReverse) {
+                recordTorque(controller_state[2]);
+            }
+            if (stallDetector.update(controller_state[2], controller_state[1], phaseState.cycleAcceleration)) {  // Torque above the ramp's model
+                return stallDetected(commandedPosition, currentPosition);
+            }
+        }
+        logCycle(phaseState.index, controller_state, commandedPosition, currentPosition);
+        if (++phaseState.index > static_cast<int>(stepsToAccelerate)) {
+            return finishPhase(TickResult::Done);
+        }
+        return TickResult::Running;
+    }
+
+    // CRUISING
+    case MotionPhase::Cruising:
+    case MotionPhase::CruisingReverse: {
+        std::vector<float>& controller_state = cycleReply;
+        bool replied = streamRead(controller_state);
+        phaseState.index++;
+        bool valid = replied && acceptReply(controller_state);
+        estimatePosition(currentPosition);
+        if (valid) {
+            if (phaseState.phase == MotionPhase::CruisingReverse) {
+                recordTorque(controller_state[2]);
+            }
+            if (stallDetector.update(controller_state[2], controller_state[1], phaseState.cycleAcceleration)) {  // Torque above the cruising model indicates a stall or similar issue
+                return stallDetected(commandedPosition, currentPosition);
+            }
+        }
+        if (replied) {
+            logCycle(phaseState.index, controller_state, commandedPosition, currentPosition);
+        }
+        bool cruising = (phaseState.phase == MotionPhase::Cruising) ? currentPosition >= cruisingEndPosition
+                                                                   : currentPosition <= cruisingReverseEndPosition;
+        return cruising ? TickResult::Running : finishPhase(TickResult::Done);
+    }
+
+    // DECELERATION
+    case MotionPhase::Deceleration:
+    case MotionPhase::DecelerationReverse: {
+        std::vector<float>& controller_state = readReply();
+        bool valid = acceptReply(controller_state);
+        estimatePosition(currentPosition);
+        if (valid) {
+            if (phaseState.phase == MotionPhase::DecelerationReverse) {
+                recordTorque(controller_state[2]);
+            }
+        }
+        phaseState.velocity -= phaseState.direction * phaseState.rate;   // toward zero either way
+        logCycle(phaseState.index, controller_state, commandedPosition, currentPosition);
+
+        if (phaseState.velocity * phaseState.direction <= 0) { // Check for stopping condition
+            std::cout << "Deceleration complete at step " << phaseState.index << std::endl;
+            return finishPhase(TickResult::Done);
+        }
+        if (phaseState.phase == MotionPhase::Deceleration && extendLimitSwitch.readValue() == 0) {
+            std::cout << "Button pressed, stopping at position: " << currentPosition << std::endl;
+            return finishPhase(TickResult::Done);
+        }
+        if (phaseState.index >= static_cast<int>(decelerationSteps)) {
+            return finishPhase(TickResult::Done);
+        }
+        return TickResult::Running;
+    }
+
+    // MOVE TO
+    case MotionPhase::MoveTo: {
+        std::vector<float>& controller_state = readReply();
+        phaseState.index++;
+        acceptReply(controller_state);
+        estimatePosition(currentPosition);
+        logCycle(phaseState.index, controller_state, commandedPosition, currentPosition);
+        MyGpio& limit = (phaseState.cycleDirection < 0.0f) ? extendLimitSwitch : homeLimitSwitch;
+        if (!phaseState.cycleArrived && limit.readValue() == 0) {
+            std::cout << "Limit switch pressed, stopping at position: " << currentPosition << std::endl;
+            return finishPhase(TickResult::Stalled);
+        }
+        return phaseState.cycleArrived ? finishPhase(TickResult::Done) : TickResult::Running;
+    }
+
+    // HOLD
+    case MotionPhase::Hold: {
+        std::vector<float>& controller_state = cycleReply;
+        if (streamRead(controller_state)) {
+            acceptReply(controller_state);
+        }
+        if (++phaseState.index >= phaseState.holdCycles) {
+            return finishPhase(TickResult::Done);
+        }
+        return TickResult::Running;
+    }
+
+    // HOMING
+    case MotionPhase::Homing: {
+        std::vector<float>& controller_state = readReply();
+        phaseState.index++;
+        bool valid = acceptReply(controller_state);
+        estimatePosition(currentPosition);
+        commandedPosition = currentPosition;
+
+        if (phaseState.homingStage == HomingStage::BackOff) {
+            if (valid && stallDetector.update(controller_state[2], controller_state[1], phaseState.cycleAcceleration)) {
+                std::cout << "High torque/stall detected backing off the home switch at: " << currentPosition << std::endl;
+                controller.sendStopCommand();
+                return finishPhase(TickResult::Stalled);
+            }
+            // Back off until the switch has released and we are clear of the edge
+            if (currentPosition > homeLatchPosition - homingProfile.backOffDistance || homeLimitSwitch.readValue() == 0) {
+                if (phaseState.index > phaseState.maxBackOffCycles) {
+                    std::cout << "Back off did not clear the home switch after " << phaseState.index << " cycles" << std::endl;
+                    controller.sendStopCommand();
+                    return finishPhase(TickResult::Stalled);
                 }
+                return TickResult::Running;
             }
+            phaseState.homingStage = HomingStage::SlowApproach;
+            phaseState.velocity = homingProfile.slowVelocity;
+            phaseState.index = 0;
+            stallDetector.begin(MotionPhase::Homing);
+            return TickResult::Running;
         }
-        std::cout << index << "\t" << controller_state[2] << "\tTarget: " << commandedPosition
-                  << "\tActual: " << currentPosition << "\t" << std::abs(commandedPosition - currentPosition) <<  "\tVelocity: " << controller_state[1] << std::endl;
 
+        if (valid && stallDetector.update(controller_state[2], controller_state[1], phaseState.cycleAcceleration)) {  // Torque above the homing model indicates a stall or similar issue
+            std::cout << "High torque/stall detected, stopping at position: " << currentPosition << "at index" << phaseState.index << std::endl;
+            std::cout << "extendLimitSwitch.readValue() " << extendLimitSwitch.readValue() << std::endl;
+            if (!extendLimitSwitch.readValue() == 0){
+                beginRecovery(100, -4.5f, false, true);  //Move forward a little bit
+                return TickResult::Running;
+            }
+            rezero(500.0f); // sets the current position to 500.0
+            commandedPosition = 500.0f;
+            currentPosition = 500.0f;
+            return finishPhase(TickResult::Stalled);  //obstruction encountered
+        }
+        if (homeLimitSwitch.readValue() == 0) {
+            return homeReached(commandedPosition, currentPosition);
+        }
+        return TickResult::Running;
+    }
 
+    default:
+        return finishPhase(TickResult::Done);
     }
 }
 
-// DECELERATION REVERSE
-void PositionManager::performDecelerationReverse(float& commandedPosition, float& currentPosition) {
-    std::cout << "DECELERATION REVERSE" << std::endl;
-    float stableVelocity = maxSpeed;
-    float currentVelocity = stableVelocity;
-    float decelerationRate = stableVelocity / decelerationSteps;
-    int index = 0;
-
-    for (size_t step = 0; step < decelerationSteps; ++step) {
-        index++;
-        commandedPosition += currentVelocity;
-        controller.sendWriteCommand(commandedPosition, std::numeric_limits<float>::quiet_NaN());
-        nanosleep(&req, nullptr);
-        auto controller_state = controller.sendReadCommand();
-        currentVelocity -= decelerationRate;
-        if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-            currentPosition = controller_state[0];
-            torques.push_back(controller_state[2]);
-        }
-        std::cout << index << "\t" << controller_state[2] << "\tTarget: " << commandedPosition
-                  << "\tActual: " << currentPosition << "\t" << std::abs(commandedPosition - currentPosition) <<  "\tVelocity: " << controller_state[1] << std::endl;;
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// BEGIN HOMING
+TickResult PositionManager::beginHoming(float& commandedPosition, float& currentPosition, bool twoStage) {
+    phaseState = PhaseState();
+    phaseState.phase = MotionPhase::Homing;
+    phaseState.startedNs = controller.nowNs();
+    stallDetector.begin(MotionPhase::Homing);
+    referenced = false;
+
+    if (twoStage) {
+        std::cout << "Starting Two Stage Homing..." << std::endl;
+        rezero(500.0f); // sets the current position to 500.0
+        commandedPosition = 500.0f;
+        currentPosition = 500.0f;
+        phaseState.homingStage = HomingStage::FastApproach;
+        phaseState.velocity = homingProfile.fastVelocity;
+        double periodSeconds = req.tv_sec + req.tv_nsec / 1e9;
+        phaseState.maxBackOffCycles = 50 + static_cast<long>(4.0 * homingProfile.backOffDistance / (homingProfile.backOffVelocity * periodSeconds));
+    } else {
+        std::cout << "Starting Homing..." << std::endl;
+        rezero(500.0f); // sets the current position to 500.0
+        phaseState.homingStage = HomingStage::Approach;
+        phaseState.velocity = 4.5f;
+    }
+
+    if (homeLimitSwitch.readValue() == 0) {
+        return homeReached(commandedPosition, currentPosition);
+    }
+    return TickResult::Running;
+}
+
+// HOME REACHED - home switch closed during an approach
+TickResult PositionManager::homeReached(float& commandedPosition, float& currentPosition) {
+    if (phaseState.homingStage == HomingStage::FastApproach) {
+        // Latch the position at the switch edge and back off for the slow approach
+        homeLatchPosition = currentPosition;
+        std::cout << "Fast approach latched home switch at: " << homeLatchPosition << std::endl;
+        phaseState.homingStage = HomingStage::BackOff;
+        phaseState.index = 0;
+        stallDetector.begin(MotionPhase::Homing);
+        return TickResult::Running;
+    }
+
+    if (phaseState.homingStage == HomingStage::SlowApproach) {
+        std::cout << "Slow approach found home switch at: " << currentPosition
+                  << "\tOffset from fast latch: " << currentPosition - homeLatchPosition << std::endl;
+    } else {
+        std::cout << "Button pressed, stopping at position: " << commandedPosition << std::endl;
+        std::cout << "Button pressed, stopping at position: " << currentPosition << std::endl;
+    }
+
+    // Blade and motor meet at the switch, the output encoder is referenced there
+    if (lastReplyValid) {
+        loadTracker.reference(lastReply.position, lastReply.output);
+    }
+
+    //Clean Up
+    rezero(500.0f); // sets the current position to 500.0
+    commandedPosition = 500.0f;
+    currentPosition = 500.0f;
+    referenced = true;
+    std::cout << "HOMED in " << (controller.nowNs() - phaseState.startedNs) / 1000000 << " ms" << std::endl;
+    return finishPhase(TickResult::Done);
+}
 
-        if (currentVelocity <= 0) {
-            std::cout << "Deceleration complete at step " << step + 1 << std::endl;
-            break;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// SEQUENCES
+void PositionManager::startSequence(const MotionStep* steps, size_t count) {
+    sequenceSteps = steps;
+    sequenceCount = count;
+    sequenceIndex = 0;
+    phaseState.phase = MotionPhase::Idle;
+}
+
+void PositionManager::cancelSequence() {
+    sequenceIndex = sequenceCount;
+    cancelPhase();
+}
+
+// TICK SEQUENCE - starts steps until one needs a control cycle, then runs that cycle
+TickResult PositionManager::tickSequence(float& commandedPosition, float& currentPosition) {
+    while (phaseState.phase == MotionPhase::Idle) {
+        if (sequenceIndex >= sequenceCount) {
+            return TickResult::Done;
+        }
+        const MotionStep& step = sequenceSteps[sequenceIndex++];
+        TickResult started = TickResult::Done;
+        switch (step.kind) {
+            case MotionStepKind::Rezero:
+                rezero(step.value); // sets the current position to value
+                commandedPosition = step.value;
+                currentPosition = step.value;
+                break;
+            case MotionStepKind::Phase:
+                started = beginPhase(step.phase, commandedPosition, currentPosition);
+                break;
+            case MotionStepKind::Hold:
+                started = beginHold(commandedPosition, step.value);
+                break;
+            case MotionStepKind::HoldAverage:
+                started = beginHold((commandedPosition + currentPosition) / 2.0f, step.value);
+                break;
+            case MotionStepKind::Report:
+                std::cout << commandedPosition << "\t" << currentPosition << std::endl;
+                break;
+        }
+        if (started == TickResult::Stalled || started == TickResult::Preempted) {
+            sequenceIndex = sequenceCount;
+            return started;
         }
     }
+
+    TickResult result = tick(commandedPosition, currentPosition);
+    if (result == TickResult::Stalled || result == TickResult::Preempted) {
+        sequenceIndex = sequenceCount;
+        return result;
+    }
+    if (result == TickResult::Done && sequenceIndex >= sequenceCount) {
+        return TickResult::Done;
+    }
+    return TickResult::Running;
 }
 
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// HOLD POSITION 
-void PositionManager::holdPosition(float position) {
 
-    struct timespec req = {0, 1200 * 1000};
-    controller.sendWriteCommand(position, 0.0);
-    nanosleep(&req, NULL);
-    auto controller_state = controller.sendReadCommand();
-    if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-        //torques.push_back(controller_state[2]);
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// BLOCKING WRAPPERS - run a phase to completion on the calling thread
+TickResult PositionManager::runToCompletion(TickResult result, float& commandedPosition, float& currentPosition) {
+    while (result == TickResult::Running) {
+        result = tick(commandedPosition, currentPosition);
     }
-    //std::cout << "Position: " << controller_state[0] << " Velocity: " << controller_state[1] << " Torque: " << controller_state[2] << std::endl;
+    return result;
+}
+
+// ACCELERATION
+void PositionManager::performAcceleration(float& commandedPosition, float& currentPosition) {
+    runToCompletion(beginPhase(MotionPhase::Acceleration, commandedPosition, currentPosition), commandedPosition, currentPosition);
+}
+
+// CRUISING
+void PositionManager::performCruising(float& commandedPosition, float& currentPosition) {
+    runToCompletion(beginPhase(MotionPhase::Cruising, commandedPosition, currentPosition), commandedPosition, currentPosition);
+}
+
+// DECELERATION
+float PositionManager::performDeceleration(float& commandedPosition, float& currentPosition) {
+    runToCompletion(beginPhase(MotionPhase::Deceleration, commandedPosition, currentPosition), commandedPosition, currentPosition);
+    return currentPosition;
+}
+
+// ACCELERATION REVERSE
+void PositionManager::performAccelerationReverse(float& commandedPosition, float& currentPosition) {
+    runToCompletion(beginPhase(MotionPhase::AccelerationReverse, commandedPosition, currentPosition), commandedPosition, currentPosition);
+}
+
+// CRUISING REVERSE
+void PositionManager::performCruisingReverse(float& commandedPosition, float& currentPosition) {
+    runToCompletion(beginPhase(MotionPhase::CruisingReverse, commandedPosition, currentPosition), commandedPosition, currentPosition);
+}
+
+// DECELERATION REVERSE
+void PositionManager::performDecelerationReverse(float& commandedPosition, float& currentPosition) {
+    runToCompletion(beginPhase(MotionPhase::DecelerationReverse, commandedPosition, currentPosition), commandedPosition, currentPosition);
+}
+
+// HOLD POSITION 
+void PositionManager::holdPosition(float position) {
+    float commandedPosition = position;
+    float currentPosition = position;
+    runToCompletion(beginHoldCycles(position, 1), commandedPosition, currentPosition);
 }
 
 // HOLD POSITION DURATION
 void PositionManager::holdPositionDuration(float position, float duration) {
-    long holdTime = static_cast<long>(duration * 1000000 / 1025);
-    struct timespec req = {0, 1200 * 1000};
-    for (long i = 0; i < holdTime; i++) {
-        controller.sendWriteCommand(position, 0.0);
-        nanosleep(&req, NULL);
-        auto controller_state = controller.sendReadCommand();
-        if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-            //torques.push_back(controller_state[0]);
-        }
-        //std::cout << "Position: " << controller_state[0] << " Velocity: " << controller_state[1] << " Torque: " << controller_state[2] << std::endl;
-    }
+    float commandedPosition = position;
+    float currentPosition = position;
+    runToCompletion(beginHold(position, duration), commandedPosition, currentPosition);
 }
 
 // HOLD POSITION NAN
 void PositionManager::holdPositionNan() {
-
-    struct timespec req = {0, 1200 * 1000};
-    controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), 0.0);
-    nanosleep(&req, NULL);
-    auto controller_state = controller.sendReadCommand();
-    if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-        //torques.push_back(controller_state[2]);
-    }
-    //std::cout << "Position: " << controller_state[0] << " Velocity: " << controller_state[1] << " Torque: " << controller_state[2] << std::endl;
+    float commandedPosition = std::numeric_limits<float>::quiet_NaN();
+    float currentPosition = commandedPosition;
+    runToCompletion(beginHoldCycles(commandedPosition, 1), commandedPosition, currentPosition);
 }
 
 // HOLD POSITION NAN Duration
 void PositionManager::holdPositionNanDuration(float duration) {
-    long holdTime = static_cast<long>(duration * 1000000 / 1025);
-    struct timespec req = {0, 1200 * 1000};
-    controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), 0.0);
-    nanosleep(&req, NULL);
-    auto controller_state = controller.sendReadCommand();
-    if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-        //torques.push_back(controller_state[2]);
-    }
-    //std::cout << "Position: " << controller_state[0] << " Velocity: " << controller_state[1] << " Torque: " << controller_state[2] << std::endl;
+    float commandedPosition = std::numeric_limits<float>::quiet_NaN();
+    float currentPosition = commandedPosition;
+    runToCompletion(beginHold(commandedPosition, duration), commandedPosition, currentPosition);
 }
 
-
 // HOMING
 bool PositionManager::homing(float& commandedPosition, float& currentPosition) {    
-    std::cout << "Starting Homing..." << std::endl;
-    controller.sendRezeroCommand(500.0); // sets the current position to 500.0
-    int index = 0;
-    struct timespec req = {0, 1200 * 1000};
-    
-    while (true) {
-        if (homeLimitSwitch.readValue() == 0) {  
-            std::cout << "Button pressed, stopping at position: " << commandedPosition << std::endl;
-            std::cout << "Button pressed, stopping at position: " << currentPosition << std::endl;
-            break;
-        }
-        controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), 4.5);
-        nanosleep(&req, NULL);
-        auto controller_state = controller.sendReadCommand();
-        index++;
-        if (controller_state[0] >= 450 && controller_state[0] <= 550) {
-            currentPosition = controller_state[0];
-            commandedPosition = currentPosition;
-            //std::cout << "Current Position: " << controller_state[0] << " Velocity: " << controller_state[1] << " Torque: " << controller_state[2] << std::endl;
-            //torques.push_back(controller_state[2]);
-            if (index > 20) {
-                if (controller_state[2] >= 0.13) {  // Check for torque limit indicating a stall or similar issue
-                    std::cout << "High torque/stall detected, stopping at position: " << currentPosition << "at index" << index << std::endl;
-                    //Move forward a little bit
-                    std::cout << "extendLimitSwitch.readValue() " << extendLimitSwitch.readValue() << std::endl;
-                    if (!extendLimitSwitch.readValue() == 0){
-                        for (int i = 0; i < 100; i++) {
-                            controller.sendWriteCommand(std::numeric_limits<float>::quiet_NaN(), -4.5);
-                            nanosleep(&req, NULL);
-                            auto controller_state = controller.sendReadCommand();
-                            //torques.push_back(controller_state[2]);
-                        }
-                    }
-                    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
-                    commandedPosition = 500.0f;
-                    currentPosition = 500.0f;
-                    return false;  //obstruction encountered
-                }
-            }
-            // Check if the button is pressed
-        }
-    }
-    //Clean Up
-    controller.sendRezeroCommand(500.0); // sets the current position to 500.0
-    commandedPosition = 500.0f;
-    currentPosition = 500.0f;
-    std::cout << "HOMED" << std::endl; 
-    return true; 
+    TickResult result = beginHoming(commandedPosition, currentPosition, homingProfile.twoStage);
+    return runToCompletion(result, commandedPosition, currentPosition) == TickResult::Done;
 } // End HOMING
 
+// HOMING TWO STAGE
+bool PositionManager::homingTwoStage(float& commandedPosition, float& currentPosition) {
+    TickResult result = beginHoming(commandedPosition, currentPosition, true);
+    return runToCompletion(result, commandedPosition, currentPosition) == TickResult::Done;
+} // End HOMING TWO STAGE
 
-// TRIPLE QUERY
-float PositionManager::tripleQuery() {
-    std::cout << "Querying initial position..." << std::endl;
-    struct timespec req = {0, 900 * 1000};
-    std::vector<float> positions(3);
 
-    while (true) {
-        // Collect the three position queries
-        for (int i = 0; i < 3; i++) {
+// QUERY ESTIMATE - only used when no control cycle has fed the estimator recently
+float PositionManager::queryEstimate(int rounds, int queriesPerRound) {
+    for (int round = 0; round < rounds; round++) {
+        if (preempted()) return std::numeric_limits<float>::quiet_NaN();
+        for (int i = 0; i < queriesPerRound; i++) {
             controller.sendQueryCommand();
-            nanosleep(&req, NULL);
-            auto controller_state = controller.sendReadCommand();
-            positions[i] = controller_state[0];  // Store each position in the vector
-            std::cout << "Query " << i << " Position: " << positions[i] << std::endl;
-        }
-
-        // Check if any position is within the range of 450 to 550
-        for (float position : positions) {
-            if (position >= 450.0f && position <= 550.0f) {
-                std::cout << "Confirmed Initial Position within range: " << position << std::endl;
-                return position;  // Return the first position within the range
+            controller.waitCycle(req);
+            std::vector<float>& controller_state = readReply();
+            std::cout << "Query " << i << " Position: " << controller_state[0] << std::endl;
+            if (acceptReply(controller_state)) {
+                return frame.toLogical(estimator.getPosition(controller.nowNs()));
             }
         }
+    }
+    return std::numeric_limits<float>::quiet_NaN();
+}
 
-        // If no position is in the range, print a message and the loop will run again
-        std::cout << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX" << std::endl; 
-        std::cout << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX" << std::endl; 
-        std::cout << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX" << std::endl; 
-        std::cout << "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX" << std::endl; 
+// TRIPLE QUERY
+float PositionManager::tripleQuery() {
+    if (estimator.isFresh(controller.nowNs())) {
+        return frame.toLogical(estimator.getPosition(controller.nowNs()));
     }
+    std::cout << "Querying initial position..." << std::endl;
+    float position = queryEstimate(10, 3);
+    if (std::isnan(position)) {
+        std::cout << "No position within range after 10 rounds of 3 queries" << std::endl;
+    } else {
+        std::cout << "Confirmed Initial Position within range: " << position << std::endl;
+    }
+    return position;
 }
 
 
-//VALID QUERY
+//VALID QUERY - the load side position when the output encoder is tracked, so the true
+// position comes from the same reply as the motor's
 float PositionManager::validQuery() {
+    if (estimator.isFresh(controller.nowNs())) {
+        return loadTracked() ? getLoadPosition() : frame.toLogical(estimator.getPosition(controller.nowNs()));
+    }
     std::cout << "Querying position..." << std::endl;
-    struct timespec req = {0, 900 * 1000};
-    int attemptCount = 0;
     const int maxAttempts = 5;
-    const float lowerBound = 450.0f;
-    const float upperBound = 550.0f;
-
-    while (attemptCount < maxAttempts) {
-        controller.sendQueryCommand();
-        nanosleep(&req, NULL);
-        auto controller_state = controller.sendReadCommand();
-        float position = controller_state[0];
-
-        std::cout << "Attempt " << attemptCount + 1 << ": Position = " << position << std::endl;
-
-        if (position >= lowerBound && position <= upperBound) {
-            std::cout << "Valid position found within range: " << position << std::endl;
-            return position;
-        }
-
-        attemptCount++;
+    float position = queryEstimate(1, maxAttempts);
+    if (std::isnan(position)) {
+        std::cout << "Failed to find a valid position after " << maxAttempts << " attempts." << std::endl;
+        return -1;  // Indicate failure to find a valid position
     }
-
-    std::cout << "Failed to find a valid position after " << maxAttempts << " attempts." << std::endl;
-    return -1;  // Indicate failure to find a valid position
+    if (loadTracked()) {
+        position = getLoadPosition();
+    }
+    std::cout << "Valid position found within range: " << position << std::endl;
+    return position;
 }
 
 
 
-
 #endif // POSITION_MANAGER_H
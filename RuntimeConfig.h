@@ -0,0 +1,518 @@
+#ifndef RUNTIME_CONFIG_H
+#define RUNTIME_CONFIG_H
+
+#include "MotionPhase.h"
+#include "StallDetector.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+// Immutable snapshot of every tunable. Startup keys (device, pins, control period) are
+// only read when the program starts, motion keys are applied between moves.
+struct MotionConfig {
+    uint64_t generation = 0;
+
+    // STARTUP
+    std::string controllerDevice = "/dev/fdcanusb";
+    int controllerCanId = 1;
+    std::vector<int> axisCanIds = {1, 2};                     // axes of a coordinated move, one fdcanusb
+    std::string gpioChip = "gpiochip0";
+    int homePin = 24;
+    int extendPin = 27;
+    int activatePin = 17;
+    int safetyPin = 21;
+    long controlPeriodUs = 1200;
+    std::string telemetrySegment = "/doomblade_telemetry";     // "none" disables publishing
+    std::string daemonSocket = "/tmp/doomblade.sock";
+
+    // DEVICE RECOVERY - fdcanusb write deadline, and when a link that stopped answering is reopened
+    int writeTimeoutMs = 20;
+    int recoveryTimeouts = 5;           // reply timeouts in a row before a recovery
+    long recoveryBudgetMs = 250;        // longest one recovery may take
+    long recoveryRetryMs = 1000;        // after a failed recovery, until the next one
+
+    // OUTPUT ENCODER - read in every state query, tracks the load side position and backlash
+    int outputEncoder = -1;             // moteus encoder source 0-2, -1 for none
+    float outputScale = 1.0f;           // encoder units per controller unit
+
+    // SPEED INPUT - potentiometer on an MCP3008 channel, sampled on its own thread
+    std::string speedDevice;            // spidev device, empty for none
+    int speedChannel = 0;
+    uint32_t speedClockHz = 1000000;
+    long speedSamplePeriodUs = 5000;
+    double speedFilterMs = 50.0;        // low pass time constant
+
+    // WARM START - skips homing when the position saved at the last clean stop still holds
+    std::string warmStartFile = "doomblade.state";              // "none" always homes
+    float warmStartTolerance = 0.02f;                           // controller units
+
+    // LINK CHARACTERIZATION - replaces controlPeriodUs with the shortest period the link sustains
+    bool linkCharacterize = false;
+    size_t linkQueries = 500;
+    double linkMissRate = 0.001;        // share of cycles allowed to read before the reply is in
+    long linkMarginUs = 100;            // host side of the cycle on top of the round trip
+    long linkMinPeriodUs = 600;
+    long linkMaxPeriodUs = 3000;
+
+    // MOTION - per cycle values are tuned at controlPeriodUs and rescaled to the period in use
+    float maxSpeed = 0.065f;
+    float cruisingEndPosition = 497.0f;
+    float cruisingReverseEndPosition = 501.8f;
+    size_t stepsToAccelerate = 30;
+    size_t decelerationSteps = 10;
+    int queryInterval = 1;              // cruising and holds query every Nth cycle, write only in between
+    float inputMinSpeed = 0.015f;       // speed input at either end, capped at maxSpeed
+    float inputMaxSpeed = 0.065f;
+
+    // HOMING
+    bool homingTwoStage = true;
+    float homingFastVelocity = 9.0f;
+    float homingBackOffVelocity = 4.5f;
+    float homingBackOffDistance = 0.2f;
+    float homingSlowVelocity = 1.0f;
+    float homingAcceleration = 1500.0f;
+
+    // STALL MODELS
+    StallModel cruisingStall = StallDetector().getModel(MotionPhase::Cruising);
+    StallModel cruisingReverseStall = StallDetector().getModel(MotionPhase::CruisingReverse);
+    StallModel homingStall = StallDetector().getModel(MotionPhase::Homing);
+    StallModel accelerationStall = StallDetector().getModel(MotionPhase::Acceleration);
+    StallModel accelerationReverseStall = StallDetector().getModel(MotionPhase::AccelerationReverse);
+
+    // COORDINATED AXES
+    std::vector<float> axisPhaseOffsets;        // seconds each axis runs behind the first, missing is 0
+    float axisFollowingError = 0.5f;            // commanded to measured distance that counts as a stall
+    int axisFollowingErrorCycles = 20;
+    float axisTorqueLimit = 0.5f;
+    int axisMissedReplies = 10;
+
+    inline struct timespec controlPeriod() const { return {controlPeriodUs / 1000000, (controlPeriodUs % 1000000) * 1000}; }
+};
+
+// Loads a key/value file in the drpi1.cfg style and republishes it whenever it changes
+// on disk. Readers get an immutable snapshot through one atomic pointer load. Replaced
+// snapshots are freed only after the reader has acquired a newer generation, so a
+// snapshot in use is never freed under it. One reader thread (the control loop).
+class RuntimeConfig {
+public:
+    // Constructor
+    explicit RuntimeConfig(const std::string& path) : path(path) {}
+    ~RuntimeConfig();
+
+    inline bool load();
+    inline bool start();
+    inline void stop();
+
+    // Reader side, call between moves. Also declares older snapshots unused.
+    inline const MotionConfig& acquire();
+
+    // Reader side. One motion key over the current snapshot, published as a new generation.
+    // Startup keys are refused. Lasts until the file next reloads.
+    inline bool set(const std::string& key, const std::string& value);
+
+    static inline bool parse(std::istream& input, MotionConfig& config);
+
+    // Every value within a range the blade can run with, else the first key outside in
+    // problem. Against the previous snapshot, null at startup: a reload cannot switch off
+    // stall detection or its hard limit that the running config has on.
+    static inline bool validate(const MotionConfig& config, const MotionConfig* previous, std::string& problem);
+
+private:
+    static inline bool setValue(MotionConfig& config, const std::string& key, const std::string& value);
+    static inline bool setStallValue(StallModel& model, const std::string& field, const std::string& value);
+    static inline void validateStall(const StallModel& model, const StallModel* previous, const std::string& prefix, std::string& problem);
+    template <typename T>
+    static inline std::vector<T> parseList(const std::string& value);
+    inline void publish(MotionConfig* snapshot);
+    inline void reclaim();
+    inline void watch();
+
+    std::string path;
+    std::atomic<const MotionConfig*> current{nullptr};
+    std::atomic<uint64_t> generation{0};
+    std::atomic<uint64_t> readerGeneration{0};
+    std::mutex publishMutex;
+    std::vector<std::pair<uint64_t, const MotionConfig*>> retired;  // generation that replaced it
+    std::thread watcher;
+    std::atomic<bool> running{false};
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+RuntimeConfig::~RuntimeConfig() {
+    stop();
+    for (auto& entry : retired) {
+        delete entry.second;
+    }
+    delete current.load();
+}
+
+// PARSE - "key value" per line, '#' starts a comment
+bool RuntimeConfig::parse(std::istream& input, MotionConfig& config) {
+    std::string line;
+    int lineNumber = 0;
+    bool ok = true;
+    while (std::getline(input, line)) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream fields(line);
+        std::string key, value;
+        if (!(fields >> key)) {
+            continue;
+        }
+        if (!(fields >> value) || !setValue(config, key, value)) {
+            std::cerr << "Config line " << lineNumber << ": cannot apply '" << line << "'" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool RuntimeConfig::setValue(MotionConfig& config, const std::string& key, const std::string& value) {
+    try {
+        if (key == "controller.device")                config.controllerDevice = value;
+        else if (key == "controller.can_id")           config.controllerCanId = std::stoi(value);
+        else if (key == "controller.axis_ids")         config.axisCanIds = parseList<int>(value);
+        else if (key == "controller.write_timeout_ms") config.writeTimeoutMs = std::stoi(value);
+        else if (key == "controller.recovery_timeouts") config.recoveryTimeouts = std::stoi(value);
+        else if (key == "controller.recovery_budget_ms") config.recoveryBudgetMs = std::stol(value);
+        else if (key == "controller.recovery_retry_ms") config.recoveryRetryMs = std::stol(value);
+        else if (key == "gpio.chip")                   config.gpioChip = value;
+        else if (key == "gpio.home")                   config.homePin = std::stoi(value);
+        else if (key == "gpio.extend")                 config.extendPin = std::stoi(value);
+        else if (key == "gpio.activate")               config.activatePin = std::stoi(value);
+        else if (key == "gpio.safety")                 config.safetyPin = std::stoi(value);
+        else if (key == "control.period_us")           config.controlPeriodUs = std::stol(value);
+        else if (key == "telemetry.segment")           config.telemetrySegment = value == "none" ? std::string() : value;
+        else if (key == "daemon.socket")               config.daemonSocket = value;
+        else if (key == "output.encoder")              config.outputEncoder = std::stoi(value);
+        else if (key == "output.scale")                config.outputScale = std::stof(value);
+        else if (key == "speed.device")                config.speedDevice = value == "none" ? std::string() : value;
+        else if (key == "speed.channel")               config.speedChannel = std::stoi(value);
+        else if (key == "speed.clock_hz")              config.speedClockHz = std::stoul(value);
+        else if (key == "speed.sample_us")             config.speedSamplePeriodUs = std::stol(value);
+        else if (key == "speed.filter_ms")             config.speedFilterMs = std::stod(value);
+        else if (key == "warmstart.state_file")        config.warmStartFile = value == "none" ? std::string() : value;
+        else if (key == "warmstart.tolerance")         config.warmStartTolerance = std::stof(value);
+        else if (key == "link.characterize")           config.linkCharacterize = std::stoi(value) != 0;
+        else if (key == "link.queries")                config.linkQueries = std::stoul(value);
+        else if (key == "link.miss_rate")              config.linkMissRate = std::stod(value);
+        else if (key == "link.margin_us")              config.linkMarginUs = std::stol(value);
+        else if (key == "link.min_period_us")          config.linkMinPeriodUs = std::stol(value);
+        else if (key == "link.max_period_us")          config.linkMaxPeriodUs = std::stol(value);
+        else if (key == "motion.max_speed")            config.maxSpeed = std::stof(value);
+        else if (key == "motion.cruising_end")         config.cruisingEndPosition = std::stof(value);
+        else if (key == "motion.cruising_reverse_end") config.cruisingReverseEndPosition = std::stof(value);
+        else if (key == "motion.accel_steps")          config.stepsToAccelerate = std::stoul(value);
+        else if (key == "motion.decel_steps")          config.decelerationSteps = std::stoul(value);
+        else if (key == "motion.query_interval")       config.queryInterval = std::max(1, std::stoi(value));
+        else if (key == "motion.input_min_speed")      config.inputMinSpeed = std::stof(value);
+        else if (key == "motion.input_max_speed")      config.inputMaxSpeed = std::stof(value);
+        else if (key == "homing.two_stage")            config.homingTwoStage = std::stoi(value) != 0;
+        else if (key == "homing.fast_velocity")        config.homingFastVelocity = std::stof(value);
+        else if (key == "homing.back_off_velocity")    config.homingBackOffVelocity = std::stof(value);
+        else if (key == "homing.back_off_distance")    config.homingBackOffDistance = std::stof(value);
+        else if (key == "homing.slow_velocity")        config.homingSlowVelocity = std::stof(value);
+        else if (key == "homing.acceleration")         config.homingAcceleration = std::stof(value);
+        else if (key == "axes.phase_offsets")          config.axisPhaseOffsets = parseList<float>(value);
+        else if (key == "axes.following_error")        config.axisFollowingError = std::stof(value);
+        else if (key == "axes.following_error_cycles") config.axisFollowingErrorCycles = std::stoi(value);
+        else if (key == "axes.torque_limit")           config.axisTorqueLimit = std::stof(value);
+        else if (key == "axes.missed_replies")         config.axisMissedReplies = std::stoi(value);
+        else if (key.rfind("stall.cruising_reverse.", 0) == 0) return setStallValue(config.cruisingReverseStall, key.substr(23), value);
+        else if (key.rfind("stall.cruising.", 0) == 0)         return setStallValue(config.cruisingStall, key.substr(15), value);
+        else if (key.rfind("stall.homing.", 0) == 0)           return setStallValue(config.homingStall, key.substr(13), value);
+        else if (key.rfind("stall.acceleration_reverse.", 0) == 0) return setStallValue(config.accelerationReverseStall, key.substr(27), value);
+        else if (key.rfind("stall.acceleration.", 0) == 0)     return setStallValue(config.accelerationStall, key.substr(19), value);
+        else return false;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+bool RuntimeConfig::setStallValue(StallModel& model, const std::string& field, const std::string& value) {
+    if (field == "bias")                   model.bias = std::stof(value);
+    else if (field == "velocity_gain")     model.velocityGain = std::stof(value);
+    else if (field == "acceleration_gain") model.accelerationGain = std::stof(value);
+    else if (field == "drift")             model.drift = std::stof(value);
+    else if (field == "threshold")         model.threshold = std::stof(value);
+    else if (field == "hard_limit")        model.hardLimit = std::stof(value);
+    else if (field == "settle_samples")    model.settleSamples = std::stoul(value);
+    else if (field == "enabled")           model.enabled = std::stoi(value) != 0;
+    else return false;
+    return true;
+}
+
+// PARSE LIST - comma separated, "1,2" or "0,0.05"
+template <typename T>
+std::vector<T> RuntimeConfig::parseList(const std::string& value) {
+    std::vector<T> list;
+    std::istringstream items(value);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t used = 0;
+        double number = std::stod(item, &used);
+        if (used != item.size()) {
+            throw std::invalid_argument(item);
+        }
+        list.push_back(static_cast<T>(number));
+    }
+    return list;
+}
+
+// VALIDATE - NaN fails every range
+bool RuntimeConfig::validate(const MotionConfig& config, const MotionConfig* previous, std::string& problem) {
+    problem.clear();
+    auto within = [](double value, double low, double high) { return value >= low && value <= high; };
+    auto require = [&](bool ok, const char* key) {
+        if (!ok && problem.empty()) {
+            problem = key;
+        }
+    };
+
+    // STARTUP
+    require(within(config.controllerCanId, 1, 127), "controller.can_id");
+    for (int id : config.axisCanIds) {
+        require(within(id, 1, 127), "controller.axis_ids");
+    }
+    require(within(config.writeTimeoutMs, 1, 1000), "controller.write_timeout_ms");
+    require(within(config.recoveryTimeouts, 1, 1000), "controller.recovery_timeouts");
+    require(within(config.recoveryBudgetMs, 1, 10000), "controller.recovery_budget_ms");
+    require(within(config.recoveryRetryMs, 1, 600000), "controller.recovery_retry_ms");
+    require(within(config.controlPeriodUs, 200, 20000), "control.period_us");
+    require(within(config.outputEncoder, -1, 2), "output.encoder");
+    require(std::isfinite(config.outputScale) && config.outputScale != 0.0f, "output.scale");
+    require(within(config.speedChannel, 0, 7), "speed.channel");
+    require(within(config.speedClockHz, 1000, 3600000), "speed.clock_hz");
+    require(within(config.speedSamplePeriodUs, 100, 1000000), "speed.sample_us");
+    require(within(config.speedFilterMs, 0.0, 10000.0), "speed.filter_ms");
+    require(within(config.warmStartTolerance, 0.0, 1.0), "warmstart.tolerance");
+    require(within(config.linkQueries, 10, 100000), "link.queries");
+    require(within(config.linkMissRate, 0.0, 0.5), "link.miss_rate");
+    require(within(config.linkMarginUs, 0, 10000), "link.margin_us");
+    require(within(config.linkMinPeriodUs, 200, 20000), "link.min_period_us");
+    require(within(config.linkMaxPeriodUs, config.linkMinPeriodUs, 20000), "link.max_period_us");
+
+    // MOTION - per cycle at control.period_us, 0.15 is well past what the drive follows
+    require(within(config.maxSpeed, 1e-4, 0.15), "motion.max_speed");
+    require(within(config.inputMinSpeed, 1e-4, 0.15), "motion.input_min_speed");
+    require(within(config.inputMaxSpeed, config.inputMinSpeed, 0.15), "motion.input_max_speed");
+    require(within(config.cruisingEndPosition, 450.0, 550.0), "motion.cruising_end");
+    require(within(config.cruisingReverseEndPosition, 450.0, 550.0), "motion.cruising_reverse_end");
+    require(config.cruisingEndPosition < config.cruisingReverseEndPosition, "motion.cruising_reverse_end");
+    require(within(config.stepsToAccelerate, 1, 5000), "motion.accel_steps");
+    require(within(config.decelerationSteps, 1, 5000), "motion.decel_steps");
+    require(within(config.queryInterval, 1, 100), "motion.query_interval");
+
+    // HOMING - velocities per second
+    require(within(config.homingFastVelocity, 0.01, 20.0), "homing.fast_velocity");
+    require(within(config.homingBackOffVelocity, 0.01, 20.0), "homing.back_off_velocity");
+    require(within(config.homingBackOffDistance, 0.001, 5.0), "homing.back_off_distance");
+    require(within(config.homingSlowVelocity, 0.01, config.homingFastVelocity), "homing.slow_velocity");
+    require(within(config.homingAcceleration, 10.0, 100000.0), "homing.acceleration");
+
+    // COORDINATED AXES
+    for (float offset : config.axisPhaseOffsets) {
+        require(within(offset, 0.0, 10.0), "axes.phase_offsets");
+    }
+    require(within(config.axisFollowingError, 0.001, 10.0), "axes.following_error");
+    require(within(config.axisFollowingErrorCycles, 1, 10000), "axes.following_error_cycles");
+    require(within(config.axisTorqueLimit, 0.01, 5.0), "axes.torque_limit");
+    require(within(config.axisMissedReplies, 1, 10000), "axes.missed_replies");
+
+    // STALL MODELS
+    validateStall(config.cruisingStall, previous ? &previous->cruisingStall : nullptr, "stall.cruising", problem);
+    validateStall(config.cruisingReverseStall, previous ? &previous->cruisingReverseStall : nullptr, "stall.cruising_reverse", problem);
+    validateStall(config.homingStall, previous ? &previous->homingStall : nullptr, "stall.homing", problem);
+    validateStall(config.accelerationStall, previous ? &previous->accelerationStall : nullptr, "stall.acceleration", problem);
+    validateStall(config.accelerationReverseStall, previous ? &previous->accelerationReverseStall : nullptr, "stall.acceleration_reverse", problem);
+    return problem.empty();
+}
+
+// VALIDATE STALL - torques in Nm
+void RuntimeConfig::validateStall(const StallModel& model, const StallModel* previous, const std::string& prefix, std::string& problem) {
+    auto within = [](double value, double low, double high) { return value >= low && value <= high; };
+    auto require = [&](bool ok, const char* field) {
+        if (!ok && problem.empty()) {
+            problem = prefix + "." + field;
+        }
+    };
+    require(model.enabled || previous == nullptr || !previous->enabled, "enabled");
+    require(within(model.bias, -1.0, 2.0), "bias");
+    require(within(model.velocityGain, 0.0, 1.0), "velocity_gain");
+    require(within(model.accelerationGain, 0.0, 1.0), "acceleration_gain");
+    require(within(model.drift, 0.0, 2.0), "drift");
+    require(within(model.threshold, 0.001, 5.0), "threshold");
+    require(within(model.hardLimit, 0.0, 5.0) && (model.hardLimit > 0.0f || previous == nullptr || previous->hardLimit == 0.0f), "hard_limit");
+    require(within(model.settleSamples, 0, 10000), "settle_samples");
+}
+
+// LOAD - parse the file into a new snapshot, the current one stays on any error or any
+// value out of range
+bool RuntimeConfig::load() {
+    std::ifstream input(path);
+    if (!input.is_open()) {
+        std::cerr << "Failed to open config " << path << std::endl;
+        return false;
+    }
+    MotionConfig* snapshot = new MotionConfig();
+    std::string problem;
+    if (!parse(input, *snapshot)) {
+        std::cerr << "Config " << path << " not applied" << std::endl;
+        delete snapshot;
+        return false;
+    }
+    // Checked against a copy, the current snapshot may be replaced and freed meanwhile
+    MotionConfig previous;
+    bool started = false;
+    {
+        std::lock_guard<std::mutex> lock(publishMutex);
+        const MotionConfig* running = current.load();
+        if (running != nullptr) {
+            previous = *running;
+            started = true;
+        }
+    }
+    if (!validate(*snapshot, started ? &previous : nullptr, problem)) {
+        std::cerr << "Config " << path << " not applied, " << problem << " out of range" << std::endl;
+        delete snapshot;
+        return false;
+    }
+    publish(snapshot);
+    return true;
+}
+
+// PUBLISH - swap in the new snapshot, retire the old one
+void RuntimeConfig::publish(MotionConfig* snapshot) {
+    std::lock_guard<std::mutex> lock(publishMutex);
+    snapshot->generation = generation.load() + 1;
+    const MotionConfig* previous = current.exchange(snapshot);
+    generation.store(snapshot->generation);
+    if (previous != nullptr) {
+        retired.emplace_back(snapshot->generation, previous);
+    }
+    reclaim();
+}
+
+// RECLAIM - free snapshots replaced at or before the generation the reader has acquired
+void RuntimeConfig::reclaim() {
+    uint64_t seen = readerGeneration.load();
+    size_t kept = 0;
+    for (auto& entry : retired) {
+        if (entry.first <= seen) {
+            delete entry.second;
+        } else {
+            retired[kept++] = entry;
+        }
+    }
+    retired.resize(kept);
+}
+
+// ACQUIRE - generation first, so the pointer loaded is never older than the generation announced
+const MotionConfig& RuntimeConfig::acquire() {
+    uint64_t seen = generation.load();
+    const MotionConfig* snapshot = current.load();
+    readerGeneration.store(seen);
+    if (snapshot == nullptr) {
+        static const MotionConfig defaults;
+        return defaults;
+    }
+    return *snapshot;
+}
+
+// SET - the base snapshot cannot be freed under us, only the reader frees by acquiring
+bool RuntimeConfig::set(const std::string& key, const std::string& value) {
+    static const char* const startupPrefixes[] = {"controller.", "gpio.", "control.", "telemetry.", "daemon.", "link.", "warmstart.", "output.", "speed."};
+    for (const char* prefix : startupPrefixes) {
+        if (key.rfind(prefix, 0) == 0) {
+            return false;
+        }
+    }
+    const MotionConfig& base = acquire();
+    MotionConfig* snapshot = new MotionConfig(base);
+    std::string problem;
+    if (!setValue(*snapshot, key, value)) {
+        delete snapshot;
+        return false;
+    }
+    if (!validate(*snapshot, &base, problem)) {
+        std::cerr << "Config " << key << " " << value << " not applied, " << problem << " out of range" << std::endl;
+        delete snapshot;
+        return false;
+    }
+    publish(snapshot);
+    return true;
+}
+
+// START - watch the directory, editors usually replace the file rather than rewrite it
+bool RuntimeConfig::start() {
+    if (running.exchange(true)) {
+        return true;
+    }
+    watcher = std::thread(&RuntimeConfig::watch, this);
+    return true;
+}
+
+void RuntimeConfig::stop() {
+    if (running.exchange(false) && watcher.joinable()) {
+        watcher.join();
+    }
+}
+
+void RuntimeConfig::watch() {
+    size_t slash = path.find_last_of('/');
+    std::string directory = (slash == std::string::npos) ? "." : path.substr(0, slash);
+    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "Config reload disabled, cannot watch " << directory << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    alignas(inotify_event) char buffer[4096];
+    while (running.load()) {
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) > 0) {
+            bool changed = false;
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+                for (char* p = buffer; p < buffer + length; ) {
+                    inotify_event* event = reinterpret_cast<inotify_event*>(p);
+                    if (event->len > 0 && name == event->name) {
+                        changed = true;
+                    }
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+            if (changed && load()) {
+                std::cout << "Config " << path << " reloaded, generation " << generation.load() << std::endl;
+            }
+        }
+        std::lock_guard<std::mutex> lock(publishMutex);
+        reclaim();
+    }
+    close(fd);
+}
+
+#endif // RUNTIME_CONFIG_H
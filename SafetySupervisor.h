@@ -0,0 +1,232 @@
+#ifndef SAFETY_SUPERVISOR_H
+#define SAFETY_SUPERVISOR_H
+
+#include "MyController.h"
+#include "MyGpio.h"
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+
+// Why the supervisor tripped
+enum class SafetyTrip {
+    None,
+    SafetyReleased,     // safety switch released (or unreadable)
+    LimitConflict,      // home and extend limit both pressed, or unreadable
+    ControllerFault     // controller replies invalid or missing for too long
+};
+
+// Watches the safety switch, the limit switches and the controller link on its own
+// high priority thread. On a trip it brakes the controller straight away and raises a
+// flag that PositionManager checks every control cycle, so a running motion is
+// abandoned within one control period instead of at the end of the phase.
+// A capture or replay has no thread: the control thread polls once per cycle on the
+// controller's clock, so the supervisor's GPIO reads and brake sit in the recording at
+// the cycle they happened and a replay trips at that same cycle.
+class SafetySupervisor {
+public:
+    // Constructor
+    SafetySupervisor(MyController& controller, MyGpio& safetySwitch, MyGpio& homeLimitSwitch, MyGpio& extendLimitSwitch, struct timespec controlPeriod)
+    : controller(controller), safetySwitch(safetySwitch), homeLimitSwitch(homeLimitSwitch), extendLimitSwitch(extendLimitSwitch),
+      controlPeriodNs(controlPeriod.tv_sec * 1000000000LL + controlPeriod.tv_nsec) {}
+
+    ~SafetySupervisor() { stop(); }
+
+    inline bool start();
+    inline void stop();
+    inline void runOnControlThread() { controlThread = true; }
+    inline bool onControlThread() const { return controlThread; }
+    inline void poll();
+    inline void setFaultLimits(int maxInvalidReplies, int maxSilentPeriods);
+
+    // Control thread side
+    inline bool tripped() const { return trip.load(std::memory_order_acquire) != SafetyTrip::None; }
+    inline SafetyTrip reason() const { return trip.load(std::memory_order_acquire); }
+    inline bool acknowledged() const { return tripAcknowledged; }
+    inline void acknowledge();
+    inline void noteReply(bool valid);
+    inline bool rearm();
+
+    // Metrics
+    inline void printLatencyReport() const;
+    static inline const char* tripName(SafetyTrip why);
+
+private:
+    inline void run();
+    inline void raise(SafetyTrip why);
+    inline int64_t nowNs() const;
+
+    MyController& controller;
+    MyGpio& safetySwitch;
+    MyGpio& homeLimitSwitch;
+    MyGpio& extendLimitSwitch;
+    int64_t controlPeriodNs;
+    int maxInvalidReplies = 25;
+    int maxSilentPeriods = 100;
+    bool controlThread = false;     // polled by the control thread, no worker
+
+    std::thread worker;
+    std::atomic<bool> running{false};
+    std::atomic<SafetyTrip> trip{SafetyTrip::None};
+    std::atomic<int64_t> tripTimeNs{0};
+    std::atomic<int64_t> lastReplyNs{0};
+    std::atomic<int> consecutiveInvalid{0};
+
+    // Written by the control thread only
+    bool tripAcknowledged = false;
+    size_t latencySamples = 0;
+    int64_t totalLatencyNs = 0;
+    int64_t maxLatencyNs = 0;
+    int64_t lastLatencyNs = 0;
+    size_t overBudget = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// NOW - the controller's clock when polled with the stream, a capture replays it exactly
+int64_t SafetySupervisor::nowNs() const {
+    if (controlThread) {
+        return controller.nowNs();
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* SafetySupervisor::tripName(SafetyTrip why) {
+    switch (why) {
+        case SafetyTrip::SafetyReleased:  return "safety switch released";
+        case SafetyTrip::LimitConflict:   return "limit switch conflict";
+        case SafetyTrip::ControllerFault: return "controller fault";
+        default:                          return "none";
+    }
+}
+
+// START
+bool SafetySupervisor::start() {
+    if (controlThread || running.exchange(true)) {
+        return true;
+    }
+    worker = std::thread(&SafetySupervisor::run, this);
+
+    // Run above the control loop so a trip is never queued behind it
+    sched_param param{};
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+    int rc = pthread_setschedparam(worker.native_handle(), SCHED_FIFO, &param);
+    if (rc != 0) {
+        std::cerr << "Safety supervisor running without realtime priority: " << strerror(rc) << std::endl;
+    }
+    return true;
+}
+
+// STOP
+void SafetySupervisor::stop() {
+    if (running.exchange(false) && worker.joinable()) {
+        worker.join();
+    }
+}
+
+void SafetySupervisor::setFaultLimits(int newMaxInvalidReplies, int newMaxSilentPeriods) {
+    maxInvalidReplies = newMaxInvalidReplies;
+    maxSilentPeriods = newMaxSilentPeriods;
+}
+
+// RAISE - first trip wins, brake immediately from this thread
+void SafetySupervisor::raise(SafetyTrip why) {
+    SafetyTrip expected = SafetyTrip::None;
+    if (!trip.compare_exchange_strong(expected, why, std::memory_order_acq_rel)) {
+        return;
+    }
+    tripTimeNs.store(nowNs(), std::memory_order_release);
+    controller.sendBrakeCommand();
+}
+
+// POLL - one check of every input, the first failing one trips
+void SafetySupervisor::poll() {
+    if (tripped()) {
+        return;
+    }
+    if (safetySwitch.readValue() != 1) {
+        raise(SafetyTrip::SafetyReleased);
+        return;
+    }
+    int home = homeLimitSwitch.readValue();
+    int extend = extendLimitSwitch.readValue();
+    if (home < 0 || extend < 0 || (home == 0 && extend == 0)) {
+        raise(SafetyTrip::LimitConflict);
+    } else if (consecutiveInvalid.load(std::memory_order_relaxed) >= maxInvalidReplies) {
+        raise(SafetyTrip::ControllerFault);
+    } else {
+        int64_t lastReply = lastReplyNs.load(std::memory_order_relaxed);
+        if (lastReply != 0 && nowNs() - lastReply > maxSilentPeriods * controlPeriodNs) {
+            raise(SafetyTrip::ControllerFault);
+        }
+    }
+}
+
+// SUPERVISOR LOOP - polls four times per control period
+void SafetySupervisor::run() {
+    struct timespec period = {0, static_cast<long>(controlPeriodNs / 4)};
+    while (running.load(std::memory_order_relaxed)) {
+        poll();
+        nanosleep(&period, nullptr);
+    }
+}
+
+// ACKNOWLEDGE - called by the motion loop once it has stopped commanding motion
+void SafetySupervisor::acknowledge() {
+    if (!tripped() || tripAcknowledged) {
+        return;
+    }
+    tripAcknowledged = true;
+    int64_t latency = nowNs() - tripTimeNs.load(std::memory_order_acquire);
+    lastLatencyNs = latency;
+    totalLatencyNs += latency;
+    maxLatencyNs = std::max(maxLatencyNs, latency);
+    latencySamples++;
+    if (latency > controlPeriodNs) {
+        overBudget++;
+    }
+    std::cout << "SAFETY TRIP (" << tripName(reason()) << ") preempted motion after " << latency / 1000 << " us" << std::endl;
+}
+
+// NOTE REPLY - feeds the controller fault detection
+void SafetySupervisor::noteReply(bool valid) {
+    if (valid) {
+        consecutiveInvalid.store(0, std::memory_order_relaxed);
+        lastReplyNs.store(nowNs(), std::memory_order_relaxed);
+    } else {
+        consecutiveInvalid.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// REARM - only succeeds once the inputs are healthy again
+bool SafetySupervisor::rearm() {
+    if (safetySwitch.readValue() != 1) {
+        return false;
+    }
+    consecutiveInvalid.store(0, std::memory_order_relaxed);
+    lastReplyNs.store(0, std::memory_order_relaxed);
+    tripAcknowledged = false;
+    trip.store(SafetyTrip::None, std::memory_order_release);
+    return true;
+}
+
+// LATENCY REPORT
+void SafetySupervisor::printLatencyReport() const {
+    std::cout << "Safety preemption latency: ";
+    if (latencySamples == 0) {
+        std::cout << "no trips recorded" << std::endl;
+        return;
+    }
+    std::cout << "last " << lastLatencyNs / 1000 << " us"
+              << "\tmean " << totalLatencyNs / static_cast<int64_t>(latencySamples) / 1000 << " us"
+              << "\tmax " << maxLatencyNs / 1000 << " us"
+              << "\tbudget " << controlPeriodNs / 1000 << " us"
+              << "\tover budget " << overBudget << "/" << latencySamples << std::endl;
+}
+
+#endif // SAFETY_SUPERVISOR_H
@@ -0,0 +1,61 @@
+#ifndef SCENARIO_RUNNER_H
+#define SCENARIO_RUNNER_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <functional>
+
+// The harness shared by the scenario test programs. Each scenario prints one PASS or FAIL
+// line, its detail lines below it, and the run ends with the count that passed. The
+// program's exit code is what runScenarios returns.
+
+struct ScenarioResult {
+    bool passed = false;
+    std::string failure;
+    std::string detail;         // one or more lines, printed indented
+};
+
+struct Scenario {
+    const char* name;
+    std::function<ScenarioResult()> run;
+};
+
+// quiet drops what a scenario prints itself, its result lines are always shown
+inline int runScenarios(const std::vector<Scenario>& scenarios, bool quiet = false);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// RUN - every scenario in order, 0 when all passed
+int runScenarios(const std::vector<Scenario>& scenarios, bool quiet) {
+    // The cycle log is still formatted, only the terminal is left out
+    std::ofstream discard("/dev/null");
+    std::streambuf* console = std::cout.rdbuf();
+    std::streambuf* errors = std::cerr.rdbuf();
+
+    size_t failed = 0;
+    for (const Scenario& scenario : scenarios) {
+        if (quiet) {
+            std::cout.rdbuf(discard.rdbuf());
+            std::cerr.rdbuf(discard.rdbuf());
+        }
+        ScenarioResult result = scenario.run();
+        std::cout.rdbuf(console);
+        std::cerr.rdbuf(errors);
+
+        std::cout << scenario.name << ": " << (result.passed ? "PASS" : "FAIL " + result.failure) << std::endl;
+        size_t start = 0;
+        while (start < result.detail.size()) {
+            size_t end = result.detail.find('\n', start);
+            end = (end == std::string::npos) ? result.detail.size() : end;
+            std::cout << "  " << result.detail.substr(start, end - start) << std::endl;
+            start = end + 1;
+        }
+        failed += result.passed ? 0 : 1;
+    }
+    std::cout << scenarios.size() - failed << " of " << scenarios.size() << " scenarios passed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+#endif // SCENARIO_RUNNER_H
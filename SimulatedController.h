@@ -0,0 +1,440 @@
+#ifndef SIMULATED_CONTROLLER_H
+#define SIMULATED_CONTROLLER_H
+
+#include "ControllerTransport.h"
+#include "MyGpio.h"
+#include "CanFrameDecoder.h"
+#include "FloatConverter.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+// Physical model of one blade, positions in the controller's units. phys 0 is the home
+// switch edge, extension is negative.
+struct SimulatedPlantConfig {
+    double startPosition = -1.0;            // phys at power up
+    double startOutput = 500.0;             // controller position reported at startPosition
+    double extendSwitchAt = -3.3;           // extend switch closed at or below
+    double homeStop = 0.05;                 // hard stops
+    double extendStop = -3.4;
+    double tracking = 0.8;                  // share of the position error closed per command
+    double obstructionAt = -100.0;          // blade stops here moving out, torque goes high
+    float torque = 0.02f;
+    float obstructedTorque = 0.5f;
+    double backlash = 0.0;                  // load lags the motor by up to this, either way
+    double outputScale = 1.0;               // output encoder units per controller unit
+    double outputZero = 0.25;               // load phys where the output encoder reads 0
+};
+
+// Link between host and controller
+struct SimulatedLinkConfig {
+    int64_t latencyNs = 300000;             // command to reply
+    int64_t jitterNs = 100000;              // uniform on top of latency
+    uint32_t seed = 1;
+    bool hostTime = true;                   // host time between calls counts as simulated time
+};
+
+// Times of the last injected input and what followed it, -1 until seen
+struct SimulatedResponse {
+    int64_t inputNs = -1;
+    int64_t firstMotionNs = -1;             // first command moving the blade off where it was
+    int64_t extendSwitchNs = -1;
+    int64_t homeSwitchNs = -1;
+};
+
+// SIMULATED CONTROLLER - stands in for the fdcanusb, the moteus behind it and the GPIO lines
+// of the blade. Commands are decoded and applied to the plant, replies queue with the link
+// latency. Time is simulated: control period sleeps advance it without sleeping, host time
+// spent between them is measured and added, so a faster build shows up as shorter times.
+// Without host time a run depends on the seed alone and repeats exactly.
+class SimulatedController : public ControllerTransport, public GpioTap {
+public:
+    SimulatedController(unsigned int homePin, unsigned int extendPin,
+                        const SimulatedPlantConfig& plant = SimulatedPlantConfig(), const SimulatedLinkConfig& link = SimulatedLinkConfig());
+
+    inline bool open() override { return true; }
+    inline void close() override {}
+    inline ssize_t writeBytes(const char* data, size_t length) override;
+    inline ssize_t readBytes(char* buffer, size_t length) override;
+    inline bool waitReadable(int timeoutMs) override;
+    inline void sleep(const struct timespec& duration) override;
+    inline int64_t nowNs() const override;
+
+    inline bool simulated() const override { return true; }
+    inline int onRead(unsigned int gpio, int value) override;
+
+    // INPUTS - switch lines other than home and extend, released (1) unless set
+    inline void setInput(unsigned int gpio, int value);
+    inline void scheduleInput(int64_t atNs, unsigned int gpio, int value);
+    inline void markInput();                // starts a new SimulatedResponse at the current time
+    inline SimulatedResponse getResponse() const;
+
+    inline void setObstruction(double phys);
+    inline void setUuid(const uint8_t (&value)[16]);   // answered to "conf get uuid.uuid.N"
+    inline double getPosition() const;      // phys
+    inline double getLoadPosition() const;  // phys of the load, behind the backlash
+    inline size_t getCommands() const { return commands; }
+
+private:
+    struct Pending {
+        int64_t readyNs;
+        std::string bytes;
+    };
+
+    // Register writes and reads of one frame
+    struct FrameVisitor {
+        int mode = -1;
+        float position = std::numeric_limits<float>::quiet_NaN();
+        float velocity = 0.0f;
+        bool rezero = false;
+        float rezeroTo = 0.0f;
+        bool query = false;
+        uint32_t outputRegister = 0;    // encoder position register read along with the query
+
+        void onWrite(uint32_t reg, const RegisterValue& value) {
+            float real = value.type == RegisterType::F32 ? value.real : static_cast<float>(value.integer);
+            if (reg == 0x000) mode = value.integer;
+            else if (reg == 0x020) position = real;
+            else if (reg == 0x021) velocity = real;
+            else if (reg == 0x131) { rezero = true; rezeroTo = real; }
+        }
+        void onRead(uint32_t startReg, uint32_t count, RegisterType) {
+            query = query || (startReg <= 1 && startReg + count >= 4);
+            if (count == 1 && (startReg == 0x050 || startReg == 0x052 || startReg == 0x054)) {
+                outputRegister = startReg;
+            }
+        }
+        void onReply(uint32_t, const RegisterValue&) {}
+        void onError(MultiplexCommand, uint32_t, uint32_t) {}
+        void onStream(MultiplexCommand, uint32_t, uint32_t) {}
+        void onPoll(uint32_t, uint32_t) {}
+        void onNop() {}
+        void onUnknown(uint8_t) {}
+    };
+
+    inline void advance() const;
+    inline void applyInputs() const;
+    inline void handleLine(const char* begin, const char* end);
+    inline void handleDiagnostic(const CanLine& line, uint8_t command);
+    inline void move(double target, double dt);
+    inline void queue(const std::string& bytes);
+
+    unsigned int homePin;
+    unsigned int extendPin;
+    SimulatedPlantConfig plant;
+    SimulatedLinkConfig link;
+    mutable std::mutex mutex;
+
+    // Time, mutable so nowNs() can fold in host time
+    mutable int64_t simNs = 0;
+    mutable int64_t lastHostNs = 0;
+    mutable std::map<unsigned int, int> inputs;
+    mutable std::multimap<int64_t, std::pair<unsigned int, int>> scheduled;
+
+    // Plant
+    double phys;
+    double load;
+    double offset;
+    double velocity = 0.0;
+    float torque;
+    int64_t lastCommandNs = 0;
+    double markedPosition = 0.0;
+    mutable SimulatedResponse response;
+
+    // Link
+    std::string received;               // partial command line
+    std::deque<Pending> replies;
+    std::mt19937 random;
+    size_t commands = 0;
+
+    // Diagnostic stream
+    std::string diagnosticIn;           // partial command line
+    std::string diagnosticOut;          // text waiting for a poll
+    uint8_t uuid[16] = {0x5d, 0x0b, 0x7e, 0x21, 0x93, 0x4c, 0x18, 0xa6, 0x02, 0xf1, 0x6d, 0x3a, 0xc4, 0x88, 0x57, 0x9e};
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static inline int64_t simulatedHostNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SimulatedController::SimulatedController(unsigned int homePin, unsigned int extendPin, const SimulatedPlantConfig& plant, const SimulatedLinkConfig& link)
+    : homePin(homePin), extendPin(extendPin), plant(plant), link(link), phys(plant.startPosition), load(plant.startPosition),
+      offset(plant.startOutput - plant.startPosition), torque(plant.torque), random(link.seed) {
+    lastHostNs = simulatedHostNs();
+}
+
+// ADVANCE - host time since the last call counts as simulated time
+void SimulatedController::advance() const {
+    int64_t host = simulatedHostNs();
+    if (link.hostTime) {
+        simNs += host - lastHostNs;
+    }
+    lastHostNs = host;
+    applyInputs();
+}
+
+void SimulatedController::applyInputs() const {
+    while (!scheduled.empty() && scheduled.begin()->first <= simNs) {
+        inputs[scheduled.begin()->second.first] = scheduled.begin()->second.second;
+        scheduled.erase(scheduled.begin());
+    }
+}
+
+int64_t SimulatedController::nowNs() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance();
+    return simNs;
+}
+
+// SLEEP - a control period passes without waiting for it
+void SimulatedController::sleep(const struct timespec& duration) {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance();
+    simNs += duration.tv_sec * 1000000000LL + duration.tv_nsec;
+    applyInputs();
+}
+
+ssize_t SimulatedController::writeBytes(const char* data, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance();
+    received.append(data, length);
+    size_t end;
+    while ((end = received.find('\n')) != std::string::npos) {
+        handleLine(received.data(), received.data() + end);
+        received.erase(0, end + 1);
+    }
+    return static_cast<ssize_t>(length);
+}
+
+// HANDLE LINE - "can send <id> <hex>", every line is acknowledged, a query is answered
+void SimulatedController::handleLine(const char* begin, const char* end) {
+    CanLine line;
+    if (!parseCanLine(begin, end, line) || line.reply) {
+        queue("ERR\r\n");
+        return;
+    }
+    uint8_t first = 0;
+    HexCursor peek(line.hexBegin, line.hexEnd);
+    if (peek.readByte(first) && (first == 0x40 || first == 0x42)) {
+        handleDiagnostic(line, first);
+        return;
+    }
+    FrameVisitor frame;
+    decodeMultiplex(HexCursor(line.hexBegin, line.hexEnd), frame);
+    commands++;
+
+    double dt = lastCommandNs > 0 ? (simNs - lastCommandNs) / 1e9 : 0.0;
+    lastCommandNs = simNs;
+    if (frame.rezero) {
+        offset = frame.rezeroTo - phys;
+    }
+    if (frame.mode == 0x0a) {
+        double target = std::isnan(frame.position) ? phys + frame.velocity * dt : frame.position - offset;
+        if (response.inputNs >= 0 && response.firstMotionNs < 0 && std::abs(target - markedPosition) > 1e-3) {
+            response.firstMotionNs = simNs;
+        }
+        move(target, dt);
+    } else if (frame.mode >= 0) {
+        velocity = 0.0;     // stop and brake hold the blade where it is
+    }
+
+    std::string reply = "OK\r\n";
+    if (frame.query && (line.id & 0x8000) != 0) {
+        char text[64];
+        int length = std::snprintf(text, sizeof text, "rcv %x00 2c0301", line.id & 0x7f);
+        FloatConverter::writeHex(static_cast<float>(phys + offset), text + length);
+        FloatConverter::writeHex(static_cast<float>(velocity), text + length + 8);
+        FloatConverter::writeHex(torque, text + length + 16);
+        length += 24;
+        if (frame.outputRegister != 0) {
+            length += std::snprintf(text + length, sizeof text - length, "2d%02x", frame.outputRegister);
+            FloatConverter::writeHex(static_cast<float>((load - plant.outputZero) * plant.outputScale), text + length);
+            length += 8;
+        }
+        reply.append(text, length);
+        reply += "\r\n";
+    }
+    queue(reply);
+}
+
+// HANDLE DIAGNOSTIC - 0x40 carries console text in, a 0x42 poll takes up to its size out as
+// 0x41. Only "conf get uuid.uuid.N" is known, every other line is answered with ERR.
+void SimulatedController::handleDiagnostic(const CanLine& line, uint8_t command) {
+    HexCursor cursor(line.hexBegin, line.hexEnd);
+    uint8_t ignored, channel, size;
+    if (!cursor.readByte(ignored) || !cursor.readByte(channel) || !cursor.readByte(size)) {
+        queue("ERR\r\n");
+        return;
+    }
+    if (command == 0x40) {
+        for (uint8_t i = 0; i < size; i++) {
+            uint8_t byte;
+            if (!cursor.readByte(byte)) {
+                break;
+            }
+            diagnosticIn.push_back(static_cast<char>(byte));
+        }
+        size_t end;
+        while ((end = diagnosticIn.find('\n')) != std::string::npos) {
+            std::string text = diagnosticIn.substr(0, end);
+            diagnosticIn.erase(0, end + 1);
+            unsigned index;
+            char tail;
+            if (std::sscanf(text.c_str(), "conf get uuid.uuid.%u%c", &index, &tail) == 1 && index < 16) {
+                diagnosticOut += std::to_string(uuid[index]) + "\r\n";
+            } else {
+                diagnosticOut += "ERR unknown command\r\n";
+            }
+        }
+        queue("OK\r\n");
+        return;
+    }
+
+    std::string reply = "OK\r\n";
+    if ((line.id & 0x8000) != 0) {
+        size_t count = std::min<size_t>({size, diagnosticOut.size(), 61});
+        char text[32];
+        std::snprintf(text, sizeof text, "rcv %x00 41%02x%02x", line.id & 0x7f, channel, static_cast<unsigned>(count));
+        reply += text;
+        for (size_t i = 0; i < count; i++) {
+            std::snprintf(text, sizeof text, "%02x", static_cast<unsigned char>(diagnosticOut[i]));
+            reply += text;
+        }
+        reply += "\r\n";
+        diagnosticOut.erase(0, count);
+    }
+    queue(reply);
+}
+
+// MOVE - first order tracking of the target, clamped at the stops and any obstruction
+void SimulatedController::move(double target, double dt) {
+    double next = phys + (target - phys) * plant.tracking;
+    torque = plant.torque;
+    if (next < plant.obstructionAt && next < phys) {
+        next = std::max(phys, plant.obstructionAt);
+        torque = plant.obstructedTorque;
+    }
+    next = std::min(std::max(next, plant.extendStop), plant.homeStop);
+    velocity = dt > 0.0 ? (next - phys) / dt : 0.0;
+    phys = next;
+    load = std::min(std::max(load, phys - plant.backlash / 2.0), phys + plant.backlash / 2.0);
+    if (response.inputNs >= 0 && response.extendSwitchNs < 0 && phys <= plant.extendSwitchAt) {
+        response.extendSwitchNs = simNs;
+    }
+    if (response.inputNs >= 0 && response.homeSwitchNs < 0 && phys >= 0.0) {
+        response.homeSwitchNs = simNs;
+    }
+}
+
+void SimulatedController::queue(const std::string& bytes) {
+    int64_t jitter = link.jitterNs > 0 ? std::uniform_int_distribution<int64_t>(0, link.jitterNs)(random) : 0;
+    int64_t ready = simNs + link.latencyNs + jitter;
+    if (!replies.empty()) {
+        ready = std::max(ready, replies.back().readyNs);    // the link keeps order
+    }
+    replies.push_back({ready, bytes});
+}
+
+// WAIT READABLE - the clock jumps to the next reply when it is due within the timeout
+bool SimulatedController::waitReadable(int timeoutMs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance();
+    int64_t deadline = simNs + timeoutMs * 1000000LL;
+    if (replies.empty() || replies.front().readyNs > deadline) {
+        simNs = deadline;
+        applyInputs();
+        return false;
+    }
+    simNs = std::max(simNs, replies.front().readyNs);
+    applyInputs();
+    return true;
+}
+
+// READ BYTES - whatever has arrived, never blocks
+ssize_t SimulatedController::readBytes(char* buffer, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance();
+    size_t copied = 0;
+    while (!replies.empty() && replies.front().readyNs <= simNs && copied < length) {
+        Pending& front = replies.front();
+        size_t count = std::min(length - copied, front.bytes.size());
+        memcpy(buffer + copied, front.bytes.data(), count);
+        copied += count;
+        front.bytes.erase(0, count);
+        if (front.bytes.empty()) {
+            replies.pop_front();
+        }
+    }
+    return static_cast<ssize_t>(copied);
+}
+
+// GPIO - home and extend follow the plant, 0 when closed
+int SimulatedController::onRead(unsigned int gpio, int) {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance();
+    if (gpio == homePin) {
+        return phys >= 0.0 ? 0 : 1;
+    }
+    if (gpio == extendPin) {
+        return phys <= plant.extendSwitchAt ? 0 : 1;
+    }
+    auto found = inputs.find(gpio);
+    return found == inputs.end() ? 1 : found->second;
+}
+
+void SimulatedController::setInput(unsigned int gpio, int value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    inputs[gpio] = value;
+}
+
+void SimulatedController::scheduleInput(int64_t atNs, unsigned int gpio, int value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    scheduled.insert({atNs, {gpio, value}});
+}
+
+void SimulatedController::markInput() {
+    std::lock_guard<std::mutex> lock(mutex);
+    advance();
+    response = SimulatedResponse();
+    response.inputNs = simNs;
+    markedPosition = phys;
+}
+
+SimulatedResponse SimulatedController::getResponse() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return response;
+}
+
+void SimulatedController::setObstruction(double at) {
+    std::lock_guard<std::mutex> lock(mutex);
+    plant.obstructionAt = at;
+}
+
+void SimulatedController::setUuid(const uint8_t (&value)[16]) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::memcpy(uuid, value, sizeof uuid);
+}
+
+double SimulatedController::getPosition() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return phys;
+}
+
+double SimulatedController::getLoadPosition() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return load;
+}
+
+#endif // SIMULATED_CONTROLLER_H
@@ -0,0 +1,71 @@
+#ifndef SIMULATED_SPI_DEVICE_H
+#define SIMULATED_SPI_DEVICE_H
+
+#include "SpeedInput.h"
+#include <atomic>
+#include <random>
+#include <ctime>
+#include <cstdint>
+
+// MCP3008 stand-in for SpeedInput. Channels are set from any thread while the sampling
+// thread converts them. A transfer can be given a latency, so a slow or stuck bus costs the
+// sampling thread and nothing else, plus noise and spikes on the reading, and can be made
+// to fail.
+class SimulatedSpiDevice : public SpiDevice {
+public:
+    explicit SimulatedSpiDevice(uint32_t seed = 11) : random(seed) {}
+
+    inline void setChannel(int channel, int value) { channels[channel & 0x07].store(value, std::memory_order_relaxed); }
+    inline void setLatency(long latencyUs) { transferLatencyUs.store(latencyUs, std::memory_order_relaxed); }
+    inline void setNoise(int amplitude, double spikeChance) {
+        noise.store(amplitude, std::memory_order_relaxed);
+        spikes.store(spikeChance, std::memory_order_relaxed);
+    }
+    inline void setFailing(bool fail) { failing.store(fail, std::memory_order_relaxed); }
+    inline uint64_t getTransfers() const { return transfers.load(std::memory_order_relaxed); }
+
+    inline bool open() override { return true; }
+    inline void close() override {}
+    inline bool transfer(const uint8_t* tx, uint8_t* rx, size_t length) override;
+
+private:
+    std::atomic<int> channels[8] = {};
+    std::atomic<long> transferLatencyUs{0};
+    std::atomic<int> noise{0};
+    std::atomic<double> spikes{0.0};
+    std::atomic<bool> failing{false};
+    std::atomic<uint64_t> transfers{0};
+    std::mt19937 random;                // sampling thread only
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// TRANSFER - answers a single ended conversion request the way the MCP3008 clocks it out
+bool SimulatedSpiDevice::transfer(const uint8_t* tx, uint8_t* rx, size_t length) {
+    transfers.fetch_add(1, std::memory_order_relaxed);
+    long latencyUs = transferLatencyUs.load(std::memory_order_relaxed);
+    if (latencyUs > 0) {
+        struct timespec latency = {latencyUs / 1000000, (latencyUs % 1000000) * 1000};
+        nanosleep(&latency, nullptr);
+    }
+    if (failing.load(std::memory_order_relaxed) || length < 3 || tx[0] != 0x01 || (tx[1] & 0x80) == 0) {
+        return false;
+    }
+    int value = channels[(tx[1] >> 4) & 0x07].load(std::memory_order_relaxed);
+    int amplitude = noise.load(std::memory_order_relaxed);
+    if (amplitude > 0) {
+        value += std::uniform_int_distribution<int>(-amplitude, amplitude)(random);
+    }
+    if (std::uniform_real_distribution<double>(0.0, 1.0)(random) < spikes.load(std::memory_order_relaxed)) {
+        value = (value < 512) ? 1023 : 0;
+    }
+    value = std::clamp(value, 0, 1023);
+    for (size_t i = 0; i < length; i++) {
+        rx[i] = 0;
+    }
+    rx[1] = static_cast<uint8_t>((value >> 8) & 0x03);
+    rx[2] = static_cast<uint8_t>(value & 0xff);
+    return true;
+}
+
+#endif // SIMULATED_SPI_DEVICE_H
@@ -0,0 +1,223 @@
+#ifndef SPEED_INPUT_H
+#define SPEED_INPUT_H
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+// Full duplex SPI transfers to one chip select. spidev is the normal device, a simulated
+// MCP3008 stands in for it in tests.
+class SpiDevice {
+public:
+    virtual ~SpiDevice() = default;
+
+    virtual bool open() = 0;
+    virtual void close() = 0;
+    virtual bool transfer(const uint8_t* tx, uint8_t* rx, size_t length) = 0;
+};
+
+// SPIDEV DEVICE - /dev/spidevB.C, mode 0
+class SpidevDevice : public SpiDevice {
+public:
+    explicit SpidevDevice(const std::string& path, uint32_t clockHz = 1000000) : path(path), clockHz(clockHz) {}
+    ~SpidevDevice() override { close(); }
+
+    inline bool open() override;
+    inline void close() override;
+    inline bool transfer(const uint8_t* tx, uint8_t* rx, size_t length) override;
+
+private:
+    std::string path;
+    uint32_t clockHz;
+    int fd = -1;
+};
+
+// Speed potentiometer on an MCP3008 channel, as DoomBlade_Orig.py read it. Sampled on its
+// own thread at normal priority, below the control loop: each sample is median filtered
+// over the last three conversions against spikes, then low pass filtered, and published
+// as a level from 0 to 1 through one atomic. The control loop only loads that atomic, so
+// it never waits on the SPI bus, however slow or stuck the bus is. The level is NaN
+// before the first sample and while conversions keep failing.
+class SpeedInput {
+public:
+    // Constructor
+    SpeedInput(SpiDevice& device, int channel, long samplePeriodUs = 5000, double filterMs = 50.0)
+    : device(device), channel(channel), samplePeriodNs(samplePeriodUs * 1000LL), filterMs(filterMs) {}
+
+    ~SpeedInput() { stop(); }
+
+    inline bool start();
+    inline void stop();
+    inline void setErrorLimit(int consecutiveErrors) { errorLimit = std::max(1, consecutiveErrors); }
+
+    // Control thread side
+    inline float getLevel() const { return level.load(std::memory_order_relaxed); }
+    inline bool isLive() const { return std::isfinite(getLevel()); }
+
+    // Metrics
+    inline uint64_t getSamples() const { return samples.load(std::memory_order_relaxed); }
+    inline uint64_t getErrors() const { return errors.load(std::memory_order_relaxed); }
+    inline void printReport(std::ostream& out) const;
+
+    // One single ended conversion, 0-1023, -1 when the transfer failed
+    static inline int readMcp3008(SpiDevice& device, int channel);
+
+private:
+    inline void run();
+    inline void sample(double weight);
+
+    SpiDevice& device;
+    int channel;
+    int64_t samplePeriodNs;
+    double filterMs;
+    int errorLimit = 10;
+
+    std::thread worker;
+    std::atomic<bool> running{false};
+    std::atomic<float> level{std::numeric_limits<float>::quiet_NaN()};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> errors{0};
+
+    // Sampling thread only
+    int recent[3] = {0, 0, 0};
+    int recentIndex = 0;
+    int recentCount = 0;
+    double filtered = 0.0;
+    int consecutiveErrors = 0;
+
+    static_assert(std::atomic<float>::is_always_lock_free, "the control loop reads the level without a lock");
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SpidevDevice::open() {
+    fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+    if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0 || ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+        ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &clockHz) < 0) {
+        std::cerr << "Failed to configure " << path << ": " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SpidevDevice::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool SpidevDevice::transfer(const uint8_t* tx, uint8_t* rx, size_t length) {
+    if (fd < 0) {
+        return false;
+    }
+    spi_ioc_transfer message{};
+    message.tx_buf = reinterpret_cast<uintptr_t>(tx);
+    message.rx_buf = reinterpret_cast<uintptr_t>(rx);
+    message.len = static_cast<uint32_t>(length);
+    message.speed_hz = clockHz;
+    message.bits_per_word = 8;
+    return ioctl(fd, SPI_IOC_MESSAGE(1), &message) == static_cast<int>(length);
+}
+
+// READ MCP3008 - start bit, single ended channel, then ten bits clocked out
+int SpeedInput::readMcp3008(SpiDevice& device, int channel) {
+    uint8_t tx[3] = {0x01, static_cast<uint8_t>((0x08 | (channel & 0x07)) << 4), 0x00};
+    uint8_t rx[3] = {0, 0, 0};
+    if (!device.transfer(tx, rx, sizeof tx)) {
+        return -1;
+    }
+    return ((rx[1] & 0x03) << 8) | rx[2];
+}
+
+// START - false when the device does not open, the level then stays NaN
+bool SpeedInput::start() {
+    if (running.load()) {
+        return true;
+    }
+    if (channel < 0 || channel > 7) {
+        std::cerr << "Speed input channel " << channel << " is not an MCP3008 channel" << std::endl;
+        return false;
+    }
+    if (!device.open()) {
+        return false;
+    }
+    running.store(true);
+    worker = std::thread(&SpeedInput::run, this);
+    return true;
+}
+
+// STOP
+void SpeedInput::stop() {
+    if (running.exchange(false) && worker.joinable()) {
+        worker.join();
+        device.close();
+    }
+}
+
+// SAMPLING LOOP - absolute deadlines, a slow transfer shortens the next wait instead of
+// stretching the period
+void SpeedInput::run() {
+    double weight = filterMs > 0.0 ? 1.0 - std::exp(-samplePeriodNs / (filterMs * 1e6)) : 1.0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (running.load(std::memory_order_relaxed)) {
+        sample(weight);
+        next.tv_nsec += samplePeriodNs;
+        next.tv_sec += next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+    }
+}
+
+// SAMPLE - the first good conversion is published as is, the filter starts from it
+void SpeedInput::sample(double weight) {
+    int raw = readMcp3008(device, channel);
+    if (raw < 0) {
+        errors.fetch_add(1, std::memory_order_relaxed);
+        consecutiveErrors = std::min(consecutiveErrors + 1, errorLimit);
+        if (consecutiveErrors == errorLimit) {
+            recentCount = 0;
+            level.store(std::numeric_limits<float>::quiet_NaN(), std::memory_order_relaxed);
+        }
+        return;
+    }
+    consecutiveErrors = 0;
+    samples.fetch_add(1, std::memory_order_relaxed);
+
+    recent[recentIndex] = raw;
+    recentIndex = (recentIndex + 1) % 3;
+    recentCount = std::min(recentCount + 1, 3);
+    int median = raw;
+    if (recentCount >= 3) {
+        median = std::max(std::min(recent[0], recent[1]), std::min(std::max(recent[0], recent[1]), recent[2]));
+    }
+    double value = median / 1023.0;
+    filtered = (recentCount == 1) ? value : filtered + weight * (value - filtered);
+    level.store(static_cast<float>(filtered), std::memory_order_relaxed);
+}
+
+void SpeedInput::printReport(std::ostream& out) const {
+    out << "Speed input: " << getSamples() << " samples, " << getErrors() << " errors, level " << getLevel() << std::endl;
+}
+
+#endif // SPEED_INPUT_H
@@ -0,0 +1,109 @@
+#ifndef STALL_DETECTOR_H
+#define STALL_DETECTOR_H
+
+#include "MotionPhase.h"
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+// Expected torque model and alarm levels for one motion phase
+struct StallModel {
+    float bias = 0.0f;              // expected torque with no motion
+    float velocityGain = 0.0f;      // expected torque per unit of |velocity| (units/s)
+    float accelerationGain = 0.0f;  // expected torque per unit of |acceleration| (units/s^2)
+    float drift = 0.0f;             // residual below this is treated as noise
+    float threshold = 0.0f;         // CUSUM alarm level
+    float hardLimit = 0.0f;         // instantaneous torque that trips on its own, 0 disables
+    size_t settleSamples = 0;       // samples ignored at the start of the phase
+    bool enabled = false;
+};
+
+// One sided CUSUM on the difference between measured and expected torque. A sustained
+// rise above the model trips after a few samples, a single spike during a transient does
+// not, and a hard obstruction still trips in one sample through the hard limit.
+// update() is O(1) with no allocation.
+class StallDetector {
+public:
+    StallDetector() {
+        StallModel cruising;
+        cruising.bias = 0.05f;
+        cruising.accelerationGain = 0.00005f;
+        cruising.drift = 0.04f;
+        cruising.threshold = 0.12f;
+        cruising.hardLimit = 0.30f;
+        cruising.settleSamples = 10;
+        cruising.enabled = true;
+        models[index(MotionPhase::Cruising)] = cruising;
+
+        StallModel cruisingReverse;
+        cruisingReverse.bias = 0.10f;
+        cruisingReverse.accelerationGain = 0.00005f;
+        cruisingReverse.drift = 0.08f;
+        cruisingReverse.threshold = 0.25f;
+        cruisingReverse.hardLimit = 0.55f;
+        cruisingReverse.settleSamples = 4;
+        cruisingReverse.enabled = true;
+        models[index(MotionPhase::CruisingReverse)] = cruisingReverse;
+
+        // The ramps load the blade as cruising does, plus the commanded acceleration
+        StallModel acceleration = cruising;
+        acceleration.settleSamples = 4;
+        models[index(MotionPhase::Acceleration)] = acceleration;
+        models[index(MotionPhase::AccelerationReverse)] = cruisingReverse;
+
+        StallModel homing;
+        homing.bias = 0.03f;
+        homing.velocityGain = 0.004f;
+        homing.accelerationGain = 0.00005f;
+        homing.drift = 0.03f;
+        homing.threshold = 0.08f;
+        homing.hardLimit = 0.20f;
+        homing.settleSamples = 10;
+        homing.enabled = true;
+        models[index(MotionPhase::Homing)] = homing;
+    }
+
+    inline void setModel(MotionPhase phase, const StallModel& model) { models[index(phase)] = model; }
+    inline const StallModel& getModel(MotionPhase phase) const { return models[index(phase)]; }
+
+    // Start watching a new phase
+    inline void begin(MotionPhase newPhase) {
+        phase = newPhase;
+        samples = 0;
+        statistic = 0.0f;
+        expected = 0.0f;
+    }
+
+    // Feed one valid reply, returns true when a stall is detected
+    inline bool update(float torque, float velocity, float acceleration) {
+        const StallModel& model = models[index(phase)];
+        if (!model.enabled) {
+            return false;
+        }
+        samples++;
+        expected = model.bias + model.velocityGain * std::fabs(velocity) + model.accelerationGain * std::fabs(acceleration);
+        if (samples <= model.settleSamples) {
+            return false;
+        }
+        if (model.hardLimit > 0.0f && torque >= model.hardLimit) {
+            return true;
+        }
+        statistic = std::max(0.0f, statistic + (torque - expected) - model.drift);
+        return statistic > model.threshold;
+    }
+
+    inline float getStatistic() const { return statistic; }
+    inline float getExpected() const { return expected; }
+    inline size_t getSamples() const { return samples; }
+
+private:
+    static inline size_t index(MotionPhase phase) { return static_cast<size_t>(phase); }
+
+    std::array<StallModel, kMotionPhaseCount> models{};
+    MotionPhase phase = MotionPhase::Idle;
+    size_t samples = 0;
+    float statistic = 0.0f;
+    float expected = 0.0f;
+};
+
+#endif // STALL_DETECTOR_H
@@ -0,0 +1,158 @@
+#ifndef STATE_ESTIMATOR_H
+#define STATE_ESTIMATOR_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+
+// Alpha-beta tracker of position and velocity, fed by every controller reply. Replies
+// whose position disagrees with the prediction by more than the gate are rejected as
+// outliers; between accepted replies the estimate is extrapolated from the tracked
+// velocity and its uncertainty grows with the time since the last accepted reply.
+class StateEstimator {
+public:
+    // Constructor
+    explicit StateEstimator(double periodSeconds)
+    : periodSeconds(periodSeconds) {}
+
+    inline void setGains(float newAlpha, float newBeta) { alpha = newAlpha; beta = newBeta; }
+    inline void setGate(float sigmas, float floor) { gateSigmas = sigmas; gateFloor = floor; }
+    inline void setFreshness(int periods) { freshPeriods = periods; }
+    inline void setPeriod(double seconds) { periodSeconds = seconds; }
+
+    inline void reset(float position) { reset(position, nowNs()); }
+    inline void reset(float position, int64_t timeNs);
+    inline bool update(float measuredPosition);
+    inline bool update(float measuredPosition, int64_t timeNs);
+
+    // Estimate extrapolated to now
+    inline float getPosition() const { return getPosition(nowNs()); }
+    inline float getPosition(int64_t timeNs) const;
+    inline float getVelocity() const { return velocity; }           // position units per second
+    inline float getUncertainty() const { return getUncertainty(nowNs()); }
+    inline float getUncertainty(int64_t timeNs) const;               // one sigma, position units
+    inline bool isInitialized() const { return initialized; }
+    inline bool isFresh() const { return isFresh(nowNs()); }         // accepted a reply within the freshness window
+    inline bool isFresh(int64_t timeNs) const;
+
+    // Counters
+    inline size_t getAccepted() const { return accepted; }
+    inline size_t getRejected() const { return rejected; }
+
+    static inline int64_t nowNs();
+
+private:
+    inline void initialize(float position, int64_t timeNs);
+
+    double periodSeconds;
+    float alpha = 0.6f;
+    float beta = 0.25f;
+    float gateSigmas = 6.0f;
+    float gateFloor = 0.05f;            // position units, covers one cycle at full speed
+    int freshPeriods = 20;
+    int maxConsecutiveRejects = 5;      // after this many the measurement is trusted again
+
+    bool initialized = false;
+    float position = 0.0f;
+    float velocity = 0.0f;
+    float residualVariance = 1e-6f;
+    int64_t lastUpdateNs = 0;
+    int consecutiveRejects = 0;
+    float lastRejectedPosition = 0.0f;
+    int64_t lastRejectedNs = 0;
+    size_t accepted = 0;
+    size_t rejected = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int64_t StateEstimator::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void StateEstimator::initialize(float newPosition, int64_t timeNs) {
+    initialized = true;
+    position = newPosition;
+    velocity = 0.0f;
+    residualVariance = gateFloor * gateFloor;  // wide gate until the filter has converged
+    lastUpdateNs = timeNs;
+    consecutiveRejects = 0;
+}
+
+// RESET - position is known exactly, e.g. right after a rezero
+void StateEstimator::reset(float newPosition, int64_t timeNs) {
+    initialize(newPosition, timeNs);
+}
+
+bool StateEstimator::update(float measuredPosition) {
+    return update(measuredPosition, nowNs());
+}
+
+// UPDATE - returns false when the measurement is rejected as an outlier
+bool StateEstimator::update(float measuredPosition, int64_t timeNs) {
+    if (!std::isfinite(measuredPosition)) {
+        rejected++;
+        return false;
+    }
+    if (!initialized) {
+        initialize(measuredPosition, timeNs);
+        accepted++;
+        return true;
+    }
+
+    float dt = static_cast<float>((timeNs - lastUpdateNs) / 1e9);
+    if (dt <= 0.0f) {
+        dt = static_cast<float>(periodSeconds);
+    }
+    float predicted = position + velocity * dt;
+    float residual = measuredPosition - predicted;
+
+    // OUTLIER GATE
+    float gate = gateSigmas * std::sqrt(residualVariance) + gateFloor;
+    if (std::fabs(residual) > gate) {
+        rejected++;
+        if (++consecutiveRejects < maxConsecutiveRejects) {
+            lastRejectedPosition = measuredPosition;
+            lastRejectedNs = timeNs;
+            return false;
+        }
+        // Persistent disagreement means the estimate is wrong, not the replies
+        float rejectedDt = static_cast<float>((timeNs - lastRejectedNs) / 1e9);
+        initialize(measuredPosition, timeNs);
+        if (rejectedDt > 0.0f) {
+            velocity = (measuredPosition - lastRejectedPosition) / rejectedDt;
+        }
+        accepted++;
+        return true;
+    }
+
+    position = predicted + alpha * residual;
+    velocity += beta * residual / dt;
+    residualVariance = 0.95f * residualVariance + 0.05f * residual * residual;
+    lastUpdateNs = timeNs;
+    consecutiveRejects = 0;
+    accepted++;
+    return true;
+}
+
+float StateEstimator::getPosition(int64_t timeNs) const {
+    float dt = static_cast<float>((timeNs - lastUpdateNs) / 1e9);
+    return position + velocity * dt;
+}
+
+float StateEstimator::getUncertainty(int64_t timeNs) const {
+    if (!initialized) {
+        return std::numeric_limits<float>::infinity();
+    }
+    double periods = (timeNs - lastUpdateNs) / 1e9 / periodSeconds;
+    return static_cast<float>(std::sqrt(residualVariance) * (1.0 + periods));
+}
+
+bool StateEstimator::isFresh(int64_t timeNs) const {
+    return initialized && (timeNs - lastUpdateNs) / 1e9 <= freshPeriods * periodSeconds;
+}
+
+#endif // STATE_ESTIMATOR_H
@@ -0,0 +1,412 @@
+#ifndef STREAM_CAPTURE_H
+#define STREAM_CAPTURE_H
+
+#include "ControllerTransport.h"
+#include "MyGpio.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+// Capture file: 8 byte magic, then one record per transport call or GPIO read
+//   kind (1 byte) | time since previous record in ns (varint) | payload
+//   Write, Read:  length + 1 (varint, 0 for a failed call) | bytes
+//   Wait:         result (1 byte)
+//   Gpio:         line (varint) | value (1 byte, signed)
+enum class CaptureKind : uint8_t {
+    Write = 0,
+    Read = 1,
+    Wait = 2,
+    Gpio = 3
+};
+
+static const char kCaptureMagic[8] = {'D', 'B', 'C', 'A', 'P', 1, 0, 0};
+
+// CAPTURE TRANSPORT - passes everything through to the real transport and logs it
+class CaptureTransport : public ControllerTransport, public GpioTap {
+public:
+    CaptureTransport(ControllerTransport& inner, const std::string& path) : inner(inner), path(path) {}
+    ~CaptureTransport() override { close(); }
+
+    inline bool open() override;
+    inline void close() override;
+    inline ssize_t writeBytes(const char* data, size_t length) override;
+    inline ssize_t readBytes(char* buffer, size_t length) override;
+    inline bool waitReadable(int timeoutMs) override;
+    inline bool reopen() override { return inner.reopen(); }  // the capture file stays open
+    inline void sleep(const struct timespec& duration) override { inner.sleep(duration); }
+    inline int64_t nowNs() const override { return streamNs.load(std::memory_order_acquire); }
+
+    inline bool simulated() const override { return false; }
+    inline int onRead(unsigned int gpio, int value) override;
+
+    inline size_t getRecords() const { return records; }
+
+private:
+    inline void record(CaptureKind kind, const char* data, ssize_t length);
+    inline void putVarint(uint64_t value);
+
+    ControllerTransport& inner;
+    std::string path;
+    std::FILE* file = nullptr;
+    std::mutex mutex;           // a supervisor thread would brake and read GPIO too
+    int64_t openNs = 0;
+    int64_t lastNs = 0;
+    std::atomic<int64_t> streamNs{0};   // time of the last stream record, what a replay reports
+    size_t records = 0;
+};
+
+// REPLAY TRANSPORT - plays a capture back in recorded order, at recorded speed or as
+// fast as possible. Reads and waits return what was recorded, writes are compared
+// against the recording, GPIO reads return the line's value at that point of the
+// recording. Once the capture is exhausted reads return 0 and GPIO reads return -1,
+// as an unreadable line does, so the safety checks stop the program.
+class ReplayTransport : public ControllerTransport, public GpioTap {
+public:
+    ReplayTransport(const std::string& path, bool realTime) : path(path), realTime(realTime) {}
+
+    inline bool open() override;
+    inline void close() override {}
+    inline ssize_t writeBytes(const char* data, size_t length) override;
+    inline ssize_t readBytes(char* buffer, size_t length) override;
+    inline bool waitReadable(int timeoutMs) override;
+    inline bool reopen() override { return true; }
+    inline void sleep(const struct timespec&) override {}
+    inline int64_t nowNs() const override { return currentNs; }
+
+    inline bool simulated() const override { return true; }
+    inline int onRead(unsigned int gpio, int value) override;
+
+    inline bool finished() const { return nextInput >= inputs.size() && nextWrite >= writes.size(); }
+    inline size_t getDivergences() const { return divergences; }
+    inline void printReport() const;
+
+private:
+    struct Record {
+        size_t index;           // position in the capture
+        int64_t timeNs;         // since the start of the capture
+        CaptureKind kind;
+        ssize_t length;         // -1 for a failed call
+        std::string bytes;
+        int value;
+    };
+
+    inline bool load();
+    inline void pace(const Record& record);
+    inline void advanceFrontier();
+    inline void diverged(const char* what, const Record* expected);
+
+    std::string path;
+    bool realTime;
+    std::vector<Record> writes;
+    std::vector<Record> inputs;                         // reads and waits, in order
+    std::map<unsigned int, std::vector<std::pair<size_t, int>>> lines;
+    std::map<unsigned int, size_t> tails;               // per line cursor past the last stream record
+    size_t streamEnd = 0;                               // index after the last stream record
+    size_t nextWrite = 0;
+    size_t nextInput = 0;
+    std::atomic<size_t> frontier{0};                    // index of the next unconsumed record
+    int64_t currentNs = 0;
+    int64_t startNs = 0;
+    size_t divergences = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// CAPTURE
+
+bool CaptureTransport::open() {
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open capture " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 16);
+    std::fwrite(kCaptureMagic, 1, sizeof kCaptureMagic, file);
+    openNs = inner.nowNs();
+    lastNs = openNs;
+    return inner.open();
+}
+
+void CaptureTransport::close() {
+    inner.close();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file != nullptr) {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
+
+void CaptureTransport::putVarint(uint64_t value) {
+    while (value >= 0x80) {
+        std::fputc(static_cast<int>((value & 0x7f) | 0x80), file);
+        value >>= 7;
+    }
+    std::fputc(static_cast<int>(value), file);
+}
+
+// RECORD - buffered, the file is only written when the stdio buffer fills
+void CaptureTransport::record(CaptureKind kind, const char* data, ssize_t length) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file == nullptr) {
+        return;
+    }
+    int64_t now = inner.nowNs();
+    std::fputc(static_cast<int>(kind), file);
+    putVarint(static_cast<uint64_t>(std::max<int64_t>(0, now - lastNs)));
+    lastNs = now;
+    if (kind != CaptureKind::Gpio) {
+        streamNs.store(now - openNs, std::memory_order_release);
+    }
+    switch (kind) {
+        case CaptureKind::Write:
+        case CaptureKind::Read:
+            putVarint(length < 0 ? 0 : static_cast<uint64_t>(length) + 1);
+            if (length > 0) {
+                std::fwrite(data, 1, static_cast<size_t>(length), file);
+            }
+            break;
+        case CaptureKind::Wait:
+            std::fputc(length != 0 ? 1 : 0, file);
+            break;
+        case CaptureKind::Gpio:
+            putVarint(static_cast<unsigned char>(data[0]));
+            std::fputc(static_cast<int>(static_cast<int8_t>(length)), file);
+            break;
+    }
+    records++;
+}
+
+ssize_t CaptureTransport::writeBytes(const char* data, size_t length) {
+    ssize_t written = inner.writeBytes(data, length);
+    record(CaptureKind::Write, data, written);
+    return written;
+}
+
+// READ - nothing there yet is recorded as an empty read, a failed one as -1 (EIO on replay)
+ssize_t CaptureTransport::readBytes(char* buffer, size_t length) {
+    ssize_t received = inner.readBytes(buffer, length);
+    int error = errno;
+    bool empty = received < 0 && ioStatusFromErrno(error) == IoStatus::Timeout;
+    record(CaptureKind::Read, buffer, empty ? 0 : received);
+    errno = error;
+    return received;
+}
+
+bool CaptureTransport::waitReadable(int timeoutMs) {
+    bool ready = inner.waitReadable(timeoutMs);
+    record(CaptureKind::Wait, nullptr, ready ? 1 : 0);
+    return ready;
+}
+
+int CaptureTransport::onRead(unsigned int gpio, int value) {
+    char line = static_cast<char>(gpio);
+    record(CaptureKind::Gpio, &line, value);
+    return value;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// REPLAY
+
+bool ReplayTransport::open() {
+    if (!load()) {
+        return false;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    startNs = now.tv_sec * 1000000000LL + now.tv_nsec;
+    advanceFrontier();
+    return true;
+}
+
+// LOAD - reads the whole capture, records are split by kind but keep their position
+bool ReplayTransport::load() {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open capture " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    char magic[sizeof kCaptureMagic];
+    if (std::fread(magic, 1, sizeof magic, file) != sizeof magic || memcmp(magic, kCaptureMagic, sizeof magic) != 0) {
+        std::cerr << path << " is not a capture file" << std::endl;
+        std::fclose(file);
+        return false;
+    }
+
+    auto getVarint = [file](uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c = std::fgetc(file);
+            if (c == EOF) return false;
+            value |= static_cast<uint64_t>(c & 0x7f) << shift;
+            if ((c & 0x80) == 0) return true;
+        }
+        return false;
+    };
+
+    int64_t timeNs = 0;
+    size_t index = 0;
+    int kind;
+    bool truncated = false;
+    while ((kind = std::fgetc(file)) != EOF) {
+        Record record{index, 0, static_cast<CaptureKind>(kind), 0, std::string(), 0};
+        uint64_t delta, value;
+        if (!getVarint(delta)) { truncated = true; break; }
+        timeNs += static_cast<int64_t>(delta);
+        record.timeNs = timeNs;
+        if (record.kind == CaptureKind::Write || record.kind == CaptureKind::Read) {
+            if (!getVarint(value)) { truncated = true; break; }
+            record.length = static_cast<ssize_t>(value) - 1;
+            if (record.length > 0) {
+                record.bytes.resize(static_cast<size_t>(record.length));
+                if (std::fread(&record.bytes[0], 1, record.bytes.size(), file) != record.bytes.size()) { truncated = true; break; }
+            }
+        } else if (record.kind == CaptureKind::Wait) {
+            int result = std::fgetc(file);
+            if (result == EOF) { truncated = true; break; }
+            record.value = result;
+        } else if (record.kind == CaptureKind::Gpio) {
+            int level;
+            if (!getVarint(value) || (level = std::fgetc(file)) == EOF) { truncated = true; break; }
+            lines[static_cast<unsigned int>(value)].emplace_back(index, static_cast<int8_t>(level));
+            index++;
+            continue;
+        } else {
+            std::cerr << "Unknown record kind " << kind << " in " << path << std::endl;
+            truncated = true;
+            break;
+        }
+        if (record.kind == CaptureKind::Write) {
+            writes.push_back(std::move(record));
+        } else {
+            inputs.push_back(std::move(record));
+        }
+        index++;
+        streamEnd = index;
+    }
+    std::fclose(file);
+    if (truncated) {
+        std::cerr << "Capture " << path << " is truncated, replaying the first " << index << " records" << std::endl;
+    }
+    return true;
+}
+
+// PACE - at recorded speed a record is not released before its original time
+void ReplayTransport::pace(const Record& record) {
+    currentNs = std::max(currentNs, record.timeNs);
+    if (!realTime) {
+        return;
+    }
+    int64_t due = startNs + record.timeNs;
+    struct timespec until = {static_cast<time_t>(due / 1000000000LL), static_cast<long>(due % 1000000000LL)};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr);
+}
+
+void ReplayTransport::advanceFrontier() {
+    size_t next = SIZE_MAX;
+    if (nextWrite < writes.size()) next = std::min(next, writes[nextWrite].index);
+    if (nextInput < inputs.size()) next = std::min(next, inputs[nextInput].index);
+    frontier.store(next, std::memory_order_release);
+}
+
+void ReplayTransport::diverged(const char* what, const Record* expected) {
+    if (divergences++ < 10) {
+        std::cerr << "Replay diverged at " << what;
+        if (expected != nullptr) {
+            std::cerr << ", capture record " << expected->index;
+        }
+        std::cerr << std::endl;
+    }
+}
+
+ssize_t ReplayTransport::writeBytes(const char* data, size_t length) {
+    if (nextWrite >= writes.size()) {
+        diverged("write past the end of the capture", nullptr);
+        return static_cast<ssize_t>(length);
+    }
+    const Record& record = writes[nextWrite++];
+    pace(record);
+    if (record.length != static_cast<ssize_t>(length) || record.bytes.compare(0, std::string::npos, data, length) != 0) {
+        diverged("write", &record);
+    }
+    advanceFrontier();
+    return record.length;
+}
+
+ssize_t ReplayTransport::readBytes(char* buffer, size_t length) {
+    while (nextInput < inputs.size() && inputs[nextInput].kind != CaptureKind::Read) {
+        diverged("read where the capture waited", &inputs[nextInput]);
+        nextInput++;
+    }
+    if (nextInput >= inputs.size()) {
+        advanceFrontier();
+        return 0;
+    }
+    const Record& record = inputs[nextInput++];
+    pace(record);
+    size_t copied = std::min(length, record.bytes.size());
+    memcpy(buffer, record.bytes.data(), copied);
+    advanceFrontier();
+    if (record.length < 0) {
+        errno = EIO;
+        return -1;
+    }
+    if (record.length == 0) {
+        errno = EAGAIN;     // nothing had arrived
+        return -1;
+    }
+    return static_cast<ssize_t>(copied);
+}
+
+bool ReplayTransport::waitReadable(int) {
+    if (nextInput >= inputs.size()) {
+        return false;
+    }
+    const Record& record = inputs[nextInput];
+    if (record.kind == CaptureKind::Read) {
+        return true;    // not recorded as a wait, the data was already there
+    }
+    nextInput++;
+    pace(record);
+    advanceFrontier();
+    return record.value != 0;
+}
+
+// GPIO - last value recorded for the line before the next unconsumed record. Past the
+// last stream record the reads recorded after it are handed out in order, then -1.
+int ReplayTransport::onRead(unsigned int gpio, int) {
+    auto found = lines.find(gpio);
+    if (found == lines.end() || found->second.empty()) {
+        return -1;
+    }
+    const auto& history = found->second;
+    size_t next = frontier.load(std::memory_order_acquire);
+    if (next == SIZE_MAX) {
+        auto tail = tails.find(gpio);
+        if (tail == tails.end()) {
+            auto first = std::lower_bound(history.begin(), history.end(), std::make_pair(streamEnd, INT32_MIN));
+            tail = tails.emplace(gpio, static_cast<size_t>(first - history.begin())).first;
+        }
+        return tail->second < history.size() ? history[tail->second++].second : -1;
+    }
+    auto after = std::upper_bound(history.begin(), history.end(), std::make_pair(next, INT32_MAX));
+    if (after == history.begin()) {
+        return history.front().second;
+    }
+    return std::prev(after)->second;
+}
+
+void ReplayTransport::printReport() const {
+    std::cout << "Replay: " << nextWrite << "/" << writes.size() << " writes, "
+              << nextInput << "/" << inputs.size() << " reads, "
+              << divergences << " divergences" << std::endl;
+}
+
+#endif // STREAM_CAPTURE_H
@@ -0,0 +1,582 @@
+#ifndef TELEMETRY_ARCHIVE_H
+#define TELEMETRY_ARCHIVE_H
+
+#include "TelemetryPublisher.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+// Compressed archive of telemetry samples for long soak runs. A file is a header followed
+// by blocks, each decodable on its own: predictors restart at every block and its payload
+// carries a CRC, so a block torn by a power cut or a bad sector costs only that block.
+//
+//   file header   "DBTARCH" version
+//   block header  magic | version | samples | payload bytes | payload CRC-32 | first cycle | first time
+//   payload       bit stream, one sample after another
+//
+// Per sample after the first of a block:
+//   cycle, time     delta of delta: 0 | 10 +8 bits | 110 +14 | 1110 +20 | 1111 +64
+//   5 float chans   Gorilla XOR against the previous value of the channel:
+//                   0 same value | 10 meaningful bits in the previous window |
+//                   11 +5 bits leading zeros +5 bits length-1 + meaningful bits
+//   state           0 unchanged | 1 +16 bits (phase, motor state, reply valid)
+// The first sample of a block stores its floats and state raw. The float channels are
+// commanded and current position, reply position, velocity and torque. The estimator's
+// velocity and uncertainty are not archived.
+
+static const char kArchiveFileMagic[8] = {'D', 'B', 'T', 'A', 'R', 'C', 'H', 1};
+static const uint32_t kArchiveBlockMagic = 0x42415444;     // "DTAB"
+static const uint16_t kArchiveVersion = 1;
+static const size_t kArchiveChannels = 5;
+
+#pragma pack(push, 1)
+struct ArchiveBlockHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t channels;
+    uint32_t samples;
+    uint32_t payloadBytes;
+    uint32_t crc;
+    uint64_t firstCycle;
+    int64_t firstTimeNs;
+};
+#pragma pack(pop)
+
+// CRC-32 (IEEE), table built at compile time
+inline uint32_t archiveCrc32(const uint8_t* data, size_t length) {
+    static constexpr std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> entries{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+            entries[i] = crc;
+        }
+        return entries;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// BIT STREAM - most significant bit first
+class ArchiveBitWriter {
+public:
+    inline void reset() { bytes.clear(); accumulator = 0; used = 0; }
+    inline void reserve(size_t capacity) { bytes.reserve(capacity); }
+    inline void write(uint64_t value, int count);
+    inline void finish();       // pads the last byte with zeros
+    inline const std::vector<uint8_t>& data() const { return bytes; }
+
+private:
+    std::vector<uint8_t> bytes;
+    uint64_t accumulator = 0;
+    int used = 0;               // bits waiting in the accumulator, always < 8 between calls
+};
+
+class ArchiveBitReader {
+public:
+    ArchiveBitReader(const uint8_t* data, size_t length) : data(data), length(length) {}
+    inline bool read(int count, uint64_t& value);
+    inline bool readBit(bool& bit) {
+        uint64_t value;
+        if (!read(1, value)) return false;
+        bit = value != 0;
+        return true;
+    }
+
+private:
+    const uint8_t* data;
+    size_t length;
+    size_t position = 0;       // in bits
+};
+
+// Predictor state of one block, shared by writer and reader so they stay in step
+struct ArchiveChannelState {
+    uint32_t previous = 0;
+    int leading = -1;           // window of the last meaningful bits, -1 before the first
+    int trailing = 0;
+};
+
+struct ArchiveBlockState {
+    uint64_t samples = 0;
+    uint64_t cycle = 0;
+    int64_t cycleDelta = 1;
+    int64_t timeNs = 0;
+    int64_t timeDelta = 0;
+    uint16_t state = 0;
+    ArchiveChannelState channels[kArchiveChannels];
+};
+
+// Streams samples into an archive file. append() only touches memory; a full block is
+// written with one fwrite. Nothing allocates once the block buffer is reserved.
+class TelemetryArchiveWriter {
+public:
+    explicit TelemetryArchiveWriter(const std::string& path, uint32_t samplesPerBlock = 4096)
+    : path(path), samplesPerBlock(samplesPerBlock == 0 ? 1 : samplesPerBlock) {}
+    ~TelemetryArchiveWriter() { close(); }
+
+    inline bool open();         // appends to an existing archive
+    inline bool append(const TelemetrySample& sample);
+    inline bool flush();        // writes the partial block, the next append starts a new one
+    inline void close();
+
+    inline uint64_t getSamples() const { return samples; }
+    inline uint64_t getBlocks() const { return blocks; }
+    inline uint64_t getBytesWritten() const { return bytesWritten; }
+
+private:
+    inline void encode(const TelemetrySample& sample);
+    inline void encodeDelta(int64_t deltaOfDelta);
+    inline void encodeFloat(ArchiveChannelState& channel, float value);
+
+    std::string path;
+    uint32_t samplesPerBlock;
+    std::FILE* file = nullptr;
+    ArchiveBitWriter bits;
+    ArchiveBlockState block;
+    uint64_t firstCycle = 0;
+    int64_t firstTimeNs = 0;
+    uint64_t samples = 0;
+    uint64_t blocks = 0;
+    uint64_t bytesWritten = 0;
+};
+
+// Streams blocks back out. A block that fails its checks is skipped and the reader
+// resynchronises on the next block magic.
+class TelemetryArchiveReader {
+public:
+    explicit TelemetryArchiveReader(const std::string& path) : path(path) {}
+    ~TelemetryArchiveReader() { close(); }
+
+    inline bool open();
+    inline void close();
+    inline bool nextBlock(std::vector<TelemetrySample>& out);   // false at the end of the file
+
+    inline uint64_t getBlocks() const { return blocks; }
+    inline uint64_t getCorruptBlocks() const { return corruptBlocks; }
+
+private:
+    inline bool resync();
+    inline bool decode(const ArchiveBlockHeader& header, std::vector<TelemetrySample>& out);
+    inline bool decodeDelta(ArchiveBitReader& reader, int64_t& deltaOfDelta);
+    inline bool decodeFloat(ArchiveBitReader& reader, ArchiveChannelState& channel, float& value);
+
+    std::string path;
+    std::FILE* file = nullptr;
+    std::vector<uint8_t> payload;
+    uint64_t blocks = 0;
+    uint64_t corruptBlocks = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// CHANNELS
+
+static inline void archiveChannels(const TelemetrySample& sample, float (&values)[kArchiveChannels]) {
+    values[0] = sample.commandedPosition;
+    values[1] = sample.currentPosition;
+    values[2] = sample.reply.position;
+    values[3] = sample.reply.velocity;
+    values[4] = sample.reply.torque;
+}
+
+static inline void archiveRestore(TelemetrySample& sample, const float (&values)[kArchiveChannels]) {
+    sample.commandedPosition = values[0];
+    sample.currentPosition = values[1];
+    sample.reply.position = values[2];
+    sample.reply.velocity = values[3];
+    sample.reply.torque = values[4];
+}
+
+static inline uint16_t archiveState(const TelemetrySample& sample) {
+    return static_cast<uint16_t>((sample.phase & 0x3f) | ((sample.motorState & 0x3f) << 6) | ((sample.replyValid & 1) << 12));
+}
+
+static inline void archiveRestoreState(TelemetrySample& sample, uint16_t state) {
+    sample.phase = state & 0x3f;
+    sample.motorState = (state >> 6) & 0x3f;
+    sample.replyValid = (state >> 12) & 1;
+}
+
+static inline uint32_t archiveFloatBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof bits);
+    return bits;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// BIT STREAM
+
+void ArchiveBitWriter::write(uint64_t value, int count) {
+    if (count > 32) {
+        write(value >> 32, count - 32);
+        count = 32;
+    }
+    value &= (count == 64) ? ~0ull : ((1ull << count) - 1);
+    accumulator = (accumulator << count) | value;
+    used += count;
+    while (used >= 8) {
+        used -= 8;
+        bytes.push_back(static_cast<uint8_t>(accumulator >> used));
+    }
+    accumulator &= (1ull << used) - 1;
+}
+
+void ArchiveBitWriter::finish() {
+    if (used > 0) {
+        bytes.push_back(static_cast<uint8_t>(accumulator << (8 - used)));
+        accumulator = 0;
+        used = 0;
+    }
+}
+
+bool ArchiveBitReader::read(int count, uint64_t& value) {
+    if (position + count > length * 8) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < count; ) {
+        size_t byte = position >> 3;
+        int offset = static_cast<int>(position & 7);
+        int take = std::min(8 - offset, count - i);
+        uint64_t chunk = (data[byte] >> (8 - offset - take)) & ((1u << take) - 1);
+        value = (value << take) | chunk;
+        position += take;
+        i += take;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// WRITER
+
+bool TelemetryArchiveWriter::open() {
+    close();
+    file = std::fopen(path.c_str(), "ab");
+    if (file == nullptr) {
+        std::cerr << "Failed to open archive " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (std::ftell(file) == 0) {
+        std::fwrite(kArchiveFileMagic, 1, sizeof kArchiveFileMagic, file);
+        bytesWritten += sizeof kArchiveFileMagic;
+    }
+    // Worst case sample: two 68 bit deltas, five 44 bit floats, a 17 bit state
+    bits.reserve(static_cast<size_t>(samplesPerBlock) * 48 + 16);
+    bits.reset();
+    block = ArchiveBlockState();
+    return true;
+}
+
+bool TelemetryArchiveWriter::append(const TelemetrySample& sample) {
+    if (file == nullptr) {
+        return false;
+    }
+    encode(sample);
+    samples++;
+    return block.samples < samplesPerBlock || flush();
+}
+
+// ENCODE - the first sample of a block goes into the header and raw floats
+void TelemetryArchiveWriter::encode(const TelemetrySample& sample) {
+    float values[kArchiveChannels];
+    archiveChannels(sample, values);
+    uint16_t state = archiveState(sample);
+
+    if (block.samples == 0) {
+        firstCycle = sample.cycle;
+        firstTimeNs = sample.timeNs;
+        block.cycle = sample.cycle;
+        block.timeNs = sample.timeNs;
+        for (size_t i = 0; i < kArchiveChannels; i++) {
+            block.channels[i].previous = archiveFloatBits(values[i]);
+            bits.write(block.channels[i].previous, 32);
+        }
+        block.state = state;
+        bits.write(state, 16);
+        block.samples = 1;
+        return;
+    }
+
+    int64_t cycleDelta = static_cast<int64_t>(sample.cycle - block.cycle);
+    encodeDelta(cycleDelta - block.cycleDelta);
+    block.cycle = sample.cycle;
+    block.cycleDelta = cycleDelta;
+
+    int64_t timeDelta = sample.timeNs - block.timeNs;
+    encodeDelta(timeDelta - block.timeDelta);
+    block.timeNs = sample.timeNs;
+    block.timeDelta = timeDelta;
+
+    for (size_t i = 0; i < kArchiveChannels; i++) {
+        encodeFloat(block.channels[i], values[i]);
+    }
+    if (state == block.state) {
+        bits.write(0, 1);
+    } else {
+        bits.write(1, 1);
+        bits.write(state, 16);
+        block.state = state;
+    }
+    block.samples++;
+}
+
+void TelemetryArchiveWriter::encodeDelta(int64_t value) {
+    if (value == 0) {
+        bits.write(0b0, 1);
+    } else if (value >= -(1 << 7) && value < (1 << 7)) {
+        bits.write(0b10, 2);
+        bits.write(static_cast<uint64_t>(value), 8);
+    } else if (value >= -(1 << 13) && value < (1 << 13)) {
+        bits.write(0b110, 3);
+        bits.write(static_cast<uint64_t>(value), 14);
+    } else if (value >= -(1 << 19) && value < (1 << 19)) {
+        bits.write(0b1110, 4);
+        bits.write(static_cast<uint64_t>(value), 20);
+    } else {
+        bits.write(0b1111, 4);
+        bits.write(static_cast<uint64_t>(value), 64);
+    }
+}
+
+// ENCODE FLOAT - XOR with the previous value, only the meaningful bits are kept
+void TelemetryArchiveWriter::encodeFloat(ArchiveChannelState& channel, float value) {
+    uint32_t current = archiveFloatBits(value);
+    uint32_t x = current ^ channel.previous;
+    channel.previous = current;
+    if (x == 0) {
+        bits.write(0b0, 1);
+        return;
+    }
+    int leading = __builtin_clz(x);
+    int trailing = __builtin_ctz(x);
+    if (leading > 31) leading = 31;
+    if (channel.leading >= 0 && leading >= channel.leading && trailing >= channel.trailing) {
+        int meaningful = 32 - channel.leading - channel.trailing;
+        bits.write(0b10, 2);
+        bits.write(x >> channel.trailing, meaningful);
+        return;
+    }
+    int meaningful = 32 - leading - trailing;
+    bits.write(0b11, 2);
+    bits.write(static_cast<uint64_t>(leading), 5);
+    bits.write(static_cast<uint64_t>(meaningful - 1), 5);
+    bits.write(x >> trailing, meaningful);
+    channel.leading = leading;
+    channel.trailing = trailing;
+}
+
+// FLUSH - header and payload in one write
+bool TelemetryArchiveWriter::flush() {
+    if (file == nullptr || block.samples == 0) {
+        return file != nullptr;
+    }
+    bits.finish();
+    const std::vector<uint8_t>& payload = bits.data();
+    ArchiveBlockHeader header;
+    header.magic = kArchiveBlockMagic;
+    header.version = kArchiveVersion;
+    header.channels = kArchiveChannels;
+    header.samples = static_cast<uint32_t>(block.samples);
+    header.payloadBytes = static_cast<uint32_t>(payload.size());
+    header.crc = archiveCrc32(payload.data(), payload.size());
+    header.firstCycle = firstCycle;
+    header.firstTimeNs = firstTimeNs;
+
+    bool ok = std::fwrite(&header, sizeof header, 1, file) == 1
+              && (payload.empty() || std::fwrite(payload.data(), payload.size(), 1, file) == 1)
+              && std::fflush(file) == 0;
+    bytesWritten += sizeof header + payload.size();
+    blocks++;
+    bits.reset();
+    block = ArchiveBlockState();
+    if (!ok) {
+        std::cerr << "Failed to write archive " << path << ": " << strerror(errno) << std::endl;
+    }
+    return ok;
+}
+
+void TelemetryArchiveWriter::close() {
+    if (file == nullptr) {
+        return;
+    }
+    flush();
+    std::fclose(file);
+    file = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// READER
+
+bool TelemetryArchiveReader::open() {
+    close();
+    file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open archive " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    char magic[sizeof kArchiveFileMagic];
+    if (std::fread(magic, 1, sizeof magic, file) != sizeof magic || std::memcmp(magic, kArchiveFileMagic, sizeof magic) != 0) {
+        std::cerr << path << " is not a telemetry archive" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void TelemetryArchiveReader::close() {
+    if (file != nullptr) {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
+
+// RESYNC - one byte past the last candidate, scan for the next block magic
+bool TelemetryArchiveReader::resync() {
+    uint32_t window = 0;
+    int c;
+    int seen = 0;
+    while ((c = std::fgetc(file)) != EOF) {
+        window = (window >> 8) | (static_cast<uint32_t>(c) << 24);    // little endian on the wire
+        if (++seen >= 4 && window == kArchiveBlockMagic) {
+            std::fseek(file, -4, SEEK_CUR);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TelemetryArchiveReader::nextBlock(std::vector<TelemetrySample>& out) {
+    out.clear();
+    while (file != nullptr) {
+        long start = std::ftell(file);
+        ArchiveBlockHeader header;
+        if (std::fread(&header, sizeof header, 1, file) != 1) {
+            return false;
+        }
+        bool plausible = header.magic == kArchiveBlockMagic && header.version == kArchiveVersion
+                         && header.channels == kArchiveChannels && header.samples > 0
+                         && header.payloadBytes <= static_cast<uint64_t>(header.samples) * 48 + 16;
+        if (plausible) {
+            payload.resize(header.payloadBytes);
+            if (header.payloadBytes > 0 && std::fread(payload.data(), header.payloadBytes, 1, file) != 1) {
+                corruptBlocks++;    // torn at the end of the file
+                return false;
+            }
+            if (archiveCrc32(payload.data(), payload.size()) == header.crc && decode(header, out)) {
+                blocks++;
+                return true;
+            }
+        }
+        corruptBlocks++;
+        out.clear();
+        std::fseek(file, start + 1, SEEK_SET);
+        if (!resync()) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool TelemetryArchiveReader::decode(const ArchiveBlockHeader& header, std::vector<TelemetrySample>& out) {
+    ArchiveBitReader reader(payload.data(), payload.size());
+    ArchiveBlockState block;
+    float values[kArchiveChannels];
+    uint64_t raw;
+
+    block.cycle = header.firstCycle;
+    block.timeNs = header.firstTimeNs;
+    for (size_t i = 0; i < kArchiveChannels; i++) {
+        if (!reader.read(32, raw)) return false;
+        block.channels[i].previous = static_cast<uint32_t>(raw);
+        std::memcpy(&values[i], &block.channels[i].previous, sizeof(float));
+    }
+    if (!reader.read(16, raw)) return false;
+    block.state = static_cast<uint16_t>(raw);
+
+    out.reserve(header.samples);
+    for (uint32_t n = 0; n < header.samples; n++) {
+        if (n > 0) {
+            int64_t deltaOfDelta;
+            if (!decodeDelta(reader, deltaOfDelta)) return false;
+            block.cycleDelta += deltaOfDelta;
+            block.cycle += block.cycleDelta;
+            if (!decodeDelta(reader, deltaOfDelta)) return false;
+            block.timeDelta += deltaOfDelta;
+            block.timeNs += block.timeDelta;
+            for (size_t i = 0; i < kArchiveChannels; i++) {
+                if (!decodeFloat(reader, block.channels[i], values[i])) return false;
+            }
+            bool changed;
+            if (!reader.readBit(changed)) return false;
+            if (changed) {
+                if (!reader.read(16, raw)) return false;
+                block.state = static_cast<uint16_t>(raw);
+            }
+        }
+        TelemetrySample sample;
+        sample.cycle = block.cycle;
+        sample.timeNs = block.timeNs;
+        archiveRestore(sample, values);
+        archiveRestoreState(sample, block.state);
+        out.push_back(sample);
+    }
+    return true;
+}
+
+bool TelemetryArchiveReader::decodeDelta(ArchiveBitReader& reader, int64_t& value) {
+    static const int widths[] = {8, 14, 20, 64};
+    int prefix = 0;
+    bool bit;
+    while (prefix < 4) {
+        if (!reader.readBit(bit)) return false;
+        if (!bit) break;
+        prefix++;
+    }
+    if (prefix == 0) {
+        value = 0;
+        return true;
+    }
+    int width = widths[prefix - 1];
+    uint64_t raw;
+    if (!reader.read(width, raw)) return false;
+    if (width < 64 && (raw & (1ull << (width - 1)))) {
+        raw |= ~0ull << width;      // sign extend
+    }
+    value = static_cast<int64_t>(raw);
+    return true;
+}
+
+bool TelemetryArchiveReader::decodeFloat(ArchiveBitReader& reader, ArchiveChannelState& channel, float& value) {
+    bool bit;
+    uint64_t raw;
+    if (!reader.readBit(bit)) return false;
+    if (bit) {
+        if (!reader.readBit(bit)) return false;
+        if (bit) {
+            uint64_t leading, length;
+            if (!reader.read(5, leading) || !reader.read(5, length)) return false;
+            channel.leading = static_cast<int>(leading);
+            channel.trailing = 32 - channel.leading - static_cast<int>(length + 1);
+            if (channel.trailing < 0) return false;
+        } else if (channel.leading < 0) {
+            return false;   // no window yet
+        }
+        int meaningful = 32 - channel.leading - channel.trailing;
+        if (!reader.read(meaningful, raw)) return false;
+        channel.previous ^= static_cast<uint32_t>(raw) << channel.trailing;
+    }
+    std::memcpy(&value, &channel.previous, sizeof value);
+    return true;
+}
+
+#endif // TELEMETRY_ARCHIVE_H
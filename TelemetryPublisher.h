@@ -0,0 +1,321 @@
+#ifndef TELEMETRY_PUBLISHER_H
+#define TELEMETRY_PUBLISHER_H
+
+#include "MyController.h"
+#include "MotionPhase.h"
+#include "MotorState.h"
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint32_t kTelemetryMagic = 0x44425431;    // "DBT1"
+static const uint32_t kTelemetryVersion = 2;
+static const size_t kTelemetryRingSize = 4096;          // about 5 s of cycles at 1.2 ms
+
+// One control cycle as seen by the state machine
+struct TelemetrySample {
+    uint64_t cycle = 0;
+    int64_t timeNs = 0;                 // transport time at the end of the cycle
+    ControllerState reply;              // last reply, absolute frame
+    float commandedPosition = 0.0f;     // logical frame
+    float currentPosition = 0.0f;       // logical frame, filtered
+    float estimatedVelocity = 0.0f;     // per second
+    float uncertainty = 0.0f;
+    uint8_t replyValid = 0;
+    uint8_t phase = 0;                  // MotionPhase
+    uint8_t motorState = 0;             // MotorState
+};
+
+// Control loop timing, period from one tick start to the next
+struct LoopStats {
+    uint64_t cycles = 0;
+    uint64_t overruns = 0;              // periods over 1.5 control periods
+    int64_t lastPeriodNs = 0;
+    int64_t meanPeriodNs = 0;
+    int64_t maxPeriodNs = 0;
+    int64_t lastTickNs = 0;             // time spent inside tick()
+    int64_t maxTickNs = 0;
+};
+
+// Latest state, always read as one consistent copy
+struct TelemetrySnapshot {
+    TelemetrySample latest;
+    LoopStats loop;
+};
+
+struct TelemetrySlot {
+    std::atomic<uint64_t> sequence;     // 2n+1 while sample n is written, 2n+2 once complete
+    TelemetrySample sample;
+};
+
+// Layout of the shared memory segment. The control process is the only writer. The
+// snapshot and every ring slot are seqlocks: the writer never waits and never makes a
+// syscall, readers retry or drop a sample when the writer overtook them. A publisher that
+// starts after a crash initialises the segment again under the readers, with a new
+// generation.
+struct TelemetrySegment {
+    std::atomic<uint32_t> magic;        // stored last, readers ignore a segment without it
+    uint32_t version;
+    uint32_t ringSize;
+    int32_t ownerPid;
+    int64_t controlPeriodNs;
+    std::atomic<uint64_t> generation;   // distinct for every open() of a publisher
+    std::atomic<uint32_t> active;       // cleared when the publisher closes
+    alignas(64) std::atomic<uint64_t> sequence;
+    TelemetrySnapshot snapshot;
+    alignas(64) std::atomic<uint64_t> head;     // samples published so far
+    TelemetrySlot ring[kTelemetryRingSize];
+};
+
+static_assert(std::is_trivially_copyable<TelemetrySnapshot>::value, "snapshot is copied out of shared memory");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "seqlock needs lock free 64 bit atomics");
+
+// Publishes the control loop state into a POSIX shared memory segment, once per tick
+class TelemetryPublisher {
+public:
+    // Constructor
+    TelemetryPublisher(const std::string& name, struct timespec controlPeriod)
+    : name(name), controlPeriodNs(controlPeriod.tv_sec * 1000000000LL + controlPeriod.tv_nsec) {}
+    ~TelemetryPublisher() { close(); }
+
+    inline bool open();
+    inline void close();
+    inline bool isOpen() const { return segment != nullptr; }
+
+    // Control thread only. tickStartNs is when the tick began, sample.timeNs when it ended.
+    inline void publish(TelemetrySample& sample, int64_t tickStartNs);
+    inline const LoopStats& getLoopStats() const { return loop; }
+
+private:
+    inline void updateLoopStats(int64_t tickStartNs, int64_t tickEndNs);
+
+    std::string name;
+    int64_t controlPeriodNs;
+    TelemetrySegment* segment = nullptr;
+    LoopStats loop;
+    int64_t previousStartNs = 0;
+    int64_t totalPeriodNs = 0;
+};
+
+// Read side, used by monitors and recorders in other processes
+class TelemetryReader {
+public:
+    explicit TelemetryReader(const std::string& name) : name(name) {}
+    ~TelemetryReader() { close(); }
+
+    inline bool open();
+    inline void close();
+    inline bool active() const { return segment != nullptr && segment->active.load(std::memory_order_acquire) != 0; }
+    inline uint64_t head() const { return segment->head.load(std::memory_order_acquire); }
+    inline int64_t controlPeriodNs() const { return segment->controlPeriodNs; }
+    inline int32_t ownerPid() const { return segment->ownerPid; }
+
+    // RESTARTED - a new publisher initialised the segment since open(), usually after the
+    // last one crashed without closing it. Reopen and read on from head().
+    inline bool restarted() const;
+
+    // False when the writer kept the snapshot busy for every retry
+    inline bool snapshot(TelemetrySnapshot& out, int retries = 1000) const;
+
+    // Copies samples from cursor on, up to max. Samples overwritten before they were read
+    // are counted in dropped and skipped.
+    inline size_t readSamples(uint64_t& cursor, TelemetrySample* out, size_t max, uint64_t& dropped) const;
+
+private:
+    std::string name;
+    const TelemetrySegment* segment = nullptr;
+    uint64_t openedGeneration = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// PUBLISHER
+
+bool TelemetryPublisher::open() {
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to create telemetry segment " << name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, sizeof(TelemetrySegment)) != 0) {
+        std::cerr << "Failed to size telemetry segment " << name << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, sizeof(TelemetrySegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map telemetry segment " << name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Touch every page now so the control loop never takes a page fault on a publish
+    std::memset(mapped, 0, sizeof(TelemetrySegment));
+    segment = static_cast<TelemetrySegment*>(mapped);
+    segment->version = kTelemetryVersion;
+    segment->ringSize = kTelemetryRingSize;
+    segment->ownerPid = static_cast<int32_t>(getpid());
+    segment->controlPeriodNs = controlPeriodNs;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    segment->generation.store((static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec) ^ (static_cast<uint64_t>(getpid()) << 48),
+                              std::memory_order_relaxed);
+    segment->active.store(1, std::memory_order_relaxed);
+    segment->magic.store(kTelemetryMagic, std::memory_order_release);
+    return true;
+}
+
+// CLOSE - readers see the segment go inactive, the name is removed
+void TelemetryPublisher::close() {
+    if (segment == nullptr) {
+        return;
+    }
+    segment->active.store(0, std::memory_order_release);
+    munmap(segment, sizeof(TelemetrySegment));
+    shm_unlink(name.c_str());
+    segment = nullptr;
+}
+
+void TelemetryPublisher::updateLoopStats(int64_t tickStartNs, int64_t tickEndNs) {
+    loop.cycles++;
+    loop.lastTickNs = tickEndNs - tickStartNs;
+    loop.maxTickNs = std::max(loop.maxTickNs, loop.lastTickNs);
+    if (loop.cycles > 1) {
+        loop.lastPeriodNs = tickStartNs - previousStartNs;
+        loop.maxPeriodNs = std::max(loop.maxPeriodNs, loop.lastPeriodNs);
+        totalPeriodNs += loop.lastPeriodNs;
+        loop.meanPeriodNs = totalPeriodNs / static_cast<int64_t>(loop.cycles - 1);
+        if (loop.lastPeriodNs * 2 > controlPeriodNs * 3) {
+            loop.overruns++;
+        }
+    }
+    previousStartNs = tickStartNs;
+}
+
+// PUBLISH - two seqlock writes, plain stores and fences only
+void TelemetryPublisher::publish(TelemetrySample& sample, int64_t tickStartNs) {
+    updateLoopStats(tickStartNs, sample.timeNs);
+    if (segment == nullptr) {
+        return;
+    }
+    uint64_t n = segment->head.load(std::memory_order_relaxed);
+    sample.cycle = n;
+
+    // Ring slot
+    TelemetrySlot& slot = segment->ring[n % kTelemetryRingSize];
+    slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.sample = sample;
+    slot.sequence.store(2 * n + 2, std::memory_order_release);
+    segment->head.store(n + 1, std::memory_order_release);
+
+    // Latest snapshot
+    uint64_t sequence = segment->sequence.load(std::memory_order_relaxed);
+    segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    segment->snapshot.latest = sample;
+    segment->snapshot.loop = loop;
+    segment->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+// READER
+
+bool TelemetryReader::open() {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "No telemetry segment " << name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(TelemetrySegment)) {
+        std::cerr << "Telemetry segment " << name << " is not initialized" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, sizeof(TelemetrySegment), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map telemetry segment " << name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    segment = static_cast<const TelemetrySegment*>(mapped);
+    if (segment->magic.load(std::memory_order_acquire) != kTelemetryMagic || segment->version != kTelemetryVersion
+        || segment->ringSize != kTelemetryRingSize) {
+        std::cerr << "Telemetry segment " << name << " has an unknown layout" << std::endl;
+        close();
+        return false;
+    }
+    openedGeneration = segment->generation.load(std::memory_order_acquire);
+    return true;
+}
+
+bool TelemetryReader::restarted() const {
+    return segment != nullptr && (segment->magic.load(std::memory_order_acquire) != kTelemetryMagic
+                                  || segment->generation.load(std::memory_order_acquire) != openedGeneration);
+}
+
+void TelemetryReader::close() {
+    if (segment != nullptr) {
+        munmap(const_cast<TelemetrySegment*>(segment), sizeof(TelemetrySegment));
+        segment = nullptr;
+    }
+}
+
+// SNAPSHOT - the copy may be torn while the writer is in it, the sequence check rejects it
+bool TelemetryReader::snapshot(TelemetrySnapshot& out, int retries) const {
+    for (int attempt = 0; attempt < retries; attempt++) {
+        uint64_t before = segment->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        std::memcpy(&out, &segment->snapshot, sizeof out);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment->sequence.load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t TelemetryReader::readSamples(uint64_t& cursor, TelemetrySample* out, size_t max, uint64_t& dropped) const {
+    uint64_t end = head();
+    if (end < cursor) {
+        cursor = end;       // the ring started over under a new publisher
+        return 0;
+    }
+    if (end - cursor > kTelemetryRingSize) {
+        dropped += end - cursor - kTelemetryRingSize;
+        cursor = end - kTelemetryRingSize;
+    }
+    size_t count = 0;
+    while (cursor < end && count < max) {
+        const TelemetrySlot& slot = segment->ring[cursor % kTelemetryRingSize];
+        uint64_t expected = 2 * cursor + 2;
+        uint64_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before == expected) {
+            std::memcpy(&out[count], &slot.sample, sizeof(TelemetrySample));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == expected) {
+                count++;
+                cursor++;
+                continue;
+            }
+        }
+        dropped++;      // overwritten by a later lap of the ring
+        cursor++;
+    }
+    return count;
+}
+
+#endif // TELEMETRY_PUBLISHER_H
@@ -0,0 +1,243 @@
+#ifndef WARM_START_H
+#define WARM_START_H
+
+#include "MyController.h"
+#include "MyGpio.h"
+#include "MoteusConfig.h"
+#include "CoordinateFrame.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Outcome of the startup check, anything but Valid homes as before
+enum class WarmStartVerdict {
+    Valid,
+    Disabled,
+    NoState,            // no state file, or one that does not parse
+    Unclean,            // the last run did not stop cleanly, or was never homed
+    UuidMismatch,       // another controller, or its UUID could not be read
+    NoReply,
+    PositionMoved,      // the controller no longer counts from where it stopped
+    SwitchMismatch      // home switch disagrees with where the blade was left
+};
+
+inline const char* warmStartVerdictName(WarmStartVerdict verdict) {
+    switch (verdict) {
+        case WarmStartVerdict::Valid:          return "valid";
+        case WarmStartVerdict::Disabled:       return "disabled";
+        case WarmStartVerdict::NoState:        return "no saved state";
+        case WarmStartVerdict::Unclean:        return "last run did not stop cleanly";
+        case WarmStartVerdict::UuidMismatch:   return "controller UUID differs";
+        case WarmStartVerdict::NoReply:        return "controller did not answer";
+        case WarmStartVerdict::PositionMoved:  return "position moved";
+        case WarmStartVerdict::SwitchMismatch: return "home switch disagrees";
+        default:                               return "unknown";
+    }
+}
+
+// What one run leaves for the next
+struct WarmState {
+    std::string uuid;                   // controller UUID, 32 hex digits, empty when unread
+    float absolutePosition = std::numeric_limits<float>::quiet_NaN();  // controller frame
+    float logicalPosition = std::numeric_limits<float>::quiet_NaN();   // logical frame, same moment
+    bool atHome = false;                // home switch closed
+    bool clean = false;                 // written by a clean stop of a referenced blade
+};
+
+// State kept across runs so a start can skip homing. The controller keeps counting position
+// while it stays powered, so a clean stop saves the absolute position with the frame and
+// the controller UUID. At the next start one query and the home switch decide whether the
+// blade is still there. The file is marked unclean as soon as a run starts, so a crash or
+// a power cut leaves it that way, and it is only ever replaced by rename().
+class WarmStart {
+public:
+    explicit WarmStart(const std::string& path, float tolerance = 0.02f, int timeoutMs = 50)
+    : path(path), tolerance(tolerance), timeoutMs(timeoutMs) {}
+
+    // START - after the stop command and before any rezero. Marks the file unclean.
+    inline WarmStartVerdict start(MyController& controller, MyGpio& homeLimitSwitch);
+    // STOP - saves the position, clean only when the blade was referenced
+    inline bool stop(MyController& controller, MyGpio& homeLimitSwitch, const CoordinateFrame& frame, bool referenced);
+
+    inline bool load();
+    inline bool save(const WarmState& state) const;
+    inline const WarmState& getSaved() const { return saved; }
+    inline float getLiveAbsolute() const { return liveAbsolute; }
+    inline const std::string& getPath() const { return path; }
+
+    static inline bool readUuid(MyController& controller, std::string& uuid);
+    static inline bool queryPosition(MyController& controller, float& absolute, int timeoutMs);
+
+private:
+    std::string path;
+    float tolerance;                    // controller units the position may have drifted
+    int timeoutMs;
+    WarmState saved;
+    std::string liveUuid;
+    float liveAbsolute = std::numeric_limits<float>::quiet_NaN();
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// START - cheapest checks first; the UUID is read either way, the next save needs it
+WarmStartVerdict WarmStart::start(MyController& controller, MyGpio& homeLimitSwitch) {
+    bool haveUuid = readUuid(controller, liveUuid);
+    if (!haveUuid) {
+        std::cerr << "Could not read the controller UUID" << std::endl;
+        liveUuid.clear();
+    }
+    bool loaded = load();
+
+    // Whatever happens from here on, the next start must not trust this file
+    WarmState running;
+    running.uuid = liveUuid;
+    if (!save(running)) {
+        return WarmStartVerdict::Disabled;      // a state file we cannot mark unclean is never trusted
+    }
+
+    if (!loaded) {
+        return WarmStartVerdict::NoState;
+    }
+    if (!saved.clean || !std::isfinite(saved.absolutePosition) || !std::isfinite(saved.logicalPosition)) {
+        return WarmStartVerdict::Unclean;
+    }
+    if (!haveUuid || saved.uuid != liveUuid) {
+        return WarmStartVerdict::UuidMismatch;
+    }
+    if (!queryPosition(controller, liveAbsolute, timeoutMs)) {
+        return WarmStartVerdict::NoReply;
+    }
+    if (std::fabs(liveAbsolute - saved.absolutePosition) > tolerance) {
+        std::cout << "Warm start: saved position " << saved.absolutePosition << ", controller reports " << liveAbsolute << std::endl;
+        return WarmStartVerdict::PositionMoved;
+    }
+    if ((homeLimitSwitch.readValue() == 0) != saved.atHome) {
+        return WarmStartVerdict::SwitchMismatch;
+    }
+    return WarmStartVerdict::Valid;
+}
+
+// STOP - one query for where the blade came to rest
+bool WarmStart::stop(MyController& controller, MyGpio& homeLimitSwitch, const CoordinateFrame& frame, bool referenced) {
+    WarmState state;
+    state.uuid = liveUuid;
+    float absolute;
+    if (referenced && !liveUuid.empty() && queryPosition(controller, absolute, timeoutMs)) {
+        state.absolutePosition = absolute;
+        state.logicalPosition = frame.toLogical(absolute);
+        state.atHome = homeLimitSwitch.readValue() == 0;
+        state.clean = true;
+    }
+    return save(state) && state.clean;
+}
+
+// LOAD - "key value" lines as in doomblade.cfg
+bool WarmStart::load() {
+    saved = WarmState();
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    bool haveClean = false;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string key, value;
+        fields >> key >> value;
+        if (key == "uuid") {
+            saved.uuid = value;
+        } else if (key == "absolute_position") {
+            saved.absolutePosition = std::strtof(value.c_str(), nullptr);
+        } else if (key == "logical_position") {
+            saved.logicalPosition = std::strtof(value.c_str(), nullptr);
+        } else if (key == "at_home") {
+            saved.atHome = value == "1";
+        } else if (key == "clean") {
+            saved.clean = value == "1";
+            haveClean = true;
+        }
+    }
+    return haveClean;
+}
+
+// SAVE - written to a temporary file, synced, renamed over the old one and the directory
+// synced, so the file on disk is always one whole state or the other
+bool WarmStart::save(const WarmState& state) const {
+    char text[256];
+    int length = std::snprintf(text, sizeof text,
+                               "# DoomBlade warm start state, rewritten at every start and stop\n"
+                               "uuid %s\nabsolute_position %.9g\nlogical_position %.9g\nat_home %d\nclean %d\n",
+                               state.uuid.empty() ? "-" : state.uuid.c_str(), state.absolutePosition, state.logicalPosition,
+                               state.atHome ? 1 : 0, state.clean ? 1 : 0);
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to write warm start state " << temporary << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    bool ok = ::write(fd, text, length) == length && fsync(fd) == 0;
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to write warm start state " << path << ": " << strerror(errno) << std::endl;
+        ::unlink(temporary.c_str());
+        return false;
+    }
+    size_t slash = path.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int directoryFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (directoryFd >= 0) {
+        fsync(directoryFd);     // makes the rename itself durable
+        ::close(directoryFd);
+    }
+    return true;
+}
+
+// READ UUID - the 16 bytes of uuid.uuid.N over the diagnostic stream
+bool WarmStart::readUuid(MyController& controller, std::string& uuid) {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 16; i++) {
+        keys.push_back("uuid.uuid." + std::to_string(i));
+    }
+    MoteusConfigClient client(controller, 100);
+    std::vector<std::string> values;
+    if (!client.get(keys, values)) {
+        return false;
+    }
+    uuid.clear();
+    for (const std::string& value : values) {
+        char* end = nullptr;
+        long byte = std::strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || byte < 0 || byte > 255) {
+            return false;   // "ERR ..." from firmware without the key
+        }
+        char hex[3];
+        std::snprintf(hex, sizeof hex, "%02x", static_cast<unsigned>(byte));
+        uuid += hex;
+    }
+    return true;
+}
+
+// QUERY POSITION - reads position, velocity and torque without commanding anything
+bool WarmStart::queryPosition(MyController& controller, float& absolute, int timeoutMs) {
+    controller.sendFrame("1c0301", true);   //Read 3 registers starting at 0x01
+    ControllerState state;
+    if (!controller.readState(state, timeoutMs) || !std::isfinite(state.position)) {
+        return false;
+    }
+    absolute = state.position;
+    return true;
+}
+
+#endif // WARM_START_H
@@ -0,0 +1,198 @@
+#include "MyController.h"
+#include "MyGpio.h"
+#include "PositionManager.h"
+#include "BladeStateMachine.h"
+#include "RuntimeConfig.h"
+#include "SimulatedController.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Activate switch to blade latencies of the position_control_test state machine, run
+// against SimulatedController instead of the fdcanusb and the GPIO lines
+//   actuation_benchmark                      20 extend / sheath trials
+//   actuation_benchmark --trials 100         more trials
+//   actuation_benchmark --seed 7             link jitter seed
+//   actuation_benchmark --tsv results.tsv    one row per trial
+//   actuation_benchmark --verbose            keep the state machine output
+// Motion settings come from doomblade.cfg. Times are simulated time, the control period
+// sleeps cost nothing but the host time of every cycle is included, so runs of two
+// builds with the same config and seed compare their control path and nothing else.
+
+struct Distribution {
+    std::vector<double> values;     // milliseconds
+
+    void add(double value) { values.push_back(value); }
+    double quantile(double fraction) const {
+        std::vector<double> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[rank];
+    }
+    void print(const char* name) const {
+        if (values.empty()) {
+            std::cout << name << ": no samples" << std::endl;
+            return;
+        }
+        double sum = 0.0;
+        for (double value : values) {
+            sum += value;
+        }
+        std::cout << name << ": n " << values.size() << ", mean " << sum / values.size() << " ms, p50 " << quantile(0.5)
+                  << " ms, p90 " << quantile(0.9) << " ms, p99 " << quantile(0.99) << " ms, max " << quantile(1.0) << " ms" << std::endl;
+    }
+};
+
+static double elapsedMs(int64_t fromNs, int64_t toNs) {
+    return (fromNs < 0 || toNs < 0) ? -1.0 : (toNs - fromNs) / 1e6;
+}
+
+int main(int argc, char** argv) {
+    int trials = 20;
+    uint32_t seed = 1;
+    std::string tsvPath;
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--trials" && i + 1 < argc) {
+            trials = std::stoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--tsv" && i + 1 < argc) {
+            tsvPath = argv[++i];
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else {
+            std::cerr << "usage: actuation_benchmark [--trials n] [--seed n] [--tsv file] [--verbose]" << std::endl;
+            return 1;
+        }
+    }
+
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    runtimeConfig.load();
+    const MotionConfig& config = runtimeConfig.acquire();
+
+    // SIMULATOR - controller, link and every GPIO line
+    SimulatedLinkConfig link;
+    link.seed = seed;
+    SimulatedController simulator(config.homePin, config.extendPin, SimulatedPlantConfig(), link);
+
+    MyGpio homeLimitSwitch(config.gpioChip, config.homePin);
+    MyGpio extendLimitSwitch(config.gpioChip, config.extendPin);
+    MyGpio activateSwitch(config.gpioChip, config.activatePin);
+    MyGpio safetySwitch(config.gpioChip, config.safetyPin);
+    for (MyGpio* line : {&homeLimitSwitch, &extendLimitSwitch, &activateSwitch, &safetySwitch}) {
+        line->setTap(&simulator);
+        line->init();
+    }
+
+    MyController controller(simulator);
+    controller.setupSerialPort();
+    controller.setCanId(config.controllerCanId);
+    controller.sendStopCommand();  //gets controller to a known state
+    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+
+    // STATE MACHINE - as position_control_test builds it, without the supervisor thread,
+    // which times itself on the wall clock
+    struct timespec req = config.controlPeriod();
+    PositionManager positionManager(controller, homeLimitSwitch, extendLimitSwitch, config.maxSpeed, config.cruisingEndPosition,
+                                    config.cruisingReverseEndPosition, config.stepsToAccelerate, config.decelerationSteps, req);
+    positionManager.applyConfig(config);
+    BladeStateMachine stateMachine(positionManager, controller, homeLimitSwitch, extendLimitSwitch, activateSwitch, safetySwitch, nullptr, req);
+
+    // The cycle log is still formatted, only the terminal is left out
+    std::ofstream discard("/dev/null");
+    std::streambuf* console = std::cout.rdbuf();
+    if (!verbose) {
+        std::cout.rdbuf(discard.rdbuf());
+    }
+
+    // A press holds the switch low for pressNs of simulated time
+    const int64_t pressNs = 30 * 1000000LL;
+    const int64_t settleNs = 100 * 1000000LL;
+    const int64_t trialLimitNs = 30 * 1000000000LL;
+    auto press = [&]() {
+        simulator.setInput(config.activatePin, 0);
+        simulator.markInput();
+        simulator.scheduleInput(controller.nowNs() + pressNs, config.activatePin, 1);
+    };
+    auto runUntil = [&](MotorState target, int64_t dwellNs) {
+        int64_t deadline = controller.nowNs() + trialLimitNs;
+        int64_t reachedNs = -1;
+        while (controller.nowNs() < deadline) {
+            if (!stateMachine.tick()) {
+                return false;
+            }
+            if (stateMachine.getState() == target && reachedNs < 0) {
+                reachedNs = controller.nowNs();
+            }
+            if (reachedNs >= 0 && controller.nowNs() - reachedNs >= dwellNs) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // HOMING - first press after power up homes the blade
+    press();
+    if (!runUntil(MotorState::WaitingToExtend, settleNs)) {
+        std::cout.rdbuf(console);
+        std::cerr << "Simulated blade did not home" << std::endl;
+        return 1;
+    }
+
+    Distribution extendFirstCommand, extendFull, sheathFirstCommand, sheathFull;
+    std::vector<std::vector<double>> rows;
+    int failed = 0;
+    for (int trial = 0; trial < trials; trial++) {
+        press();
+        bool extended = runUntil(MotorState::Extended, settleNs);
+        SimulatedResponse extend = simulator.getResponse();
+        bool sheathed = false;
+        SimulatedResponse sheath;
+        if (extended) {
+            press();
+            sheathed = runUntil(MotorState::WaitingToExtend, settleNs);
+            sheath = simulator.getResponse();
+        }
+        if (!extended || !sheathed || extend.firstMotionNs < 0 || extend.extendSwitchNs < 0 || sheath.firstMotionNs < 0 || sheath.homeSwitchNs < 0) {
+            failed++;
+            if (!runUntil(MotorState::WaitingToExtend, settleNs)) {
+                break;
+            }
+            continue;
+        }
+        std::vector<double> row = {elapsedMs(extend.inputNs, extend.firstMotionNs), elapsedMs(extend.inputNs, extend.extendSwitchNs),
+                                    elapsedMs(sheath.inputNs, sheath.firstMotionNs), elapsedMs(sheath.inputNs, sheath.homeSwitchNs)};
+        extendFirstCommand.add(row[0]);
+        extendFull.add(row[1]);
+        sheathFirstCommand.add(row[2]);
+        sheathFull.add(row[3]);
+        rows.push_back(row);
+    }
+    std::cout.rdbuf(console);
+
+    // REPORT
+    std::cout << "Actuation benchmark: " << rows.size() << " trials, " << failed << " failed, seed " << seed
+              << ", control period " << (req.tv_sec * 1000000 + req.tv_nsec / 1000) << " us, " << simulator.getCommands() << " commands" << std::endl;
+#ifdef __OPTIMIZE__
+    std::cout << "Build: " << __VERSION__ << ", optimized" << std::endl;
+#else
+    std::cout << "Build: " << __VERSION__ << ", not optimized" << std::endl;
+#endif
+    extendFirstCommand.print("Activate to first extend command");
+    extendFull.print("Activate to extend switch");
+    sheathFirstCommand.print("Activate to first sheath command");
+    sheathFull.print("Activate to home switch");
+
+    if (!tsvPath.empty()) {
+        std::ofstream tsv(tsvPath);
+        tsv << "trial\textend_first_command_ms\textend_switch_ms\tsheath_first_command_ms\thome_switch_ms\n";
+        for (size_t i = 0; i < rows.size(); i++) {
+            tsv << i << "\t" << rows[i][0] << "\t" << rows[i][1] << "\t" << rows[i][2] << "\t" << rows[i][3] << "\n";
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
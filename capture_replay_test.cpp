@@ -0,0 +1,240 @@
+#include "MyController.h"
+#include "MyGpio.h"
+#include "PositionManager.h"
+#include "BladeStateMachine.h"
+#include "SafetySupervisor.h"
+#include "RuntimeConfig.h"
+#include "SimulatedController.h"
+#include "StreamCapture.h"
+#include "ScenarioRunner.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unistd.h>
+
+// Capture and replay of position_control_test sessions that end in a supervisor trip
+//   capture_replay_test             every scenario
+//   capture_replay_test --verbose   keep the state machine output
+// Each scenario homes a simulated blade, extends it and trips the supervisor while cruising,
+// all through CaptureTransport, then replays the capture with the supervisor polled on the
+// control thread as position_control_test does. The replay has to match every recorded
+// write, brake included, trip for the same reason and pass through the same states. The
+// capture lives in /tmp and is removed afterwards.
+
+struct TripScenario {
+    const char* name;
+    bool releaseSafety;         // else both limit lines stick pressed
+    const char* expectedTrip;
+};
+
+// SESSION TAP - simulated lines, optionally stuck pressed from a simulated time on, recorded
+// by the capture. A line only changes with the simulated clock, that is between stream
+// records, so the replay hands out the value each read saw.
+class SessionTap : public GpioTap {
+public:
+    SessionTap(SimulatedController& simulator, CaptureTransport& capture) : simulator(simulator), capture(capture) {}
+
+    bool simulated() const override { return true; }
+    int onRead(unsigned int gpio, int value) override {
+        value = simulator.onRead(gpio, value);
+        auto found = stuckFromNs.find(gpio);
+        if (found != stuckFromNs.end() && simulator.nowNs() >= found->second) {
+            value = 0;
+        }
+        return capture.onRead(gpio, value);
+    }
+
+    std::map<unsigned int, int64_t> stuckFromNs;
+
+private:
+    SimulatedController& simulator;
+    CaptureTransport& capture;
+};
+
+// SESSION - what both runs are compared on
+struct Session {
+    std::vector<MotorState> states;
+    std::string trip;
+    bool shutDown = false;
+    size_t ticks = 0;
+};
+
+static std::string capturePath() {
+    return "/tmp/capture_replay_test_" + std::to_string(getpid()) + ".cap";
+}
+
+// RIG - the position_control_test setup on any transport and GPIO tap
+struct Rig {
+    Rig(ControllerTransport& transport, GpioTap& tap, const MotionConfig& config)
+    : config(config), homeLimitSwitch(config.gpioChip, config.homePin), extendLimitSwitch(config.gpioChip, config.extendPin),
+      activateSwitch(config.gpioChip, config.activatePin), safetySwitch(config.gpioChip, config.safetyPin), controller(transport),
+      positionManager(controller, homeLimitSwitch, extendLimitSwitch, config.maxSpeed, config.cruisingEndPosition,
+                      config.cruisingReverseEndPosition, config.stepsToAccelerate, config.decelerationSteps, config.controlPeriod()),
+      supervisor(controller, safetySwitch, homeLimitSwitch, extendLimitSwitch, config.controlPeriod()),
+      stateMachine(positionManager, controller, homeLimitSwitch, extendLimitSwitch, activateSwitch, safetySwitch, &supervisor, config.controlPeriod()) {
+        for (MyGpio* line : {&homeLimitSwitch, &extendLimitSwitch, &activateSwitch, &safetySwitch}) {
+            line->setTap(&tap);
+            line->init();
+        }
+        controller.setupSerialPort();
+        controller.setCanId(config.controllerCanId);
+        controller.sendStopCommand();  //gets controller to a known state
+        controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+        positionManager.applyConfig(config);
+        positionManager.attachSupervisor(&supervisor);
+        supervisor.runOnControlThread();
+    }
+
+    // TICK - false once the trip has shut the machine down
+    bool tick(Session& session) {
+        session.ticks++;
+        if (!stateMachine.tick()) {
+            session.shutDown = true;
+            session.trip = stateMachine.getLastTrip();
+            return false;
+        }
+        if (session.states.empty() || session.states.back() != stateMachine.getState()) {
+            session.states.push_back(stateMachine.getState());
+        }
+        return true;
+    }
+
+    const MotionConfig& config;
+    MyGpio homeLimitSwitch;
+    MyGpio extendLimitSwitch;
+    MyGpio activateSwitch;
+    MyGpio safetySwitch;
+    MyController controller;
+    PositionManager positionManager;
+    SafetySupervisor supervisor;
+    BladeStateMachine stateMachine;
+};
+
+// CAPTURE - home, extend, trip while cruising, record until the machine shuts down
+static bool captureSession(const TripScenario& scenario, const MotionConfig& config, const std::string& path,
+                           Session& session, std::string& failure) {
+    SimulatedLinkConfig link;
+    link.hostTime = false;
+    SimulatedController simulator(config.homePin, config.extendPin, SimulatedPlantConfig(), link);
+    CaptureTransport capture(simulator, path);
+    SessionTap tap(simulator, capture);
+    Rig rig(capture, tap, config);
+
+    const int64_t pressNs = 30 * 1000000LL;
+    const int64_t limitNs = 30 * 1000000000LL;
+    auto press = [&]() {
+        simulator.scheduleInput(simulator.nowNs() + 1000000LL, config.activatePin, 0);
+        simulator.scheduleInput(simulator.nowNs() + pressNs, config.activatePin, 1);
+    };
+    auto runUntil = [&](auto reached) {
+        int64_t deadline = simulator.nowNs() + limitNs;
+        while (simulator.nowNs() < deadline) {
+            if (!rig.tick(session)) {
+                return false;
+            }
+            if (reached()) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    press();
+    if (!runUntil([&]() { return rig.stateMachine.getState() == MotorState::WaitingToExtend && simulator.getPosition() >= 0.0; })) {
+        failure = "did not home";
+        return false;
+    }
+    press();
+    if (!runUntil([&]() { return rig.positionManager.getPhase() == MotionPhase::Cruising; })) {
+        failure = "did not reach cruising";
+        return false;
+    }
+
+    // TRIP - a millisecond of simulated time ahead, the change lands between stream records
+    int64_t tripNs = simulator.nowNs() + 1000000LL;
+    if (scenario.releaseSafety) {
+        simulator.scheduleInput(tripNs, config.safetyPin, 0);
+    } else {
+        tap.stuckFromNs[config.homePin] = tripNs;
+        tap.stuckFromNs[config.extendPin] = tripNs;
+    }
+    runUntil([]() { return false; });
+    rig.controller.closeSerialPort();
+    if (!session.shutDown) {
+        failure = "supervisor did not trip";
+        return false;
+    }
+    return true;
+}
+
+// REPLAY - as fast as possible, the inputs come from the capture only. A replay that has not
+// shut down a few ticks after the captured session did never will.
+static bool replaySession(const MotionConfig& config, size_t maxTicks, Session& session, ReplayTransport& replay) {
+    Rig rig(replay, replay, config);
+    while (session.ticks < maxTicks && rig.tick(session)) {
+    }
+    return session.shutDown;
+}
+
+static ScenarioResult runTrip(const TripScenario& scenario, const MotionConfig& config) {
+    ScenarioResult result;
+    std::string path = capturePath();
+    std::remove(path.c_str());
+
+    Session captured;
+    if (!captureSession(scenario, config, path, captured, result.failure)) {
+        std::remove(path.c_str());
+        return result;
+    }
+    Session replayed;
+    ReplayTransport replay(path, false);
+    bool shutDown = replaySession(config, captured.ticks + 10, replayed, replay);
+    std::remove(path.c_str());
+
+    result.detail = std::to_string(captured.states.size()) + " states, trip \"" + captured.trip + "\", replay " +
+                    std::to_string(replay.getDivergences()) + " divergences" + (replay.finished() ? "" : ", capture not used up");
+    if (captured.trip != scenario.expectedTrip) {
+        result.failure = "captured session tripped on \"" + captured.trip + "\"";
+    } else if (!shutDown) {
+        result.failure = "replay did not trip";
+    } else if (replayed.trip != captured.trip) {
+        result.failure = "replay tripped on \"" + replayed.trip + "\"";
+    } else if (replay.getDivergences() != 0) {
+        result.failure = "replay diverged from the capture";
+    } else if (replayed.states != captured.states) {
+        result.failure = "replay went through other states";
+    } else if (!replay.finished()) {
+        result.failure = "replay stopped before the end of the capture";
+    } else {
+        result.passed = true;
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--verbose") {
+            verbose = true;
+        } else {
+            std::cerr << "usage: capture_replay_test [--verbose]" << std::endl;
+            return 1;
+        }
+    }
+
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    runtimeConfig.load();
+    const MotionConfig& config = runtimeConfig.acquire();
+
+    const std::vector<TripScenario> trips = {
+        {"safety release while cruising",   true,  "safety switch released"},
+        {"limit conflict while cruising",   false, "limit switch conflict"},
+    };
+    std::vector<Scenario> scenarios;
+    for (const TripScenario& trip : trips) {
+        scenarios.push_back({trip.name, [&config, &trip]() { return runTrip(trip, config); }});
+    }
+    return runScenarios(scenarios, !verbose);
+}
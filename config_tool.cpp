@@ -0,0 +1,123 @@
+#include "MyController.h"
+#include "MoteusConfig.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Moteus configuration tool
+//   config_tool parse drpi1.cfg                 check a config file offline
+//   config_tool dump                            print the live config
+//   config_tool diff drpi1.cfg                  show keys that differ from the file
+//   config_tool push drpi1.cfg [--write]        push only the differing keys, --write persists them
+// --device <path> selects the fdcanusb (default /dev/fdcanusb), --id <n> the controller's
+// CAN id (default 1), --all includes unit specific keys (uuid, clock trim) that are
+// skipped by default.
+
+static void usage() {
+    std::cerr << "usage: config_tool [--device path] [--id n] [--all] parse|dump|diff|push [file] [--write]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string device = "/dev/fdcanusb";
+    std::string command;
+    std::string path;
+    bool persist = false;
+    bool all = false;
+    int canId = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--device" && i + 1 < argc) {
+            device = argv[++i];
+        } else if (arg == "--id" && i + 1 < argc) {
+            canId = std::stoi(argv[++i]);
+        } else if (arg == "--write") {
+            persist = true;
+        } else if (arg == "--all") {
+            all = true;
+        } else if (command.empty()) {
+            command = arg;
+        } else if (path.empty()) {
+            path = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    bool needsFile = (command == "parse" || command == "diff" || command == "push");
+    if (command.empty() || (needsFile && path.empty())) {
+        usage();
+        return 1;
+    }
+
+    // DESIRED CONFIG
+    MoteusConfig desired;
+    if (needsFile) {
+        if (!desired.load(path)) {
+            return 1;
+        }
+        std::cout << "Parsed " << desired.size() << " keys from " << path << std::endl;
+        if (command == "parse") {
+            for (const auto& group : desired.root().children) {
+                std::cout << "  " << group.first << std::endl;
+            }
+            return 0;
+        }
+    }
+
+    // LIVE CONFIG
+    MyController controller(device.c_str());
+    if (!controller.setupSerialPort()) {
+        std::cerr << "Failed to setup serial port" << std::endl;
+        return 1;
+    }
+    controller.setCanId(static_cast<uint8_t>(canId));
+    MoteusConfigClient client(controller);
+    MoteusConfig live;
+    if (!client.enumerate(live)) {
+        std::cerr << "Failed to read the live config" << std::endl;
+        return 1;
+    }
+
+    if (command == "dump") {
+        for (const std::string& key : live.keys()) {
+            std::cout << key << " " << live.find(key)->text << std::endl;
+        }
+        return 0;
+    }
+
+    // DIFF
+    std::vector<std::string> skip;
+    if (!all) {
+        skip = {"uuid.", "clock.hsitrim"};
+    }
+    std::vector<ConfigChange> changes = live.diff(desired, skip);
+    for (const ConfigChange& change : changes) {
+        std::cout << change.key << "\t" << (change.from.empty() ? "(missing)" : change.from) << " -> " << change.to << std::endl;
+    }
+    std::cout << changes.size() << " of " << desired.size() << " keys differ" << std::endl;
+    if (command == "diff") {
+        return 0;
+    }
+    if (command != "push") {
+        usage();
+        return 1;
+    }
+
+    // PUSH
+    size_t framesBefore = client.getFramesSent();
+    if (!client.push(changes)) {
+        std::cerr << "Push failed" << std::endl;
+        return 1;
+    }
+    std::cout << "Pushed " << changes.size() << " keys in " << client.getFramesSent() - framesBefore << " frames" << std::endl;
+    if (persist) {
+        if (!client.persist()) {
+            std::cerr << "conf write failed" << std::endl;
+            return 1;
+        }
+        std::cout << "Config written to flash" << std::endl;
+    }
+    controller.closeSerialPort();
+    return 0;
+}
@@ -0,0 +1,501 @@
+#include "CanFrameDecoder.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Decodes fdcanusb traffic into a per register timeline
+//   decode_can_capture session.log                  register summary
+//   decode_can_capture session.log --out timeline   columnar timeline files, plus the summary
+//   decode_can_capture session.dbcap --out timeline StreamCapture files are read as well
+//   decode_can_capture --print session.log          every frame, like decode_can_frame.py
+//   decode_can_capture --hex 01000a0c0220...        decode frames given on the command line
+// Text logs hold one fdcanusb line per line, "can send <id> <hex>" or "rcv <id> <hex>",
+// optionally after a timestamp in seconds. The file is memory mapped and split at line
+// boundaries across --threads workers (default all cores). Timeline files are raw little
+// endian arrays, reg_XXX.<column>.<type>, so numpy.fromfile reads them directly.
+
+static const uint32_t kTimelineRegisters = kRegisterTableSize;
+static const char kCaptureMagic[8] = {'D', 'B', 'C', 'A', 'P', 1, 0, 0};
+
+// One register's columns, values in the order they appear in the capture
+struct RegisterColumns {
+    std::vector<double> time;           // seconds, NaN when the log has no timestamps
+    std::vector<uint64_t> frame;        // frame index in the capture
+    std::vector<uint16_t> id;           // CAN arbitration id, low 16 bits
+    std::vector<uint8_t> kind;          // 0 written by a command, 1 reported in a reply
+    std::vector<float> value;           // scaled to physical units
+};
+
+struct RegisterStats {
+    uint64_t count = 0;
+    uint64_t nans = 0;
+    double min = 0.0;
+    double max = 0.0;
+    double sum = 0.0;
+
+    inline void add(double value) {
+        count++;
+        if (std::isnan(value)) {
+            nans++;
+            return;
+        }
+        uint64_t seen = count - nans - 1;
+        min = (seen == 0) ? value : std::min(min, value);
+        max = (seen == 0) ? value : std::max(max, value);
+        sum += value;
+    }
+    inline void merge(const RegisterStats& other) {
+        if (other.count == other.nans) {
+            count += other.count;
+            nans += other.nans;
+            return;
+        }
+        bool empty = (count == nans);
+        min = empty ? other.min : std::min(min, other.min);
+        max = empty ? other.max : std::max(max, other.max);
+        sum += other.sum;
+        count += other.count;
+        nans += other.nans;
+    }
+};
+
+// Everything one worker decoded from its part of the input
+struct ChunkResult {
+    std::vector<RegisterColumns> columns;   // empty unless a timeline is written
+    std::vector<RegisterStats> stats = std::vector<RegisterStats>(kTimelineRegisters);
+    uint64_t lines = 0;
+    uint64_t frames = 0;
+    uint64_t ignoredLines = 0;
+    uint64_t badFrames = 0;
+    uint64_t outOfRange = 0;        // registers past the timeline table
+    uint64_t reads = 0;
+    uint64_t errors = 0;
+    uint64_t streams = 0;
+    uint64_t nops = 0;
+    uint64_t unknown = 0;
+};
+
+// TIMELINE BUILDER - decode visitor appending every register value of a frame
+class TimelineBuilder {
+public:
+    TimelineBuilder(ChunkResult& result, bool keepColumns) : result(result), keepColumns(keepColumns) {
+        if (keepColumns) {
+            result.columns.resize(kTimelineRegisters);
+        }
+    }
+
+    inline void beginFrame(double frameTime, uint16_t frameId) {
+        time = frameTime;
+        id = frameId;
+        frame = result.frames++;
+    }
+
+    inline void onWrite(uint32_t reg, const RegisterValue& value) { append(reg, value, 0); }
+    inline void onReply(uint32_t reg, const RegisterValue& value) { append(reg, value, 1); }
+    inline void onRead(uint32_t, uint32_t, RegisterType) { result.reads++; }
+    inline void onError(MultiplexCommand, uint32_t, uint32_t) { result.errors++; }
+    inline void onStream(MultiplexCommand, uint32_t, uint32_t) { result.streams++; }
+    inline void onPoll(uint32_t, uint32_t) { result.streams++; }
+    inline void onNop() { result.nops++; }
+    inline void onUnknown(uint8_t) { result.unknown++; }
+
+private:
+    inline void append(uint32_t reg, const RegisterValue& raw, uint8_t kind) {
+        if (reg >= kTimelineRegisters) {
+            result.outOfRange++;
+            return;
+        }
+        double value = scaledValue(reg, raw);
+        result.stats[reg].add(value);
+        if (keepColumns) {
+            RegisterColumns& columns = result.columns[reg];
+            columns.time.push_back(time);
+            columns.frame.push_back(frame);
+            columns.id.push_back(id);
+            columns.kind.push_back(kind);
+            columns.value.push_back(static_cast<float>(value));
+        }
+    }
+
+    ChunkResult& result;
+    bool keepColumns;
+    double time = 0.0;
+    uint64_t frame = 0;
+    uint16_t id = 0;
+};
+
+// PRINTER - decode visitor in the decode_can_frame.py layout
+class FramePrinter {
+public:
+    inline void onWrite(uint32_t reg, const RegisterValue& value) { printValue("WRITE_REGISTERS", reg, value); }
+    inline void onReply(uint32_t reg, const RegisterValue& value) { printValue("REPLY", reg, value); }
+    inline void onRead(uint32_t reg, uint32_t count, RegisterType type) {
+        std::cout << "  READ_REGISTERS - " << typeName(type) << " " << count << " registers starting at reg " << regName(reg) << "\n";
+    }
+    inline void onError(MultiplexCommand command, uint32_t reg, uint32_t code) {
+        std::cout << "  " << (command == MultiplexCommand::ReadError ? "READ_ERROR" : "WRITE_ERROR")
+                  << " - register " << regName(reg) << " error " << code << "\n";
+    }
+    inline void onStream(MultiplexCommand command, uint32_t channel, uint32_t bytes) {
+        std::cout << "  " << (command == MultiplexCommand::StreamClientToServer ? "STREAM_CLIENT_TO_SERVER" : "STREAM_SERVER_TO_CLIENT")
+                  << " - channel " << channel << ", " << bytes << " bytes\n";
+    }
+    inline void onPoll(uint32_t channel, uint32_t bytes) {
+        std::cout << "  STREAM_CLIENT_POLL_SERVER - channel " << channel << ", at most " << bytes << " bytes\n";
+    }
+    inline void onNop() { std::cout << "  NOP\n"; }
+    inline void onUnknown(uint8_t byte) { std::cout << "  unknown command 0x" << std::hex << static_cast<int>(byte) << std::dec << "\n"; }
+
+private:
+    static inline const char* typeName(RegisterType type) {
+        static const char* const names[] = {"INT8", "INT16", "INT32", "F32"};
+        return names[static_cast<size_t>(type)];
+    }
+    static inline std::string regName(uint32_t reg) {
+        char text[16];
+        std::snprintf(text, sizeof text, "0x%03x", reg);
+        const RegisterInfo* info = findRegister(reg);
+        return info != nullptr ? std::string(text) + "(" + info->name + ")" : std::string(text);
+    }
+    inline void printValue(const char* command, uint32_t reg, const RegisterValue& value) {
+        std::cout << "  " << command << " - " << typeName(value.type) << " Reg " << regName(reg) << " = ";
+        if (value.type == RegisterType::F32) {
+            std::cout << value.real;
+        } else if (value.isNan()) {
+            std::cout << value.integer << " (NaN)";
+        } else {
+            std::cout << value.integer << " (" << scaledValue(reg, value) << ")";
+        }
+        std::cout << "\n";
+    }
+};
+
+static inline void decodeLine(const char* begin, const char* end, double recordTime, TimelineBuilder& builder, ChunkResult& result) {
+    result.lines++;
+    CanLine fields;
+    if (!parseCanLine(begin, end, fields)) {
+        result.ignoredLines++;
+        return;
+    }
+    builder.beginFrame(std::isnan(recordTime) ? fields.time : recordTime, fields.id);
+    if (!decodeMultiplex(HexCursor(fields.hexBegin, fields.hexEnd), builder)) {
+        result.badFrames++;
+    }
+}
+
+// TEXT CHUNK - [begin, end) starts at a line, the last line may run past end
+static void decodeTextChunk(const char* begin, const char* end, const char* fileEnd, ChunkResult& result, bool keepColumns) {
+    TimelineBuilder builder(result, keepColumns);
+    const char* line = begin;
+    while (line < end) {
+        const char* newline = static_cast<const char*>(std::memchr(line, '\n', fileEnd - line));
+        const char* lineEnd = newline != nullptr ? newline : fileEnd;
+        decodeLine(line, lineEnd, std::numeric_limits<double>::quiet_NaN(), builder, result);
+        line = lineEnd + 1;
+    }
+}
+
+// STREAM CAPTURE - records are sequential (delta times), decoded on one thread. Lines
+// inside one record are decoded in place, lines split across reads are reassembled.
+static bool decodeCapture(const uint8_t* data, size_t size, ChunkResult& result, bool keepColumns) {
+    TimelineBuilder builder(result, keepColumns);
+    std::string partial[2];         // writes, reads
+    const uint8_t* position = data + sizeof kCaptureMagic;
+    const uint8_t* end = data + size;
+    uint64_t timeNs = 0;
+
+    auto varint = [&](uint64_t& value) -> bool {
+        value = 0;
+        for (int shift = 0; shift < 64 && position < end; shift += 7) {
+            uint8_t byte = *position++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+        return false;
+    };
+
+    while (position < end) {
+        uint8_t kind = *position++;
+        uint64_t delta;
+        if (!varint(delta)) return false;
+        timeNs += delta;
+        double time = timeNs / 1e9;
+        if (kind == 0 || kind == 1) {
+            uint64_t length;
+            if (!varint(length)) return false;
+            size_t bytes = length == 0 ? 0 : static_cast<size_t>(length - 1);
+            if (static_cast<size_t>(end - position) < bytes) return false;
+            const char* text = reinterpret_cast<const char*>(position);
+            const char* textEnd = text + bytes;
+            std::string& carry = partial[kind];
+            while (text < textEnd) {
+                const char* newline = static_cast<const char*>(std::memchr(text, '\n', textEnd - text));
+                if (newline == nullptr) {
+                    carry.append(text, textEnd);
+                    break;
+                }
+                if (carry.empty()) {
+                    decodeLine(text, newline, time, builder, result);
+                } else {
+                    carry.append(text, newline);
+                    decodeLine(carry.data(), carry.data() + carry.size(), time, builder, result);
+                    carry.clear();
+                }
+                text = newline + 1;
+            }
+            position += bytes;
+        } else if (kind == 2) {
+            position++;
+        } else if (kind == 3) {
+            uint64_t line;
+            if (!varint(line) || position >= end) return false;
+            position++;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// TIMELINE OUTPUT - one file per column and register, chunks concatenated in order
+template <typename T>
+static bool writeColumn(const std::string& path, const std::vector<ChunkResult>& chunks, uint32_t reg,
+                        std::vector<T> RegisterColumns::*column, const std::vector<uint64_t>* frameOffsets) {
+    std::ofstream output(path, std::ios::binary);
+    if (!output.is_open()) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < chunks.size(); i++) {
+        const std::vector<T>& values = chunks[i].columns[reg].*column;
+        if (frameOffsets == nullptr) {
+            output.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+        } else {
+            for (T value : values) {
+                T global = value + static_cast<T>((*frameOffsets)[i]);
+                output.write(reinterpret_cast<const char*>(&global), sizeof global);
+            }
+        }
+    }
+    return output.good();
+}
+
+static bool writeTimeline(const std::string& directory, const std::vector<ChunkResult>& chunks, const std::vector<RegisterStats>& totals) {
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create " << directory << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::vector<uint64_t> frameOffsets(chunks.size(), 0);
+    for (size_t i = 1; i < chunks.size(); i++) {
+        frameOffsets[i] = frameOffsets[i - 1] + chunks[i - 1].frames;
+    }
+    std::ofstream index(directory + "/index.tsv");
+    index << "reg\tname\tcount\tnan\tmin\tmax\tmean\n";
+    for (uint32_t reg = 0; reg < kTimelineRegisters; reg++) {
+        const RegisterStats& stats = totals[reg];
+        if (stats.count == 0) {
+            continue;
+        }
+        char prefix[32];
+        std::snprintf(prefix, sizeof prefix, "/reg_%03x", reg);
+        std::string base = directory + prefix;
+        bool ok = writeColumn(base + ".time.f64", chunks, reg, &RegisterColumns::time, nullptr)
+               && writeColumn(base + ".frame.u64", chunks, reg, &RegisterColumns::frame, &frameOffsets)
+               && writeColumn(base + ".id.u16", chunks, reg, &RegisterColumns::id, nullptr)
+               && writeColumn(base + ".kind.u8", chunks, reg, &RegisterColumns::kind, nullptr)
+               && writeColumn(base + ".value.f32", chunks, reg, &RegisterColumns::value, nullptr);
+        if (!ok) {
+            return false;
+        }
+        const RegisterInfo* info = findRegister(reg);
+        uint64_t valid = stats.count - stats.nans;
+        index << "0x" << prefix + 5 << "\t" << (info != nullptr ? info->name : "") << "\t" << stats.count << "\t" << stats.nans << "\t"
+              << stats.min << "\t" << stats.max << "\t" << (valid > 0 ? stats.sum / valid : 0.0) << "\n";
+    }
+    return index.good();
+}
+
+static void usage() {
+    std::cerr << "usage: decode_can_capture [--threads n] [--out directory] [--print] file\n"
+                 "       decode_can_capture --hex frame..." << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string path;
+    std::string outDirectory;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bool print = false;
+    bool hex = false;
+    std::vector<std::string> hexFrames;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (hex) {
+            hexFrames.push_back(arg);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--out" && i + 1 < argc) {
+            outDirectory = argv[++i];
+        } else if (arg == "--print") {
+            print = true;
+        } else if (arg == "--hex") {
+            hex = true;
+        } else if (path.empty()) {
+            path = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    // HEX FRAMES - the decode_can_frame.py command line
+    if (hex) {
+        std::string frame;
+        for (const auto& part : hexFrames) frame += part;
+        FramePrinter printer;
+        if (!decodeMultiplex(HexCursor(frame.data(), frame.data() + frame.size()), printer)) {
+            std::cout << "  frame truncated or not hex" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (path.empty()) {
+        usage();
+        return 1;
+    }
+
+    // MAP INPUT
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        std::cerr << path << " is empty" << std::endl;
+        close(fd);
+        return 1;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map " << path << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    const char* data = static_cast<const char*>(mapped);
+    bool capture = size >= sizeof kCaptureMagic && std::memcmp(data, kCaptureMagic, sizeof kCaptureMagic) == 0;
+
+    // PRINT - every frame, in order, on one thread
+    if (print) {
+        FramePrinter printer;
+        auto printLine = [&](const char* begin, const char* end) {
+            CanLine fields;
+            if (!parseCanLine(begin, end, fields)) return;
+            std::cout << std::string(begin, end) << "\n";
+            if (!decodeMultiplex(HexCursor(fields.hexBegin, fields.hexEnd), printer)) {
+                std::cout << "  frame truncated or not hex\n";
+            }
+        };
+        if (capture) {
+            std::cerr << "--print reads text logs only" << std::endl;
+            return 1;
+        }
+        for (const char* line = data; line < data + size; ) {
+            const char* newline = static_cast<const char*>(std::memchr(line, '\n', data + size - line));
+            const char* lineEnd = newline != nullptr ? newline : data + size;
+            printLine(line, lineEnd);
+            line = lineEnd + 1;
+        }
+        munmap(mapped, size);
+        return 0;
+    }
+
+    // DECODE - text split at line starts across the workers, captures on one
+    auto started = std::chrono::steady_clock::now();
+    bool keepColumns = !outDirectory.empty();
+    std::vector<ChunkResult> chunks;
+    if (capture) {
+        chunks.resize(1);
+        if (!decodeCapture(reinterpret_cast<const uint8_t*>(data), size, chunks[0], keepColumns)) {
+            std::cerr << "Capture " << path << " is truncated, decoded up to the damage" << std::endl;
+        }
+    } else {
+        size_t chunkCount = std::min<size_t>(threads, std::max<size_t>(1, size / (1 << 20)));
+        std::vector<const char*> starts(chunkCount + 1, data + size);
+        starts[0] = data;
+        for (size_t i = 1; i < chunkCount; i++) {
+            const char* guess = data + size * i / chunkCount;
+            const char* newline = static_cast<const char*>(std::memchr(guess, '\n', data + size - guess));
+            starts[i] = std::max(starts[i - 1], newline != nullptr ? newline + 1 : data + size);
+        }
+        chunks.resize(chunkCount);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < chunkCount; i++) {
+            workers.emplace_back(decodeTextChunk, starts[i], starts[i + 1], data + size, std::ref(chunks[i]), keepColumns);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    // MERGE
+    ChunkResult total;
+    for (const auto& chunk : chunks) {
+        total.lines += chunk.lines;
+        total.frames += chunk.frames;
+        total.ignoredLines += chunk.ignoredLines;
+        total.badFrames += chunk.badFrames;
+        total.outOfRange += chunk.outOfRange;
+        total.reads += chunk.reads;
+        total.errors += chunk.errors;
+        total.streams += chunk.streams;
+        total.nops += chunk.nops;
+        total.unknown += chunk.unknown;
+        for (uint32_t reg = 0; reg < kTimelineRegisters; reg++) {
+            total.stats[reg].merge(chunk.stats[reg]);
+        }
+    }
+
+    // SUMMARY
+    std::cout << "Decoded " << total.frames << " frames from " << total.lines << " lines in " << std::fixed << std::setprecision(3)
+              << seconds << " s (" << size / 1e6 / std::max(seconds, 1e-9) << " MB/s, " << chunks.size() << " workers)" << std::endl;
+    std::cout << std::defaultfloat << std::setprecision(6);
+    std::cout << "Ignored lines " << total.ignoredLines << "\tbad frames " << total.badFrames << "\tread requests " << total.reads
+              << "\terrors " << total.errors << "\tstream " << total.streams << "\tnop " << total.nops << "\tunknown " << total.unknown
+              << "\tregisters out of range " << total.outOfRange << std::endl;
+    std::cout << "reg\tname\tcount\tnan\tmin\tmax\tmean" << std::endl;
+    for (uint32_t reg = 0; reg < kTimelineRegisters; reg++) {
+        const RegisterStats& stats = total.stats[reg];
+        if (stats.count == 0) {
+            continue;
+        }
+        const RegisterInfo* registerInfo = findRegister(reg);
+        uint64_t valid = stats.count - stats.nans;
+        std::cout << "0x" << std::hex << std::setw(3) << std::setfill('0') << reg << std::dec << std::setfill(' ') << "\t"
+                  << (registerInfo != nullptr ? registerInfo->name : "") << "\t" << stats.count << "\t" << stats.nans << "\t"
+                  << stats.min << "\t" << stats.max << "\t" << (valid > 0 ? stats.sum / valid : 0.0) << std::endl;
+    }
+
+    bool ok = true;
+    if (keepColumns) {
+        ok = writeTimeline(outDirectory, chunks, total.stats);
+        if (ok) {
+            std::cout << "Timeline written to " << outDirectory << std::endl;
+        }
+    }
+    munmap(mapped, size);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,183 @@
+#include "DaemonProtocol.h"
+#include "MotionPhase.h"
+#include "MotorState.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+
+// Command line client for doomblade_daemon
+//   doomblade_ctl query
+//   doomblade_ctl home wait Homed extend wait Extended sheath
+//   doomblade_ctl move 498.5 wait Positioned query
+//   doomblade_ctl set motion.max_speed 0.05
+//   doomblade_ctl watch
+// Commands up to the next wait or watch are sent back to back without waiting for their
+// responses. wait <State> blocks until the daemon reports that state. --socket <path>
+// selects the daemon (default /tmp/doomblade.sock), --timeout <s> bounds each wait.
+
+static void usage() {
+    std::cerr << "usage: doomblade_ctl [--socket path] [--timeout s] "
+                 "home|extend|sheath|stop|query|move <pos>|set <key> <value>|wait <State>|watch ..." << std::endl;
+}
+
+static void printStatus(const char* label, const std::string& payload) {
+    DaemonStatusPayload status;
+    if (!decodeStatus(payload, status)) {
+        std::cout << label << ": short status" << std::endl;
+        return;
+    }
+    std::cout << label << ": " << motorStateName(static_cast<MotorState>(status.motorState))
+              << "\tphase " << motionPhaseName(static_cast<MotionPhase>(status.phase))
+              << "\ttarget " << status.commandedPosition << "\tactual " << status.currentPosition
+              << "\tvelocity " << status.velocity << "\ttorque " << status.torque
+              << (status.replyValid ? "" : "\treply rejected")
+              << (status.pendingCommand ? "\tcommand pending" : "")
+              << "\tconfig " << status.configGeneration << std::endl;
+}
+
+static bool parseState(const std::string& name, MotorState& state) {
+    for (size_t i = 0; i < static_cast<size_t>(MotorState::Count); i++) {
+        if (name == motorStateName(static_cast<MotorState>(i))) {
+            state = static_cast<MotorState>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    std::string socketPath = "/tmp/doomblade.sock";
+    int timeoutMs = 30000;
+    std::vector<std::string> words;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            timeoutMs = static_cast<int>(std::stod(argv[++i]) * 1000);
+        } else {
+            words.push_back(arg);
+        }
+    }
+    if (words.empty()) {
+        usage();
+        return 1;
+    }
+
+    DaemonClient client;
+    if (!client.connect(socketPath)) {
+        return 1;
+    }
+
+    std::map<uint32_t, std::string> outstanding;    // sequence -> command, for the responses
+    bool failed = false;
+
+    // HANDLE - one incoming message, returns the state of a notification or Count
+    auto handle = [&](const DaemonFrame& frame) -> MotorState {
+        if (!frame.isResponse()) {
+            if (frame.message() == DaemonMessage::StateChanged) {
+                printStatus("state", frame.payload);
+                DaemonStatusPayload status;
+                if (decodeStatus(frame.payload, status)) {
+                    return static_cast<MotorState>(status.motorState);
+                }
+            }
+            return MotorState::Count;
+        }
+        auto found = outstanding.find(frame.sequence);
+        std::string name = (found != outstanding.end()) ? found->second : "?";
+        if (found != outstanding.end()) {
+            outstanding.erase(found);
+        }
+        if (frame.status != static_cast<uint8_t>(DaemonStatus::Ok)) {
+            failed = true;
+            std::cout << name << ": " << daemonStatusName(frame.status) << std::endl;
+            if (!frame.payload.empty()) {
+                printStatus("  in", frame.payload);
+            }
+        } else if (frame.message() == DaemonMessage::Query) {
+            printStatus(name.c_str(), frame.payload);
+        } else {
+            std::cout << name << ": ok" << std::endl;
+        }
+        return MotorState::Count;
+    };
+
+    // DRAIN - collect the responses still owed before blocking on a state
+    auto drain = [&]() -> bool {
+        DaemonFrame frame;
+        while (!outstanding.empty()) {
+            if (!client.receive(frame, timeoutMs)) {
+                std::cerr << "No response from the daemon" << std::endl;
+                return false;
+            }
+            handle(frame);
+        }
+        return true;
+    };
+
+    for (size_t i = 0; i < words.size(); i++) {
+        const std::string& word = words[i];
+        uint32_t sequence = 0;
+        if (word == "home") {
+            sequence = client.send(DaemonMessage::Home);
+        } else if (word == "extend") {
+            sequence = client.send(DaemonMessage::Extend);
+        } else if (word == "sheath") {
+            sequence = client.send(DaemonMessage::Sheath);
+        } else if (word == "stop") {
+            sequence = client.send(DaemonMessage::Stop);
+        } else if (word == "query") {
+            sequence = client.send(DaemonMessage::Query);
+        } else if (word == "move" && i + 1 < words.size()) {
+            std::string payload;
+            putF32(payload, std::stof(words[++i]));
+            sequence = client.send(DaemonMessage::MoveTo, payload);
+        } else if (word == "set" && i + 2 < words.size()) {
+            std::string payload = words[i + 1] + " " + words[i + 2];
+            i += 2;
+            sequence = client.send(DaemonMessage::SetParameter, payload);
+        } else if (word == "wait" && i + 1 < words.size()) {
+            MotorState target;
+            if (!parseState(words[++i], target)) {
+                std::cerr << "Unknown state " << words[i] << std::endl;
+                return 1;
+            }
+            if (!drain() || failed) {
+                return 1;
+            }
+            DaemonFrame frame;
+            while (true) {
+                if (!client.receive(frame, timeoutMs)) {
+                    std::cerr << "Timed out waiting for " << motorStateName(target) << std::endl;
+                    return 1;
+                }
+                if (handle(frame) == target) {
+                    break;
+                }
+            }
+            continue;
+        } else if (word == "watch") {
+            if (!drain()) {
+                return 1;
+            }
+            DaemonFrame frame;
+            while (client.receive(frame, -1)) {
+                handle(frame);
+            }
+            return 0;
+        } else {
+            usage();
+            return 1;
+        }
+        if (sequence == 0) {
+            return 1;
+        }
+        outstanding[sequence] = word;
+    }
+    if (!drain()) {
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
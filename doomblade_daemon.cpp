@@ -0,0 +1,394 @@
+#include "MyController.h"
+#include "MyGpio.h"
+#include "PositionManager.h"
+#include "SafetySupervisor.h"
+#include "BladeStateMachine.h"
+#include "RuntimeConfig.h"
+#include "LinkCharacterizer.h"
+#include "TelemetryPublisher.h"
+#include "DaemonProtocol.h"
+#include "WarmStart.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Long running owner of the controller, the GPIO lines and the state machine. Tools talk
+// to it over the Unix socket in DaemonProtocol.h instead of opening the device and
+// homing themselves. The socket is serviced between state machine ticks with a zero
+// timeout poll, so a client never holds up a control cycle.
+//   doomblade_daemon [--config doomblade.cfg]
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+class DaemonServer {
+public:
+    DaemonServer(BladeStateMachine& stateMachine, PositionManager& positionManager, RuntimeConfig& runtimeConfig)
+    : stateMachine(stateMachine), positionManager(positionManager), runtimeConfig(runtimeConfig) {}
+    ~DaemonServer() { close(); }
+
+    inline bool listen(const std::string& path);
+    inline void close();
+
+    // Once per tick: accept, read and answer requests, push notifications, write
+    inline void service();
+
+private:
+    struct Connection {
+        int fd;
+        std::string input;
+        std::string output;
+    };
+
+    inline void acceptClients();
+    inline bool readFrom(Connection& connection);
+    inline void handleRequests(Connection& connection);
+    inline void respond(Connection& connection, const DaemonFrame& request, DaemonStatus status, const std::string& payload = std::string());
+    inline bool flush(Connection& connection);
+    inline void notifyStateChange();
+    inline std::string statusPayload();
+
+    static const size_t kMaxClients = 8;
+    static const size_t kMaxBuffered = 256 * 1024;      // a client that stops reading is dropped
+
+    BladeStateMachine& stateMachine;
+    PositionManager& positionManager;
+    RuntimeConfig& runtimeConfig;
+    std::string path;
+    int listenFd = -1;
+    std::vector<Connection> connections;
+    std::vector<pollfd> pollFds;
+    MotorState lastState = MotorState::Count;
+    uint32_t notificationSequence = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// LISTEN - a stale socket from a previous run is replaced
+bool DaemonServer::listen(const std::string& socketPath) {
+    path = socketPath;
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        std::cerr << "Failed to create socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return false;
+    }
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(path.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof address) != 0 || ::listen(listenFd, 8) != 0) {
+        std::cerr << "Failed to listen on " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::cout << "Listening on " << path << std::endl;
+    return true;
+}
+
+void DaemonServer::close() {
+    for (auto& connection : connections) {
+        flush(connection);
+        ::close(connection.fd);
+    }
+    connections.clear();
+    if (listenFd >= 0) {
+        ::close(listenFd);
+        unlink(path.c_str());
+        listenFd = -1;
+    }
+}
+
+void DaemonServer::service() {
+    notifyStateChange();
+
+    pollFds.clear();
+    pollFds.push_back({listenFd, POLLIN, 0});
+    for (auto& connection : connections) {
+        pollFds.push_back({connection.fd, static_cast<short>(POLLIN | (connection.output.empty() ? 0 : POLLOUT)), 0});
+    }
+    if (poll(pollFds.data(), pollFds.size(), 0) < 0) {
+        return;
+    }
+
+    // Connections closed here are swapped out, walk backwards so indices stay valid
+    for (size_t i = connections.size(); i-- > 0; ) {
+        Connection& connection = connections[i];
+        short events = pollFds[i + 1].revents;
+        bool open = true;
+        if (events & (POLLIN | POLLHUP | POLLERR)) {
+            open = readFrom(connection);
+        }
+        if (open) {
+            handleRequests(connection);
+            open = flush(connection);
+        }
+        if (!open) {
+            ::close(connection.fd);
+            connections[i] = std::move(connections.back());
+            connections.pop_back();
+        }
+    }
+    if (pollFds[0].revents & POLLIN) {
+        acceptClients();
+    }
+}
+
+void DaemonServer::acceptClients() {
+    int fd;
+    while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (connections.size() >= kMaxClients) {
+            ::close(fd);
+            continue;
+        }
+        connections.push_back({fd, std::string(), std::string()});
+    }
+}
+
+bool DaemonServer::readFrom(Connection& connection) {
+    char buf[4096];
+    while (true) {
+        ssize_t n = recv(connection.fd, buf, sizeof buf, 0);
+        if (n > 0) {
+            connection.input.append(buf, static_cast<size_t>(n));
+            if (connection.input.size() > kMaxBuffered) {
+                return false;
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return false;   // closed by the client or failed
+    }
+}
+
+// HANDLE REQUESTS - in arrival order. A motion command waits while the state machine
+// still holds an untaken one, so pipelined commands see the state the previous one made.
+void DaemonServer::handleRequests(Connection& connection) {
+    DaemonFrame request;
+    while (true) {
+        if (connection.input.size() >= 1 && stateMachine.hasPendingCommand()) {
+            uint8_t type = static_cast<uint8_t>(connection.input[0]);
+            if (type >= static_cast<uint8_t>(DaemonMessage::Home) && type <= static_cast<uint8_t>(DaemonMessage::Stop)) {
+                return;
+            }
+        }
+        bool malformed;
+        if (!decodeFrame(connection.input, request, malformed)) {
+            if (malformed) {
+                connection.input.clear();   // unframeable, the connection is closed once the output drains
+                shutdown(connection.fd, SHUT_RD);
+            }
+            return;
+        }
+
+        BladeCommand command = BladeCommand::None;
+        float value = 0.0f;
+        switch (request.message()) {
+            case DaemonMessage::Home:   command = BladeCommand::Home; break;
+            case DaemonMessage::Extend: command = BladeCommand::Extend; break;
+            case DaemonMessage::Sheath: command = BladeCommand::Sheath; break;
+            case DaemonMessage::Stop:   command = BladeCommand::Stop; break;
+            case DaemonMessage::MoveTo:
+                if (request.payload.size() != 4) {
+                    respond(connection, request, DaemonStatus::BadRequest);
+                    continue;
+                }
+                command = BladeCommand::MoveTo;
+                value = getF32(request.payload.data());
+                break;
+            case DaemonMessage::Query:
+                respond(connection, request, DaemonStatus::Ok, statusPayload());
+                continue;
+            case DaemonMessage::SetParameter: {
+                size_t split = request.payload.find(' ');
+                bool applied = split != std::string::npos
+                               && runtimeConfig.set(request.payload.substr(0, split), request.payload.substr(split + 1));
+                respond(connection, request, applied ? DaemonStatus::Ok : DaemonStatus::BadRequest);
+                continue;
+            }
+            default:
+                respond(connection, request, DaemonStatus::Unknown);
+                continue;
+        }
+
+        if (!stateMachine.accepts(command)) {
+            respond(connection, request, DaemonStatus::Refused, statusPayload());
+            continue;
+        }
+        stateMachine.command(command, value);
+        respond(connection, request, DaemonStatus::Ok);
+    }
+}
+
+void DaemonServer::respond(Connection& connection, const DaemonFrame& request, DaemonStatus status, const std::string& payload) {
+    encodeFrame(connection.output, request.type | kResponseFlag, static_cast<uint8_t>(status), request.sequence, payload);
+}
+
+bool DaemonServer::flush(Connection& connection) {
+    while (!connection.output.empty()) {
+        ssize_t n = send(connection.fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            connection.output.erase(0, static_cast<size_t>(n));
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        return false;
+    }
+    return connection.output.size() <= kMaxBuffered;
+}
+
+// NOTIFY - pushed to every client when the state machine changes state
+void DaemonServer::notifyStateChange() {
+    MotorState state = stateMachine.getState();
+    if (state == lastState) {
+        return;
+    }
+    lastState = state;
+    std::string payload = statusPayload();
+    uint32_t sequence = ++notificationSequence;
+    for (auto& connection : connections) {
+        encodeFrame(connection.output, static_cast<uint8_t>(DaemonMessage::StateChanged), 0, sequence, payload);
+    }
+}
+
+std::string DaemonServer::statusPayload() {
+    DaemonStatusPayload status;
+    status.motorState = static_cast<uint8_t>(stateMachine.getState());
+    status.phase = static_cast<uint8_t>(positionManager.getPhase());
+    status.replyValid = positionManager.isLastReplyValid() ? 1 : 0;
+    status.pendingCommand = stateMachine.hasPendingCommand() ? 1 : 0;
+    status.commandedPosition = stateMachine.getCommandedPosition();
+    status.currentPosition = stateMachine.getCurrentPosition();
+    status.velocity = positionManager.getEstimator().getVelocity();
+    status.torque = positionManager.getLastReply().torque;
+    status.configGeneration = static_cast<uint32_t>(runtimeConfig.acquire().generation);
+    return encodeStatus(status);
+}
+
+
+int main(int argc, char** argv) {
+    std::string configPath = "doomblade.cfg";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc) {
+            configPath = argv[++i];
+        } else {
+            std::cerr << "usage: doomblade_daemon [--config file]" << std::endl;
+            return 1;
+        }
+    }
+
+    // RUNTIME CONFIG - defaults when the file is missing, motion keys reload while running
+    RuntimeConfig runtimeConfig(configPath);
+    if (runtimeConfig.load()) {
+        runtimeConfig.start();
+    }
+    const MotionConfig& config = runtimeConfig.acquire();  // startup snapshot
+    std::string socketPath = config.daemonSocket;
+    std::string telemetrySegment = config.telemetrySegment;
+
+    // GPIO SETUP
+    MyGpio homeLimitSwitch(config.gpioChip, config.homePin);
+    MyGpio extendLimitSwitch(config.gpioChip, config.extendPin);
+    MyGpio activateSwitch(config.gpioChip, config.activatePin);
+    MyGpio safetySwitch(config.gpioChip, config.safetyPin);
+    if (!homeLimitSwitch.init() || !extendLimitSwitch.init() || !activateSwitch.init() || !safetySwitch.init()) {
+        std::cerr << "Failed to initialize GPIO" << std::endl;
+        return 1;
+    }
+
+    // CONTROLLER SETUP
+    MyController controller(config.controllerDevice.c_str(), config.writeTimeoutMs);
+    if (!controller.setupSerialPort()) {
+        std::cerr << "Failed to setup serial port" << std::endl;
+        return 1;
+    }
+    controller.setCanId(config.controllerCanId);
+    controller.setRecoveryPolicy(config.recoveryTimeouts, config.recoveryBudgetMs, config.recoveryRetryMs);
+    controller.setOutputEncoder(config.outputEncoder);
+
+    // WARM START - skips homing when the position saved at the last clean stop still holds
+    WarmStart warmStart(config.warmStartFile, config.warmStartTolerance);
+    WarmStartVerdict warmVerdict = config.warmStartFile.empty() ? WarmStartVerdict::Disabled : warmStart.start(controller, homeLimitSwitch);
+    std::cout << "Warm start: " << warmStartVerdictName(warmVerdict) << std::endl;
+
+    struct timespec req = selectControlPeriod(controller, config);
+    PositionManager positionManager(controller, homeLimitSwitch, extendLimitSwitch, config.maxSpeed, config.cruisingEndPosition,
+                                    config.cruisingReverseEndPosition, config.stepsToAccelerate, config.decelerationSteps, req);
+    positionManager.applyConfig(config);
+    if (warmVerdict == WarmStartVerdict::Valid) {
+        positionManager.restorePosition(warmStart.getSaved().logicalPosition, warmStart.getLiveAbsolute());
+    }
+
+    SafetySupervisor supervisor(controller, safetySwitch, homeLimitSwitch, extendLimitSwitch, req);
+    positionManager.attachSupervisor(&supervisor);
+    supervisor.start();
+
+    // SPEED INPUT - without one, or when it does not open, the blade cruises at max speed
+    SpidevDevice speedDevice(config.speedDevice, config.speedClockHz);
+    SpeedInput speedInput(speedDevice, config.speedChannel, config.speedSamplePeriodUs, config.speedFilterMs);
+    if (!config.speedDevice.empty() && speedInput.start()) {
+        positionManager.attachSpeedInput(&speedInput);
+    }
+
+    BladeStateMachine stateMachine(positionManager, controller, homeLimitSwitch, extendLimitSwitch, activateSwitch, safetySwitch, &supervisor, req);
+    stateMachine.setRuntimeConfig(&runtimeConfig);
+    stateMachine.setLockoutOnTrip(true);    // clients see the lockout, only a signal stops the daemon
+    if (warmVerdict == WarmStartVerdict::Valid) {
+        stateMachine.resume(warmStart.getSaved().logicalPosition, warmStart.getSaved().atHome);
+    }
+
+    TelemetryPublisher telemetry(telemetrySegment, req);
+    if (!telemetrySegment.empty()) {
+        telemetry.open();
+    }
+    stateMachine.setTelemetry(&telemetry);
+
+    // COMMAND SOCKET
+    DaemonServer server(stateMachine, positionManager, runtimeConfig);
+    if (!server.listen(socketPath)) {
+        return 1;
+    }
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    // SYSTEM STATE MACHINE - one control cycle per tick, the socket between ticks
+    while (!stopRequested) {
+        stateMachine.tick();
+        server.service();
+    }
+    server.service();   // last state change goes out before the socket closes
+    server.close();
+
+    controller.sendStopCommand();
+    supervisor.stop();
+    speedInput.stop();
+    if (warmVerdict != WarmStartVerdict::Disabled) {
+        warmStart.stop(controller, homeLimitSwitch, positionManager.getFrame(), positionManager.isReferenced());
+    }
+    controller.printIoReport(std::cout);
+    controller.closeSerialPort();
+    std::cout << "Daemon stopped on signal, last safety trip: " << stateMachine.getLastTrip() << std::endl;
+    return 0;
+}
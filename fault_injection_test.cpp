@@ -0,0 +1,222 @@
+#include "MyController.h"
+#include "MyGpio.h"
+#include "PositionManager.h"
+#include "BladeStateMachine.h"
+#include "RuntimeConfig.h"
+#include "SimulatedController.h"
+#include "FaultInjectingTransport.h"
+#include "ScenarioRunner.h"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Device recovery of the position_control_test state machine, run against SimulatedController
+// with FaultInjectingTransport between it and MyController
+//   fault_injection_test             every scenario
+//   fault_injection_test --verbose   keep the state machine output
+// Each scenario homes a fresh simulated blade, injects one link fault while cruising out or
+// while waiting, and checks that the link recovers, or for a device that stays gone that the
+// machine locks out, within the recovery budget. Afterwards the blade has to home and extend
+// again. Times are simulated time. Recovery settings come from doomblade.cfg.
+
+struct FaultScenario {
+    const char* name;
+    InjectedFault fault;
+    int64_t durationNs;         // < 0 until a reopen
+    int failedReopens;          // < 0 every reopen fails
+    bool whileCruising;         // else while waiting to extend
+    bool expectLockout;
+    int64_t clearAfterNs;       // device back after this long, < 0 never
+};
+
+struct RecoveryResult {
+    bool passed = false;
+    double recoveredMs = -1.0;  // fault to link up again
+    double lockoutMs = -1.0;    // fault to SafetyLockout
+    double longestTickMs = 0.0;
+    IoCounters io;
+    MotorState endState = MotorState::Initial;
+    std::string failure;
+};
+
+static RecoveryResult runRecovery(const FaultScenario& scenario, const MotionConfig& config) {
+    RecoveryResult result;
+
+    // SIMULATOR - controller, link and every GPIO line, the faults between it and MyController
+    SimulatedController simulator(config.homePin, config.extendPin);
+    FaultInjectingTransport faulty(simulator, config.writeTimeoutMs);
+
+    MyGpio homeLimitSwitch(config.gpioChip, config.homePin);
+    MyGpio extendLimitSwitch(config.gpioChip, config.extendPin);
+    MyGpio activateSwitch(config.gpioChip, config.activatePin);
+    MyGpio safetySwitch(config.gpioChip, config.safetyPin);
+    for (MyGpio* line : {&homeLimitSwitch, &extendLimitSwitch, &activateSwitch, &safetySwitch}) {
+        line->setTap(&simulator);
+        line->init();
+    }
+
+    MyController controller(faulty);
+    controller.setupSerialPort();
+    controller.setCanId(config.controllerCanId);
+    controller.setRecoveryPolicy(config.recoveryTimeouts, config.recoveryBudgetMs, config.recoveryRetryMs);
+    controller.sendStopCommand();  //gets controller to a known state
+    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+
+    struct timespec req = config.controlPeriod();
+    PositionManager positionManager(controller, homeLimitSwitch, extendLimitSwitch, config.maxSpeed, config.cruisingEndPosition,
+                                    config.cruisingReverseEndPosition, config.stepsToAccelerate, config.decelerationSteps, req);
+    positionManager.applyConfig(config);
+    BladeStateMachine stateMachine(positionManager, controller, homeLimitSwitch, extendLimitSwitch, activateSwitch, safetySwitch, nullptr, req);
+
+    const int64_t pressNs = 30 * 1000000LL;
+    const int64_t limitNs = 30 * 1000000000LL;
+    auto press = [&]() {
+        simulator.setInput(config.activatePin, 0);
+        simulator.scheduleInput(controller.nowNs() + pressNs, config.activatePin, 1);
+    };
+    auto runUntil = [&](auto reached) {
+        int64_t deadline = controller.nowNs() + limitNs;
+        while (controller.nowNs() < deadline) {
+            if (!stateMachine.tick()) {
+                return false;
+            }
+            if (reached()) {
+                return true;
+            }
+        }
+        return false;
+    };
+    auto waitingToExtend = [&]() { return stateMachine.getState() == MotorState::WaitingToExtend && simulator.getPosition() >= 0.0; };
+
+    // HOMING - first press after power up
+    press();
+    if (!runUntil(waitingToExtend)) {
+        result.failure = "did not home before the fault";
+        return result;
+    }
+    if (scenario.whileCruising) {
+        press();
+        // Far enough out that the sheath after a stopped extend ends short of the home stop
+        if (!runUntil([&]() { return positionManager.getPhase() == MotionPhase::Cruising && stateMachine.getCurrentPosition() <= config.cruisingEndPosition + 1.0f; })) {
+            result.failure = "did not reach cruising";
+            return result;
+        }
+    } else {
+        for (int i = 0; i < 50; i++) {
+            stateMachine.tick();
+        }
+    }
+
+    // FAULT - three seconds of ticks, long enough for the retries of a device that stays
+    // gone for a while and for the blade to settle wherever the fault left it
+    faulty.inject(scenario.fault, scenario.durationNs, scenario.failedReopens);
+    int64_t faultNs = controller.nowNs();
+    bool faulted = false;
+    const int64_t observeNs = 3 * 1000000000LL;
+    while (controller.nowNs() - faultNs < observeNs) {
+        if (scenario.clearAfterNs >= 0 && faulty.getFault() != InjectedFault::None && controller.nowNs() - faultNs >= scenario.clearAfterNs) {
+            faulty.inject(InjectedFault::None);
+        }
+        int64_t tickStartNs = controller.nowNs();
+        if (!stateMachine.tick()) {
+            result.failure = "state machine shut down";
+            return result;
+        }
+        int64_t now = controller.nowNs();
+        result.longestTickMs = std::max(result.longestTickMs, (now - tickStartNs) / 1e6);
+        faulted = faulted || controller.linkFaulted();
+        if (stateMachine.getState() == MotorState::SafetyLockout && result.lockoutMs < 0.0) {
+            result.lockoutMs = (now - faultNs) / 1e6;
+        }
+        if (faulted && !controller.linkFaulted() && result.recoveredMs < 0.0) {
+            result.recoveredMs = (now - faultNs) / 1e6;
+        }
+    }
+    result.io = controller.getIoCounters();
+
+    // AFTERWARDS - whatever the fault left, a press homes the blade and the next extends it
+    for (int presses = 0; presses < 3 && !waitingToExtend(); presses++) {
+        press();
+        runUntil([&]() { return waitingToExtend() || stateMachine.getState() == MotorState::WaitingToHome; });
+    }
+    bool extended = false;
+    if (waitingToExtend()) {
+        press();
+        extended = runUntil([&]() { return stateMachine.getState() == MotorState::Extended; });
+    }
+    result.endState = stateMachine.getState();
+
+    // CHECKS - one recovery may take the budget, plus the write timeouts of its two frames,
+    // plus the cycle it ran in
+    double tickBoundMs = config.recoveryBudgetMs + 2.0 * config.writeTimeoutMs + 10.0 + config.controlPeriodUs / 1000.0 + 5.0;
+    double detectMs = config.recoveryTimeouts * (config.controlPeriodUs / 1000.0 + 10.0 + config.writeTimeoutMs);
+    if (!faulted) {
+        result.failure = "fault went unnoticed";
+    } else if (result.recoveredMs < 0.0) {
+        result.failure = "link never recovered";
+    } else if (scenario.expectLockout && (result.lockoutMs < 0.0 || result.lockoutMs > detectMs + tickBoundMs)) {
+        result.failure = "no lockout within the recovery budget";
+    } else if (!scenario.expectLockout && result.lockoutMs >= 0.0) {
+        result.failure = "locked out although the link recovered";
+    } else if (!scenario.expectLockout && result.recoveredMs > detectMs + tickBoundMs) {
+        result.failure = "recovery took longer than the budget";
+    } else if (result.longestTickMs > tickBoundMs) {
+        result.failure = "a tick outlasted the recovery budget";
+    } else if (!extended) {
+        result.failure = "blade did not home and extend afterwards";
+    } else {
+        result.passed = true;
+    }
+    return result;
+}
+
+// REPORT - the recovery figures as the runner's detail lines
+static ScenarioResult report(const RecoveryResult& recovery) {
+    ScenarioResult result;
+    result.passed = recovery.passed;
+    result.failure = recovery.failure;
+    std::ostringstream detail;
+    detail << "recovered " << recovery.recoveredMs << " ms after the fault";
+    if (recovery.lockoutMs >= 0.0) {
+        detail << ", lockout after " << recovery.lockoutMs << " ms";
+    }
+    detail << ", longest tick " << recovery.longestTickMs << " ms, ends " << motorStateName(recovery.endState) << "\n";
+    detail << recovery.io.writeTimeouts << " write timeouts, " << recovery.io.writeErrors << " write errors, "
+           << recovery.io.readTimeouts << " reply timeouts, " << recovery.io.readErrors << " read errors, "
+           << recovery.io.recoveries << " recoveries, " << recovery.io.failedRecoveries << " failed";
+    result.detail = detail.str();
+    return result;
+}
+
+int main(int argc, char** argv) {
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--verbose") {
+            verbose = true;
+        } else {
+            std::cerr << "usage: fault_injection_test [--verbose]" << std::endl;
+            return 1;
+        }
+    }
+
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    runtimeConfig.load();
+    const MotionConfig& config = runtimeConfig.acquire();
+
+    const int64_t ms = 1000000LL;
+    const std::vector<FaultScenario> faults = {
+        {"stall mid-cruise",               InjectedFault::Stall,       80 * ms, 0,  true,  false, -1},
+        {"replies dropped while waiting",  InjectedFault::DropReplies, -1,      0,  false, false, -1},
+        {"garbage while waiting",          InjectedFault::Garbage,     -1,      0,  false, false, -1},
+        {"disconnect, two failed reopens", InjectedFault::Disconnect,  -1,      2,  true,  false, -1},
+        {"device gone for 1.5 s",          InjectedFault::Disconnect,  -1,      -1, true,  true,  1500 * ms},
+    };
+    std::vector<Scenario> scenarios;
+    for (const FaultScenario& fault : faults) {
+        scenarios.push_back({fault.name, [&fault, &config]() { return report(runRecovery(fault, config)); }});
+    }
+    return runScenarios(scenarios, !verbose);
+}
@@ -6,6 +6,7 @@
 #include <unistd.h> // For nanosleep
 #include <limits>
 #include "MyController.h"
+#include "LinkCharacterizer.h"
 
 
 
@@ -19,7 +20,16 @@ int main() {
     controller.sendStopCommand();  //gets controller to a known state
     controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
 
+    // LINK - round trip distribution, then loop at the period it supports
     struct timespec req = {0, 1200 * 1000};
+    LinkCharacterizer link(controller);
+    if (link.measure(1000, 10)) {
+        long periodUs = link.choosePeriod(0.001, 100, 50, 300, 5000);
+        link.printReport();
+        if (periodUs > 0) {
+            req = {periodUs / 1000000, (periodUs % 1000000) * 1000};
+        }
+    }
 
     std::deque<std::chrono::microseconds> times; // Store last 10 times
     const size_t maxTimes = 10; // Maximum number of times to average
@@ -0,0 +1,79 @@
+#include "MyController.h"
+#include "GraphPlotter.h"
+#include "MyGpio.h"
+#include "PositionManager.h"
+#include "SafetySupervisor.h"
+#include "MotionScript.h"
+#include "BladeScript.h"
+#include "RuntimeConfig.h"
+#include "LinkCharacterizer.h"
+
+// Runs the blade as the two coroutine scripts of BladeScript.h on one scheduler thread.
+// Pins, controller and motion settings come from doomblade.cfg.
+
+int main() {
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    runtimeConfig.load();
+    const MotionConfig& config = runtimeConfig.acquire();
+
+    // GPIO SETUP
+    MyGpio homeLimitSwitch(config.gpioChip, config.homePin);
+    if (!homeLimitSwitch.init()) {
+        std::cerr << "Failed to initialize home button" << std::endl;
+        return 1;
+    }
+    MyGpio extendLimitSwitch(config.gpioChip, config.extendPin);
+    if (!extendLimitSwitch.init()) {
+        std::cerr << "Failed to initialize extend button" << std::endl;
+        return 1;
+    }
+    MyGpio activateSwitch(config.gpioChip, config.activatePin);
+    if (!activateSwitch.init()) {
+        std::cerr << "Failed to initialize activate button" << std::endl;
+        return 1;
+    }
+    MyGpio safetySwitch(config.gpioChip, config.safetyPin);  //SAFETY BUTTON
+    if (!safetySwitch.init()) {
+        std::cerr << "Failed to initialize safety button" << std::endl;
+        return 1;
+    }
+
+    // CONTROLLER SETUP
+    MyController controller(config.controllerDevice.c_str());
+    if (!controller.setupSerialPort()) {
+        std::cerr << "Failed to setup serial port" << std::endl;
+        return 1;
+    }
+    controller.setCanId(config.controllerCanId);
+    controller.setRecoveryPolicy(config.recoveryTimeouts, config.recoveryBudgetMs, config.recoveryRetryMs);
+    controller.sendStopCommand();  //gets controller to a known state
+    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+
+    struct timespec req = selectControlPeriod(controller, config); // Control loop frequency
+    PositionManager positionManager(controller, homeLimitSwitch, extendLimitSwitch, config.maxSpeed, config.cruisingEndPosition,
+                                    config.cruisingReverseEndPosition, config.stepsToAccelerate, config.decelerationSteps, req);
+    positionManager.applyConfig(config);
+
+    SafetySupervisor supervisor(controller, safetySwitch, homeLimitSwitch, extendLimitSwitch, req);
+    positionManager.attachSupervisor(&supervisor);
+    supervisor.start();
+
+    // SCRIPTS - the scheduler paces every tick, a phase writes before its wait and reads after
+    float commandedPosition = 500.0f;
+    float currentPosition = 500.0f;
+    ScriptScheduler scheduler(controller, req);
+    if (!scheduler.spawn(bladeScript(positionManager, activateSwitch, commandedPosition, currentPosition)) ||
+        !scheduler.spawn(monitorScript(scheduler, supervisor))) {
+        std::cerr << "Failed to start motion scripts" << std::endl;
+        return 1;
+    }
+    scheduler.run();
+    std::cout << "Scheduler overruns: " << scheduler.getOverruns() << std::endl;
+
+    GraphPlotter plotter;
+    plotter.plot(positionManager.getTorques(), "Torque Readings Through Various Phases");
+
+    supervisor.stop();
+    controller.closeSerialPort();
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "MyController.h"
+#include "MyGpio.h"
+#include "SafetySupervisor.h"
+#include "RuntimeConfig.h"
+#include "LinkCharacterizer.h"
+#include "MultiAxisCoordinator.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Extends every blade on the bus together and sheathes them again
+//   multi_axis_test                     targets 497.0 out, 500.0 back
+//   multi_axis_test --target 496.5      extend target, all axes
+//   multi_axis_test --hold 2.0          seconds held at the target
+// Axes, phase offsets and limits come from doomblade.cfg (controller.axis_ids, axes.*).
+// The blades are expected at their home position, each is rezeroed to 500.0 first.
+
+int main(int argc, char** argv) {
+    float target = 497.0f;
+    float holdSeconds = 1.0f;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--target" && i + 1 < argc) {
+            target = std::stof(argv[++i]);
+        } else if (arg == "--hold" && i + 1 < argc) {
+            holdSeconds = std::stof(argv[++i]);
+        } else {
+            std::cerr << "usage: multi_axis_test [--target position] [--hold seconds]" << std::endl;
+            return 1;
+        }
+    }
+
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    runtimeConfig.load();
+    const MotionConfig& config = runtimeConfig.acquire();
+    if (config.axisCanIds.empty()) {
+        std::cerr << "No axes in controller.axis_ids" << std::endl;
+        return 1;
+    }
+
+    // GPIO SETUP
+    MyGpio homeLimitSwitch(config.gpioChip, config.homePin);
+    MyGpio extendLimitSwitch(config.gpioChip, config.extendPin);
+    MyGpio safetySwitch(config.gpioChip, config.safetyPin);  //SAFETY BUTTON
+    if (!homeLimitSwitch.init() || !extendLimitSwitch.init() || !safetySwitch.init()) {
+        std::cerr << "Failed to initialize GPIO" << std::endl;
+        return 1;
+    }
+
+    // CONTROLLER SETUP - one fdcanusb, one MyController for the whole bus
+    MyController controller(config.controllerDevice.c_str());
+    if (!controller.setupSerialPort()) {
+        std::cerr << "Failed to setup serial port" << std::endl;
+        return 1;
+    }
+    controller.setCanId(config.controllerCanId);
+
+    struct timespec req = selectControlPeriod(controller, config);
+    MultiAxisCoordinator coordinator(controller, config.maxSpeed, config.stepsToAccelerate, req);
+    for (int id : config.axisCanIds) {
+        coordinator.addAxis(static_cast<uint8_t>(id));
+    }
+    coordinator.applyConfig(config);
+
+    SafetySupervisor supervisor(controller, safetySwitch, homeLimitSwitch, extendLimitSwitch, req);
+    coordinator.attachSupervisor(&supervisor);
+    supervisor.start();
+
+    coordinator.rezeroAll(500.0f); // sets every axis to 500.0
+
+    // MOVES - out, hold by waiting out the cycles at the target, back
+    long holdCycles = static_cast<long>(holdSeconds * 1e9 / (req.tv_sec * 1e9 + req.tv_nsec));
+    std::vector<float> extended(coordinator.axisCount(), target);
+    std::vector<float> sheathed(coordinator.axisCount(), 500.0f);
+    const std::vector<float>* moves[] = {&extended, &sheathed};
+    TickResult result = TickResult::Done;
+    for (const std::vector<float>* targets : moves) {
+        result = coordinator.beginMove(*targets);
+        while (result == TickResult::Running) {
+            result = coordinator.tick();
+        }
+        if (result != TickResult::Done) {
+            break;
+        }
+        for (long i = 0; i < holdCycles && targets == &extended; i++) {
+            controller.waitCycle(req);
+        }
+    }
+
+    for (size_t i = 0; i < coordinator.axisCount(); i++) {
+        const Axis& axis = coordinator.axis(i);
+        std::cout << "Axis " << static_cast<int>(axis.canId) << "\tTarget: " << axis.commandedPosition << "\tActual: " << axis.currentPosition
+                  << "\treplies " << axis.replies << "\tlost " << axis.lostReplies << std::endl;
+    }
+    if (result != TickResult::Done) {
+        std::cout << "Stopped: " << MultiAxisCoordinator::faultName(coordinator.getFault()) << std::endl;
+    }
+
+    supervisor.stop();
+    controller.closeSerialPort();
+    return result == TickResult::Done ? 0 : 1;
+}
@@ -2,229 +2,201 @@
 #include "GraphPlotter.h"
 #include "MyGpio.h"
 #include "PositionManager.h"
+#include "SafetySupervisor.h"
+#include "BladeStateMachine.h"
+#include "RuntimeConfig.h"
+#include "LinkCharacterizer.h"
+#include "StreamCapture.h"
+#include "PerfCounters.h"
+#include "WarmStart.h"
+#include <string>
+
+int main(int argc, char** argv) {
+    // RECORD / REPLAY - --capture file logs the session, --replay file [--fast] plays one back.
+    // --perf reports per phase, per stage counters of the control cycle at exit.
+    std::string capturePath;
+    std::string replayPath;
+    bool fast = false;
+    bool perfReport = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--capture" && i + 1 < argc) {
+            capturePath = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (arg == "--fast") {
+            fast = true;
+        } else if (arg == "--perf") {
+            perfReport = true;
+        } else {
+            std::cerr << "usage: position_control_test [--capture file | --replay file [--fast]] [--perf]" << std::endl;
+            return 1;
+        }
+    }
+
+    // RUNTIME CONFIG - defaults when the file is missing, motion keys reload while running
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    if (runtimeConfig.load()) {
+        runtimeConfig.start();
+    }
+    const MotionConfig& config = runtimeConfig.acquire();  // startup snapshot, not used once the state machine runs
+
+    SerialTransport serial(config.controllerDevice, config.writeTimeoutMs);
+    CaptureTransport capture(serial, capturePath);
+    ReplayTransport replay(replayPath, !fast);
+    ControllerTransport* transport = &serial;
+    GpioTap* gpioTap = nullptr;
+    if (!capturePath.empty()) {
+        transport = &capture;
+        gpioTap = &capture;
+    } else if (!replayPath.empty()) {
+        transport = &replay;
+        gpioTap = &replay;
+    }
 
-enum class MotorState {
-    Initial,
-    WaitingToHome,
-    Homing,
-    Homed,
-    WaitingToExtend,
-    Extending,
-    Extended,
-    Sheathing,
-    ExtendError,
-    SafetyLockout
-};
-
-int main() {
     // GPIO SETUP
-    MyGpio homeLimitSwitch("gpiochip0", 24);  
+    MyGpio homeLimitSwitch(config.gpioChip, config.homePin);  
+    homeLimitSwitch.setTap(gpioTap);
     if (!homeLimitSwitch.init()) {
         std::cerr << "Failed to initialize home button" << std::endl;
         return 1;
     }
-    MyGpio extendLimitSwitch("gpiochip0", 27); 
+    MyGpio extendLimitSwitch(config.gpioChip, config.extendPin); 
+    extendLimitSwitch.setTap(gpioTap);
     if (!extendLimitSwitch.init()) {
         std::cerr << "Failed to initialize extend button" << std::endl;
         return 1;
     }
-    MyGpio activateSwitch("gpiochip0", 17); 
+    MyGpio activateSwitch(config.gpioChip, config.activatePin); 
+    activateSwitch.setTap(gpioTap);
     if (!activateSwitch.init()) {
         std::cerr << "Failed to initialize activate button" << std::endl;
         return 1;
     }
-    MyGpio safetySwitch("gpiochip0", 21);  //SAFETY BUTTON
+    MyGpio safetySwitch(config.gpioChip, config.safetyPin);  //SAFETY BUTTON
+    safetySwitch.setTap(gpioTap);
     if (!safetySwitch.init()) {
         std::cerr << "Failed to initialize safety button" << std::endl;
         return 1;
     }
 
     // CONTROLLER SETUP
-    MyController controller("/dev/fdcanusb");
+    MyController controller(*transport);
     if (!controller.setupSerialPort()) {
         std::cerr << "Failed to setup serial port" << std::endl;
         return 1;
     }
+    controller.setCanId(config.controllerCanId);
+    controller.setRecoveryPolicy(config.recoveryTimeouts, config.recoveryBudgetMs, config.recoveryRetryMs);
+    controller.setOutputEncoder(config.outputEncoder);
     controller.sendStopCommand();  //gets controller to a known state
-    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+
+    // WARM START - skips homing when the position saved at the last clean stop still holds.
+    // Recordings always home, so a capture does not depend on the state file.
+    WarmStart warmStart(config.warmStartFile, config.warmStartTolerance);
+    bool warmStartEnabled = !config.warmStartFile.empty() && capturePath.empty() && replayPath.empty();
+    WarmStartVerdict warmVerdict = warmStartEnabled ? warmStart.start(controller, homeLimitSwitch) : WarmStartVerdict::Disabled;
+    std::cout << "Warm start: " << warmStartVerdictName(warmVerdict) << std::endl;
+    if (warmVerdict != WarmStartVerdict::Valid) {
+        controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+    }
 /////////////////////////////////////////////////////////////////////////////////////////////////////////  
 /////////////////////////////////////////////////////////////////////////////////////////////////////////  
 //////////Initialization  
     std::vector<float> torques;
-    const float startPosition = 500.0f;
-    const float cruisingEndPosition = 497.0f;  //496.0f  0.6 gear
-    const float cruisingReverseEndPosition = 501.8f; // 503.8f 0.6 gear
-    const float stepsToAccelerate = 30.0f;  
-    const float decelerationSteps = 10.0f; 
-    const float maxSpeed = 0.065f; //0.065      // Max speed in units per control loop iteration
+    const float cruisingEndPosition = config.cruisingEndPosition;  //496.0f  0.6 gear
+    const float cruisingReverseEndPosition = config.cruisingReverseEndPosition; // 503.8f 0.6 gear
+    const float stepsToAccelerate = config.stepsToAccelerate;  
+    const float decelerationSteps = config.decelerationSteps; 
+    const float maxSpeed = config.maxSpeed; //0.065      // Max speed in units per control loop iteration
     const float decelerationPerStep = (maxSpeed / stepsToAccelerate);
     std::cout << "Deceleration per step: " << decelerationPerStep << std::endl;
     std::cout << "Deceleration per step x 20 setps: " << decelerationPerStep*20.0f << std::endl;
 
-    struct timespec req = {0, 1200 * 1000}; // Control loop frequency
-    float commandedPosition = startPosition;
-    float currentPosition = startPosition;
+    struct timespec req = selectControlPeriod(controller, config); // Control loop frequency
     PositionManager positionManager (controller, homeLimitSwitch, extendLimitSwitch, maxSpeed, cruisingEndPosition, cruisingReverseEndPosition, stepsToAccelerate, decelerationSteps, req);
-/////////////////////////////////////////////////////////////////////////////////////////////////////////  
+    positionManager.applyConfig(config);
+    if (warmVerdict == WarmStartVerdict::Valid) {
+        positionManager.restorePosition(warmStart.getSaved().logicalPosition, warmStart.getLiveAbsolute());
+    }
 
-    struct timespec req2 = {0, 5 * 1000};
-    MotorState state = MotorState::Initial;
-    bool homingSuccess = false;
-    bool obstruction_encountered = false;
-    bool safety_ok = false;
-    float safetyHoldPosition = 500.0f;
-    float extendHoldPosition = 500.0f;
-    float positionAverage = 500.0f;
-
-
-    // SYSTEM STATE MACHINE
-    while (true) {
-
-        //SAFETY CHECK
-        safety_ok = safetySwitch.readValue(); // Synchronously check the safety button
-        if (!safety_ok) {
-            ///////////////////////////////////////////////////// //Graph the torque values collected
-            GraphPlotter plotter;
-            plotter.plot(positionManager.getTorques(), "Torque Readings Through Various Phases");
-            return 0;
-            state = MotorState::SafetyLockout;
-            //break;
+    // PERF COUNTERS - opened on this thread, the one running the control loop
+    PerfCounters perf;
+    if (perfReport) {
+        if (!perf.open()) {
+            std::cerr << "perf_event_open unavailable, reporting wall time only" << std::endl;
         }
-        //INITIAL
-        if (state == MotorState::Initial) {
-            std::cout << "Initial state. Checking system status..." << std::endl;
-            nanosleep(&req, NULL);
-            if (homeLimitSwitch.readValue() == 0) {  ///////////////// 0
-                state = MotorState::Homing;
-            } else {
-                state = MotorState::WaitingToHome;
-            }
-        }
-        //WAITING TO HOME
-        else if (state == MotorState::WaitingToHome) {
-            //std::cout << "Waiting to home..." << std::endl;
-            positionManager.holdPosition(commandedPosition);
-            if (activateSwitch.readValue() == 0) {
-                state = MotorState::Homing;
-            }
-            if (homeLimitSwitch.readValue() == 0) {
-                state = MotorState::Homing;
-            }
-        }
-        //HOMING
-        else if (state == MotorState::Homing) {
-            std::cout << "Homing..." << std::endl;
-            controller.sendStopCommand();  //gets controller to a known state
-            controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
-            commandedPosition = 500.0f;
-            homingSuccess = positionManager.homing(commandedPosition, currentPosition);
-            if (homingSuccess) {
-                state = MotorState::Homed;
-            } else {
-                state = MotorState::WaitingToHome;
-            }
-        }
-        //HOMED
-        else if (state == MotorState::Homed) {
-            std::cout << "System is homed, ready for next command." << std::endl;
-            state = MotorState::WaitingToExtend;
-        }
-        //WAITING TO EXTEND
-        else if (state == MotorState::WaitingToExtend) {
-            //std::cout << "Waiting to extend..." << std::endl;
-            positionManager.holdPosition(currentPosition);
-            if (activateSwitch.readValue() == 0) {
-                state = MotorState::Extending;
-            }
-        }
-        //EXTENDING
-        else if (state == MotorState::Extending) {  
-            std::cout << "Extending..." << std::endl;
-            // Perform Forward motion
-            controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
-            commandedPosition = 500.0f;
-            currentPosition = 500.0f;
-            positionManager.performAcceleration(commandedPosition, currentPosition);
-            positionManager.performCruising(commandedPosition, currentPosition);
-            extendHoldPosition = positionManager.performDeceleration(commandedPosition, currentPosition);
-            positionAverage = (commandedPosition + currentPosition) / 2.0f;
-            positionManager.holdPositionDuration(positionAverage, 1.0f);
-            std::cout << commandedPosition << "\t" << currentPosition << "\t" << positionManager.tripleQuery() << std::endl;
-            controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
-            commandedPosition = 500.0f;
-            currentPosition = 500.0f;
-            positionManager.holdPositionDuration(commandedPosition, 0.5f);
-
-            // if (extendLimitSwitch.readValue() == 0) {
-            //     state = MotorState::Extended;
-            // }else{
-            //     state = MotorState::ExtendError;
-            // }
-            state = MotorState::Extended;
-
-            ///////////////////////////////////////////////////////// //Graph the torque values collected
-            // GraphPlotter plotter;
-            // plotter.plot(positionManager.getTorques(), "Torque Readings Through Various Phases");
-            // return 0;
-        }
-        //EXTENDED
-        else if (state == MotorState::Extended) {
-            // std::cout << "System has been successfully extended." << std::endl;
-            positionManager.holdPosition(commandedPosition);
-            if (activateSwitch.readValue() == 0) {
-                state = MotorState::Sheathing;
-            }
-        }
-        //SHEATHING
-        else if (state == MotorState::Sheathing) {
-            std::cout << "Sheathing..." << std::endl;
-            // Perform Reverse motion
-            controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
-            commandedPosition = 500.0f;
-            currentPosition = 500.0f;
-            positionManager.performAccelerationReverse(commandedPosition, currentPosition);
-            /////////////////////////////////////////////////////// //Graph the torque values collected
-            GraphPlotter plotter;
-            plotter.plot(positionManager.getTorques(), "Torque Readings Through Various Phases");
-            return 0;
-            positionManager.performCruisingReverse(commandedPosition, currentPosition);
-
-
-            positionManager.performDecelerationReverse(commandedPosition, currentPosition);
-            positionAverage = (commandedPosition + currentPosition) / 2.0f;
-            positionManager.holdPositionDuration(positionAverage, 0.5f);
-            std::cout << commandedPosition << "\t" << currentPosition << "\t" << positionManager.tripleQuery() << std::endl;
-            if (obstruction_encountered) {
-                state = MotorState::WaitingToHome;
-            } else {
-                state = MotorState::Homing;
-            }
+        positionManager.attachPerfCounters(&perf);
+    }
 
-        }
-        //EXTEND ERROR
-        else if (state == MotorState::ExtendError) {
-            std::cout << "Extension error: extend limit switch was not activated." << std::endl;
-            nanosleep(&req2, NULL);
-            state = MotorState::Initial;
-        }
-        //SAFETY LOCKOUT
-        else if (state == MotorState::SafetyLockout) {
-            std::cout << "SAFETY LOCKOUT - The system is in a locked state until the safety button is engaged." << std::endl;
-            // Wait in safety lockout state until the safety button is pressed
-            safetyHoldPosition = positionManager.tripleQuery();
-          
-                if (safetySwitch.readValue() == 1) {
-                    state = MotorState::Initial;  // Reset to initial state
-                }
-                positionManager.holdPosition(commandedPosition);
-       
-            
-            
+    // SAFETY SUPERVISOR - preempts any motion within one control period. A capture and its
+    // replay poll it on the control thread instead, so a trip replays at the cycle it was recorded.
+    SafetySupervisor supervisor(controller, safetySwitch, homeLimitSwitch, extendLimitSwitch, req);
+    positionManager.attachSupervisor(&supervisor);
+    if (capturePath.empty() && replayPath.empty()) {
+        supervisor.start();
+    } else {
+        supervisor.runOnControlThread();
+    }
 
-        }
+    // SPEED INPUT - live speed changes from the potentiometer. Recordings run at max speed,
+    // so a capture does not depend on where the knob was.
+    SpidevDevice speedDevice(config.speedDevice, config.speedClockHz);
+    SpeedInput speedInput(speedDevice, config.speedChannel, config.speedSamplePeriodUs, config.speedFilterMs);
+    bool speedInputEnabled = !config.speedDevice.empty() && capturePath.empty() && replayPath.empty();
+    if (speedInputEnabled && speedInput.start()) {
+        positionManager.attachSpeedInput(&speedInput);
+    }
+/////////////////////////////////////////////////////////////////////////////////////////////////////////  
 
-    }// END While
+    BladeStateMachine stateMachine(positionManager, controller, homeLimitSwitch, extendLimitSwitch, activateSwitch, safetySwitch,
+                                   &supervisor, req);
+    stateMachine.setRuntimeConfig(&runtimeConfig);
+    if (warmVerdict == WarmStartVerdict::Valid) {
+        stateMachine.resume(warmStart.getSaved().logicalPosition, warmStart.getSaved().atHome);
+    }
 
+    // TELEMETRY - latest state and recent cycles in shared memory, see telemetry_monitor.
+    // Loop statistics are kept even when no segment is configured.
+    TelemetryPublisher telemetry(config.telemetrySegment, req);
+    if (!config.telemetrySegment.empty()) {
+        telemetry.open();
+    }
+    stateMachine.setTelemetry(&telemetry);
+
+    // SYSTEM STATE MACHINE - one control cycle per tick
+    while (stateMachine.tick()) {
+    }
+    if (warmStartEnabled && warmVerdict != WarmStartVerdict::Disabled) {
+        bool clean = warmStart.stop(controller, homeLimitSwitch, positionManager.getFrame(), positionManager.isReferenced());
+        std::cout << "Saved " << (clean ? "position" : "unreferenced state") << " to " << warmStart.getPath() << std::endl;
+    }
+    std::cout << "Rezeros: " << positionManager.getFrame().getHostRezeros() << " host side, "
+              << positionManager.getFrame().getPhysicalRezeros() << " on the controller" << std::endl;
+    const LoopStats& loop = telemetry.getLoopStats();
+    std::cout << "Loop: " << loop.cycles << " cycles, period mean " << loop.meanPeriodNs / 1000 << " us, max "
+              << loop.maxPeriodNs / 1000 << " us, " << loop.overruns << " overruns" << std::endl;
+    controller.printIoReport(std::cout);
+    if (speedInputEnabled) {
+        speedInput.stop();
+        speedInput.printReport(std::cout);
+    }
+    if (positionManager.loadTracked()) {
+        const LoadTracker& load = positionManager.getLoadTracker();
+        std::cout << "Load side: backlash " << load.getBacklash() << ", last gap " << load.getGap() << ", "
+                  << load.getSamples() << " samples" << std::endl;
+    }
+    if (!replayPath.empty()) {
+        replay.printReport();
+    }
+    if (perfReport) {
+        perf.printReport(std::cout);
+    }
+    AllocationGuard::printReport(std::cout);    // only in a DOOMBLADE_CHECK_ALLOC build
+
+    ///////////////////////////////////////////////////// //Graph the torque values collected
+    GraphPlotter plotter;
+    plotter.plot(positionManager.getTorques(), "Torque Readings Through Various Phases");
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -232,10 +204,5 @@ int main() {
     //controller.sendStopCommand();
     controller.closeSerialPort();
 
-    // Graph the torque values collected
-    //GraphPlotter plotter;
-    //plotter.plot(positionManager.getTorques(), "Torque Readings Through Various Phases");
-
     return 0;
 }
- 
\ No newline at end of file
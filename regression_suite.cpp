@@ -0,0 +1,494 @@
+#include "MyController.h"
+#include "MyGpio.h"
+#include "PositionManager.h"
+#include "BladeStateMachine.h"
+#include "RuntimeConfig.h"
+#include "SimulatedController.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+
+// Motion quality regression suite. Canonical scenarios of the position_control_test state
+// machine run against SimulatedController, each on its own thread, and every control cycle
+// is traced. Traces are compared with the golden traces in regression/:
+//   regression_suite                     run and compare every scenario
+//   regression_suite --record            run and store the traces as the new golden ones
+//   regression_suite --only extend       one scenario
+//   regression_suite --dir path          golden traces elsewhere
+//   regression_suite --serial            one scenario after the other
+//   regression_suite --verbose           keep the state machine output
+// Motion settings come from doomblade.cfg, so a change there shows up here like a change to
+// PositionManager. The simulator runs without host time, so a trace depends only on the
+// code and the config; the host time of each cycle is measured separately and reported as
+// the cycle time. A scenario fails when its state sequence changes, or its duration, its
+// blade trajectory or its tracking error leave the tolerances below.
+
+struct Tolerances {
+    double durationMs = 20.0;           // or durationShare of the golden duration, whichever is larger
+    double durationShare = 0.02;
+    double position = 0.02;             // controller units, blade against the golden blade at the same time
+    double tracking = 0.01;             // controller units the worst tracking error may grow by
+};
+
+// One control cycle
+struct TraceSample {
+    double timeMs;                      // simulated, from the start of the scenario
+    int state;
+    int phase;
+    float commanded;                    // logical
+    float current;                      // logical, as the position manager estimates it
+    double actual;                      // simulated blade, phys
+    float torque;
+};
+
+struct Trace {
+    std::vector<TraceSample> samples;
+    std::vector<double> hostUs;         // host time of each tick, not stored per sample
+    double hostMeanUs = 0.0;
+    double hostP99Us = 0.0;
+
+    double durationMs() const { return samples.empty() ? 0.0 : samples.back().timeMs; }
+    void summarizeHost() {
+        if (hostUs.empty()) {
+            return;
+        }
+        std::vector<double> sorted = hostUs;
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+        for (double value : sorted) {
+            sum += value;
+        }
+        hostMeanUs = sum / sorted.size();
+        hostP99Us = sorted[static_cast<size_t>(0.99 * (sorted.size() - 1) + 0.5)];
+    }
+};
+
+// RIG - a simulated blade with the state machine position_control_test builds, without
+// the supervisor thread, which times itself on the wall clock
+class Rig {
+public:
+    Rig(const MotionConfig& config, const SimulatedPlantConfig& plant, const SimulatedLinkConfig& link)
+    : config(config), simulator(config.homePin, config.extendPin, plant, link),
+      homeLimitSwitch(config.gpioChip, config.homePin), extendLimitSwitch(config.gpioChip, config.extendPin),
+      activateSwitch(config.gpioChip, config.activatePin), safetySwitch(config.gpioChip, config.safetyPin),
+      controller(simulator),
+      positionManager(controller, homeLimitSwitch, extendLimitSwitch, config.maxSpeed, config.cruisingEndPosition,
+                      config.cruisingReverseEndPosition, config.stepsToAccelerate, config.decelerationSteps, config.controlPeriod()),
+      stateMachine(positionManager, controller, homeLimitSwitch, extendLimitSwitch, activateSwitch, safetySwitch, nullptr, config.controlPeriod()) {
+        for (MyGpio* line : {&homeLimitSwitch, &extendLimitSwitch, &activateSwitch, &safetySwitch}) {
+            line->setTap(&simulator);
+            line->init();
+        }
+        controller.setupSerialPort();
+        controller.setCanId(config.controllerCanId);
+        controller.sendStopCommand();  //gets controller to a known state
+        controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+        positionManager.applyConfig(config);
+    }
+
+    // A press holds the activate switch low for 30 ms
+    void press() {
+        simulator.setInput(config.activatePin, 0);
+        simulator.scheduleInput(controller.nowNs() + 30 * 1000000LL, config.activatePin, 1);
+    }
+
+    // TRACE - samples from here on go into trace, timed from now
+    void trace(Trace* newTrace) {
+        recording = newTrace;
+        startNs = controller.nowNs();
+    }
+
+    // RUN UNTIL - false when the state machine shut down or the time limit passed first
+    bool runUntil(const std::function<bool()>& reached, int64_t limitNs = 30 * 1000000000LL) {
+        int64_t deadline = controller.nowNs() + limitNs;
+        while (controller.nowNs() < deadline) {
+            if (!tick()) {
+                return false;
+            }
+            if (reached()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool runFor(int64_t durationNs) {
+        int64_t end = controller.nowNs() + durationNs;
+        return runUntil([&]() { return controller.nowNs() >= end; }, durationNs + 1000000000LL);
+    }
+
+    bool tick() {
+        auto hostStart = std::chrono::steady_clock::now();
+        bool running = stateMachine.tick();
+        auto hostEnd = std::chrono::steady_clock::now();
+        if (recording != nullptr) {
+            TraceSample sample;
+            sample.timeMs = (controller.nowNs() - startNs) / 1e6;
+            sample.state = static_cast<int>(stateMachine.getState());
+            sample.phase = static_cast<int>(positionManager.getPhase());
+            sample.commanded = stateMachine.getCommandedPosition();
+            sample.current = stateMachine.getCurrentPosition();
+            sample.actual = simulator.getPosition();
+            sample.torque = positionManager.getLastReply().torque;
+            recording->samples.push_back(sample);
+            recording->hostUs.push_back(std::chrono::duration<double, std::micro>(hostEnd - hostStart).count());
+        }
+        return running;
+    }
+
+    bool is(MotorState state) const { return stateMachine.getState() == state; }
+    bool home() {
+        press();
+        return runUntil([&]() { return is(MotorState::WaitingToExtend); }) && runFor(100 * 1000000LL);
+    }
+
+    const MotionConfig& config;
+    SimulatedController simulator;
+    MyGpio homeLimitSwitch;
+    MyGpio extendLimitSwitch;
+    MyGpio activateSwitch;
+    MyGpio safetySwitch;
+    MyController controller;
+    PositionManager positionManager;
+    BladeStateMachine stateMachine;
+
+private:
+    Trace* recording = nullptr;
+    int64_t startNs = 0;
+};
+
+// SCENARIOS - setup is not traced, the scenario's own motion is, until the blade has settled
+struct Scenario {
+    const char* name;
+    std::function<bool(Rig&, Trace&)> run;
+};
+
+static const int64_t kSettleNs = 100 * 1000000LL;
+
+static std::vector<Scenario> scenarios() {
+    return {
+        {"home", [](Rig& rig, Trace& trace) {
+            rig.trace(&trace);
+            return rig.home();
+        }},
+        {"extend", [](Rig& rig, Trace& trace) {
+            if (!rig.home()) return false;
+            rig.trace(&trace);
+            rig.press();
+            return rig.runUntil([&]() { return rig.is(MotorState::Extended); }) && rig.runFor(kSettleNs);
+        }},
+        {"sheath", [](Rig& rig, Trace& trace) {
+            if (!rig.home()) return false;
+            rig.press();
+            if (!rig.runUntil([&]() { return rig.is(MotorState::Extended); }) || !rig.runFor(kSettleNs)) return false;
+            rig.trace(&trace);
+            rig.press();
+            return rig.runUntil([&]() { return rig.is(MotorState::WaitingToExtend); }) && rig.runFor(kSettleNs);
+        }},
+        {"cancel_extend", [](Rig& rig, Trace& trace) {
+            if (!rig.home()) return false;
+            rig.trace(&trace);
+            rig.press();
+            if (!rig.runUntil([&]() { return rig.positionManager.getPhase() == MotionPhase::Cruising; }) || !rig.runFor(12 * 1000000LL)) return false;
+            // A second press cancels the extend, the setpoint steps have to shrink to a stop
+            // before the sheath starts
+            rig.press();
+            float last = rig.stateMachine.getCommandedPosition();
+            float lastStep = rig.config.maxSpeed;
+            bool slowing = true;
+            bool decelerated = false;
+            auto sheathed = [&]() {
+                float commanded = rig.stateMachine.getCommandedPosition();
+                if (rig.positionManager.getPhase() == MotionPhase::Deceleration) {
+                    float step = std::fabs(commanded - last);
+                    slowing = slowing && step <= lastStep + 1e-4f;
+                    lastStep = step;
+                    decelerated = true;
+                }
+                last = commanded;
+                return rig.is(MotorState::WaitingToExtend);
+            };
+            return rig.runUntil(sheathed) && decelerated && slowing && rig.runFor(kSettleNs);
+        }},
+        {"obstruction_cruise", [](Rig& rig, Trace& trace) {
+            if (!rig.home()) return false;
+            rig.simulator.setObstruction(-2.0);     // about halfway out
+            rig.trace(&trace);
+            rig.press();
+            return rig.runUntil([&]() { return rig.is(MotorState::WaitingToHome); }) && rig.runFor(kSettleNs);
+        }},
+        {"safety_release", [](Rig& rig, Trace& trace) {
+            if (!rig.home()) return false;
+            rig.trace(&trace);
+            rig.press();
+            if (!rig.runUntil([&]() { return rig.positionManager.getPhase() == MotionPhase::Cruising; })) return false;
+            rig.simulator.setInput(rig.config.safetyPin, 0);
+            // The tick after the release shuts the machine down
+            return !rig.runFor(kSettleNs) && !rig.is(MotorState::SafetyLockout);
+        }},
+    };
+}
+
+// GOLDEN TRACES - tab separated, one row per control cycle, host cycle time in the header
+static bool writeTrace(const std::string& path, const std::string& name, const Trace& trace) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << "# regression_suite golden trace: " << name << "\n";
+    file << "# host_cycle_us " << trace.hostMeanUs << " " << trace.hostP99Us << "\n";
+    file << "time_ms\tstate\tphase\tcommanded\tcurrent\tactual\ttorque\n";
+    char line[160];
+    for (const TraceSample& sample : trace.samples) {
+        std::snprintf(line, sizeof line, "%.4f\t%d\t%d\t%.6f\t%.6f\t%.6f\t%.5f\n", sample.timeMs, sample.state, sample.phase,
+                      sample.commanded, sample.current, sample.actual, sample.torque);
+        file << line;
+    }
+    return static_cast<bool>(file);
+}
+
+static bool readTrace(const std::string& path, Trace& trace) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.rfind("# host_cycle_us ", 0) == 0) {
+            std::istringstream(line.substr(16)) >> trace.hostMeanUs >> trace.hostP99Us;
+            continue;
+        }
+        if (line.empty() || line[0] == '#' || line.rfind("time_ms", 0) == 0) {
+            continue;
+        }
+        TraceSample sample;
+        std::istringstream fields(line);
+        if (fields >> sample.timeMs >> sample.state >> sample.phase >> sample.commanded >> sample.current >> sample.actual >> sample.torque) {
+            trace.samples.push_back(sample);
+        }
+    }
+    return !trace.samples.empty();
+}
+
+// COMPARISON
+struct TrackingError {
+    double mean = 0.0;
+    double max = 0.0;
+};
+
+static TrackingError trackingError(const Trace& trace) {
+    TrackingError error;
+    for (const TraceSample& sample : trace.samples) {
+        double difference = std::fabs(sample.commanded - sample.current);
+        error.mean += difference;
+        error.max = std::max(error.max, difference);
+    }
+    if (!trace.samples.empty()) {
+        error.mean /= trace.samples.size();
+    }
+    return error;
+}
+
+static std::vector<int> stateSequence(const Trace& trace) {
+    std::vector<int> sequence;
+    for (const TraceSample& sample : trace.samples) {
+        if (sequence.empty() || sequence.back() != sample.state) {
+            sequence.push_back(sample.state);
+        }
+    }
+    return sequence;
+}
+
+static std::string stateSequenceText(const std::vector<int>& sequence) {
+    std::string text;
+    for (int state : sequence) {
+        text += (text.empty() ? "" : " > ") + std::string(motorStateName(static_cast<MotorState>(state)));
+    }
+    return text;
+}
+
+// Blade position of trace at timeMs, linear between cycles and held past the end
+static double actualAt(const Trace& trace, double timeMs) {
+    const std::vector<TraceSample>& samples = trace.samples;
+    auto after = std::lower_bound(samples.begin(), samples.end(), timeMs,
+                                  [](const TraceSample& sample, double time) { return sample.timeMs < time; });
+    if (after == samples.begin()) {
+        return after->actual;
+    }
+    if (after == samples.end()) {
+        return samples.back().actual;
+    }
+    const TraceSample& before = *(after - 1);
+    double share = (timeMs - before.timeMs) / (after->timeMs - before.timeMs);
+    return before.actual + share * (after->actual - before.actual);
+}
+
+struct Comparison {
+    bool passed = true;
+    std::vector<std::string> failures;
+    double maxDeviation = 0.0;
+};
+
+static Comparison compare(const Trace& golden, const Trace& trace, const Tolerances& tolerances) {
+    Comparison result;
+    auto fail = [&](const std::string& failure) {
+        result.passed = false;
+        result.failures.push_back(failure);
+    };
+
+    std::vector<int> goldenStates = stateSequence(golden);
+    std::vector<int> states = stateSequence(trace);
+    if (states != goldenStates) {
+        fail("states " + stateSequenceText(states) + ", golden " + stateSequenceText(goldenStates));
+    }
+
+    double durationDelta = trace.durationMs() - golden.durationMs();
+    if (std::fabs(durationDelta) > std::max(tolerances.durationMs, tolerances.durationShare * golden.durationMs())) {
+        fail("duration changed by " + std::to_string(durationDelta) + " ms");
+    }
+
+    // Over the longer of the two, so a trace that ends early or runs on is compared too
+    const Trace& longer = trace.durationMs() > golden.durationMs() ? trace : golden;
+    for (const TraceSample& sample : longer.samples) {
+        result.maxDeviation = std::max(result.maxDeviation, std::fabs(actualAt(trace, sample.timeMs) - actualAt(golden, sample.timeMs)));
+    }
+    if (result.maxDeviation > tolerances.position) {
+        fail("blade off the golden trajectory by up to " + std::to_string(result.maxDeviation));
+    }
+
+    TrackingError goldenTracking = trackingError(golden);
+    TrackingError tracking = trackingError(trace);
+    if (tracking.max > goldenTracking.max + tolerances.tracking) {
+        fail("worst tracking error " + std::to_string(tracking.max) + ", golden " + std::to_string(goldenTracking.max));
+    }
+    return result;
+}
+
+struct ScenarioRun {
+    bool completed = false;
+    Trace trace;
+};
+
+int main(int argc, char** argv) {
+    bool record = false;
+    bool serial = false;
+    bool verbose = false;
+    std::string only;
+    std::string directory = "regression";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--record") {
+            record = true;
+        } else if (arg == "--serial") {
+            serial = true;
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else if (arg == "--only" && i + 1 < argc) {
+            only = argv[++i];
+        } else if (arg == "--dir" && i + 1 < argc) {
+            directory = argv[++i];
+        } else {
+            std::cerr << "usage: regression_suite [--record] [--only name] [--dir path] [--serial] [--verbose]" << std::endl;
+            return 1;
+        }
+    }
+
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    runtimeConfig.load();
+    const MotionConfig& config = runtimeConfig.acquire();
+    SimulatedLinkConfig link;
+    link.hostTime = false;
+
+    std::vector<Scenario> selected;
+    for (const Scenario& scenario : scenarios()) {
+        if (only.empty() || only == scenario.name) {
+            selected.push_back(scenario);
+        }
+    }
+    if (selected.empty()) {
+        std::cerr << "No scenario named " << only << std::endl;
+        return 1;
+    }
+
+    // RUN - one thread and one simulated blade per scenario. The cycle log is still
+    // formatted, only the terminal is left out.
+    std::ofstream discard("/dev/null");
+    std::streambuf* console = std::cout.rdbuf();
+    if (!verbose) {
+        std::cout.rdbuf(discard.rdbuf());
+    }
+    std::vector<ScenarioRun> runs(selected.size());
+    auto runOne = [&](size_t index) {
+        Rig rig(config, SimulatedPlantConfig(), link);
+        runs[index].completed = selected[index].run(rig, runs[index].trace);
+        runs[index].trace.summarizeHost();
+    };
+    auto wallStart = std::chrono::steady_clock::now();
+    if (serial) {
+        for (size_t i = 0; i < selected.size(); i++) {
+            runOne(i);
+        }
+    } else {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < selected.size(); i++) {
+            threads.emplace_back(runOne, i);
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+    std::cout.rdbuf(console);
+
+    // REPORT
+    Tolerances tolerances;
+    int failed = 0;
+    for (size_t i = 0; i < selected.size(); i++) {
+        const char* name = selected[i].name;
+        const Trace& trace = runs[i].trace;
+        std::string path = directory + "/" + name + ".tsv";
+        TrackingError tracking = trackingError(trace);
+        if (!runs[i].completed) {
+            std::cout << name << ": FAIL scenario did not complete, " << stateSequenceText(stateSequence(trace)) << std::endl;
+            failed++;
+            continue;
+        }
+        if (record) {
+            bool written = writeTrace(path, name, trace);
+            std::cout << name << ": " << (written ? "recorded " : "FAIL could not write ") << path << ", " << trace.samples.size()
+                      << " cycles, " << trace.durationMs() << " ms" << std::endl;
+            failed += written ? 0 : 1;
+            continue;
+        }
+
+        Trace golden;
+        if (!readTrace(path, golden)) {
+            std::cout << name << ": FAIL no golden trace " << path << std::endl;
+            failed++;
+            continue;
+        }
+        Comparison comparison = compare(golden, trace, tolerances);
+        TrackingError goldenTracking = trackingError(golden);
+        std::cout << name << ": " << (comparison.passed ? "PASS" : "FAIL") << std::endl;
+        for (const std::string& failure : comparison.failures) {
+            std::cout << "  " << failure << std::endl;
+        }
+        std::cout << "  duration " << trace.durationMs() << " ms (golden " << golden.durationMs() << "), " << trace.samples.size()
+                  << " cycles (golden " << golden.samples.size() << ")" << std::endl;
+        std::cout << "  tracking error mean " << tracking.mean << " max " << tracking.max << " (golden " << goldenTracking.mean
+                  << " / " << goldenTracking.max << "), largest deviation " << comparison.maxDeviation << std::endl;
+        std::cout << "  host cycle time mean " << trace.hostMeanUs << " us p99 " << trace.hostP99Us << " us (golden "
+                  << golden.hostMeanUs << " / " << golden.hostP99Us << ")" << std::endl;
+        failed += comparison.passed ? 0 : 1;
+    }
+    std::cout << selected.size() - failed << " of " << selected.size() << " scenarios " << (record ? "recorded" : "passed")
+              << ", " << (serial ? "serial" : "parallel") << ", " << wallMs << " ms" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
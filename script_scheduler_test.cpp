@@ -0,0 +1,201 @@
+#include "MyController.h"
+#include "MyGpio.h"
+#include "PositionManager.h"
+#include "RuntimeConfig.h"
+#include "SimulatedController.h"
+#include "MotionScript.h"
+#include "BladeScript.h"
+#include "ScenarioRunner.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// The blade script of motion_script_test on ScriptScheduler, against SimulatedController
+//   script_scheduler_test             every scenario
+//   script_scheduler_test --verbose   keep the script output
+// Every transport call is logged per scheduler tick. A tick has to wait exactly once,
+// through the controller, and a tick that runs a phase has to write its command before
+// that wait and read nothing until after it. Times are simulated time, motion settings
+// come from doomblade.cfg.
+
+// ORDER TRANSPORT - passes every call on and logs it: W write, R read, S period wait
+class OrderTransport : public ControllerTransport {
+public:
+    explicit OrderTransport(ControllerTransport& inner) : inner(inner) {}
+
+    bool open() override { return inner.open(); }
+    void close() override { inner.close(); }
+    ssize_t writeBytes(const char* data, size_t length) override {
+        events.push_back('W');
+        return inner.writeBytes(data, length);
+    }
+    ssize_t readBytes(char* buffer, size_t length) override {
+        events.push_back('R');
+        return inner.readBytes(buffer, length);
+    }
+    bool waitReadable(int timeoutMs) override { return inner.waitReadable(timeoutMs); }
+    bool reopen() override { return inner.reopen(); }
+    void sleep(const struct timespec& duration) override {
+        events.push_back('S');
+        inner.sleep(duration);
+    }
+    int64_t nowNs() const override { return inner.nowNs(); }
+
+    std::string events;
+
+private:
+    ControllerTransport& inner;
+};
+
+// BLADE CYCLE - home, extend and sheath on three presses, one tick at a time
+static ScenarioResult bladeCycle(const MotionConfig& config) {
+    ScenarioResult result;
+
+    // SIMULATOR - deterministic, host time not counted
+    SimulatedLinkConfig link;
+    link.hostTime = false;
+    SimulatedController simulator(config.homePin, config.extendPin, SimulatedPlantConfig(), link);
+    OrderTransport transport(simulator);
+    MyGpio homeLimitSwitch(config.gpioChip, config.homePin);
+    MyGpio extendLimitSwitch(config.gpioChip, config.extendPin);
+    MyGpio activateSwitch(config.gpioChip, config.activatePin);
+    for (MyGpio* line : {&homeLimitSwitch, &extendLimitSwitch, &activateSwitch}) {
+        line->setTap(&simulator);
+        line->init();
+    }
+    MyController controller(transport);
+    controller.setupSerialPort();
+    controller.setCanId(config.controllerCanId);
+    controller.sendStopCommand();  //gets controller to a known state
+    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+
+    struct timespec req = config.controlPeriod();
+    PositionManager positionManager(controller, homeLimitSwitch, extendLimitSwitch, config.maxSpeed, config.cruisingEndPosition,
+                                    config.cruisingReverseEndPosition, config.stepsToAccelerate, config.decelerationSteps, req);
+    positionManager.applyConfig(config);
+
+    float commandedPosition = 500.0f;
+    float currentPosition = 500.0f;
+    ScriptScheduler scheduler(controller, req);
+    if (!scheduler.spawn(bladeScript(positionManager, activateSwitch, commandedPosition, currentPosition))) {
+        result.failure = "script not spawned";
+        return result;
+    }
+
+    // TICKS - the transport calls of each tick against the order a cycle has to keep
+    const int64_t limitNs = 30 * 1000000000LL;
+    size_t ticks = 0;
+    size_t exchanges = 0;
+    int64_t startNs = controller.nowNs();
+    MotionPhase lastActive = MotionPhase::Idle;
+    auto check = [&](MotionPhase running, const std::string& events) {
+        size_t waits = std::count(events.begin(), events.end(), 'S');
+        if (waits != 1) {
+            return "tick " + std::to_string(ticks) + " waited " + std::to_string(waits) + " times: " + events;
+        }
+        if (running == MotionPhase::Idle) {
+            return std::string();
+        }
+        exchanges++;
+        std::string before = events.substr(0, events.find('S'));
+        if (before.find('W') == std::string::npos || before.find('R') != std::string::npos) {
+            return "tick " + std::to_string(ticks) + " of " + motionPhaseName(running) + " out of order: " + events;
+        }
+        return std::string();
+    };
+    auto runUntil = [&](MotionPhase last) {
+        lastActive = MotionPhase::Idle;
+        int64_t deadline = controller.nowNs() + limitNs;
+        while (controller.nowNs() < deadline) {
+            MotionPhase running = positionManager.getPhase();
+            transport.events.clear();
+            if (!scheduler.tick()) {
+                result.failure = "script ended";
+                return false;
+            }
+            ticks++;
+            std::string failure = check(running, transport.events);
+            if (!failure.empty()) {
+                result.failure = failure;
+                return false;
+            }
+            MotionPhase phase = positionManager.getPhase();
+            lastActive = (phase == MotionPhase::Idle) ? lastActive : phase;
+            if (phase == MotionPhase::Idle && lastActive == last) {
+                return true;
+            }
+        }
+        result.failure = std::string("no ") + motionPhaseName(last) + " within the time limit";
+        return false;
+    };
+    auto press = [&]() {
+        simulator.setInput(config.activatePin, 0);
+        simulator.scheduleInput(controller.nowNs() + 30 * 1000000LL, config.activatePin, 1);
+    };
+
+    // HOME, EXTEND, SHEATH - each press runs to the script's next wait for the switch
+    press();
+    if (!runUntil(MotionPhase::Homing)) {
+        return result;
+    }
+    if (!positionManager.isReferenced()) {
+        result.failure = "did not home";
+        return result;
+    }
+    double homed = simulator.getPosition();
+    press();
+    if (!runUntil(MotionPhase::Hold)) {
+        return result;
+    }
+    double extended = simulator.getPosition();
+    press();
+    if (!runUntil(MotionPhase::Hold)) {
+        return result;
+    }
+    double sheathed = simulator.getPosition();
+    scheduler.requestStop();
+    bool stopped = !scheduler.tick();
+
+    // CHECKS - a tick is one period of simulated time, give or take the last reply
+    double periodMs = (req.tv_sec * 1e9 + req.tv_nsec) / 1e6;
+    double elapsedMs = (controller.nowNs() - startNs) / 1e6;
+    result.detail = std::to_string(ticks) + " ticks, " + std::to_string(exchanges) + " phase exchanges, " +
+                    std::to_string(scheduler.getOverruns()) + " overruns, " + std::to_string(elapsedMs) + " ms simulated\n" +
+                    "blade at " + std::to_string(homed) + " homed, " + std::to_string(extended) + " extended, " +
+                    std::to_string(sheathed) + " sheathed";
+    if (extended > homed - 1.0 || sheathed < extended + 1.0) {
+        result.failure = "blade did not extend and sheath";
+    } else if (scheduler.getOverruns() != 0) {
+        result.failure = "ticks overran the period";
+    } else if (std::abs(elapsedMs - (ticks + 1) * periodMs) > periodMs) {
+        result.failure = "ticks did not keep the period";
+    } else if (!stopped) {
+        result.failure = "stop request did not end the script";
+    } else {
+        result.passed = true;
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--verbose") {
+            verbose = true;
+        } else {
+            std::cerr << "usage: script_scheduler_test [--verbose]" << std::endl;
+            return 1;
+        }
+    }
+
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    runtimeConfig.load();
+    const MotionConfig& config = runtimeConfig.acquire();
+
+    const std::vector<Scenario> scenarios = {
+        {"home, extend and sheath",            [&]() { return bladeCycle(config); }},
+    };
+    return runScenarios(scenarios, !verbose);
+}
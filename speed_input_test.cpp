@@ -0,0 +1,269 @@
+#include "MyController.h"
+#include "MyGpio.h"
+#include "PositionManager.h"
+#include "BladeStateMachine.h"
+#include "RuntimeConfig.h"
+#include "SimulatedController.h"
+#include "SimulatedSpiDevice.h"
+#include "SpeedInput.h"
+#include "ScenarioRunner.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+// SpeedInput against SimulatedSpiDevice, and live speed changes of the position_control_test
+// state machine against SimulatedController
+//   speed_input_test             every scenario
+//   speed_input_test --verbose   keep the state machine output
+// The sampling thread runs on the wall clock, the blade in simulated time, so a knob turn
+// lands at one exact control cycle: the blade stops ticking until the published level has
+// followed the knob. Every SPI transfer is given a latency far longer than a control
+// period, a tick that waited on the bus would show up as a long tick. Motion settings come
+// from doomblade.cfg.
+
+static const long kSpiLatencyUs = 20000;
+
+// WAIT FOR LEVEL - wall clock, false after timeoutMs
+static bool waitForLevel(const SpeedInput& input, const std::function<bool(float)>& reached, int timeoutMs = 3000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (reached(input.getLevel())) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+// FILTERING - noise and spikes on a held knob, then a step, then a bus that stops answering
+static ScenarioResult filtering() {
+    ScenarioResult result;
+    SimulatedSpiDevice spi;
+    spi.setChannel(0, 512);
+    spi.setNoise(4, 0.05);
+    SpeedInput input(spi, 0, 1000, 20.0);
+    input.setErrorLimit(5);
+    if (!input.start()) {
+        result.failure = "did not start";
+        return result;
+    }
+
+    // Held at mid scale, spikes to either end must not reach the level
+    if (!waitForLevel(input, [](float level) { return std::isfinite(level); })) {
+        result.failure = "no first sample";
+        return result;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    float worst = 0.0f;
+    for (int i = 0; i < 200; i++) {
+        worst = std::max(worst, std::fabs(input.getLevel() - 512.0f / 1023.0f));
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+    if (worst > 0.01f) {
+        result.failure = "held level wandered by " + std::to_string(worst);
+        return result;
+    }
+
+    // Full scale step, settled within a few time constants
+    spi.setChannel(0, 1023);
+    if (!waitForLevel(input, [](float level) { return level > 0.98f; }, 500)) {
+        result.failure = "step not followed";
+        return result;
+    }
+
+    // A bus that stops answering drops the level, one that comes back restores it
+    spi.setFailing(true);
+    if (!waitForLevel(input, [](float level) { return std::isnan(level); }, 500)) {
+        result.failure = "failing bus still published";
+        return result;
+    }
+    spi.setFailing(false);
+    if (!waitForLevel(input, [](float level) { return level > 0.98f; }, 500)) {
+        result.failure = "no level after the bus came back";
+        return result;
+    }
+    input.stop();
+    result.detail = "held within " + std::to_string(worst) + ", " + std::to_string(input.getSamples()) + " samples, " +
+                    std::to_string(input.getErrors()) + " errors";
+    result.passed = true;
+    return result;
+}
+
+// LIVE CHANGE - the knob is turned while the blade cruises. The cruise speed has to move to
+// the new setting within one acceleration ramp, never faster than the profile's acceleration.
+static ScenarioResult liveChange(const MotionConfig& config, bool sheathing, int fromValue, int toValue) {
+    ScenarioResult result;
+
+    // SIMULATOR - deterministic, host time not counted, with a slow SPI bus
+    SimulatedLinkConfig link;
+    link.hostTime = false;
+    SimulatedController simulator(config.homePin, config.extendPin, SimulatedPlantConfig(), link);
+    MyGpio homeLimitSwitch(config.gpioChip, config.homePin);
+    MyGpio extendLimitSwitch(config.gpioChip, config.extendPin);
+    MyGpio activateSwitch(config.gpioChip, config.activatePin);
+    MyGpio safetySwitch(config.gpioChip, config.safetyPin);
+    for (MyGpio* line : {&homeLimitSwitch, &extendLimitSwitch, &activateSwitch, &safetySwitch}) {
+        line->setTap(&simulator);
+        line->init();
+    }
+    MyController controller(simulator);
+    controller.setupSerialPort();
+    controller.setCanId(config.controllerCanId);
+    controller.sendStopCommand();  //gets controller to a known state
+    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+
+    struct timespec req = config.controlPeriod();
+    PositionManager positionManager(controller, homeLimitSwitch, extendLimitSwitch, config.maxSpeed, config.cruisingEndPosition,
+                                    config.cruisingReverseEndPosition, config.stepsToAccelerate, config.decelerationSteps, req);
+    positionManager.applyConfig(config);
+    BladeStateMachine stateMachine(positionManager, controller, homeLimitSwitch, extendLimitSwitch, activateSwitch, safetySwitch, nullptr, req);
+
+    SimulatedSpiDevice spi;
+    spi.setChannel(config.speedChannel, fromValue);
+    spi.setLatency(kSpiLatencyUs);
+    SpeedInput speedInput(spi, config.speedChannel, config.speedSamplePeriodUs, config.speedFilterMs);
+    if (!speedInput.start() || !waitForLevel(speedInput, [&](float level) { return std::fabs(level - fromValue / 1023.0f) < 0.002f; })) {
+        result.failure = "speed input did not settle";
+        return result;
+    }
+    positionManager.attachSpeedInput(&speedInput);
+
+    const int64_t pressNs = 30 * 1000000LL;
+    const int64_t limitNs = 30 * 1000000000LL;
+    double longestTickMs = 0.0;
+    auto press = [&]() {
+        simulator.setInput(config.activatePin, 0);
+        simulator.scheduleInput(controller.nowNs() + pressNs, config.activatePin, 1);
+    };
+    auto tick = [&]() {
+        auto start = std::chrono::steady_clock::now();
+        bool running = stateMachine.tick();
+        longestTickMs = std::max(longestTickMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        return running;
+    };
+    auto runUntil = [&](auto reached) {
+        int64_t deadline = controller.nowNs() + limitNs;
+        while (controller.nowNs() < deadline) {
+            if (!tick()) {
+                return false;
+            }
+            if (reached()) {
+                return true;
+            }
+        }
+        return false;
+    };
+    auto is = [&](MotorState state) { return stateMachine.getState() == state; };
+
+    // HOMING, then out, and back in for a sheath
+    press();
+    if (!runUntil([&]() { return is(MotorState::WaitingToExtend); })) {
+        result.failure = "did not home";
+        return result;
+    }
+    if (sheathing) {
+        press();
+        if (!runUntil([&]() { return is(MotorState::Extended); })) {
+            result.failure = "did not extend";
+            return result;
+        }
+    }
+
+    // CRUISE - a few cycles at the first setting, then the knob turns
+    MotionPhase cruise = sheathing ? MotionPhase::CruisingReverse : MotionPhase::Cruising;
+    press();
+    if (!runUntil([&]() { return positionManager.getPhase() == cruise; })) {
+        result.failure = "did not reach cruising";
+        return result;
+    }
+    for (int i = 0; i < 5; i++) {
+        tick();
+    }
+    float before = positionManager.speedSetting();
+    spi.setChannel(config.speedChannel, toValue);
+    if (!waitForLevel(speedInput, [&](float level) { return std::fabs(level - toValue / 1023.0f) < 0.002f; })) {
+        result.failure = "speed input did not follow the knob";
+        return result;
+    }
+    float after = positionManager.speedSetting();
+
+    // Per cycle setpoint steps from the knob turn to the end of the cruise
+    std::vector<float> speeds;
+    float last = stateMachine.getCommandedPosition();
+    while (positionManager.getPhase() == cruise) {
+        if (!tick()) {
+            result.failure = "state machine shut down";
+            return result;
+        }
+        float commanded = stateMachine.getCommandedPosition();
+        if (positionManager.getPhase() == cruise) {
+            speeds.push_back(std::fabs(commanded - last));
+        }
+        last = commanded;
+    }
+    MotorState done = sheathing ? MotorState::WaitingToExtend : MotorState::Extended;
+    if (!runUntil([&]() { return is(done); })) {
+        result.failure = std::string("did not end ") + motorStateName(done);
+        return result;
+    }
+    speedInput.stop();
+
+    // CHECKS
+    float step = config.maxSpeed / config.stepsToAccelerate;
+    size_t rampCycles = static_cast<size_t>(std::ceil(std::fabs(after - before) / step)) + 1;
+    float largestChange = 0.0f;
+    size_t settledAt = speeds.size();
+    for (size_t i = 0; i < speeds.size(); i++) {
+        float previous = (i == 0) ? before : speeds[i - 1];
+        largestChange = std::max(largestChange, std::fabs(speeds[i] - previous));
+        if (settledAt == speeds.size() && std::fabs(speeds[i] - after) < 1e-4f) {
+            settledAt = i;
+        }
+    }
+    result.detail = "speed " + std::to_string(before) + " to " + std::to_string(after) + " in " + std::to_string(settledAt + 1) +
+                    " cycles, largest change per cycle " + std::to_string(largestChange) + ", longest tick " +
+                    std::to_string(longestTickMs) + " ms";
+    if (std::fabs(after - before) < 2.0f * step) {
+        result.failure = "knob turn did not change the speed setting";
+    } else if (settledAt >= speeds.size()) {
+        result.failure = "cruise never reached the new speed";
+    } else if (settledAt + 1 > rampCycles) {
+        result.failure = "new speed reached later than one ramp";
+    } else if (largestChange > step * 1.01f) {
+        result.failure = "cruise speed stepped faster than the acceleration";
+    } else if (longestTickMs > kSpiLatencyUs / 1000.0 / 2.0) {
+        result.failure = "a control cycle waited on the SPI bus";
+    } else {
+        result.passed = true;
+    }
+    return result;
+}
+
+int main(int argc, char** argv) {
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--verbose") {
+            verbose = true;
+        } else {
+            std::cerr << "usage: speed_input_test [--verbose]" << std::endl;
+            return 1;
+        }
+    }
+
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    runtimeConfig.load();
+    const MotionConfig& config = runtimeConfig.acquire();
+
+    const std::vector<Scenario> scenarios = {
+        {"filtering and a failing bus",        []() { return filtering(); }},
+        {"knob turned down mid-extend",        [&]() { return liveChange(config, false, 1023, 0); }},
+        {"knob turned up mid-sheath",          [&]() { return liveChange(config, true, 200, 1023); }},
+    };
+    return runScenarios(scenarios, !verbose);
+}
@@ -0,0 +1,202 @@
+#include "StallDetector.h"
+#include "RuntimeConfig.h"
+#include "ScenarioRunner.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+// StallDetector with the models of doomblade.cfg against the fixed torque gates it replaced
+//   stall_detector_test
+// Torque traces are synthetic, at the 1.2 ms control period and the 0.065 per cycle speed
+// and 30 step ramps of doomblade.cfg, with measurement noise from a fixed seed. An
+// obstruction has to trip in fewer cycles than the old gates did, a transient or the load
+// of a commanded acceleration must not trip at all.
+
+static const double kPeriodSeconds = 0.0012;
+static const float kStep = 0.065f;              // per cycle position step at full speed
+static const int kRampSteps = 30;
+
+// One control cycle as the position manager feeds the detector
+struct Cycle {
+    MotionPhase phase;
+    float torque;
+    float velocity;         // units/s
+    float acceleration;     // units/s^2, commanded
+};
+
+// TRACE - what a motion would read back, expected torque plus noise
+class Trace {
+public:
+    explicit Trace(uint32_t seed) : random(seed), noise(0.0f, 0.01f) {}
+
+    // n cycles of a phase, torque from the model plus extra(i)
+    void add(MotionPhase phase, const StallModel& model, int n, float velocity, float acceleration,
+             const std::function<float(int)>& extra = [](int) { return 0.0f; }) {
+        for (int i = 0; i < n; i++) {
+            float expected = model.bias + model.velocityGain * std::fabs(velocity) + model.accelerationGain * std::fabs(acceleration);
+            cycles.push_back({phase, expected + extra(i) + noise(random), velocity, acceleration});
+        }
+    }
+
+    std::vector<Cycle> cycles;
+
+private:
+    std::mt19937 random;
+    std::normal_distribution<float> noise;
+};
+
+// DETECTOR - cycle of the first trip, -1 for none. ignoreAcceleration feeds 0 as the
+// position manager did before the ramps were modelled.
+static int detectorTrip(const StallDetector& models, const std::vector<Cycle>& cycles, bool ignoreAcceleration = false) {
+    StallDetector detector = models;
+    MotionPhase phase = MotionPhase::Idle;
+    for (size_t i = 0; i < cycles.size(); i++) {
+        if (cycles[i].phase != phase) {
+            phase = cycles[i].phase;
+            detector.begin(phase);
+        }
+        if (detector.update(cycles[i].torque, cycles[i].velocity, ignoreAcceleration ? 0.0f : cycles[i].acceleration)) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+// FIXED GATES - the checks StallDetector replaced: a torque limit per phase once the phase
+// had run a number of cycles, nothing during the ramps
+static int fixedGateTrip(const std::vector<Cycle>& cycles) {
+    MotionPhase phase = MotionPhase::Idle;
+    int index = 0;
+    for (size_t i = 0; i < cycles.size(); i++) {
+        if (cycles[i].phase != phase) {
+            phase = cycles[i].phase;
+            index = 0;
+        }
+        index++;
+        float torque = cycles[i].torque;
+        bool tripped = (phase == MotionPhase::Cruising && index > 23 && torque >= 0.20f) ||
+                       (phase == MotionPhase::CruisingReverse && index > 7 && torque >= 0.40f) ||
+                       (phase == MotionPhase::Homing && index > 20 && torque >= 0.13f);
+        if (tripped) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+static float rampAcceleration() {
+    return static_cast<float>(kStep / kRampSteps / (kPeriodSeconds * kPeriodSeconds));
+}
+
+// OBSTRUCTION - torque climbs by rise per cycle from onset, as a blade pushing into
+// something does, until the controller's limit
+static ScenarioResult obstruction(const StallDetector& models, MotionPhase ramp, MotionPhase cruise, int onset, bool duringRamp, float rise) {
+    ScenarioResult result;
+    Trace trace(17);
+    float velocity = static_cast<float>(kStep / kPeriodSeconds);
+    auto obstructed = [&](int from) {
+        return [=](int i) { return i < from ? 0.0f : std::min(rise * (i - from + 1), 0.45f); };
+    };
+    if (duringRamp) {
+        trace.add(ramp, models.getModel(ramp), kRampSteps, velocity / 2.0f, rampAcceleration(), obstructed(onset));
+        trace.add(cruise, models.getModel(cruise), 200, velocity, 0.0f, [=](int i) { return std::min(rise * (i + kRampSteps - onset + 1), 0.45f); });
+    } else {
+        trace.add(ramp, models.getModel(ramp), kRampSteps, velocity / 2.0f, rampAcceleration());
+        trace.add(cruise, models.getModel(cruise), 200, velocity, 0.0f, obstructed(onset));
+    }
+    int start = duringRamp ? onset : kRampSteps + onset;
+    int detected = detectorTrip(models, trace.cycles);
+    int gated = fixedGateTrip(trace.cycles);
+    if (detected < 0) {
+        result.failure = "obstruction not detected";
+        return result;
+    }
+    int detectorCycles = detected - start + 1;
+    int gateCycles = gated < 0 ? -1 : gated - start + 1;
+    result.detail = "tripped " + std::to_string(detectorCycles) + " cycles after the onset, the fixed gates " +
+                    (gated < 0 ? std::string("never") : "after " + std::to_string(gateCycles));
+    if (detected < start) {
+        result.failure = "tripped before the obstruction";
+    } else if (gated >= 0 && detectorCycles >= gateCycles) {
+        result.failure = "no sooner than the fixed gates";
+    } else {
+        result.passed = true;
+    }
+    return result;
+}
+
+// SPIKES - single cycle spikes short of the alarm level and a short bump while cruising
+static ScenarioResult spikes(const StallDetector& models) {
+    ScenarioResult result;
+    Trace trace(23);
+    const StallModel& model = models.getModel(MotionPhase::Cruising);
+    float velocity = static_cast<float>(kStep / kPeriodSeconds);
+    trace.add(MotionPhase::Cruising, model, 300, velocity, 0.0f, [&](int i) {
+        if (i == 60 || i == 140) {
+            return model.threshold + model.drift - 0.02f;   // one cycle, just short of the alarm level
+        }
+        if (i >= 220 && i < 223) {
+            return 0.06f;                                   // three cycles of a bump
+        }
+        return 0.0f;
+    });
+    int gated = fixedGateTrip(trace.cycles);
+    result.detail = std::string("the fixed gates ") + (gated < 0 ? "did not trip" : "tripped at cycle " + std::to_string(gated));
+    if (detectorTrip(models, trace.cycles) >= 0) {
+        result.failure = "a transient tripped";
+    } else {
+        result.passed = true;
+    }
+    return result;
+}
+
+// RAMP LOAD - torque following the commanded acceleration of an extend ramp, and of a
+// knob turn mid-cruise, is expected and must not trip
+static ScenarioResult rampLoad(const StallDetector& models) {
+    ScenarioResult result;
+    Trace trace(29);
+    float velocity = static_cast<float>(kStep / kPeriodSeconds);
+    trace.add(MotionPhase::Acceleration, models.getModel(MotionPhase::Acceleration), kRampSteps, velocity / 2.0f, rampAcceleration());
+    trace.add(MotionPhase::Cruising, models.getModel(MotionPhase::Cruising), 40, velocity, 0.0f);
+    trace.add(MotionPhase::Cruising, models.getModel(MotionPhase::Cruising), 20, velocity, rampAcceleration());
+    trace.add(MotionPhase::Cruising, models.getModel(MotionPhase::Cruising), 100, velocity, 0.0f);
+    int unmodelled = detectorTrip(models, trace.cycles, true);
+    result.detail = std::string("without the commanded acceleration ") + (unmodelled < 0 ? "no trip" : "tripped at cycle " + std::to_string(unmodelled));
+    if (detectorTrip(models, trace.cycles) >= 0) {
+        result.failure = "the load of a commanded acceleration tripped";
+    } else {
+        result.passed = true;
+    }
+    return result;
+}
+
+int main(int argc, char**) {
+    if (argc > 1) {
+        std::cerr << "usage: stall_detector_test" << std::endl;
+        return 1;
+    }
+
+    RuntimeConfig runtimeConfig("doomblade.cfg");
+    runtimeConfig.load();
+    const MotionConfig& config = runtimeConfig.acquire();
+    StallDetector models;
+    models.setModel(MotionPhase::Cruising, config.cruisingStall);
+    models.setModel(MotionPhase::CruisingReverse, config.cruisingReverseStall);
+    models.setModel(MotionPhase::Homing, config.homingStall);
+    models.setModel(MotionPhase::Acceleration, config.accelerationStall);
+    models.setModel(MotionPhase::AccelerationReverse, config.accelerationReverseStall);
+
+    const std::vector<Scenario> scenarios = {
+        {"obstruction while extending",        [&]() { return obstruction(models, MotionPhase::Acceleration, MotionPhase::Cruising, 40, false, 0.012f); }},
+        {"obstruction while sheathing",        [&]() { return obstruction(models, MotionPhase::AccelerationReverse, MotionPhase::CruisingReverse, 20, false, 0.02f); }},
+        {"obstruction in the extend ramp",     [&]() { return obstruction(models, MotionPhase::Acceleration, MotionPhase::Cruising, 10, true, 0.012f); }},
+        {"obstruction in the sheath ramp",     [&]() { return obstruction(models, MotionPhase::AccelerationReverse, MotionPhase::CruisingReverse, 10, true, 0.02f); }},
+        {"spikes while cruising",              [&]() { return spikes(models); }},
+        {"ramp and knob turn load",            [&]() { return rampLoad(models); }},
+    };
+    return runScenarios(scenarios);
+}
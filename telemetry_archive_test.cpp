@@ -0,0 +1,249 @@
+#include "TelemetryPublisher.h"
+#include "TelemetryArchive.h"
+#include "ScenarioRunner.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <limits>
+#include <cstdio>
+#include <unistd.h>
+
+// Round trip of the telemetry archive codec
+//   telemetry_archive_test
+// Synthetic soak telemetry is written through TelemetryArchiveWriter and read back with
+// TelemetryArchiveReader. Every archived field has to come back bit for bit, across block
+// sizes, partial flushes, an append to an existing archive and a block torn on disk. The
+// archive lives in /tmp and is removed afterwards.
+
+// SOAK - cycles with gaps and restarts, jittered time, smooth positions, noisy torque,
+// missing replies, phase changes and the float values a codec gets wrong first
+static std::vector<TelemetrySample> soak(size_t count, uint32_t seed) {
+    std::mt19937 random(seed);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+    std::uniform_int_distribution<int> jitter(-40000, 40000);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    const float specials[] = {0.0f, -0.0f, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+                              std::numeric_limits<float>::denorm_min(), std::numeric_limits<float>::max(), 1e-30f};
+
+    std::vector<TelemetrySample> samples(count);
+    uint64_t cycle = 0;
+    int64_t timeNs = 1700000000000000000LL;
+    float commanded = 500.0f;
+    float velocity = 0.0f;
+    uint8_t phase = 0;
+    uint8_t motorState = 0;
+    for (size_t i = 0; i < count; i++) {
+        TelemetrySample& sample = samples[i];
+        double roll = chance(random);
+        if (roll < 0.002) {
+            cycle = 0;                                  // control process restarted
+            timeNs += 5000000000LL;
+        } else if (roll < 0.01) {
+            cycle += 1 + random() % 300;                // dropped by the reader
+            timeNs += 1200000LL * 300;
+        } else {
+            cycle++;
+        }
+        timeNs += 1200000 + jitter(random);
+        if (chance(random) < 0.005) {
+            phase = static_cast<uint8_t>(random() % 16);
+            motorState = static_cast<uint8_t>(random() % 12);
+            velocity = (phase % 2 == 0) ? -0.065f : 0.065f;
+        }
+        commanded = std::clamp(commanded + velocity, 450.0f, 550.0f);
+
+        sample.cycle = cycle;
+        sample.timeNs = timeNs;
+        sample.commandedPosition = commanded;
+        sample.currentPosition = commanded + noise(random);
+        sample.phase = phase;
+        sample.motorState = motorState;
+        sample.replyValid = chance(random) < 0.98 ? 1 : 0;
+        if (sample.replyValid) {
+            sample.reply.position = commanded + noise(random) - 500.0f;
+            sample.reply.velocity = velocity / 0.0012f + noise(random);
+            sample.reply.torque = 0.05f + std::fabs(noise(random)) * 10.0f;
+        } else {
+            sample.reply.position = sample.reply.velocity = sample.reply.torque = std::numeric_limits<float>::quiet_NaN();
+        }
+        if (chance(random) < 0.001) {
+            sample.reply.torque = specials[random() % (sizeof specials / sizeof specials[0])];
+        }
+    }
+    return samples;
+}
+
+static bool sameFloat(float a, float b) {
+    return archiveFloatBits(a) == archiveFloatBits(b);
+}
+
+// SAME - every field the archive keeps, floats bit for bit
+static bool same(const TelemetrySample& a, const TelemetrySample& b) {
+    return a.cycle == b.cycle && a.timeNs == b.timeNs && sameFloat(a.commandedPosition, b.commandedPosition)
+        && sameFloat(a.currentPosition, b.currentPosition) && sameFloat(a.reply.position, b.reply.position)
+        && sameFloat(a.reply.velocity, b.reply.velocity) && sameFloat(a.reply.torque, b.reply.torque)
+        && a.phase == b.phase && a.motorState == b.motorState && a.replyValid == b.replyValid;
+}
+
+static std::string archivePath() {
+    return "/tmp/telemetry_archive_test_" + std::to_string(getpid()) + ".dta";
+}
+
+// WRITE - a partial flush every flushEvery samples, 0 for none
+static bool write(const std::string& path, const std::vector<TelemetrySample>& samples, uint32_t samplesPerBlock, size_t flushEvery,
+                  uint64_t& bytes) {
+    TelemetryArchiveWriter writer(path, samplesPerBlock);
+    if (!writer.open()) {
+        return false;
+    }
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (!writer.append(samples[i])) {
+            return false;
+        }
+        if (flushEvery > 0 && (i + 1) % flushEvery == 0 && !writer.flush()) {
+            return false;
+        }
+    }
+    bool flushed = writer.flush();
+    bytes = writer.getBytesWritten();
+    writer.close();
+    return flushed;
+}
+
+static bool readAll(const std::string& path, std::vector<TelemetrySample>& out, uint64_t& corrupt) {
+    TelemetryArchiveReader reader(path);
+    if (!reader.open()) {
+        return false;
+    }
+    std::vector<TelemetrySample> block;
+    out.clear();
+    while (reader.nextBlock(block)) {
+        out.insert(out.end(), block.begin(), block.end());
+    }
+    corrupt = reader.getCorruptBlocks();
+    return true;
+}
+
+// COMPARE - decoded against written, in order
+static bool compare(const std::vector<TelemetrySample>& written, const std::vector<TelemetrySample>& decoded, ScenarioResult& result) {
+    if (decoded.size() != written.size()) {
+        result.failure = "decoded " + std::to_string(decoded.size()) + " samples of " + std::to_string(written.size());
+        return false;
+    }
+    for (size_t i = 0; i < written.size(); i++) {
+        if (!same(written[i], decoded[i])) {
+            result.failure = "sample " + std::to_string(i) + " differs";
+            return false;
+        }
+    }
+    return true;
+}
+
+static ScenarioResult roundTrip(size_t count, uint32_t samplesPerBlock, size_t flushEvery) {
+    ScenarioResult result;
+    std::string path = archivePath();
+    std::remove(path.c_str());
+    std::vector<TelemetrySample> written = soak(count, 3 + samplesPerBlock);
+    std::vector<TelemetrySample> decoded;
+    uint64_t bytes = 0;
+    uint64_t corrupt = 0;
+    if (!write(path, written, samplesPerBlock, flushEvery, bytes) || !readAll(path, decoded, corrupt)) {
+        result.failure = "archive not written or not read";
+    } else if (corrupt != 0) {
+        result.failure = std::to_string(corrupt) + " corrupt blocks";
+    } else if (compare(written, decoded, result)) {
+        result.passed = true;
+    }
+    result.detail = std::to_string(count) + " samples, " + std::to_string(static_cast<double>(bytes) / count) + " bytes per sample";
+    std::remove(path.c_str());
+    return result;
+}
+
+// APPEND - a second recording session onto the same archive
+static ScenarioResult append() {
+    ScenarioResult result;
+    std::string path = archivePath();
+    std::remove(path.c_str());
+    std::vector<TelemetrySample> first = soak(5000, 21);
+    std::vector<TelemetrySample> second = soak(3000, 22);
+    std::vector<TelemetrySample> decoded;
+    uint64_t bytes = 0;
+    uint64_t corrupt = 0;
+    if (!write(path, first, 1024, 0, bytes) || !write(path, second, 1024, 0, bytes) || !readAll(path, decoded, corrupt)) {
+        result.failure = "archive not written or not read";
+    } else {
+        std::vector<TelemetrySample> written = first;
+        written.insert(written.end(), second.begin(), second.end());
+        result.passed = corrupt == 0 && compare(written, decoded, result);
+        if (corrupt != 0) {
+            result.failure = std::to_string(corrupt) + " corrupt blocks";
+        }
+    }
+    std::remove(path.c_str());
+    return result;
+}
+
+// TORN BLOCK - one payload byte damaged on disk costs that block and nothing else
+static ScenarioResult tornBlock() {
+    ScenarioResult result;
+    const uint32_t samplesPerBlock = 1000;
+    std::string path = archivePath();
+    std::remove(path.c_str());
+    std::vector<TelemetrySample> written = soak(5000, 31);
+    uint64_t bytes = 0;
+    if (!write(path, written, samplesPerBlock, 0, bytes)) {
+        result.failure = "archive not written";
+        return result;
+    }
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(0, std::ios::end);
+        std::streamoff middle = file.tellg() / 2;
+        char byte = 0;
+        file.seekg(middle);
+        file.get(byte);
+        file.seekp(middle);
+        file.put(static_cast<char>(byte ^ 0x5a));
+    }
+    std::vector<TelemetrySample> decoded;
+    uint64_t corrupt = 0;
+    if (!readAll(path, decoded, corrupt)) {
+        result.failure = "archive not read";
+    } else if (corrupt != 1 || decoded.size() != written.size() - samplesPerBlock) {
+        result.failure = std::to_string(corrupt) + " corrupt blocks, " + std::to_string(decoded.size()) + " samples decoded";
+    } else {
+        // The surviving samples are the written ones less one whole block
+        size_t skip = 0;
+        while (skip < decoded.size() && same(written[skip], decoded[skip])) {
+            skip++;
+        }
+        bool rest = skip % samplesPerBlock == 0;
+        for (size_t i = skip; rest && i < decoded.size(); i++) {
+            rest = same(written[i + samplesPerBlock], decoded[i]);
+        }
+        result.passed = rest;
+        result.failure = rest ? "" : "samples around the torn block differ";
+        result.detail = "block " + std::to_string(skip / samplesPerBlock) + " skipped";
+    }
+    std::remove(path.c_str());
+    return result;
+}
+
+int main(int argc, char**) {
+    if (argc > 1) {
+        std::cerr << "usage: telemetry_archive_test" << std::endl;
+        return 1;
+    }
+
+    const std::vector<Scenario> scenarios = {
+        {"round trip, 4096 sample blocks",        []() { return roundTrip(20000, 4096, 0); }},
+        {"round trip, one sample blocks",         []() { return roundTrip(2000, 1, 0); }},
+        {"round trip, partial flushes",           []() { return roundTrip(20000, 4096, 777); }},
+        {"append to an existing archive",         append},
+        {"torn block",                            tornBlock},
+    };
+    return runScenarios(scenarios);
+}
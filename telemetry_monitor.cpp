@@ -0,0 +1,118 @@
+#include "TelemetryPublisher.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <ctime>
+
+// Live view of a running control process, reads the shared memory telemetry segment
+//   telemetry_monitor                    dashboard, refreshed 10 times a second
+//   telemetry_monitor --rate 30          dashboard at 30 Hz
+//   telemetry_monitor --samples          every control cycle as tab separated lines
+// --segment <name> selects the segment (default /doomblade_telemetry). Exits when the
+// control process closes the segment.
+
+static void usage() {
+    std::cerr << "usage: telemetry_monitor [--segment name] [--rate hz] [--samples]" << std::endl;
+}
+
+static void printDashboard(const TelemetrySnapshot& snapshot, uint64_t head) {
+    const TelemetrySample& sample = snapshot.latest;
+    const LoopStats& loop = snapshot.loop;
+    std::cout << "\033[H\033[2J";
+    std::cout << "State:      " << motorStateName(static_cast<MotorState>(sample.motorState))
+              << "\tPhase: " << motionPhaseName(static_cast<MotionPhase>(sample.phase)) << std::endl;
+    std::cout << "Cycle:      " << sample.cycle << " of " << head << "\tt = " << sample.timeNs / 1000000 << " ms" << std::endl;
+    std::cout << "Target:     " << sample.commandedPosition << "\tActual: " << sample.currentPosition
+              << "\tError: " << sample.commandedPosition - sample.currentPosition << std::endl;
+    std::cout << "Estimate:   velocity " << sample.estimatedVelocity << "/s\tuncertainty " << sample.uncertainty << std::endl;
+    std::cout << "Reply:      position " << sample.reply.position << "\tvelocity " << sample.reply.velocity
+              << "\ttorque " << sample.reply.torque << (sample.replyValid ? "" : "\tREJECTED") << std::endl;
+    std::cout << "Loop:       period last " << loop.lastPeriodNs / 1000 << " us\tmean " << loop.meanPeriodNs / 1000
+              << " us\tmax " << loop.maxPeriodNs / 1000 << " us\toverruns " << loop.overruns << std::endl;
+    std::cout << "Tick:       last " << loop.lastTickNs / 1000 << " us\tmax " << loop.maxTickNs / 1000 << " us" << std::endl;
+}
+
+static void printSample(const TelemetrySample& sample) {
+    std::cout << sample.cycle << "\t" << sample.timeNs << "\t"
+              << motorStateName(static_cast<MotorState>(sample.motorState)) << "\t"
+              << motionPhaseName(static_cast<MotionPhase>(sample.phase)) << "\t"
+              << sample.commandedPosition << "\t" << sample.currentPosition << "\t"
+              << sample.estimatedVelocity << "\t" << sample.uncertainty << "\t"
+              << sample.reply.position << "\t" << sample.reply.velocity << "\t" << sample.reply.torque << "\t"
+              << static_cast<int>(sample.replyValid) << "\n";
+}
+
+int main(int argc, char** argv) {
+    std::string segmentName = "/doomblade_telemetry";
+    double rate = 10.0;
+    bool samples = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--segment" && i + 1 < argc) {
+            segmentName = argv[++i];
+        } else if (arg == "--rate" && i + 1 < argc) {
+            rate = std::stod(argv[++i]);
+        } else if (arg == "--samples") {
+            samples = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (!(rate > 0.0)) {
+        usage();
+        return 1;
+    }
+
+    TelemetryReader reader(segmentName);
+    if (!reader.open()) {
+        return 1;
+    }
+
+    // SAMPLE STREAM - drains the ring every few milliseconds, well inside its 5 s depth
+    if (samples) {
+        std::cout << "cycle\ttime_ns\tstate\tphase\ttarget\tactual\test_velocity\tuncertainty\treply_position\treply_velocity\treply_torque\tvalid\n";
+        std::vector<TelemetrySample> batch(256);
+        uint64_t cursor = reader.head();
+        uint64_t dropped = 0;
+        uint64_t reported = 0;
+        struct timespec poll = {0, 5 * 1000 * 1000};
+        while (true) {
+            bool active = reader.active();
+            size_t count;
+            while ((count = reader.readSamples(cursor, batch.data(), batch.size(), dropped)) > 0) {
+                for (size_t i = 0; i < count; i++) {
+                    printSample(batch[i]);
+                }
+            }
+            std::cout.flush();
+            if (dropped != reported) {
+                std::cerr << "Dropped " << dropped - reported << " samples" << std::endl;
+                reported = dropped;
+            }
+            if (reader.restarted()) {
+                std::cerr << "A new control process took over the telemetry segment" << std::endl;
+                break;
+            }
+            if (!active) {
+                break;
+            }
+            nanosleep(&poll, nullptr);
+        }
+        return 0;
+    }
+
+    // DASHBOARD
+    long periodNs = static_cast<long>(1e9 / rate);
+    struct timespec refresh = {periodNs / 1000000000L, periodNs % 1000000000L};
+    TelemetrySnapshot snapshot;
+    while (reader.active() && !reader.restarted()) {
+        if (reader.snapshot(snapshot)) {
+            printDashboard(snapshot, reader.head());
+        }
+        nanosleep(&refresh, nullptr);
+    }
+    std::cout << "Control process closed the telemetry segment" << std::endl;
+    return 0;
+}
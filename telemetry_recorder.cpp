@@ -0,0 +1,175 @@
+#include "TelemetryPublisher.h"
+#include "TelemetryArchive.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <csignal>
+#include <ctime>
+
+// Soak recorder, every control cycle from the shared memory telemetry into a compressed archive
+//   telemetry_recorder --out soak.dta                record until the control process exits
+//   telemetry_recorder --out soak.dta --follow       keep recording across control process restarts
+//   telemetry_recorder --out soak.dta --block 8192   samples per archive block (default 4096)
+//   telemetry_recorder --decode soak.dta             archive back out as tab separated lines
+// --segment <name> selects the segment (default /doomblade_telemetry). Recording appends
+// to an existing archive. A partial block is written at least every --flush seconds
+// (default 10), which bounds what a power cut can take.
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+static void usage() {
+    std::cerr << "usage: telemetry_recorder [--segment name] --out file [--block samples] [--flush s] [--follow]\n"
+                 "       telemetry_recorder --decode file" << std::endl;
+}
+
+static int64_t monotonicNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
+
+// DECODE - same columns as telemetry_monitor --samples, less the estimator ones
+static int decode(const std::string& path) {
+    TelemetryArchiveReader reader(path);
+    if (!reader.open()) {
+        return 1;
+    }
+    std::cout << "cycle\ttime_ns\tstate\tphase\ttarget\tactual\treply_position\treply_velocity\treply_torque\tvalid\n";
+    std::vector<TelemetrySample> block;
+    uint64_t samples = 0;
+    while (reader.nextBlock(block)) {
+        for (const TelemetrySample& sample : block) {
+            std::cout << sample.cycle << "\t" << sample.timeNs << "\t"
+                      << motorStateName(static_cast<MotorState>(sample.motorState)) << "\t"
+                      << motionPhaseName(static_cast<MotionPhase>(sample.phase)) << "\t"
+                      << sample.commandedPosition << "\t" << sample.currentPosition << "\t"
+                      << sample.reply.position << "\t" << sample.reply.velocity << "\t" << sample.reply.torque << "\t"
+                      << static_cast<int>(sample.replyValid) << "\n";
+        }
+        samples += block.size();
+    }
+    std::cout.flush();
+    std::cerr << "Decoded " << samples << " samples in " << reader.getBlocks() << " blocks";
+    if (reader.getCorruptBlocks() > 0) {
+        std::cerr << ", skipped " << reader.getCorruptBlocks() << " corrupt blocks";
+    }
+    std::cerr << std::endl;
+    return reader.getCorruptBlocks() == 0 ? 0 : 2;
+}
+
+int main(int argc, char** argv) {
+    std::string segmentName = "/doomblade_telemetry";
+    std::string outPath;
+    std::string decodePath;
+    uint32_t samplesPerBlock = 4096;
+    double flushSeconds = 10.0;
+    bool follow = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--segment" && i + 1 < argc) {
+            segmentName = argv[++i];
+        } else if (arg == "--out" && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (arg == "--decode" && i + 1 < argc) {
+            decodePath = argv[++i];
+        } else if (arg == "--block" && i + 1 < argc) {
+            samplesPerBlock = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--flush" && i + 1 < argc) {
+            flushSeconds = std::stod(argv[++i]);
+        } else if (arg == "--follow") {
+            follow = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (!decodePath.empty()) {
+        return decode(decodePath);
+    }
+    if (outPath.empty() || samplesPerBlock == 0 || !(flushSeconds > 0.0)) {
+        usage();
+        return 1;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    TelemetryArchiveWriter writer(outPath, samplesPerBlock);
+    if (!writer.open()) {
+        return 1;
+    }
+
+    // RECORD - drains the ring every few milliseconds straight into the writer, the
+    // encoder is cheap enough to keep up inline
+    std::vector<TelemetrySample> batch(256);
+    struct timespec poll = {0, 5 * 1000 * 1000};
+    struct timespec retry = {1, 0};
+    const int64_t flushNs = static_cast<int64_t>(flushSeconds * 1e9);
+    uint64_t dropped = 0;
+    uint64_t reported = 0;
+    bool writeFailed = false;
+    while (!stopRequested && !writeFailed) {
+        TelemetryReader reader(segmentName);
+        if (!reader.open()) {
+            if (!follow) {
+                return 1;
+            }
+            nanosleep(&retry, nullptr);
+            continue;
+        }
+        uint64_t cursor = reader.head();
+        int64_t lastFlushNs = monotonicNs();
+        bool restarted = false;
+        while (!stopRequested) {
+            // A control process restarted after a crash takes the segment over while it is
+            // still marked active, only the generation tells
+            restarted = reader.restarted();
+            if (restarted) {
+                break;
+            }
+            bool active = reader.active();
+            size_t count;
+            while ((count = reader.readSamples(cursor, batch.data(), batch.size(), dropped)) > 0) {
+                for (size_t i = 0; i < count; i++) {
+                    writeFailed |= !writer.append(batch[i]);
+                }
+            }
+            if (monotonicNs() - lastFlushNs >= flushNs) {
+                writeFailed |= !writer.flush();
+                lastFlushNs = monotonicNs();
+            }
+            if (dropped != reported) {
+                std::cerr << "Dropped " << dropped - reported << " samples" << std::endl;
+                reported = dropped;
+            }
+            if (!active || writeFailed) {
+                break;
+            }
+            nanosleep(&poll, nullptr);
+        }
+        writeFailed |= !writer.flush();
+        if (!follow) {
+            break;
+        }
+        if (restarted) {
+            std::cerr << "A new control process took over the telemetry segment, recording on from it" << std::endl;
+        } else if (!stopRequested) {
+            std::cerr << "Control process closed the telemetry segment, waiting for it to return" << std::endl;
+            nanosleep(&retry, nullptr);
+        }
+    }
+    writer.close();
+
+    std::cerr << "Recorded " << writer.getSamples() << " samples in " << writer.getBlocks() << " blocks, "
+              << writer.getBytesWritten() << " bytes";
+    if (writer.getSamples() > 0) {
+        std::cerr << " (" << static_cast<double>(writer.getBytesWritten()) / writer.getSamples() << " bytes per sample)";
+    }
+    std::cerr << std::endl;
+    return writeFailed ? 1 : 0;
+}
@@ -2,6 +2,7 @@
 #include "GraphPlotter.h"
 #include "MyGpio.h"
 #include "PositionManager.h"
+#include "WarmStart.h"
 
 //for storing data
 #include <iostream>
@@ -53,7 +54,15 @@ int main() {
         return 1;
     }
     controller.sendStopCommand();  //gets controller to a known state
-    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+
+    // WARM START - the sweep starts sheathed at home, so only a blade saved there skips homing
+    WarmStart warmStart("doomblade.state");
+    WarmStartVerdict warmVerdict = warmStart.start(controller, homeLimitSwitch);
+    bool warm = warmVerdict == WarmStartVerdict::Valid && warmStart.getSaved().atHome;
+    std::cout << "Warm start: " << warmStartVerdictName(warmVerdict) << (warmVerdict == WarmStartVerdict::Valid && !warm ? ", not saved at home" : "") << std::endl;
+    if (!warm) {
+        controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+    }
  
     //Initialization  
     std::vector<float> torques;
@@ -72,11 +81,18 @@ int main() {
     float currentPosition = startPosition;
     PositionManager positionManager (controller, homeLimitSwitch, extendLimitSwitch, maxSpeed, cruisingEndPosition, cruisingReverseEndPosition, stepsToAccelerate, decelerationSteps, req);
 
-    controller.sendStopCommand();  //gets controller to a known state
-    controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
-    commandedPosition = 500.0f;
     float positionAverage = 500.0f;
-    bool homingSuccess = positionManager.homing(commandedPosition, currentPosition);
+    bool homingSuccess = true;
+    if (warm) {
+        positionManager.restorePosition(warmStart.getSaved().logicalPosition, warmStart.getLiveAbsolute());
+        commandedPosition = warmStart.getSaved().logicalPosition;
+        currentPosition = commandedPosition;
+    } else {
+        controller.sendStopCommand();  //gets controller to a known state
+        positionManager.rezero(500.0f); // sets the current position to 500.0
+        commandedPosition = 500.0f;
+        homingSuccess = positionManager.homing(commandedPosition, currentPosition);
+    }
     positionManager.holdPositionDuration(commandedPosition, 1.0f);
 
     //READY FOR MOTIONS
@@ -101,7 +117,7 @@ int main() {
         for (int i = 0; i < 2; ++i) { 
 
             positionManager.changeMaxSpeed(speed);
-            controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+            positionManager.rezero(500.0f); // sets the current position to 500.0
             commandedPosition = 500.0f;
             currentPosition = 500.0f;
             positionManager.performAcceleration(commandedPosition, currentPosition);
@@ -112,11 +128,11 @@ int main() {
 
             results.push_back(positionManager.validQuery());
          
-            controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+            positionManager.rezero(500.0f); // sets the current position to 500.0
             commandedPosition = 500.0f;
             currentPosition = 500.0f;
             positionManager.holdPositionDuration(commandedPosition, 0.5f);
-            controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+            positionManager.rezero(500.0f); // sets the current position to 500.0
             commandedPosition = 500.0f;
             currentPosition = 500.0f;
             positionManager.performAccelerationReverse(commandedPosition, currentPosition);
@@ -125,7 +141,7 @@ int main() {
             positionAverage = (commandedPosition + currentPosition) / 2.0f;
             positionManager.holdPositionDuration(positionAverage, 0.1f);
             controller.sendStopCommand();  //gets controller to a known state
-            controller.sendRezeroCommand(500.0f); // sets the current position to 500.0
+            positionManager.rezero(500.0f); // sets the current position to 500.0
             commandedPosition = 500.0f;
             homingSuccess = positionManager.homing(commandedPosition, currentPosition);
             positionManager.holdPositionDuration(commandedPosition, 1.0f);
@@ -144,6 +160,7 @@ int main() {
     // Close the file
     outputFile.close();
     std::cout << "Data has been written to the file successfully." << std::endl;
+    warmStart.stop(controller, homeLimitSwitch, positionManager.getFrame(), positionManager.isReferenced());
 
     // open a new file and read the data
     std::ifstream inputFile("speed_data_pairs.txt", std::ios::in);